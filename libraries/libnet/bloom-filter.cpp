@@ -3,11 +3,13 @@
 #include <stdlib.h>
 #include <stdint.h>
 #include <assert.h>
+#include <string.h>
+#include <immintrin.h>
 
 #include "vector.h"
 #include "time.h"
-#include "hash.h"
 #include "compute.h"
+#include "sketch-hash.h"
 
 #define MIN(a, b) ((a) < (b) ? (a) : (b))
 
@@ -17,11 +19,28 @@ struct BloomFilter {
   uint32_t height;
   uint32_t width;
   uint32_t key_size;
+  // Number of 64B blocks of a blocked filter, 0 with one byte per bucket.
+  uint32_t blocks;
   time_ns_t cleanup_interval;
 
   time_ns_t last_cleanup;
 };
 
+struct AgingBloomFilter {
+  struct BloomFilter *generations[ABF_MAX_GENERATIONS];
+  uint32_t num_generations;
+  // Generation the keys are set in. The next one is the oldest, cleared while the current one fills up.
+  uint32_t current;
+  // Bytes of each expired generation cleared so far, out of generation_size: the oldest one, and the stale ones.
+  uint32_t cleared[ABF_MAX_GENERATIONS];
+  // Generations whose keys all expired in the same abf_advance, after an idle gap. Queries skip them until they are cleared.
+  uint32_t stale;
+  uint32_t generation_size;
+
+  time_ns_t generation_interval;
+  time_ns_t current_start;
+};
+
 struct hash {
   uint32_t value;
 };
@@ -30,6 +49,164 @@ struct bf_bucket {
   uint8_t value;
 };
 
+#define BF_BLOCK_SIZE 64
+#define BF_BLOCK_BITS (BF_BLOCK_SIZE * 8)
+
+namespace {
+
+// Offset of the bucket of the key in the given row: the salted hash is mapped onto the row by a multiply-shift, as the width is arbitrary.
+inline uint32_t row_offset(uint32_t hash, uint32_t row, uint32_t width) {
+  return row * width + (uint32_t)(((uint64_t)fmix32(hash ^ BF_SALTS[row]) * width) >> 32);
+}
+
+// Vectorized row_offset.
+inline __m512i row_offsets_vec(__m512i hash, uint32_t row, uint32_t width) {
+  const __m512i mixed    = fmix32_vec(_mm512_xor_si512(hash, _mm512_set1_epi32(BF_SALTS[row])));
+  const __m512i widths   = _mm512_set1_epi32(width);
+  const __m512i even     = _mm512_srli_epi64(_mm512_mul_epu32(mixed, widths), 32);
+  const __m512i odd      = _mm512_mul_epu32(_mm512_srli_epi64(mixed, 32), widths);
+  const __m512i products = _mm512_mask_blend_epi32(0xaaaa, even, odd);
+  return _mm512_add_epi32(products, _mm512_set1_epi32(row * width));
+}
+
+// Block of the key in a blocked filter. The number of blocks is a power of two.
+inline uint32_t key_block(uint32_t hash, uint32_t blocks) { return fmix32(hash ^ BF_SALTS[0]) & (blocks - 1); }
+
+// The height bits of the key inside its block, one per salt, as a mask of the whole block.
+inline __m512i key_block_mask(uint32_t hash, uint32_t height) {
+  __m512i mask = _mm512_setzero_si512();
+  for (uint32_t h = 0; h < height; h++) {
+    const uint32_t bit = fmix32(hash ^ BF_SALTS[h + 1]) & (BF_BLOCK_BITS - 1);
+    mask               = _mm512_or_si512(mask, _mm512_maskz_set1_epi64(1 << (bit >> 6), 1ull << (bit & 63)));
+  }
+  return mask;
+}
+
+void bf_set_blocked(struct BloomFilter *bf, void *key) {
+  const uint32_t hash  = key_hash(key, bf->key_size);
+  const uint32_t block = key_block(hash, bf->blocks);
+
+  __m512i *bits = 0;
+  vector_borrow(bf->buckets, block, (void **)&bits);
+  _mm512_store_si512(bits, _mm512_or_si512(_mm512_load_si512(bits), key_block_mask(hash, bf->height)));
+  vector_return(bf->buckets, block, bits);
+}
+
+inline __m512i key_blocks_vec(__m512i hash, uint32_t blocks) {
+  return _mm512_and_si512(fmix32_vec(_mm512_xor_si512(hash, _mm512_set1_epi32(BF_SALTS[0]))), _mm512_set1_epi32(blocks - 1));
+}
+
+// Bit of the key for the given salt, inside its block.
+inline __m512i key_block_bits_vec(__m512i hash, uint32_t h) {
+  return _mm512_and_si512(fmix32_vec(_mm512_xor_si512(hash, _mm512_set1_epi32(BF_SALTS[h + 1]))), _mm512_set1_epi32(BF_BLOCK_BITS - 1));
+}
+
+int bf_query_blocked(struct BloomFilter *bf, void *key) {
+  const uint32_t hash  = key_hash(key, bf->key_size);
+  const uint32_t block = key_block(hash, bf->blocks);
+
+  __m512i *bits = 0;
+  vector_borrow(bf->buckets, block, (void **)&bits);
+  const __m512i missing = _mm512_andnot_si512(_mm512_load_si512(bits), key_block_mask(hash, bf->height));
+  vector_return(bf->buckets, block, bits);
+
+  return _mm512_test_epi64_mask(missing, missing) == 0;
+}
+
+// The buckets are read 4B at a time, from the aligned word holding them.
+__mmask16 query_vec(struct BloomFilter *bf, void *keys) {
+  const __m512i hash = key_hash_vec(keys, bf->key_size);
+  __mmask16 present  = 0xffff;
+
+  void *buckets;
+  vector_borrow(bf->buckets, 0, &buckets);
+  for (uint32_t h = 0; h < bf->height && present; h++) {
+    const __m512i offsets = row_offsets_vec(hash, h, bf->width);
+    const __m512i words   = _mm512_mask_i32gather_epi32(_mm512_setzero_si512(), present, _mm512_andnot_si512(_mm512_set1_epi32(3), offsets), buckets, 1);
+    const __m512i shifts  = _mm512_slli_epi32(_mm512_and_si512(offsets, _mm512_set1_epi32(3)), 3);
+    present               = _mm512_mask_test_epi32_mask(present, _mm512_srlv_epi32(words, shifts), _mm512_set1_epi32(0xff));
+  }
+  vector_return(bf->buckets, 0, buckets);
+
+  return present;
+}
+
+// Each probe reads the 4B word of the block that holds its bit.
+__mmask16 query_blocked_vec(struct BloomFilter *bf, void *keys) {
+  const __m512i hash   = key_hash_vec(keys, bf->key_size);
+  const __m512i blocks = _mm512_slli_epi32(key_blocks_vec(hash, bf->blocks), 6);
+  __mmask16 present    = 0xffff;
+
+  void *bits;
+  vector_borrow(bf->buckets, 0, &bits);
+  for (uint32_t h = 0; h < bf->height && present; h++) {
+    const __m512i bit   = key_block_bits_vec(hash, h);
+    const __m512i bytes = _mm512_add_epi32(blocks, _mm512_slli_epi32(_mm512_srli_epi32(bit, 5), 2));
+    const __m512i words = _mm512_mask_i32gather_epi32(_mm512_setzero_si512(), present, bytes, bits, 1);
+    present             = _mm512_mask_test_epi32_mask(present, words, _mm512_sllv_epi32(_mm512_set1_epi32(1), _mm512_and_si512(bit, _mm512_set1_epi32(31))));
+  }
+  vector_return(bf->buckets, 0, bits);
+
+  return present;
+}
+
+// There are no byte scatters, and keys may share words: the positions are computed 16 keys at a time, and the buckets set one by one.
+void set_vec(struct BloomFilter *bf, void *keys) {
+  const __m512i hash = key_hash_vec(keys, bf->key_size);
+
+  uint8_t *buckets;
+  vector_borrow(bf->buckets, 0, (void **)&buckets);
+  for (uint32_t h = 0; h < bf->height; h++) {
+    alignas(64) uint32_t offsets[SKETCH_HASH_LANES];
+    _mm512_store_si512(offsets, row_offsets_vec(hash, h, bf->width));
+    for (uint32_t offset : offsets) {
+      buckets[offset] = 1;
+    }
+  }
+  vector_return(bf->buckets, 0, buckets);
+}
+
+void set_blocked_vec(struct BloomFilter *bf, void *keys) {
+  const __m512i hash   = key_hash_vec(keys, bf->key_size);
+  const __m512i blocks = _mm512_slli_epi32(key_blocks_vec(hash, bf->blocks), 4);
+
+  uint32_t *words;
+  vector_borrow(bf->buckets, 0, (void **)&words);
+  for (uint32_t h = 0; h < bf->height; h++) {
+    const __m512i bit = key_block_bits_vec(hash, h);
+    alignas(64) uint32_t lane_words[SKETCH_HASH_LANES];
+    alignas(64) uint32_t lane_bits[SKETCH_HASH_LANES];
+    _mm512_store_si512(lane_words, _mm512_add_epi32(blocks, _mm512_srli_epi32(bit, 5)));
+    _mm512_store_si512(lane_bits, _mm512_sllv_epi32(_mm512_set1_epi32(1), _mm512_and_si512(bit, _mm512_set1_epi32(31))));
+    for (int lane = 0; lane < SKETCH_HASH_LANES; lane++) {
+      words[lane_words[lane]] |= lane_bits[lane];
+    }
+  }
+  vector_return(bf->buckets, 0, words);
+}
+
+inline uint32_t abf_oldest(const struct AgingBloomFilter *abf) { return (abf->current + 1) % abf->num_generations; }
+
+// Clears the bytes of an expired generation up to the given offset.
+void abf_clear_until(struct AgingBloomFilter *abf, uint32_t generation, uint32_t offset) {
+  if (offset <= abf->cleared[generation]) {
+    return;
+  }
+
+  uint8_t *bytes;
+  struct BloomFilter *expired = abf->generations[generation];
+  vector_borrow(expired->buckets, 0, (void **)&bytes);
+  memset(bytes + abf->cleared[generation], 0, offset - abf->cleared[generation]);
+  vector_return(expired->buckets, 0, bytes);
+
+  abf->cleared[generation] = offset;
+  if (offset == abf->generation_size) {
+    abf->stale &= ~(1u << generation);
+  }
+}
+
+} // namespace
+
 int bf_allocate(uint32_t height, uint32_t width, uint32_t key_size, time_ns_t periodic_cleanup_interval, struct BloomFilter **bf_out) {
   assert(height > 0);
   assert(width > 0);
@@ -45,11 +222,18 @@ int bf_allocate(uint32_t height, uint32_t width, uint32_t key_size, time_ns_t pe
   (*bf_out)->height           = height;
   (*bf_out)->width            = width;
   (*bf_out)->key_size         = key_size;
+  (*bf_out)->blocks           = 0;
   (*bf_out)->cleanup_interval = periodic_cleanup_interval;
 
   (*bf_out)->last_cleanup = 0;
 
-  uint32_t capacity = ensure_power_of_two(height * width);
+  // At least a cache line, so that the vectorized queries can read any bucket as part of an aligned 4B word.
+  uint32_t capacity = height * width;
+  if (capacity < BF_BLOCK_SIZE) {
+    capacity = BF_BLOCK_SIZE;
+  } else if (!is_power_of_two(capacity)) {
+    capacity = ensure_power_of_two(capacity);
+  }
 
   (*bf_out)->buckets = NULL;
   if (vector_allocate(sizeof(struct bf_bucket), capacity, &((*bf_out)->buckets)) == 0) {
@@ -59,10 +243,48 @@ int bf_allocate(uint32_t height, uint32_t width, uint32_t key_size, time_ns_t pe
   return 1;
 }
 
+int bf_allocate_blocked(uint32_t height, uint32_t width, uint32_t key_size, time_ns_t periodic_cleanup_interval, struct BloomFilter **bf_out) {
+  assert(height > 0);
+  assert(width > 0);
+  assert(height + 1 < BF_MAX_SALTS_BANK_SIZE);
+
+  struct BloomFilter *bf_alloc = (struct BloomFilter *)malloc(sizeof(struct BloomFilter));
+  if (bf_alloc == NULL) {
+    return 0;
+  }
+
+  (*bf_out) = bf_alloc;
+
+  (*bf_out)->height           = height;
+  (*bf_out)->width            = width;
+  (*bf_out)->key_size         = key_size;
+  (*bf_out)->cleanup_interval = periodic_cleanup_interval;
+
+  (*bf_out)->last_cleanup = 0;
+
+  uint32_t blocks = ((uint64_t)height * width + BF_BLOCK_BITS - 1) / BF_BLOCK_BITS;
+  if (!is_power_of_two(blocks)) {
+    blocks = ensure_power_of_two(blocks);
+  }
+  (*bf_out)->blocks = blocks;
+
+  (*bf_out)->buckets = NULL;
+  if (vector_allocate(BF_BLOCK_SIZE, blocks, &((*bf_out)->buckets)) == 0) {
+    return 0;
+  }
+
+  return 1;
+}
+
 void bf_set(struct BloomFilter *bf, void *key) {
+  if (bf->blocks != 0) {
+    bf_set_blocked(bf, key);
+    return;
+  }
+
+  const uint32_t hash = key_hash(key, bf->key_size);
   for (uint32_t h = 0; h < bf->height; h++) {
-    unsigned hash   = __builtin_ia32_crc32si(BF_SALTS[h], hash_obj(key, bf->key_size));
-    uint32_t offset = h * bf->width + (hash % bf->width);
+    uint32_t offset = row_offset(hash, h, bf->width);
 
     struct bf_bucket *bucket = 0;
     vector_borrow(bf->buckets, offset, (void **)&bucket);
@@ -72,11 +294,15 @@ void bf_set(struct BloomFilter *bf, void *key) {
 }
 
 int bf_query(struct BloomFilter *bf, void *key) {
+  if (bf->blocks != 0) {
+    return bf_query_blocked(bf, key);
+  }
+
   uint32_t count = 0;
 
+  const uint32_t hash = key_hash(key, bf->key_size);
   for (uint32_t h = 0; h < bf->height; h++) {
-    unsigned hash   = __builtin_ia32_crc32si(BF_SALTS[h], hash_obj(key, bf->key_size));
-    uint32_t offset = h * bf->width + (hash % bf->width);
+    uint32_t offset = row_offset(hash, h, bf->width);
 
     struct bf_bucket *bucket = 0;
     vector_borrow(bf->buckets, offset, (void **)&bucket);
@@ -91,6 +317,37 @@ int bf_query(struct BloomFilter *bf, void *key) {
   return 0;
 }
 
+void bf_set_vec(struct BloomFilter *bf, void *keys, uint32_t n) {
+  uint32_t i = 0;
+  for (; i + SKETCH_HASH_LANES <= n; i += SKETCH_HASH_LANES) {
+    void *batch = (uint8_t *)keys + (size_t)i * bf->key_size;
+    if (bf->blocks != 0) {
+      set_blocked_vec(bf, batch);
+    } else {
+      set_vec(bf, batch);
+    }
+  }
+  for (; i < n; i++) {
+    bf_set(bf, (uint8_t *)keys + (size_t)i * bf->key_size);
+  }
+}
+
+uint64_t bf_query_vec(struct BloomFilter *bf, void *keys, uint32_t n) {
+  assert(n <= BF_QUERY_VEC_MAX_KEYS);
+
+  uint64_t present = 0;
+  uint32_t i       = 0;
+  for (; i + SKETCH_HASH_LANES <= n; i += SKETCH_HASH_LANES) {
+    void *batch          = (uint8_t *)keys + (size_t)i * bf->key_size;
+    const uint64_t lanes = bf->blocks != 0 ? query_blocked_vec(bf, batch) : query_vec(bf, batch);
+    present             |= lanes << i;
+  }
+  for (; i < n; i++) {
+    present |= (uint64_t)bf_query(bf, (uint8_t *)keys + (size_t)i * bf->key_size) << i;
+  }
+  return present;
+}
+
 int bf_periodic_cleanup(struct BloomFilter *bf, time_ns_t now) {
   if (bf->last_cleanup == 0) {
     bf->last_cleanup = now;
@@ -106,3 +363,133 @@ int bf_periodic_cleanup(struct BloomFilter *bf, time_ns_t now) {
 
   return 1;
 }
+
+int bf_merge(struct BloomFilter *dst, struct BloomFilter *src) {
+  if (dst->height != src->height || dst->width != src->width || dst->key_size != src->key_size || dst->blocks != src->blocks) {
+    return 0;
+  }
+
+  uint8_t *dst_buckets;
+  uint8_t *src_buckets;
+  vector_borrow(dst->buckets, 0, (void **)&dst_buckets);
+  vector_borrow(src->buckets, 0, (void **)&src_buckets);
+
+  const uint32_t size = dst->buckets->capacity * dst->buckets->elem_size;
+  uint32_t byte       = 0;
+  for (; byte + sizeof(__m512i) <= size; byte += sizeof(__m512i)) {
+    const __m512i merged = _mm512_or_si512(_mm512_loadu_si512(dst_buckets + byte), _mm512_loadu_si512(src_buckets + byte));
+    _mm512_storeu_si512(dst_buckets + byte, merged);
+  }
+  for (; byte < size; byte++) {
+    dst_buckets[byte] |= src_buckets[byte];
+  }
+
+  vector_return(dst->buckets, 0, dst_buckets);
+  vector_return(src->buckets, 0, src_buckets);
+  return 1;
+}
+
+int abf_allocate(uint32_t num_generations, uint32_t height, uint32_t width, uint32_t key_size, time_ns_t generation_interval,
+                 struct AgingBloomFilter **abf_out) {
+  assert(num_generations >= 2 && num_generations <= ABF_MAX_GENERATIONS);
+  assert(generation_interval > 0);
+
+  struct AgingBloomFilter *abf_alloc = (struct AgingBloomFilter *)malloc(sizeof(struct AgingBloomFilter));
+  if (abf_alloc == NULL) {
+    return 0;
+  }
+
+  (*abf_out) = abf_alloc;
+
+  (*abf_out)->num_generations     = num_generations;
+  (*abf_out)->current             = 0;
+  (*abf_out)->stale               = 0;
+  (*abf_out)->generation_interval = generation_interval;
+  (*abf_out)->current_start       = 0;
+
+  for (uint32_t generation = 0; generation < num_generations; generation++) {
+    if (bf_allocate_blocked(height, width, key_size, 0, &((*abf_out)->generations[generation])) == 0) {
+      return 0;
+    }
+    (*abf_out)->cleared[generation] = 0;
+  }
+  (*abf_out)->generation_size = (*abf_out)->generations[0]->blocks * BF_BLOCK_SIZE;
+
+  return 1;
+}
+
+void abf_set(struct AgingBloomFilter *abf, void *key) { bf_set(abf->generations[abf->current], key); }
+
+int abf_query(struct AgingBloomFilter *abf, void *key) {
+  for (uint32_t generation = 0; generation < abf->num_generations; generation++) {
+    if ((abf->stale & (1u << generation)) == 0 && bf_query(abf->generations[generation], key)) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+void abf_set_vec(struct AgingBloomFilter *abf, void *keys, uint32_t n) { bf_set_vec(abf->generations[abf->current], keys, n); }
+
+uint64_t abf_query_vec(struct AgingBloomFilter *abf, void *keys, uint32_t n) {
+  assert(n <= BF_QUERY_VEC_MAX_KEYS);
+
+  const uint64_t all = n == BF_QUERY_VEC_MAX_KEYS ? UINT64_MAX : (1ull << n) - 1;
+  uint64_t present   = 0;
+  for (uint32_t generation = 0; generation < abf->num_generations && present != all; generation++) {
+    if ((abf->stale & (1u << generation)) == 0) {
+      present |= bf_query_vec(abf->generations[generation], keys, n);
+    }
+  }
+  return present;
+}
+
+int abf_advance(struct AgingBloomFilter *abf, time_ns_t now) {
+  if (abf->current_start == 0) {
+    abf->current_start = now;
+    return 0;
+  }
+
+  // One generation takes over per generation_interval elapsed, so that keys are not kept longer after an idle gap.
+  uint32_t rotated = 0;
+  while (now - abf->current_start >= abf->generation_interval && rotated < abf->num_generations) {
+    abf->current        = abf_oldest(abf);
+    abf->current_start += abf->generation_interval;
+    rotated++;
+  }
+
+  // Idle for more than all the generations: they all expired, start over from now.
+  if (now - abf->current_start >= abf->generation_interval) {
+    abf->current_start = now;
+  }
+  if (rotated > 0) {
+    // The generations the current one went past expired without ever taking keys: they are left to the next calls.
+    for (uint32_t skipped = 1; skipped < rotated; skipped++) {
+      const uint32_t generation = (abf->current + abf->num_generations - skipped) % abf->num_generations;
+      if (abf->cleared[generation] < abf->generation_size) {
+        abf->stale |= 1u << generation;
+      }
+    }
+
+    // Keys are set in the current generation right away, it has to be clean. It expires from scratch.
+    abf_clear_until(abf, abf->current, abf->generation_size);
+    abf->cleared[abf->current] = 0;
+    return (int)rotated;
+  }
+
+  uint32_t budget = ABF_CLEAR_CHUNK;
+  while (abf->stale != 0 && budget > 0) {
+    const uint32_t generation = __builtin_ctz(abf->stale);
+    const uint32_t chunk      = MIN(budget, abf->generation_size - abf->cleared[generation]);
+    abf_clear_until(abf, generation, abf->cleared[generation] + chunk);
+    budget -= chunk;
+  }
+
+  const time_ns_t elapsed = now - abf->current_start;
+  const uint32_t oldest   = abf_oldest(abf);
+
+  // Keep pace with the current generation, so that the oldest one is clean by the time it takes over.
+  const uint32_t due = (uint32_t)((double)abf->generation_size * (double)elapsed / (double)abf->generation_interval);
+  abf_clear_until(abf, oldest, MIN(due, abf->cleared[oldest] + budget));
+  return 0;
+}
@@ -8,8 +8,46 @@
 #include "time.h"
 
 struct BloomFilter;
+struct AgingBloomFilter;
+
+// Keys of a single bf_query_vec call, one bit each in the result.
+#define BF_QUERY_VEC_MAX_KEYS 64
 
 int bf_allocate(uint32_t height, uint32_t width, uint32_t key_size, time_ns_t periodic_cleanup_interval, struct BloomFilter **bf_out);
+// Same as bf_allocate, with the height * width buckets packed as bits in 64B blocks (8x less memory). Each key gets its own block, and its
+// height bits in it: bf_set and bf_query touch a single cache line. The number of blocks is rounded up to a power of two.
+int bf_allocate_blocked(uint32_t height, uint32_t width, uint32_t key_size, time_ns_t periodic_cleanup_interval, struct BloomFilter **bf_out);
 void bf_set(struct BloomFilter *bf, void *key);
 int bf_query(struct BloomFilter *bf, void *key);
+// Same as bf_set, for n keys laid out one after the other.
+void bf_set_vec(struct BloomFilter *bf, void *keys, uint32_t n);
+// Same as bf_query, for up to BF_QUERY_VEC_MAX_KEYS keys laid out one after the other. Bit i of the result is set when key i may be in the
+// filter. Keys are processed 16 at a time, and the remainder one by one.
+uint64_t bf_query_vec(struct BloomFilter *bf, void *keys, uint32_t n);
 int bf_periodic_cleanup(struct BloomFilter *bf, time_ns_t now);
+// Sets the buckets of dst that are set in src, so that dst holds the keys of both. Both filters need the same layout, dimensions and key size;
+// returns 0 otherwise.
+int bf_merge(struct BloomFilter *dst, struct BloomFilter *src);
+
+// Maximum number of generations of an AgingBloomFilter.
+#define ABF_MAX_GENERATIONS 8
+// Maximum number of bytes abf_advance clears at once, besides the generation taking over.
+#define ABF_CLEAR_CHUNK 4096
+
+// Bloom filter that forgets keys gradually instead of all at once. Keys are set in the current generation, made of a blocked filter, and
+// queries look at all the generations. When the current generation has covered generation_interval, the oldest one takes over. The oldest
+// generation is cleared while the current one fills up, a few cache lines per abf_advance. What is left of it when it takes over is cleared by
+// that call: next to nothing when abf_advance keeps up with the traffic, up to a whole filter after an idle gap. The other generations that
+// expire in the same call are skipped by queries, and cleared ABF_CLEAR_CHUNK bytes at a time by the next calls.
+//
+// Keys set during a generation are found for the num_generations - 2 generations after it, and fade out during the next one, as their blocks
+// are cleared.
+int abf_allocate(uint32_t num_generations, uint32_t height, uint32_t width, uint32_t key_size, time_ns_t generation_interval,
+                 struct AgingBloomFilter **abf_out);
+void abf_set(struct AgingBloomFilter *abf, void *key);
+int abf_query(struct AgingBloomFilter *abf, void *key);
+void abf_set_vec(struct AgingBloomFilter *abf, void *keys, uint32_t n);
+uint64_t abf_query_vec(struct AgingBloomFilter *abf, void *keys, uint32_t n);
+// Meant to be called once per burst. Returns the number of generations that took over, one per generation_interval elapsed, up to
+// num_generations.
+int abf_advance(struct AgingBloomFilter *abf, time_ns_t now);
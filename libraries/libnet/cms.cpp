@@ -2,39 +2,504 @@
 
 #include <stdlib.h>
 #include <stdint.h>
+#include <string.h>
 #include <assert.h>
+#include <immintrin.h>
+
+#include <atomic>
+#include <limits>
+#include <new>
+#include <type_traits>
 
 #include "vector.h"
 #include "time.h"
-#include "hash.h"
 #include "compute.h"
+#include "sketch-hash.h"
 
 #define MIN(a, b) ((a) < (b) ? (a) : (b))
 
+// Granularity of the lazy reset.
+#define CMS_BLOCK_SHIFT 6
+#define CMS_BLOCK_SIZE (1 << CMS_BLOCK_SHIFT)
+
 struct CMS {
   struct Vector *buckets;
+  // Epoch each block of counters was last reset in, NULL with CMS_EAGER_RESET.
+  struct Vector *epochs;
 
   uint32_t height;
   uint32_t width;
   uint32_t key_size;
   time_ns_t cleanup_interval;
 
+  enum cms_counter counter;
+  int flags;
+  uint32_t epoch;
+
   time_ns_t last_cleanup;
 };
 
+// Cells of a SlidingCMS: the count of every pane, followed by a tag made of the rotation the cell was last incremented in, and the index of
+// the pane that was the newest one in that rotation.
+#define SCMS_PANE_BITS 4
+#define SCMS_PANE_MASK ((1 << SCMS_PANE_BITS) - 1)
+
+struct SlidingCMS {
+  struct Vector *cells;
+
+  uint32_t height;
+  uint32_t width;
+  uint32_t key_size;
+  uint32_t num_panes;
+  // Number of 32 bit lanes of a cell, the tag being the last one.
+  uint32_t cell_lanes;
+  uint32_t cell_shift;
+
+  // Tag of the cells incremented in the current rotation.
+  uint32_t tag;
+  time_ns_t pane_interval;
+  time_ns_t newest_start;
+};
+
+struct alignas(64) pcms_core {
+  // Generation of the last operation the core went through. Written by the core.
+  std::atomic<uint32_t> ack;
+  // Sketches written in the even and odd generations.
+  struct CMS *sketches[2];
+};
+
+struct PerCoreCMS {
+  struct pcms_core *cores;
+  uint32_t num_cores;
+
+  // Bumped by pcms_merge, to swap the sketches of all the cores.
+  std::atomic<uint32_t> generation;
+};
+
 struct hash {
   uint32_t value;
 };
 
-struct cms_bucket {
-  uint64_t value;
+static_assert(CMS_VECTOR_SIZE == SKETCH_HASH_LANES, "the vectorized operations hash one key per lane");
+
+namespace {
+
+// Column of the key in the given row. The width is a power of two.
+inline uint32_t row_column(uint32_t hash, uint32_t row, uint32_t width) { return fmix32(hash ^ CMS_SALTS[row]) & (width - 1); }
+
+template <typename counter_t> constexpr counter_t counter_max() { return std::numeric_limits<counter_t>::max(); }
+template <> constexpr uint32_t counter_max<uint32_t>() { return INT32_MAX; }
+
+inline uint32_t counter_size(enum cms_counter counter) {
+  switch (counter) {
+  case CMS_COUNTER_64:
+    return sizeof(uint64_t);
+  case CMS_COUNTER_32:
+    return sizeof(uint32_t);
+  case CMS_COUNTER_16:
+    return sizeof(uint16_t);
+  case CMS_COUNTER_8:
+    return sizeof(uint8_t);
+  }
+  return 0;
+}
+
+// Calls f with the counters of the sketch, as an array of the right type.
+template <typename F> inline void with_counters(struct CMS *cms, F &&f) {
+  void *counters;
+  vector_borrow(cms->buckets, 0, &counters);
+  switch (cms->counter) {
+  case CMS_COUNTER_64:
+    f((uint64_t *)counters);
+    break;
+  case CMS_COUNTER_32:
+    f((uint32_t *)counters);
+    break;
+  case CMS_COUNTER_16:
+    f((uint16_t *)counters);
+    break;
+  case CMS_COUNTER_8:
+    f((uint8_t *)counters);
+    break;
+  }
+  vector_return(cms->buckets, 0, counters);
+}
+
+// Vectorized row_column, plus the offset of the row.
+inline __m512i row_offsets_vec(__m512i hash, uint32_t row, uint32_t width) {
+  const __m512i columns = _mm512_and_si512(fmix32_vec(_mm512_xor_si512(hash, _mm512_set1_epi32(CMS_SALTS[row]))), _mm512_set1_epi32(width - 1));
+  return _mm512_add_epi32(columns, _mm512_set1_epi32(row * width));
+}
+
+// Reset the block holding the counter at the given byte offset, if it was last reset in a previous epoch.
+inline void refresh_block(struct CMS *cms, void *counters, uint32_t byte) {
+  const uint32_t block = byte / CMS_BLOCK_SIZE;
+
+  uint32_t *epoch;
+  vector_borrow(cms->epochs, block, (void **)&epoch);
+  if (*epoch != cms->epoch) {
+    memset((uint8_t *)counters + block * CMS_BLOCK_SIZE, 0, CMS_BLOCK_SIZE);
+    *epoch = cms->epoch;
+  }
+  vector_return(cms->epochs, block, epoch);
+}
+
+inline bool is_block_fresh(struct CMS *cms, uint32_t byte) {
+  const uint32_t block = byte / CMS_BLOCK_SIZE;
+
+  uint32_t *epoch;
+  vector_borrow(cms->epochs, block, (void **)&epoch);
+  const bool fresh = *epoch == cms->epoch;
+  vector_return(cms->epochs, block, epoch);
+  return fresh;
+}
+
+inline __mmask16 fresh_lanes_vec(struct CMS *cms, __m512i bytes) {
+  const __m512i epochs = vector_gather32_vec(cms->epochs, _mm512_srli_epi32(bytes, CMS_BLOCK_SHIFT));
+  return _mm512_cmpeq_epi32_mask(epochs, _mm512_set1_epi32(cms->epoch));
+}
+
+void refresh_blocks_vec(struct CMS *cms, void *counters, __m512i bytes) {
+  __mmask16 stale = ~fresh_lanes_vec(cms, bytes);
+  if (!stale) {
+    return;
+  }
+
+  alignas(64) uint32_t lane_bytes[CMS_VECTOR_SIZE];
+  _mm512_store_si512(lane_bytes, bytes);
+  for (; stale; stale &= stale - 1) {
+    refresh_block(cms, counters, lane_bytes[__builtin_ctz(stale)]);
+  }
+}
+
+struct u64x16 {
+  __m512i lo;
+  __m512i hi;
+};
+
+// The 8B counters of a row hit by the keys of the 16 lanes, gathered and scattered as two halves of 8 lanes.
+class RowLanes64 {
+public:
+  using values_t = u64x16;
+
+private:
+  uint64_t *counters;
+  __m512i offsets;
+
+  __m256i offsets_lo() const { return _mm512_castsi512_si256(offsets); }
+  __m256i offsets_hi() const { return _mm512_extracti64x4_epi64(offsets, 1); }
+
+  void store_incremented(__mmask8 lo, __mmask8 hi, values_t values) {
+    const __m512i one = _mm512_set1_epi64(1);
+    _mm512_mask_i32scatter_epi64(counters, lo, offsets_lo(), _mm512_add_epi64(values.lo, one), sizeof(uint64_t));
+    _mm512_mask_i32scatter_epi64(counters, hi, offsets_hi(), _mm512_add_epi64(values.hi, one), sizeof(uint64_t));
+  }
+
+public:
+  RowLanes64(const struct CMS *cms, uint64_t *_counters, __m512i hash, uint32_t row)
+      : counters(_counters), offsets(row_offsets_vec(hash, row, cms->width)) {}
+
+  __m512i bytes() const { return _mm512_slli_epi32(offsets, 3); }
+
+  // Bitmask of the previous lanes hitting the same counter.
+  __m512i conflicts() const { return _mm512_conflict_epi32(offsets); }
+
+  values_t load(__mmask16 lanes) const {
+    return {_mm512_mask_i32gather_epi64(_mm512_setzero_si512(), (__mmask8)lanes, offsets_lo(), counters, sizeof(uint64_t)),
+            _mm512_mask_i32gather_epi64(_mm512_setzero_si512(), (__mmask8)(lanes >> 8), offsets_hi(), counters, sizeof(uint64_t))};
+  }
+
+  // Increment the counters of the lanes. The lanes must not conflict with each other.
+  void increment(__mmask16 lanes) { store_incremented((__mmask8)lanes, (__mmask8)(lanes >> 8), load(lanes)); }
+
+  // Same as increment, only for the lanes whose counter holds the expected value.
+  void increment_equal(__mmask16 lanes, values_t expected) {
+    const values_t values = load(lanes);
+    const __mmask8 lo     = _mm512_mask_cmpeq_epu64_mask((__mmask8)lanes, values.lo, expected.lo);
+    const __mmask8 hi     = _mm512_mask_cmpeq_epu64_mask((__mmask8)(lanes >> 8), values.hi, expected.hi);
+    store_incremented(lo, hi, values);
+  }
+
+  static values_t all_ones() { return {_mm512_set1_epi64(-1), _mm512_set1_epi64(-1)}; }
+  static values_t min(values_t a, values_t b) { return {_mm512_min_epu64(a.lo, b.lo), _mm512_min_epu64(a.hi, b.hi)}; }
+  static values_t maskz(__mmask16 lanes, values_t values) {
+    return {_mm512_maskz_mov_epi64((__mmask8)lanes, values.lo), _mm512_maskz_mov_epi64((__mmask8)(lanes >> 8), values.hi)};
+  }
+  static void store(values_t values, int *counts_out) {
+    _mm256_storeu_si256((__m256i *)counts_out, _mm512_cvtepi64_epi32(values.lo));
+    _mm256_storeu_si256((__m256i *)(counts_out + 8), _mm512_cvtepi64_epi32(values.hi));
+  }
+};
+
+// Same as RowLanes64, for counters of 4B or less. They are accessed through the 4B word holding them: the lanes conflict when they hit the
+// same word, even if it is for different counters.
+template <typename counter_t> class RowLanes32 {
+  static_assert(sizeof(counter_t) <= sizeof(uint32_t));
+
+public:
+  using values_t = __m512i;
+
+private:
+  static constexpr const int SIZE_SHIFT = sizeof(counter_t) == 4 ? 2 : sizeof(counter_t) == 2 ? 1 : 0;
+
+  counter_t *counters;
+  __m512i counter_bytes;
+  __m512i words;
+  __m512i shifts;
+
+  __m512i load_words(__mmask16 lanes) const { return _mm512_mask_i32gather_epi32(_mm512_setzero_si512(), lanes, words, counters, sizeof(uint32_t)); }
+  __m512i extract(__m512i values) const {
+    return _mm512_and_si512(_mm512_srlv_epi32(values, shifts), _mm512_set1_epi32((uint32_t)std::numeric_limits<counter_t>::max()));
+  }
+
+  // Saturated counters are left as they are.
+  void store_incremented(__mmask16 lanes, __m512i values, __m512i fields) {
+    lanes = _mm512_mask_cmplt_epu32_mask(lanes, fields, _mm512_set1_epi32(counter_max<counter_t>()));
+    _mm512_mask_i32scatter_epi32(counters, lanes, words, _mm512_add_epi32(values, _mm512_sllv_epi32(_mm512_set1_epi32(1), shifts)), sizeof(uint32_t));
+  }
+
+public:
+  RowLanes32(const struct CMS *cms, counter_t *_counters, __m512i hash, uint32_t row)
+      : counters(_counters), counter_bytes(_mm512_slli_epi32(row_offsets_vec(hash, row, cms->width), SIZE_SHIFT)),
+        words(_mm512_srli_epi32(counter_bytes, 2)), shifts(_mm512_slli_epi32(_mm512_and_si512(counter_bytes, _mm512_set1_epi32(3)), 3)) {}
+
+  __m512i bytes() const { return counter_bytes; }
+
+  __m512i conflicts() const { return _mm512_conflict_epi32(words); }
+
+  values_t load(__mmask16 lanes) const { return extract(load_words(lanes)); }
+
+  void increment(__mmask16 lanes) {
+    const __m512i values = load_words(lanes);
+    store_incremented(lanes, values, extract(values));
+  }
+
+  void increment_equal(__mmask16 lanes, values_t expected) {
+    const __m512i values = load_words(lanes);
+    const __m512i fields = extract(values);
+    store_incremented(_mm512_mask_cmpeq_epi32_mask(lanes, fields, expected), values, fields);
+  }
+
+  static values_t all_ones() { return _mm512_set1_epi32(-1); }
+  static values_t min(values_t a, values_t b) { return _mm512_min_epu32(a, b); }
+  static values_t maskz(__mmask16 lanes, values_t values) { return _mm512_maskz_mov_epi32(lanes, values); }
+  static void store(values_t values, int *counts_out) { _mm512_storeu_si512(counts_out, values); }
 };
 
+template <typename counter_t> using row_lanes_t = std::conditional_t<std::is_same_v<counter_t, uint64_t>, RowLanes64, RowLanes32<counter_t>>;
+
+template <typename counter_t> void increment_vec(struct CMS *cms, counter_t *counters, __m512i hash) {
+  using lanes_t = row_lanes_t<counter_t>;
+
+  for (uint32_t h = 0; h < cms->height; h++) {
+    lanes_t lanes(cms, counters, hash, h);
+    if (cms->epochs != NULL) {
+      refresh_blocks_vec(cms, counters, lanes.bytes());
+    }
+
+    // Keys hitting the same counter are counted in successive rounds, each one made of lanes that do not conflict with each other.
+    const __m512i conflicts = lanes.conflicts();
+    __mmask16 pending       = 0xffff;
+    while (pending) {
+      const __mmask16 ready = _mm512_mask_testn_epi32_mask(pending, conflicts, _mm512_set1_epi32(pending));
+      lanes.increment(ready);
+      pending &= ~ready;
+    }
+  }
+}
+
+// With conservative update, the increments of a key depend on all of its counters: keys conflicting in any of the rows are counted in
+// successive rounds.
+template <typename counter_t> void increment_conservative_vec(struct CMS *cms, counter_t *counters, __m512i hash) {
+  using lanes_t = row_lanes_t<counter_t>;
+
+  __m512i conflicts = _mm512_setzero_si512();
+  for (uint32_t h = 0; h < cms->height; h++) {
+    lanes_t lanes(cms, counters, hash, h);
+    if (cms->epochs != NULL) {
+      refresh_blocks_vec(cms, counters, lanes.bytes());
+    }
+    conflicts = _mm512_or_si512(conflicts, lanes.conflicts());
+  }
+
+  __mmask16 pending = 0xffff;
+  while (pending) {
+    const __mmask16 ready = _mm512_mask_testn_epi32_mask(pending, conflicts, _mm512_set1_epi32(pending));
+
+    typename lanes_t::values_t estimates = lanes_t::all_ones();
+    for (uint32_t h = 0; h < cms->height; h++) {
+      estimates = lanes_t::min(estimates, lanes_t(cms, counters, hash, h).load(ready));
+    }
+    for (uint32_t h = 0; h < cms->height; h++) {
+      lanes_t(cms, counters, hash, h).increment_equal(ready, estimates);
+    }
+
+    pending &= ~ready;
+  }
+}
+
+template <typename counter_t> void count_min_vec(struct CMS *cms, counter_t *counters, __m512i hash, int *counts_out) {
+  using lanes_t = row_lanes_t<counter_t>;
+
+  typename lanes_t::values_t estimates = lanes_t::all_ones();
+  for (uint32_t h = 0; h < cms->height; h++) {
+    const lanes_t lanes(cms, counters, hash, h);
+    typename lanes_t::values_t values = lanes.load(0xffff);
+    if (cms->epochs != NULL) {
+      values = lanes_t::maskz(fresh_lanes_vec(cms, lanes.bytes()), values);
+    }
+    estimates = lanes_t::min(estimates, values);
+  }
+
+  lanes_t::store(estimates, counts_out);
+}
+
+inline uint32_t *scms_cells(struct SlidingCMS *scms) {
+  uint32_t *cells;
+  vector_borrow(scms->cells, 0, (void **)&cells);
+  return cells;
+}
+
+// Bitmask of the panes of a cell whose counts are still in the window. The panes last incremented in rotation t, t-1, ..., t-live+1 are
+// the ones that come before the newest pane of the tag, wrapping around.
+inline uint32_t live_panes(const struct SlidingCMS *scms, uint32_t tag) {
+  const uint32_t age = ((scms->tag >> SCMS_PANE_BITS) - (tag >> SCMS_PANE_BITS)) & (UINT32_MAX >> SCMS_PANE_BITS);
+  if (age >= scms->num_panes) {
+    return 0;
+  }
+
+  const uint32_t live = scms->num_panes - age;
+  uint32_t first      = (tag & SCMS_PANE_MASK) + scms->num_panes + 1 - live;
+  if (first >= scms->num_panes) {
+    first -= scms->num_panes;
+  }
+
+  const uint32_t low = (1u << live) - 1;
+  return ((low << first) | (low >> (scms->num_panes - first))) & ((1u << scms->num_panes) - 1);
+}
+
+inline __m512i live_panes_vec(const struct SlidingCMS *scms, __m512i tags) {
+  const __m512i num_panes = _mm512_set1_epi32(scms->num_panes);
+  const __m512i rotations = _mm512_sub_epi32(_mm512_set1_epi32(scms->tag >> SCMS_PANE_BITS), _mm512_srli_epi32(tags, SCMS_PANE_BITS));
+  const __m512i ages      = _mm512_and_si512(rotations, _mm512_set1_epi32(UINT32_MAX >> SCMS_PANE_BITS));
+  const __mmask16 alive   = _mm512_cmplt_epu32_mask(ages, num_panes);
+
+  const __m512i live  = _mm512_sub_epi32(num_panes, ages);
+  __m512i first       = _mm512_sub_epi32(_mm512_add_epi32(_mm512_and_si512(tags, _mm512_set1_epi32(SCMS_PANE_MASK)), _mm512_set1_epi32(scms->num_panes + 1)), live);
+  first               = _mm512_min_epu32(first, _mm512_sub_epi32(first, num_panes));
+  const __m512i low   = _mm512_sub_epi32(_mm512_sllv_epi32(_mm512_set1_epi32(1), live), _mm512_set1_epi32(1));
+  const __m512i panes = _mm512_or_si512(_mm512_sllv_epi32(low, first), _mm512_srlv_epi32(low, _mm512_sub_epi32(num_panes, first)));
+
+  return _mm512_maskz_and_epi32(alive, panes, _mm512_set1_epi32((1u << scms->num_panes) - 1));
+}
+
+// Reset the counts of the dropped panes, before incrementing the cell in the current rotation.
+inline void refresh_cell(struct SlidingCMS *scms, uint32_t *cell) {
+  uint32_t *tag = cell + scms->cell_lanes - 1;
+  if (*tag == scms->tag) {
+    return;
+  }
+
+  const uint32_t live = live_panes(scms, *tag);
+  for (uint32_t pane = 0; pane < scms->num_panes; pane++) {
+    if (!(live & (1u << pane))) {
+      cell[pane] = 0;
+    }
+  }
+  *tag = scms->tag;
+}
+
+// Offsets of the cells hit by the keys in a row, in 32 bit lanes.
+inline __m512i cell_offsets_vec(const struct SlidingCMS *scms, __m512i hash, uint32_t row) {
+  return _mm512_slli_epi32(row_offsets_vec(hash, row, scms->width), scms->cell_shift);
+}
+
+// Starts the counts over, either right away or lazily (see CMS_EAGER_RESET).
+inline void reset_counters(struct CMS *cms) {
+  // Blocks are reset when they are first touched in the new epoch. One left untouched for 2^32 epochs would be taken for a fresh one.
+  if (cms->epochs == NULL) {
+    vector_clear(cms->buckets);
+  } else {
+    cms->epoch++;
+  }
+}
+
+// Lane-wise sum of two vectors of counters, saturating at counter_max. Narrow counters are added within their 32 bit words.
+template <typename counter_t> inline __m512i add_counters_vec(__m512i a, __m512i b) {
+  if constexpr (sizeof(counter_t) == sizeof(uint64_t)) {
+    return _mm512_add_epi64(a, b);
+  } else if constexpr (sizeof(counter_t) == sizeof(uint32_t)) {
+    // Both counts are at most INT32_MAX, their sum fits 32 bits.
+    return _mm512_min_epu32(_mm512_add_epi32(a, b), _mm512_set1_epi32(counter_max<counter_t>()));
+  } else {
+    constexpr const uint32_t bits = 8 * sizeof(counter_t);
+    const __m512i max             = _mm512_set1_epi32(counter_max<counter_t>());
+
+    __m512i sum = _mm512_setzero_si512();
+    for (uint32_t shift = 0; shift < 32; shift += bits) {
+      const __m512i a_counters = _mm512_and_si512(_mm512_srli_epi32(a, shift), max);
+      const __m512i b_counters = _mm512_and_si512(_mm512_srli_epi32(b, shift), max);
+      sum                      = _mm512_or_si512(sum, _mm512_slli_epi32(_mm512_min_epu32(_mm512_add_epi32(a_counters, b_counters), max), shift));
+    }
+    return sum;
+  }
+}
+
+inline bool same_shape(const struct CMS *a, const struct CMS *b) {
+  return a->height == b->height && a->width == b->width && a->key_size == b->key_size && a->counter == b->counter;
+}
+
+// Adds the counters of src to the ones of dst, one 64B block at a time. Stale blocks count as zeros on both sides.
+template <typename counter_t> void merge_vec(struct CMS *dst, counter_t *dst_counters, struct CMS *src) {
+  counter_t *src_counters;
+  vector_borrow(src->buckets, 0, (void **)&src_counters);
+
+  const uint32_t blocks = dst->height * dst->width * sizeof(counter_t) / CMS_BLOCK_SIZE;
+  for (uint32_t block = 0; block < blocks; block++) {
+    const uint32_t byte = block * CMS_BLOCK_SIZE;
+    if (src->epochs != NULL && !is_block_fresh(src, byte)) {
+      continue;
+    }
+    if (dst->epochs != NULL) {
+      refresh_block(dst, dst_counters, byte);
+    }
+
+    __m512i *dst_block = (__m512i *)((uint8_t *)dst_counters + byte);
+    const __m512i sum  = add_counters_vec<counter_t>(_mm512_loadu_si512(dst_block), _mm512_loadu_si512((uint8_t *)src_counters + byte));
+    _mm512_storeu_si512(dst_block, sum);
+  }
+
+  vector_return(src->buckets, 0, src_counters);
+}
+
+// The sketch a core writes to in the current generation. The acknowledgment of the operation follows it, with pcms_ack.
+inline struct CMS *pcms_acquire(struct PerCoreCMS *pcms, int core, uint32_t *generation_out) {
+  *generation_out = pcms->generation.load(std::memory_order_acquire);
+  return pcms->cores[core].sketches[*generation_out & 1];
+}
+
+inline void pcms_ack(struct PerCoreCMS *pcms, int core, uint32_t generation) { pcms->cores[core].ack.store(generation, std::memory_order_release); }
+
+} // namespace
+
 int cms_allocate(uint32_t height, uint32_t width, uint32_t key_size, time_ns_t periodic_cleanup_interval, struct CMS **cms_out) {
+  return cms_allocate_counters(height, width, key_size, CMS_COUNTER_64, 0, periodic_cleanup_interval, cms_out);
+}
+
+int cms_allocate_counters(uint32_t height, uint32_t width, uint32_t key_size, enum cms_counter counter, int flags, time_ns_t periodic_cleanup_interval,
+                          struct CMS **cms_out) {
   assert(height > 0);
   assert(width > 0);
   assert(height < CMS_MAX_SALTS_BANK_SIZE);
 
+  // Rows start on their own cache line, and columns are picked with a mask.
+  const uint32_t line_counters = CMS_BLOCK_SIZE / counter_size(counter);
+  if (width < line_counters) {
+    width = line_counters;
+  } else if (!is_power_of_two(width)) {
+    width = ensure_power_of_two(width);
+  }
+
   struct CMS *cms_alloc = (struct CMS *)malloc(sizeof(struct CMS));
   if (cms_alloc == NULL) {
     return 0;
@@ -46,13 +511,19 @@ int cms_allocate(uint32_t height, uint32_t width, uint32_t key_size, time_ns_t p
   (*cms_out)->width            = width;
   (*cms_out)->key_size         = key_size;
   (*cms_out)->cleanup_interval = periodic_cleanup_interval;
+  (*cms_out)->counter          = counter;
+  (*cms_out)->flags            = flags;
+  (*cms_out)->epoch            = 0;
 
   (*cms_out)->last_cleanup = 0;
 
-  uint32_t capacity = ensure_power_of_two(height * width);
-
   (*cms_out)->buckets = NULL;
-  if (vector_allocate(sizeof(struct cms_bucket), capacity, &((*cms_out)->buckets)) == 0) {
+  if (vector_allocate(counter_size(counter), height * width, &((*cms_out)->buckets)) == 0) {
+    return 0;
+  }
+
+  (*cms_out)->epochs = NULL;
+  if (!(flags & CMS_EAGER_RESET) && vector_allocate(sizeof(uint32_t), height * width * counter_size(counter) / CMS_BLOCK_SIZE, &((*cms_out)->epochs)) == 0) {
     return 0;
   }
 
@@ -60,33 +531,65 @@ int cms_allocate(uint32_t height, uint32_t width, uint32_t key_size, time_ns_t p
 }
 
 void cms_increment(struct CMS *cms, void *key) {
-  for (uint32_t h = 0; h < cms->height; h++) {
-    unsigned hash   = __builtin_ia32_crc32si(CMS_SALTS[h], hash_obj(key, cms->key_size));
-    uint32_t offset = h * cms->width + (hash % cms->width);
+  const uint32_t hash = key_hash(key, cms->key_size);
+  with_counters(cms, [&](auto *counters) {
+    using counter_t = std::remove_pointer_t<decltype(counters)>;
 
-    struct cms_bucket *bucket = 0;
-    vector_borrow(cms->buckets, offset, (void **)&bucket);
-    bucket->value++;
-    vector_return(cms->buckets, offset, bucket);
-  }
+    counter_t *row_counters[CMS_MAX_SALTS_BANK_SIZE];
+    counter_t estimate = counter_max<counter_t>();
+    for (uint32_t h = 0; h < cms->height; h++) {
+      const uint32_t offset = h * cms->width + row_column(hash, h, cms->width);
+      if (cms->epochs != NULL) {
+        refresh_block(cms, counters, offset * sizeof(counter_t));
+      }
+      row_counters[h] = counters + offset;
+      estimate        = MIN(estimate, *row_counters[h]);
+    }
+
+    const bool conservative = cms->flags & CMS_CONSERVATIVE_UPDATE;
+    for (uint32_t h = 0; h < cms->height; h++) {
+      counter_t *counter = row_counters[h];
+      if (*counter < counter_max<counter_t>() && (!conservative || *counter == estimate)) {
+        (*counter)++;
+      }
+    }
+  });
 }
 
 int cms_count_min(struct CMS *cms, void *key) {
   uint64_t min_val = INT64_MAX;
 
-  for (uint32_t h = 0; h < cms->height; h++) {
-    unsigned hash   = __builtin_ia32_crc32si(CMS_SALTS[h], hash_obj(key, cms->key_size));
-    uint32_t offset = h * cms->width + (hash % cms->width);
-
-    struct cms_bucket *bucket = 0;
-    vector_borrow(cms->buckets, offset, (void **)&bucket);
-    min_val = MIN(min_val, bucket->value);
-    vector_return(cms->buckets, offset, bucket);
-  }
+  const uint32_t hash = key_hash(key, cms->key_size);
+  with_counters(cms, [&](auto *counters) {
+    for (uint32_t h = 0; h < cms->height; h++) {
+      const uint32_t offset = h * cms->width + row_column(hash, h, cms->width);
+      if (cms->epochs != NULL && !is_block_fresh(cms, offset * sizeof(*counters))) {
+        min_val = 0;
+        break;
+      }
+      min_val = MIN(min_val, (uint64_t)counters[offset]);
+    }
+  });
 
   return min_val;
 }
 
+void cms_increment_vec(struct CMS *cms, void *keys) {
+  const __m512i hash = key_hash_vec(keys, cms->key_size);
+  with_counters(cms, [&](auto *counters) {
+    if (cms->flags & CMS_CONSERVATIVE_UPDATE) {
+      increment_conservative_vec(cms, counters, hash);
+    } else {
+      increment_vec(cms, counters, hash);
+    }
+  });
+}
+
+void cms_count_min_vec(struct CMS *cms, void *keys, int *counts_out) {
+  const __m512i hash = key_hash_vec(keys, cms->key_size);
+  with_counters(cms, [&](auto *counters) { count_min_vec(cms, counters, hash, counts_out); });
+}
+
 int cms_periodic_cleanup(struct CMS *cms, time_ns_t now) {
   if (cms->last_cleanup == 0) {
     cms->last_cleanup = now;
@@ -97,8 +600,250 @@ int cms_periodic_cleanup(struct CMS *cms, time_ns_t now) {
     return 0;
   }
 
-  vector_clear(cms->buckets);
+  reset_counters(cms);
   cms->last_cleanup = now;
 
   return 1;
 }
+
+int cms_merge(struct CMS *dst, struct CMS *src) {
+  if (!same_shape(dst, src)) {
+    return 0;
+  }
+
+  with_counters(dst, [&](auto *counters) { merge_vec(dst, counters, src); });
+  return 1;
+}
+
+int pcms_allocate(uint32_t num_cores, uint32_t height, uint32_t width, uint32_t key_size, enum cms_counter counter, int flags,
+                  struct PerCoreCMS **pcms_out) {
+  assert(num_cores > 0);
+
+  struct PerCoreCMS *pcms_alloc = (struct PerCoreCMS *)malloc(sizeof(struct PerCoreCMS));
+  if (pcms_alloc == NULL) {
+    return 0;
+  }
+
+  (*pcms_out) = new (pcms_alloc) PerCoreCMS();
+
+  (*pcms_out)->num_cores = num_cores;
+  (*pcms_out)->generation.store(0, std::memory_order_relaxed);
+
+  (*pcms_out)->cores = (struct pcms_core *)mem_alloc(sizeof(struct pcms_core) * num_cores, NULL);
+  if ((*pcms_out)->cores == NULL) {
+    return 0;
+  }
+
+  // The sketches are never cleaned up on their own: pcms_merge resets them.
+  for (uint32_t core = 0; core < num_cores; core++) {
+    struct pcms_core *corep = new ((*pcms_out)->cores + core) pcms_core();
+    corep->ack.store(0, std::memory_order_relaxed);
+    for (struct CMS *&sketch : corep->sketches) {
+      if (cms_allocate_counters(height, width, key_size, counter, flags, 0, &sketch) == 0) {
+        return 0;
+      }
+    }
+  }
+
+  return 1;
+}
+
+void pcms_increment(struct PerCoreCMS *pcms, int core, void *key) {
+  uint32_t generation;
+  cms_increment(pcms_acquire(pcms, core, &generation), key);
+  pcms_ack(pcms, core, generation);
+}
+
+void pcms_increment_vec(struct PerCoreCMS *pcms, int core, void *keys) {
+  uint32_t generation;
+  cms_increment_vec(pcms_acquire(pcms, core, &generation), keys);
+  pcms_ack(pcms, core, generation);
+}
+
+void pcms_poll(struct PerCoreCMS *pcms, int core) { pcms_ack(pcms, core, pcms->generation.load(std::memory_order_acquire)); }
+
+int pcms_merge(struct PerCoreCMS *pcms, struct CMS *dst) {
+  // Checked before the swap: past it, the retired sketches have to be merged.
+  if (!same_shape(dst, pcms->cores[0].sketches[0])) {
+    return 0;
+  }
+
+  const uint32_t retired    = pcms->generation.load(std::memory_order_relaxed);
+  const uint32_t generation = retired + 1;
+  pcms->generation.store(generation, std::memory_order_seq_cst);
+
+  for (uint32_t core = 0; core < pcms->num_cores; core++) {
+    // Once a core went through an operation of the new generation, it is done with the retired sketch.
+    while (pcms->cores[core].ack.load(std::memory_order_acquire) != generation) {
+      _mm_pause();
+    }
+
+    struct CMS *sketch = pcms->cores[core].sketches[retired & 1];
+    cms_merge(dst, sketch);
+    reset_counters(sketch);
+  }
+
+  return 1;
+}
+
+int scms_allocate(uint32_t height, uint32_t width, uint32_t key_size, uint32_t num_panes, time_ns_t window, struct SlidingCMS **scms_out) {
+  assert(height > 0);
+  assert(width > 0);
+  assert(height < CMS_MAX_SALTS_BANK_SIZE);
+  assert(num_panes > 0 && num_panes <= SCMS_MAX_PANES);
+
+  if (!is_power_of_two(width)) {
+    width = ensure_power_of_two(width);
+  }
+
+  struct SlidingCMS *scms_alloc = (struct SlidingCMS *)malloc(sizeof(struct SlidingCMS));
+  if (scms_alloc == NULL) {
+    return 0;
+  }
+
+  (*scms_out) = scms_alloc;
+
+  (*scms_out)->height     = height;
+  (*scms_out)->width      = width;
+  (*scms_out)->key_size   = key_size;
+  (*scms_out)->num_panes  = num_panes;
+  (*scms_out)->cell_shift = 0;
+  while ((1u << (*scms_out)->cell_shift) < num_panes + 1) {
+    (*scms_out)->cell_shift++;
+  }
+  (*scms_out)->cell_lanes = 1u << (*scms_out)->cell_shift;
+
+  (*scms_out)->tag           = 0;
+  (*scms_out)->pane_interval = window / num_panes;
+  (*scms_out)->newest_start  = 0;
+
+  (*scms_out)->cells = NULL;
+  if (vector_allocate(sizeof(uint32_t) * (*scms_out)->cell_lanes, height * width, &((*scms_out)->cells)) == 0) {
+    return 0;
+  }
+
+  return 1;
+}
+
+void scms_increment(struct SlidingCMS *scms, void *key) {
+  const uint32_t hash = key_hash(key, scms->key_size);
+  const uint32_t pane = scms->tag & SCMS_PANE_MASK;
+  uint32_t *cells     = scms_cells(scms);
+
+  for (uint32_t h = 0; h < scms->height; h++) {
+    uint32_t *cell = cells + ((h * scms->width + row_column(hash, h, scms->width)) << scms->cell_shift);
+    refresh_cell(scms, cell);
+    if (cell[pane] < INT32_MAX) {
+      cell[pane]++;
+    }
+  }
+
+  vector_return(scms->cells, 0, cells);
+}
+
+int scms_count_min(struct SlidingCMS *scms, void *key) {
+  const uint32_t hash = key_hash(key, scms->key_size);
+  uint32_t *cells     = scms_cells(scms);
+
+  uint32_t min_val = INT32_MAX;
+  for (uint32_t h = 0; h < scms->height; h++) {
+    const uint32_t *cell = cells + ((h * scms->width + row_column(hash, h, scms->width)) << scms->cell_shift);
+    const uint32_t live  = live_panes(scms, cell[scms->cell_lanes - 1]);
+
+    uint32_t sum = 0;
+    for (uint32_t pane = 0; pane < scms->num_panes; pane++) {
+      if (live & (1u << pane)) {
+        sum = MIN(sum + cell[pane], (uint32_t)INT32_MAX);
+      }
+    }
+    min_val = MIN(min_val, sum);
+  }
+
+  vector_return(scms->cells, 0, cells);
+  return min_val;
+}
+
+void scms_increment_vec(struct SlidingCMS *scms, void *keys) {
+  const __m512i hash  = key_hash_vec(keys, scms->key_size);
+  const __m512i panes = _mm512_set1_epi32(scms->tag & SCMS_PANE_MASK);
+  const __m512i max   = _mm512_set1_epi32(INT32_MAX);
+  const __m512i one   = _mm512_set1_epi32(1);
+  uint32_t *cells     = scms_cells(scms);
+
+  for (uint32_t h = 0; h < scms->height; h++) {
+    const __m512i offsets = cell_offsets_vec(scms, hash, h);
+
+    // Cells already incremented in this rotation are the common case, the others are refreshed one by one.
+    const __m512i tags = _mm512_i32gather_epi32(_mm512_add_epi32(offsets, _mm512_set1_epi32(scms->cell_lanes - 1)), cells, sizeof(uint32_t));
+    __mmask16 stale    = _mm512_cmpneq_epi32_mask(tags, _mm512_set1_epi32(scms->tag));
+    if (stale) {
+      alignas(64) uint32_t lane_offsets[CMS_VECTOR_SIZE];
+      _mm512_store_si512(lane_offsets, offsets);
+      for (; stale; stale &= stale - 1) {
+        refresh_cell(scms, cells + lane_offsets[__builtin_ctz(stale)]);
+      }
+    }
+
+    const __m512i counters  = _mm512_add_epi32(offsets, panes);
+    const __m512i conflicts = _mm512_conflict_epi32(offsets);
+    __mmask16 pending       = 0xffff;
+    while (pending) {
+      const __mmask16 ready = _mm512_mask_testn_epi32_mask(pending, conflicts, _mm512_set1_epi32(pending));
+      const __m512i values  = _mm512_mask_i32gather_epi32(_mm512_setzero_si512(), ready, counters, cells, sizeof(uint32_t));
+      _mm512_mask_i32scatter_epi32(cells, _mm512_mask_cmplt_epu32_mask(ready, values, max), counters, _mm512_add_epi32(values, one), sizeof(uint32_t));
+      pending &= ~ready;
+    }
+  }
+
+  vector_return(scms->cells, 0, cells);
+}
+
+void scms_count_min_vec(struct SlidingCMS *scms, void *keys, int *counts_out) {
+  const __m512i hash = key_hash_vec(keys, scms->key_size);
+  const __m512i max  = _mm512_set1_epi32(INT32_MAX);
+  uint32_t *cells    = scms_cells(scms);
+
+  __m512i estimates = max;
+  for (uint32_t h = 0; h < scms->height; h++) {
+    const __m512i offsets = cell_offsets_vec(scms, hash, h);
+    const __m512i tags    = _mm512_i32gather_epi32(_mm512_add_epi32(offsets, _mm512_set1_epi32(scms->cell_lanes - 1)), cells, sizeof(uint32_t));
+    const __m512i live    = live_panes_vec(scms, tags);
+
+    // The counts are at most INT32_MAX, so adding one to a sum capped to INT32_MAX cannot overflow.
+    __m512i sum = _mm512_setzero_si512();
+    for (uint32_t pane = 0; pane < scms->num_panes; pane++) {
+      const __mmask16 lanes = _mm512_test_epi32_mask(live, _mm512_set1_epi32(1u << pane));
+      const __m512i counts  = _mm512_mask_i32gather_epi32(_mm512_setzero_si512(), lanes, _mm512_add_epi32(offsets, _mm512_set1_epi32(pane)), cells, sizeof(uint32_t));
+      sum                   = _mm512_min_epu32(_mm512_add_epi32(sum, counts), max);
+    }
+    estimates = _mm512_min_epu32(estimates, sum);
+  }
+
+  vector_return(scms->cells, 0, cells);
+  _mm512_storeu_si512(counts_out, estimates);
+}
+
+int scms_advance(struct SlidingCMS *scms, time_ns_t now) {
+  if (scms->newest_start == 0) {
+    scms->newest_start = now;
+    return 0;
+  }
+
+  uint32_t dropped = 0;
+  while (now - scms->newest_start >= scms->pane_interval && dropped < scms->num_panes) {
+    uint32_t pane = (scms->tag & SCMS_PANE_MASK) + 1;
+    if (pane == scms->num_panes) {
+      pane = 0;
+    }
+    scms->tag           = (((scms->tag >> SCMS_PANE_BITS) + 1) << SCMS_PANE_BITS) | pane;
+    scms->newest_start += scms->pane_interval;
+    dropped++;
+  }
+
+  // Idle for more than a whole window: all the panes were dropped, start over from now.
+  if (now - scms->newest_start >= scms->pane_interval) {
+    scms->newest_start = now;
+  }
+
+  return dropped;
+}
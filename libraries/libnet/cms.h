@@ -8,8 +8,72 @@
 #include "time.h"
 
 struct CMS;
+struct SlidingCMS;
+struct PerCoreCMS;
 
+// Number of keys processed at once by the vectorized operations.
+#define CMS_VECTOR_SIZE 16
+
+enum cms_counter {
+  // 8B counters, the default.
+  CMS_COUNTER_64,
+  // Saturating counters: they stop at their maximum value (INT32_MAX for the 32 bit ones, so that counts fit the int returned by
+  // cms_count_min) instead of wrapping around.
+  CMS_COUNTER_32,
+  CMS_COUNTER_16,
+  CMS_COUNTER_8,
+};
+
+// Increment only the counters of the key that hold its current estimate (conservative update), instead of all of them. Estimates are closer
+// to the exact counts, for the same memory.
+#define CMS_CONSERVATIVE_UPDATE (1 << 0)
+// Clear all the counters at once in cms_periodic_cleanup. By default, the cleanup only starts a new epoch: each 64B block of counters is
+// tagged with the epoch it was last reset in, and stale blocks are reset when they are first touched.
+#define CMS_EAGER_RESET (1 << 1)
+
+// The width is rounded up to a power of two, and to at least a cache line worth of counters.
 int cms_allocate(uint32_t height, uint32_t width, uint32_t key_size, time_ns_t periodic_cleanup_interval, struct CMS **cms_out);
+// Same as cms_allocate, with counters of the given size, and a combination of the CMS_* flags above.
+int cms_allocate_counters(uint32_t height, uint32_t width, uint32_t key_size, enum cms_counter counter, int flags, time_ns_t periodic_cleanup_interval,
+                          struct CMS **cms_out);
 void cms_increment(struct CMS *cms, void *key);
 int cms_count_min(struct CMS *cms, void *key);
+// Same as cms_increment, for CMS_VECTOR_SIZE keys laid out one after the other.
+void cms_increment_vec(struct CMS *cms, void *keys);
+// Same as cms_count_min, for CMS_VECTOR_SIZE keys laid out one after the other.
+void cms_count_min_vec(struct CMS *cms, void *keys, int *counts_out);
 int cms_periodic_cleanup(struct CMS *cms, time_ns_t now);
+// Adds the counts of src to the ones of dst. Both sketches need the same dimensions, key size and counters; returns 0 otherwise. Narrow counters
+// saturate.
+int cms_merge(struct CMS *dst, struct CMS *src);
+
+// One CMS per core, so that cores count without sharing any counter, and a control thread to add them up. Each core has two sketches: it
+// increments one of them while pcms_merge adds the other one to the global sketch. pcms_merge swaps the sketches of all the cores, waits for
+// every core to be done with the previous ones, merges them into dst and resets them. The counts of dst keep growing until it is cleaned up.
+//
+// pcms_merge only knows a core is done with a sketch once it goes through its next operation: cores with no traffic have to call pcms_poll.
+int pcms_allocate(uint32_t num_cores, uint32_t height, uint32_t width, uint32_t key_size, enum cms_counter counter, int flags,
+                  struct PerCoreCMS **pcms_out);
+void pcms_increment(struct PerCoreCMS *pcms, int core, void *key);
+void pcms_increment_vec(struct PerCoreCMS *pcms, int core, void *keys);
+void pcms_poll(struct PerCoreCMS *pcms, int core);
+// Called by the control thread only. Returns 0 if dst does not match the per-core sketches.
+int pcms_merge(struct PerCoreCMS *pcms, struct CMS *dst);
+
+// Maximum number of panes of a SlidingCMS.
+#define SCMS_MAX_PANES 15
+
+// Count-min sketch over a sliding time window, split in num_panes panes covering window / num_panes each. Increments count in the newest
+// pane, and queries add up the counts of all the panes. Once the newest pane has covered its share of the window, scms_advance drops the
+// oldest pane and starts a new one: queries cover the last window, minus up to window / num_panes.
+//
+// Each counter of the sketch is a cell holding its 32 bit saturating count in every pane, so that a query reads a single cache line per
+// row. Cells are sized to a power of two, making 3, 7 and 15 panes the most compact choices. The counts of the dropped panes are reset lazily,
+// when their cell is first incremented.
+int scms_allocate(uint32_t height, uint32_t width, uint32_t key_size, uint32_t num_panes, time_ns_t window, struct SlidingCMS **scms_out);
+void scms_increment(struct SlidingCMS *scms, void *key);
+int scms_count_min(struct SlidingCMS *scms, void *key);
+void scms_increment_vec(struct SlidingCMS *scms, void *keys);
+void scms_count_min_vec(struct SlidingCMS *scms, void *keys, int *counts_out);
+// Returns the number of panes that were dropped.
+int scms_advance(struct SlidingCMS *scms, time_ns_t now);
@@ -0,0 +1,315 @@
+#include "cuckoo-filter.h"
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <assert.h>
+#include <string.h>
+#include <immintrin.h>
+
+#include "vector.h"
+#include "compute.h"
+#include "sketch-hash.h"
+
+struct CuckooFilter {
+  // One 64 bit word per bucket, holding CF_BUCKET_SLOTS fingerprints of 16 bits. An empty slot is a zero fingerprint.
+  struct Vector *buckets;
+
+  uint32_t num_buckets;
+  uint32_t key_size;
+  uint32_t size;
+  // State of the xorshift picking the fingerprints to relocate.
+  uint32_t kick_state;
+
+  // Fingerprint that could not be placed when the filter ran out of room, kept aside until a deletion frees a slot. It belongs in victim_bucket.
+  bool has_victim;
+  uint16_t victim_fingerprint;
+  uint32_t victim_bucket;
+};
+
+#define CF_INDEX_SALT 0x3c6ef372
+#define CF_FINGERPRINT_SALT 0xa54ff53a
+#define CF_ALT_SALT 0x510e527f
+
+#define CF_SLOT_BITS 16
+#define CF_LOW_BITS 0x0001000100010001ull
+#define CF_HIGH_BITS 0x8000800080008000ull
+
+namespace {
+
+struct cf_key {
+  uint16_t fingerprint;
+  uint32_t bucket1;
+  uint32_t bucket2;
+};
+
+// A relocation done by an insertion, so that it can be undone.
+struct cf_kick {
+  uint32_t bucket;
+  uint32_t slot;
+  uint16_t kicked;
+};
+
+// Fingerprints are never zero, which marks the empty slots.
+inline uint16_t key_fingerprint(uint32_t hash) {
+  const uint16_t fingerprint = fmix32(hash ^ CF_FINGERPRINT_SALT) >> CF_SLOT_BITS;
+  return fingerprint ? fingerprint : 1;
+}
+
+// The other bucket of a fingerprint only depends on the fingerprint and the current bucket, so that it can be relocated without its key. The
+// number of buckets is a power of two, and alt_bucket(alt_bucket(b)) == b.
+inline uint32_t alt_bucket(uint32_t bucket, uint16_t fingerprint, uint32_t num_buckets) {
+  return bucket ^ (fmix32(fingerprint ^ CF_ALT_SALT) & (num_buckets - 1));
+}
+
+inline struct cf_key key_locate(struct CuckooFilter *cf, void *key) {
+  const uint32_t hash = key_hash(key, cf->key_size);
+
+  struct cf_key located;
+  located.fingerprint = key_fingerprint(hash);
+  located.bucket1     = fmix32(hash ^ CF_INDEX_SALT) & (cf->num_buckets - 1);
+  located.bucket2     = alt_bucket(located.bucket1, located.fingerprint, cf->num_buckets);
+  return located;
+}
+
+inline uint64_t *get_bucket(struct CuckooFilter *cf, uint32_t bucket) {
+  uint64_t *word = 0;
+  vector_borrow(cf->buckets, bucket, (void **)&word);
+  return word;
+}
+
+inline uint16_t get_slot(uint64_t word, uint32_t slot) { return word >> (slot * CF_SLOT_BITS); }
+
+inline uint64_t set_slot(uint64_t word, uint32_t slot, uint16_t fingerprint) {
+  const uint32_t shift = slot * CF_SLOT_BITS;
+  return (word & ~(0xffffull << shift)) | ((uint64_t)fingerprint << shift);
+}
+
+// Whether any 16 bit slot of the word is zero. The carries may flag the wrong slot, but never a word without a zero slot.
+inline bool has_zero_slot(uint64_t word) { return ((word - CF_LOW_BITS) & ~word & CF_HIGH_BITS) != 0; }
+
+inline bool bucket_contains(uint64_t word, uint16_t fingerprint) { return has_zero_slot(word ^ (fingerprint * CF_LOW_BITS)); }
+
+inline __mmask8 bucket_contains_vec(__m512i words, __m512i fingerprints) {
+  const __m512i diff  = _mm512_xor_si512(words, fingerprints);
+  const __m512i zeros = _mm512_and_si512(_mm512_sub_epi64(diff, _mm512_set1_epi64(CF_LOW_BITS)), _mm512_andnot_si512(diff, _mm512_set1_epi64(CF_HIGH_BITS)));
+  return _mm512_test_epi64_mask(zeros, zeros);
+}
+
+// Puts the fingerprint in a free slot of the bucket.
+bool bucket_insert(struct CuckooFilter *cf, uint32_t bucket, uint16_t fingerprint) {
+  uint64_t *word = get_bucket(cf, bucket);
+  for (uint32_t slot = 0; slot < CF_BUCKET_SLOTS; slot++) {
+    if (get_slot(*word, slot) == 0) {
+      *word = set_slot(*word, slot, fingerprint);
+      return true;
+    }
+  }
+  return false;
+}
+
+inline uint32_t bucket_count(struct CuckooFilter *cf, uint32_t bucket, uint16_t fingerprint) {
+  const uint64_t word = *get_bucket(cf, bucket);
+  uint32_t count      = 0;
+  for (uint32_t slot = 0; slot < CF_BUCKET_SLOTS; slot++) {
+    count += get_slot(word, slot) == fingerprint;
+  }
+  return count;
+}
+
+inline bool is_victim(struct CuckooFilter *cf, const struct cf_key &located) {
+  return cf->has_victim && cf->victim_fingerprint == located.fingerprint &&
+         (cf->victim_bucket == located.bucket1 || cf->victim_bucket == located.bucket2);
+}
+
+// Copies of the fingerprint of the key in its buckets, and aside.
+uint32_t count_copies(struct CuckooFilter *cf, const struct cf_key &located) {
+  uint32_t count = bucket_count(cf, located.bucket1, located.fingerprint) + is_victim(cf, located);
+  if (located.bucket2 != located.bucket1) {
+    count += bucket_count(cf, located.bucket2, located.fingerprint);
+  }
+  return count;
+}
+
+// Removes one copy of the fingerprint from the bucket.
+bool bucket_delete(struct CuckooFilter *cf, uint32_t bucket, uint16_t fingerprint) {
+  uint64_t *word = get_bucket(cf, bucket);
+  for (uint32_t slot = 0; slot < CF_BUCKET_SLOTS; slot++) {
+    if (get_slot(*word, slot) == fingerprint) {
+      *word = set_slot(*word, slot, 0);
+      return true;
+    }
+  }
+  return false;
+}
+
+inline uint32_t next_kick(struct CuckooFilter *cf) {
+  uint32_t x = cf->kick_state;
+
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+
+  cf->kick_state = x;
+  return x;
+}
+
+// Places the fingerprint in one of its buckets, relocating the fingerprints in the way. When they cannot all be placed, the last one is kept
+// aside as the victim. If there already is one, the relocations are undone instead, newest first, and false is returned.
+bool place(struct CuckooFilter *cf, uint32_t bucket, uint16_t fingerprint) {
+  struct cf_kick kicks[CF_MAX_KICKS];
+
+  for (uint32_t kick = 0; kick < CF_MAX_KICKS; kick++) {
+    const uint32_t slot   = next_kick(cf) % CF_BUCKET_SLOTS;
+    uint64_t *word        = get_bucket(cf, bucket);
+    const uint16_t kicked = get_slot(*word, slot);
+    *word                 = set_slot(*word, slot, fingerprint);
+    kicks[kick]           = {bucket, slot, kicked};
+
+    fingerprint = kicked;
+    bucket      = alt_bucket(bucket, fingerprint, cf->num_buckets);
+    if (bucket_insert(cf, bucket, fingerprint)) {
+      return true;
+    }
+  }
+
+  if (!cf->has_victim) {
+    cf->has_victim         = true;
+    cf->victim_fingerprint = fingerprint;
+    cf->victim_bucket      = bucket;
+    return true;
+  }
+
+  for (uint32_t kick = CF_MAX_KICKS; kick-- > 0;) {
+    uint64_t *word = get_bucket(cf, kicks[kick].bucket);
+    *word          = set_slot(*word, kicks[kick].slot, kicks[kick].kicked);
+  }
+  return false;
+}
+
+} // namespace
+
+int cf_allocate(uint32_t capacity, uint32_t key_size, struct CuckooFilter **cf_out) {
+  assert(capacity > 0);
+
+  struct CuckooFilter *cf_alloc = (struct CuckooFilter *)malloc(sizeof(struct CuckooFilter));
+  if (cf_alloc == NULL) {
+    return 0;
+  }
+
+  (*cf_out) = cf_alloc;
+
+  // At least two buckets, so that the two buckets of a key can differ.
+  uint32_t num_buckets = (capacity + CF_BUCKET_SLOTS - 1) / CF_BUCKET_SLOTS;
+  if (num_buckets < 2) {
+    num_buckets = 2;
+  } else if (!is_power_of_two(num_buckets)) {
+    num_buckets = ensure_power_of_two(num_buckets);
+  }
+
+  (*cf_out)->num_buckets = num_buckets;
+  (*cf_out)->key_size    = key_size;
+  (*cf_out)->size        = 0;
+  (*cf_out)->kick_state  = 0x9e3779b9;
+
+  (*cf_out)->has_victim         = false;
+  (*cf_out)->victim_fingerprint = 0;
+  (*cf_out)->victim_bucket      = 0;
+
+  (*cf_out)->buckets = NULL;
+  if (vector_allocate(sizeof(uint64_t), num_buckets, &((*cf_out)->buckets)) == 0) {
+    return 0;
+  }
+
+  return 1;
+}
+
+int cf_insert(struct CuckooFilter *cf, void *key) {
+  const struct cf_key located = key_locate(cf, key);
+
+  // Copies of a single fingerprint can only move between its two buckets, relocating them could never make room.
+  if (count_copies(cf, located) >= CF_MAX_COPIES) {
+    return 0;
+  }
+
+  if (!bucket_insert(cf, located.bucket1, located.fingerprint) && !bucket_insert(cf, located.bucket2, located.fingerprint) &&
+      !place(cf, (next_kick(cf) & 1) ? located.bucket2 : located.bucket1, located.fingerprint)) {
+    return 0;
+  }
+
+  cf->size++;
+  return 1;
+}
+
+int cf_query(struct CuckooFilter *cf, void *key) {
+  const struct cf_key located = key_locate(cf, key);
+  if (bucket_contains(*get_bucket(cf, located.bucket1), located.fingerprint) || bucket_contains(*get_bucket(cf, located.bucket2), located.fingerprint)) {
+    return 1;
+  }
+  return is_victim(cf, located);
+}
+
+int cf_delete(struct CuckooFilter *cf, void *key) {
+  const struct cf_key located = key_locate(cf, key);
+
+  if (is_victim(cf, located)) {
+    cf->has_victim = false;
+    cf->size--;
+    return 1;
+  }
+
+  if (!bucket_delete(cf, located.bucket1, located.fingerprint) && !bucket_delete(cf, located.bucket2, located.fingerprint)) {
+    return 0;
+  }
+  cf->size--;
+
+  // A slot was freed, the victim may fit again.
+  if (cf->has_victim) {
+    const uint32_t other = alt_bucket(cf->victim_bucket, cf->victim_fingerprint, cf->num_buckets);
+    if (bucket_insert(cf, cf->victim_bucket, cf->victim_fingerprint) || bucket_insert(cf, other, cf->victim_fingerprint)) {
+      cf->has_victim = false;
+    }
+  }
+  return 1;
+}
+
+// Both buckets of 8 keys are gathered at a time, with the fingerprint of each key repeated in every slot of a 64 bit lane.
+uint16_t cf_query_vec(struct CuckooFilter *cf, void *keys) {
+  static_assert(CF_VECTOR_SIZE == SKETCH_HASH_LANES, "one key per hash lane");
+
+  const __m512i mask = _mm512_set1_epi32(cf->num_buckets - 1);
+  const __m512i hash = key_hash_vec(keys, cf->key_size);
+
+  __m512i fingerprints  = _mm512_srli_epi32(fmix32_vec(_mm512_xor_si512(hash, _mm512_set1_epi32(CF_FINGERPRINT_SALT))), CF_SLOT_BITS);
+  fingerprints          = _mm512_max_epu32(fingerprints, _mm512_set1_epi32(1));
+  const __m512i bucket1 = _mm512_and_si512(fmix32_vec(_mm512_xor_si512(hash, _mm512_set1_epi32(CF_INDEX_SALT))), mask);
+  const __m512i bucket2 =
+      _mm512_xor_si512(bucket1, _mm512_and_si512(fmix32_vec(_mm512_xor_si512(fingerprints, _mm512_set1_epi32(CF_ALT_SALT))), mask));
+
+  void *buckets;
+  vector_borrow(cf->buckets, 0, &buckets);
+  uint16_t present = 0;
+  for (int half = 0; half < 2; half++) {
+    const __m256i half_fingerprints = half ? _mm512_extracti64x4_epi64(fingerprints, 1) : _mm512_castsi512_si256(fingerprints);
+    const __m256i half_bucket1      = half ? _mm512_extracti64x4_epi64(bucket1, 1) : _mm512_castsi512_si256(bucket1);
+    const __m256i half_bucket2      = half ? _mm512_extracti64x4_epi64(bucket2, 1) : _mm512_castsi512_si256(bucket2);
+
+    const __m512i repeated = _mm512_mullo_epi64(_mm512_cvtepu32_epi64(half_fingerprints), _mm512_set1_epi64(CF_LOW_BITS));
+    const __m512i words1   = _mm512_i32gather_epi64(half_bucket1, buckets, sizeof(uint64_t));
+    const __m512i words2   = _mm512_i32gather_epi64(half_bucket2, buckets, sizeof(uint64_t));
+    const __mmask8 found   = bucket_contains_vec(words1, repeated) | bucket_contains_vec(words2, repeated);
+
+    present |= (uint16_t)found << (half * 8);
+  }
+  vector_return(cf->buckets, 0, buckets);
+
+  if (cf->has_victim) {
+    const __m512i victim_fingerprint = _mm512_set1_epi32(cf->victim_fingerprint);
+    const __m512i victim_bucket      = _mm512_set1_epi32(cf->victim_bucket);
+    const __mmask16 in_buckets       = _mm512_cmpeq_epi32_mask(bucket1, victim_bucket) | _mm512_cmpeq_epi32_mask(bucket2, victim_bucket);
+    present                         |= _mm512_mask_cmpeq_epi32_mask(in_buckets, fingerprints, victim_fingerprint);
+  }
+
+  return present;
+}
+
+uint32_t cf_get_size(struct CuckooFilter *cf) { return cf->size; }
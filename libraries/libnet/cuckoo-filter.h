@@ -0,0 +1,38 @@
+#pragma once
+
+#include <stdint.h>
+
+struct CuckooFilter;
+
+// Number of fingerprints of a bucket.
+#define CF_BUCKET_SLOTS 4
+// Number of keys processed at once by cf_query_vec.
+#define CF_VECTOR_SIZE 16
+// Number of fingerprints an insertion may relocate before the filter is considered full.
+#define CF_MAX_KICKS 500
+// Number of copies of a fingerprint the two buckets of a key may hold.
+#define CF_MAX_COPIES CF_BUCKET_SLOTS
+
+// Approximate set membership like BloomFilter, with deletions. Keys are stored as 16 bit fingerprints, in one of two candidate buckets of
+// CF_BUCKET_SLOTS slots, each bucket a 64 bit word. A query reads both buckets, and errs with a probability of about 8 / 2^16 at full load,
+// plus n / 2^32 for n keys, as the keys are hashed to 32 bits first.
+//
+// The number of buckets is a power of two, large enough for capacity keys. Insertions relocate fingerprints to make room, and start failing
+// around 95% load.
+int cf_allocate(uint32_t capacity, uint32_t key_size, struct CuckooFilter **cf_out);
+// Adds one copy of the key. Unlike bf_set, inserting is not idempotent: a key inserted twice is held twice, and must be deleted twice. Callers
+// that see the same key repeatedly (e.g. once per packet of a flow) should cf_query it first.
+//
+// Returns 0, with the filter left unchanged, when the buckets of the key already hold CF_MAX_COPIES copies of its fingerprint, or when the
+// filter is full. The first time the filter runs out of room, the last fingerprint that could not be placed is kept aside instead, and the
+// insertion succeeds. From then on, an insertion that cannot place its fingerprint, even by relocating others, undoes its relocations and
+// fails, until a deletion makes room for the fingerprint kept aside.
+int cf_insert(struct CuckooFilter *cf, void *key);
+int cf_query(struct CuckooFilter *cf, void *key);
+// Removes one copy of the key, returns 0 if it was not found. Only inserted keys may be deleted: another key with the same fingerprint and
+// buckets would be removed in their place.
+int cf_delete(struct CuckooFilter *cf, void *key);
+// Same as cf_query, for CF_VECTOR_SIZE keys laid out one after the other. Bit i of the result is set when key i may be in the filter.
+uint16_t cf_query_vec(struct CuckooFilter *cf, void *keys);
+// Number of keys in the filter.
+uint32_t cf_get_size(struct CuckooFilter *cf);
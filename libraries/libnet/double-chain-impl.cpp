@@ -2,37 +2,37 @@
 
 enum DCHAIN_ENUM { ALLOC_LIST_HEAD = 0, FREE_LIST_HEAD = 1, INDEX_SHIFT = DCHAIN_RESERVED };
 
-void dchain_impl_init(struct dchain_cell *cells, int size) {
-  struct dchain_cell *al_head = cells + ALLOC_LIST_HEAD;
-  al_head->prev               = 0;
-  al_head->next               = 0;
-  int i                       = INDEX_SHIFT;
+template <typename cell_t> void dchain_impl_init(cell_t *cells, int size) {
+  cell_t *al_head = cells + ALLOC_LIST_HEAD;
+  al_head->prev   = 0;
+  al_head->next   = 0;
+  int i           = INDEX_SHIFT;
 
-  struct dchain_cell *fl_head = cells + FREE_LIST_HEAD;
-  fl_head->next               = i;
-  fl_head->prev               = fl_head->next;
+  cell_t *fl_head = cells + FREE_LIST_HEAD;
+  fl_head->next   = i;
+  fl_head->prev   = fl_head->next;
 
   while (i < (size + INDEX_SHIFT - 1)) {
-    struct dchain_cell *current = cells + i;
-    current->next               = i + 1;
-    current->prev               = current->next;
+    cell_t *current = cells + i;
+    current->next   = i + 1;
+    current->prev   = current->next;
     ++i;
   }
 
-  struct dchain_cell *last = cells + i;
-  last->next               = FREE_LIST_HEAD;
-  last->prev               = last->next;
+  cell_t *last = cells + i;
+  last->next   = FREE_LIST_HEAD;
+  last->prev   = last->next;
 }
 
-int dchain_impl_allocate_new_index(struct dchain_cell *cells, int *index) {
-  struct dchain_cell *fl_head = cells + FREE_LIST_HEAD;
-  struct dchain_cell *al_head = cells + ALLOC_LIST_HEAD;
-  int allocated               = fl_head->next;
+template <typename cell_t> int dchain_impl_allocate_new_index(cell_t *cells, int *index) {
+  cell_t *fl_head = cells + FREE_LIST_HEAD;
+  cell_t *al_head = cells + ALLOC_LIST_HEAD;
+  int allocated   = fl_head->next;
   if (allocated == FREE_LIST_HEAD) {
     return 0;
   }
 
-  struct dchain_cell *allocp = cells + allocated;
+  cell_t *allocp = cells + allocated;
   // Extract the link from the "empty" chain.
   fl_head->next = allocp->next;
   fl_head->prev = fl_head->next;
@@ -41,20 +41,53 @@ int dchain_impl_allocate_new_index(struct dchain_cell *cells, int *index) {
   allocp->next = ALLOC_LIST_HEAD;
   allocp->prev = al_head->prev;
 
-  struct dchain_cell *alloc_head_prevp = cells + al_head->prev;
-  alloc_head_prevp->next               = allocated;
-  al_head->prev                        = allocated;
+  cell_t *alloc_head_prevp = cells + al_head->prev;
+  alloc_head_prevp->next   = allocated;
+  al_head->prev            = allocated;
 
   *index = allocated - INDEX_SHIFT;
   return 1;
 }
 
-int dchain_impl_free_index(struct dchain_cell *cells, int index) {
+template <typename cell_t> int dchain_impl_allocate_n(cell_t *cells, int n, int *indexes) {
+  cell_t *fl_head = cells + FREE_LIST_HEAD;
+  cell_t *al_head = cells + ALLOC_LIST_HEAD;
+
+  // Pop a run of cells from the "free" chain, linking them to each other as
+  // they go, and splice the whole run at the "new"-end of the "alloc" chain.
+  int last      = al_head->prev;
+  int allocated = 0;
+  int next_free = fl_head->next;
+  while (allocated < n && next_free != FREE_LIST_HEAD) {
+    cell_t *allocp = cells + next_free;
+    int current    = next_free;
+    next_free      = allocp->next;
+
+    allocp->prev         = last;
+    cells[last].next     = current;
+    last                 = current;
+    indexes[allocated++] = current - INDEX_SHIFT;
+  }
+
+  if (allocated == 0) {
+    return 0;
+  }
+
+  fl_head->next = next_free;
+  fl_head->prev = fl_head->next;
+
+  cells[last].next = ALLOC_LIST_HEAD;
+  al_head->prev    = last;
+
+  return allocated;
+}
+
+template <typename cell_t> int dchain_impl_free_index(cell_t *cells, int index) {
   int freed = index + INDEX_SHIFT;
 
-  struct dchain_cell *freedp = cells + freed;
-  int freed_prev             = freedp->prev;
-  int freed_next             = freedp->next;
+  cell_t *freedp = cells + freed;
+  int freed_prev = freedp->prev;
+  int freed_next = freedp->next;
 
   // The index is already free.
   if (freed_next == freed_prev) {
@@ -63,14 +96,14 @@ int dchain_impl_free_index(struct dchain_cell *cells, int index) {
     }
   }
 
-  struct dchain_cell *fr_head = cells + FREE_LIST_HEAD;
+  cell_t *fr_head = cells + FREE_LIST_HEAD;
 
   // Extract the link from the "alloc" chain.
-  struct dchain_cell *freed_prevp = cells + freed_prev;
-  freed_prevp->next               = freed_next;
+  cell_t *freed_prevp = cells + freed_prev;
+  freed_prevp->next   = freed_next;
 
-  struct dchain_cell *freed_nextp = cells + freed_next;
-  freed_nextp->prev               = freed_prev;
+  cell_t *freed_nextp = cells + freed_next;
+  freed_nextp->prev   = freed_prev;
 
   // Add the link to the "free" chain.
   freedp->next = fr_head->next;
@@ -82,8 +115,42 @@ int dchain_impl_free_index(struct dchain_cell *cells, int index) {
   return 1;
 }
 
-int dchain_impl_get_oldest_index(struct dchain_cell *cells, int *index) {
-  struct dchain_cell *al_head = cells + ALLOC_LIST_HEAD;
+template <typename cell_t> int dchain_impl_free_n(cell_t *cells, const int *indexes, int n) {
+  cell_t *fr_head = cells + FREE_LIST_HEAD;
+
+  // Same as dchain_impl_free_index, with the head of the "free" chain kept
+  // aside until every index is pushed.
+  int free_head = fr_head->next;
+  int freed_n   = 0;
+  for (int i = 0; i < n; i++) {
+    int freed = indexes[i] + INDEX_SHIFT;
+
+    cell_t *freedp = cells + freed;
+    int freed_prev = freedp->prev;
+    int freed_next = freedp->next;
+
+    // The index is already free.
+    if (freed_next == freed_prev && freed_prev != ALLOC_LIST_HEAD) {
+      continue;
+    }
+
+    cells[freed_prev].next = freed_next;
+    cells[freed_next].prev = freed_prev;
+
+    freedp->next = free_head;
+    freedp->prev = freedp->next;
+    free_head    = freed;
+    freed_n++;
+  }
+
+  fr_head->next = free_head;
+  fr_head->prev = fr_head->next;
+
+  return freed_n;
+}
+
+template <typename cell_t> int dchain_impl_get_oldest_index(cell_t *cells, int *index) {
+  cell_t *al_head = cells + ALLOC_LIST_HEAD;
   // No allocated indexes.
   if (al_head->next == ALLOC_LIST_HEAD) {
     return 0;
@@ -93,12 +160,12 @@ int dchain_impl_get_oldest_index(struct dchain_cell *cells, int *index) {
   return 1;
 }
 
-int dchain_impl_rejuvenate_index(struct dchain_cell *cells, int index) {
+template <typename cell_t> int dchain_impl_rejuvenate_index(cell_t *cells, int index) {
   int lifted = index + INDEX_SHIFT;
 
-  struct dchain_cell *liftedp = cells + lifted;
-  int lifted_next             = liftedp->next;
-  int lifted_prev             = liftedp->prev;
+  cell_t *liftedp = cells + lifted;
+  int lifted_next = liftedp->next;
+  int lifted_prev = liftedp->prev;
 
   // The index is not allocated.
   if (lifted_next == lifted_prev) {
@@ -111,32 +178,37 @@ int dchain_impl_rejuvenate_index(struct dchain_cell *cells, int index) {
     }
   }
 
-  struct dchain_cell *lifted_prevp = cells + lifted_prev;
-  lifted_prevp->next               = lifted_next;
+  // Already the most recent one.
+  if (lifted_next == ALLOC_LIST_HEAD) {
+    return 1;
+  }
+
+  cell_t *lifted_prevp = cells + lifted_prev;
+  lifted_prevp->next   = lifted_next;
 
-  struct dchain_cell *lifted_nextp = cells + lifted_next;
-  lifted_nextp->prev               = lifted_prev;
+  cell_t *lifted_nextp = cells + lifted_next;
+  lifted_nextp->prev   = lifted_prev;
 
-  struct dchain_cell *al_head = cells + ALLOC_LIST_HEAD;
-  int al_head_prev            = al_head->prev;
+  cell_t *al_head  = cells + ALLOC_LIST_HEAD;
+  int al_head_prev = al_head->prev;
 
   // Link it at the very end - right before the special link.
   liftedp->next = ALLOC_LIST_HEAD;
   liftedp->prev = al_head_prev;
 
-  struct dchain_cell *al_head_prevp = cells + al_head_prev;
-  al_head_prevp->next               = lifted;
-  al_head->prev                     = lifted;
+  cell_t *al_head_prevp = cells + al_head_prev;
+  al_head_prevp->next   = lifted;
+  al_head->prev         = lifted;
 
   return 1;
 }
 
-int dchain_impl_is_index_allocated(struct dchain_cell *cells, int index) {
+template <typename cell_t> int dchain_impl_is_index_allocated(cell_t *cells, int index) {
   int lifted = index + INDEX_SHIFT;
 
-  struct dchain_cell *liftedp = cells + lifted;
-  int lifted_next             = liftedp->next;
-  int lifted_prev             = liftedp->prev;
+  cell_t *liftedp = cells + lifted;
+  int lifted_next = liftedp->next;
+  int lifted_prev = liftedp->prev;
 
   if (lifted_next == lifted_prev) {
     if (lifted_next != ALLOC_LIST_HEAD) {
@@ -148,3 +220,17 @@ int dchain_impl_is_index_allocated(struct dchain_cell *cells, int index) {
     return 1;
   }
 }
+
+#define DCHAIN_IMPL_INSTANTIATE(cell_t)                                                                                                                                  \
+  template void dchain_impl_init<cell_t>(cell_t * cells, int index_range);                                                                                               \
+  template int dchain_impl_allocate_new_index<cell_t>(cell_t * cells, int *index);                                                                                       \
+  template int dchain_impl_allocate_n<cell_t>(cell_t * cells, int n, int *indexes);                                                                                      \
+  template int dchain_impl_free_index<cell_t>(cell_t * cells, int index);                                                                                                \
+  template int dchain_impl_free_n<cell_t>(cell_t * cells, const int *indexes, int n);                                                                                    \
+  template int dchain_impl_get_oldest_index<cell_t>(cell_t * cells, int *index);                                                                                         \
+  template int dchain_impl_rejuvenate_index<cell_t>(cell_t * cells, int index);                                                                                          \
+  template int dchain_impl_is_index_allocated<cell_t>(cell_t * cells, int index);
+
+DCHAIN_IMPL_INSTANTIATE(struct dchain_cell)
+DCHAIN_IMPL_INSTANTIATE(struct dchain_cell_compact)
+DCHAIN_IMPL_INSTANTIATE(struct dchain_cell_aos)
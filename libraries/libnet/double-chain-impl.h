@@ -1,10 +1,29 @@
 #pragma once
 
+#include <stdint.h>
+
+#include "time.h"
+
 struct dchain_cell {
   int prev;
   int next;
 };
 
+// Same as dchain_cell, for index ranges that fit in 16 bits (see
+// DCHAIN_COMPACT_LIMIT): half the footprint.
+struct dchain_cell_compact {
+  uint16_t prev;
+  uint16_t next;
+};
+
+// Same as dchain_cell, with the timestamp of the index stored along the links,
+// so that rejuvenation and expiry only touch one cache line per index.
+struct dchain_cell_aos {
+  int prev;
+  int next;
+  time_ns_t timestamp;
+};
+
 // Requires the array dchain_cell, large enough to fit all the range of
 // possible 'index' values + 2 special values.
 // Forms a two closed linked lists inside the array.
@@ -43,9 +62,13 @@ struct dchain_cell {
 
 #define DCHAIN_RESERVED (2)
 
-void dchain_impl_init(struct dchain_cell *cells, int index_range);
-int dchain_impl_allocate_new_index(struct dchain_cell *cells, int *index);
-int dchain_impl_free_index(struct dchain_cell *cells, int index);
-int dchain_impl_get_oldest_index(struct dchain_cell *cells, int *index);
-int dchain_impl_rejuvenate_index(struct dchain_cell *cells, int index);
-int dchain_impl_is_index_allocated(struct dchain_cell *cells, int index);
+// The operations below are instantiated for dchain_cell, dchain_cell_compact
+// and dchain_cell_aos.
+template <typename cell_t> void dchain_impl_init(cell_t *cells, int index_range);
+template <typename cell_t> int dchain_impl_allocate_new_index(cell_t *cells, int *index);
+template <typename cell_t> int dchain_impl_allocate_n(cell_t *cells, int n, int *indexes);
+template <typename cell_t> int dchain_impl_free_index(cell_t *cells, int index);
+template <typename cell_t> int dchain_impl_free_n(cell_t *cells, const int *indexes, int n);
+template <typename cell_t> int dchain_impl_get_oldest_index(cell_t *cells, int *index);
+template <typename cell_t> int dchain_impl_rejuvenate_index(cell_t *cells, int index);
+template <typename cell_t> int dchain_impl_is_index_allocated(cell_t *cells, int index);
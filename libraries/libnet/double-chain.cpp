@@ -2,69 +2,300 @@
 
 #include <stdlib.h>
 #include <stddef.h>
+#include <immintrin.h>
 
 #include "double-chain-impl.h"
+#include "snapshot.h"
 
 struct DoubleChain {
-  struct dchain_cell *cells;
+  void *cells;
   time_ns_t *timestamps;
+  // Distance between the timestamps of consecutive indexes, in time_ns_t units.
+  size_t timestamps_stride;
+  int index_range;
+  enum dchain_layout layout;
+  // Image the cells and timestamps are mapped from, NULL when they were allocated.
+  struct Snapshot *snapshot;
 };
 
-int dchain_allocate(int index_range, struct DoubleChain **chain_out) {
-  struct DoubleChain *old_chain_out = *chain_out;
-  struct DoubleChain *chain_alloc   = (struct DoubleChain *)malloc(sizeof(struct DoubleChain));
+namespace {
+
+size_t cell_size(enum dchain_layout layout) {
+  switch (layout) {
+  case DCHAIN_LAYOUT_COMPACT:
+    return sizeof(struct dchain_cell_compact);
+  case DCHAIN_LAYOUT_AOS:
+    return sizeof(struct dchain_cell_aos);
+  default:
+    return sizeof(struct dchain_cell);
+  }
+}
+
+// Calls fn with the cells, cast to the cell type of the layout.
+template <typename F> inline auto with_cells(struct DoubleChain *chain, F &&fn) {
+  switch (chain->layout) {
+  case DCHAIN_LAYOUT_COMPACT:
+    return fn((struct dchain_cell_compact *)chain->cells);
+  case DCHAIN_LAYOUT_AOS:
+    return fn((struct dchain_cell_aos *)chain->cells);
+  default:
+    return fn((struct dchain_cell *)chain->cells);
+  }
+}
+
+inline time_ns_t &timestamp_of(struct DoubleChain *chain, int index) { return chain->timestamps[(size_t)index * chain->timestamps_stride]; }
+
+// Point the timestamps at the cells themselves when they are stored inline.
+void bind_timestamps(struct DoubleChain *chain, time_ns_t *timestamps) {
+  if (chain->layout == DCHAIN_LAYOUT_AOS) {
+    struct dchain_cell_aos *cells = (struct dchain_cell_aos *)chain->cells;
+    chain->timestamps             = &cells[DCHAIN_RESERVED].timestamp;
+    chain->timestamps_stride      = sizeof(struct dchain_cell_aos) / sizeof(time_ns_t);
+  } else {
+    chain->timestamps        = timestamps;
+    chain->timestamps_stride = 1;
+  }
+}
+
+// Whether indexes[i] shows up again in indexes[i+1..n-1].
+inline bool occurs_after(const int *indexes, int i, int n) {
+  const __m512i needle = _mm512_set1_epi32(indexes[i]);
+
+  int j = i + 1;
+  for (; j + 16 <= n; j += 16) {
+    const __m512i chunk = _mm512_loadu_si512(indexes + j);
+    if (_mm512_cmpeq_epi32_mask(chunk, needle)) {
+      return true;
+    }
+  }
+
+  if (j < n) {
+    const __mmask16 tail = (__mmask16)((1u << (n - j)) - 1);
+    const __m512i chunk  = _mm512_maskz_loadu_epi32(tail, indexes + j);
+    if (_mm512_mask_cmpeq_epi32_mask(tail, chunk, needle)) {
+      return true;
+    }
+  }
+
+  return false;
+}
+
+// Whether the image holds a known layout, and sections of exactly the sizes its index range implies.
+bool is_valid_image(const struct snapshot_header *header) {
+  const uint64_t index_range = header->params[0];
+  const uint64_t layout      = header->params[1];
+  if (index_range == 0 || index_range > IRANG_LIMIT || layout > DCHAIN_LAYOUT_AOS) {
+    return false;
+  }
+  if (layout == DCHAIN_LAYOUT_COMPACT && index_range > DCHAIN_COMPACT_LIMIT) {
+    return false;
+  }
+
+  const uint64_t cells_size = cell_size((enum dchain_layout)layout) * (index_range + DCHAIN_RESERVED);
+  if (layout == DCHAIN_LAYOUT_AOS) {
+    return header->num_sections == 1 && header->section_sizes[0] == cells_size;
+  }
+  return header->num_sections == 2 && header->section_sizes[0] == cells_size && header->section_sizes[1] == sizeof(time_ns_t) * index_range;
+}
+
+} // namespace
+
+int dchain_allocate(int index_range, struct DoubleChain **chain_out) { return dchain_allocate_mem(index_range, NULL, chain_out); }
+
+int dchain_allocate_mem(int index_range, const struct mem_opts *opts, struct DoubleChain **chain_out) {
+  return dchain_allocate_layout(index_range, DCHAIN_LAYOUT_DEFAULT, opts, chain_out);
+}
+
+int dchain_allocate_layout(int index_range, enum dchain_layout layout, const struct mem_opts *opts, struct DoubleChain **chain_out) {
+  if (index_range <= 0 || index_range > IRANG_LIMIT) {
+    return 0;
+  }
+  if (layout == DCHAIN_LAYOUT_COMPACT && index_range > DCHAIN_COMPACT_LIMIT) {
+    return 0;
+  }
+
+  struct DoubleChain *chain_alloc = (struct DoubleChain *)malloc(sizeof(struct DoubleChain));
   if (chain_alloc == NULL)
     return 0;
-  *chain_out = (struct DoubleChain *)chain_alloc;
 
-  struct dchain_cell *cells_alloc = (struct dchain_cell *)malloc(sizeof(struct dchain_cell) * (index_range + DCHAIN_RESERVED));
+  void *cells_alloc = mem_alloc(cell_size(layout) * ((size_t)index_range + DCHAIN_RESERVED), opts);
   if (cells_alloc == NULL) {
     free(chain_alloc);
-    *chain_out = old_chain_out;
     return 0;
   }
-  (*chain_out)->cells = cells_alloc;
 
-  time_ns_t *timestamps_alloc = (time_ns_t *)malloc(sizeof(time_ns_t) * (index_range));
-  if (timestamps_alloc == NULL) {
-    free((void *)cells_alloc);
-    free(chain_alloc);
-    *chain_out = old_chain_out;
-    return 0;
+  time_ns_t *timestamps_alloc = NULL;
+  if (layout != DCHAIN_LAYOUT_AOS) {
+    timestamps_alloc = (time_ns_t *)mem_alloc(sizeof(time_ns_t) * (size_t)index_range, opts);
+    if (timestamps_alloc == NULL) {
+      mem_free(cells_alloc);
+      free(chain_alloc);
+      return 0;
+    }
   }
-  (*chain_out)->timestamps = timestamps_alloc;
 
-  dchain_impl_init((*chain_out)->cells, index_range);
+  chain_alloc->cells       = cells_alloc;
+  chain_alloc->index_range = index_range;
+  chain_alloc->layout      = layout;
+  chain_alloc->snapshot    = NULL;
+  bind_timestamps(chain_alloc, timestamps_alloc);
+
+  with_cells(chain_alloc, [&](auto *cells) { dchain_impl_init(cells, index_range); });
+
+  *chain_out = chain_alloc;
   return 1;
 }
 
+void dchain_free(struct DoubleChain *chain) {
+  if (chain->snapshot) {
+    snapshot_unmap(chain->snapshot);
+  } else {
+    mem_free(chain->cells);
+    if (chain->layout != DCHAIN_LAYOUT_AOS) {
+      mem_free(chain->timestamps);
+    }
+  }
+  free(chain);
+}
+
 int dchain_allocate_new_index(struct DoubleChain *chain, int *index_out, time_ns_t time) {
-  int ret = dchain_impl_allocate_new_index(chain->cells, index_out);
+  int ret = with_cells(chain, [&](auto *cells) { return dchain_impl_allocate_new_index(cells, index_out); });
+  if (ret) {
+    timestamp_of(chain, *index_out) = time;
+  }
+  return ret;
+}
+
+int dchain_allocate_n(struct DoubleChain *chain, int n, int *indexes_out, time_ns_t time) {
+  int allocated = with_cells(chain, [&](auto *cells) { return dchain_impl_allocate_n(cells, n, indexes_out); });
+  for (int i = 0; i < allocated; i++) {
+    timestamp_of(chain, indexes_out[i]) = time;
+  }
+  return allocated;
+}
+
+int dchain_allocate_new_index_evict(struct DoubleChain *chain, int *index_out, time_ns_t time, int *evicted_out) {
+  *evicted_out = 0;
+
+  int ret = with_cells(chain, [&](auto *cells) {
+    if (!dchain_impl_allocate_new_index(cells, index_out)) {
+      if (!dchain_impl_get_oldest_index(cells, index_out)) {
+        return 0;
+      }
+      dchain_impl_rejuvenate_index(cells, *index_out);
+      *evicted_out = 1;
+    }
+    return 1;
+  });
+
   if (ret) {
-    chain->timestamps[*index_out] = time;
+    timestamp_of(chain, *index_out) = time;
   }
   return ret;
 }
 
 int dchain_rejuvenate_index(struct DoubleChain *chain, int index, time_ns_t time) {
-  int ret = dchain_impl_rejuvenate_index(chain->cells, index);
+  int ret = with_cells(chain, [&](auto *cells) { return dchain_impl_rejuvenate_index(cells, index); });
   if (ret) {
-    chain->timestamps[index] = time;
+    timestamp_of(chain, index) = time;
   }
   return ret;
 }
 
+int dchain_rejuvenate_batch(struct DoubleChain *chain, const int *indexes, int n, time_ns_t time) {
+  return with_cells(chain, [&](auto *cells) {
+    int rejuvenated = 0;
+
+    for (int i = 0; i < n; i++) {
+      const int index = indexes[i];
+
+      // Only the last occurrence decides the final position in the list
+      if (occurs_after(indexes, i, n)) {
+        continue;
+      }
+
+      if (dchain_impl_rejuvenate_index(cells, index)) {
+        timestamp_of(chain, index) = time;
+        rejuvenated++;
+      }
+    }
+
+    return rejuvenated;
+  });
+}
+
 int dchain_expire_one_index(struct DoubleChain *chain, int *index_out, time_ns_t time) {
-  int has_ind = dchain_impl_get_oldest_index(chain->cells, index_out);
-  if (has_ind) {
-    if (chain->timestamps[*index_out] < time) {
-      int rez = dchain_impl_free_index(chain->cells, *index_out);
-      return rez;
+  return with_cells(chain, [&](auto *cells) {
+    int has_ind = dchain_impl_get_oldest_index(cells, index_out);
+    if (has_ind) {
+      if (timestamp_of(chain, *index_out) < time) {
+        int rez = dchain_impl_free_index(cells, *index_out);
+        return rez;
+      }
     }
-  }
-  return 0;
+    return 0;
+  });
 }
 
-int dchain_is_index_allocated(struct DoubleChain *chain, int index) { return dchain_impl_is_index_allocated(chain->cells, index); }
+int dchain_expire_batch(struct DoubleChain *chain, time_ns_t time, int *indexes_out, int max) {
+  return with_cells(chain, [&](auto *cells) {
+    int expired = 0;
+    int index;
+    while (expired < max && dchain_impl_get_oldest_index(cells, &index) && timestamp_of(chain, index) < time) {
+      dchain_impl_free_index(cells, index);
+      indexes_out[expired++] = index;
+    }
+    return expired;
+  });
+}
+
+int dchain_is_index_allocated(struct DoubleChain *chain, int index) {
+  return with_cells(chain, [&](auto *cells) { return dchain_impl_is_index_allocated(cells, index); });
+}
 
-int dchain_free_index(struct DoubleChain *chain, int index) { return dchain_impl_free_index(chain->cells, index); }
+int dchain_free_index(struct DoubleChain *chain, int index) {
+  return with_cells(chain, [&](auto *cells) { return dchain_impl_free_index(cells, index); });
+}
+
+int dchain_free_n(struct DoubleChain *chain, const int *indexes, int n) {
+  return with_cells(chain, [&](auto *cells) { return dchain_impl_free_n(cells, indexes, n); });
+}
+
+int dchain_save(struct DoubleChain *chain, const char *path) {
+  const uint64_t params[SNAPSHOT_MAX_PARAMS] = {(uint64_t)chain->index_range, (uint64_t)chain->layout, 0, 0};
+  const struct snapshot_section sections[]   = {
+      {chain->cells, cell_size(chain->layout) * ((size_t)chain->index_range + DCHAIN_RESERVED)},
+      {chain->timestamps, sizeof(time_ns_t) * (size_t)chain->index_range},
+  };
+  // Inline timestamps are saved along the cells.
+  return snapshot_save(path, SNAPSHOT_DCHAIN, params, sections, chain->layout == DCHAIN_LAYOUT_AOS ? 1 : 2);
+}
+
+int dchain_load(const char *path, struct DoubleChain **chain_out) {
+  struct Snapshot *snapshot;
+  if (!snapshot_map(path, SNAPSHOT_DCHAIN, &snapshot)) {
+    return 0;
+  }
+
+  const struct snapshot_header *header = snapshot_get_header(snapshot);
+  if (!is_valid_image(header)) {
+    snapshot_unmap(snapshot);
+    return 0;
+  }
+
+  struct DoubleChain *chain_alloc = (struct DoubleChain *)malloc(sizeof(struct DoubleChain));
+  if (chain_alloc == NULL) {
+    snapshot_unmap(snapshot);
+    return 0;
+  }
+
+  // The image is unmapped by dchain_free.
+  chain_alloc->cells       = snapshot_get_section(snapshot, 0);
+  chain_alloc->index_range = (int)header->params[0];
+  chain_alloc->layout      = (enum dchain_layout)header->params[1];
+  chain_alloc->snapshot    = snapshot;
+  bind_timestamps(chain_alloc, chain_alloc->layout == DCHAIN_LAYOUT_AOS ? NULL : (time_ns_t *)snapshot_get_section(snapshot, 1));
+
+  *chain_out = chain_alloc;
+  return 1;
+}
@@ -3,12 +3,28 @@
 #include <stdint.h>
 
 #include "time.h"
+#include "mem.h"
 
 struct DoubleChain;
 
-// Makes sure the allocator structur fits into memory, and particularly into
-// 32 bit address space.
-#define IRANG_LIMIT (1048576)
+// Makes sure the allocator links fit into an int: the largest index is
+// INT_MAX minus the special cells of the lists.
+#define IRANG_LIMIT (2147483645)
+
+// Largest index range of the DCHAIN_LAYOUT_COMPACT layout, whose links are 16
+// bits wide.
+#define DCHAIN_COMPACT_LIMIT (65534)
+
+enum dchain_layout {
+  // 8B cells (int links), timestamps in a separate array.
+  DCHAIN_LAYOUT_DEFAULT,
+  // 4B cells (16 bit links), timestamps in a separate array. Twice as many
+  // cells per cache line, for index ranges up to DCHAIN_COMPACT_LIMIT.
+  DCHAIN_LAYOUT_COMPACT,
+  // 16B cells holding the links and the timestamp of the index (array of
+  // structures), so that each operation touches a single cell.
+  DCHAIN_LAYOUT_AOS,
+};
 
 // kinda hacky, but makes the proof independent of time_ns_t... sort of
 #define malloc_block_time malloc_block_llongs
@@ -17,13 +33,26 @@ struct DoubleChain;
 
 //   Allocate memory and initialize a new double chain allocator. The produced
 //   allocator will operate on indexes [0-index).
-//   @param index_range - the limit on the number of allocated indexes.
+//   @param index_range - the limit on the number of allocated indexes, from 1
+//                        up to IRANG_LIMIT.
 //   @param chain_out - an output pointer that will hold the pointer to the
 //   newly
 //                      allocated allocator in the case of success.
 //   @returns 0 if the allocation failed, and 1 if the allocation is successful.
 int dchain_allocate(int index_range, struct DoubleChain **chain_out);
 
+//   Same as dchain_allocate, with the backing memory of the cells and
+//   timestamps configured by opts (NULL for the defaults).
+int dchain_allocate_mem(int index_range, const struct mem_opts *opts, struct DoubleChain **chain_out);
+
+//   Same as dchain_allocate_mem, with the cells laid out as described by
+//   layout. Fails if the index range does not fit the layout.
+int dchain_allocate_layout(int index_range, enum dchain_layout layout, const struct mem_opts *opts, struct DoubleChain **chain_out);
+
+//   Release an allocator obtained from dchain_allocate, dchain_allocate_mem,
+//   dchain_allocate_layout or dchain_load. A loaded allocator is unmapped.
+void dchain_free(struct DoubleChain *chain);
+
 //   Allocate a fresh index. If there is an unused, or expired index in the
 //   range, allocate it.
 //   @param chain - pointer to the allocator.
@@ -32,6 +61,30 @@ int dchain_allocate(int index_range, struct DoubleChain **chain_out);
 //   @returns 0 if there is no space, and 1 if the allocation is successful.
 int dchain_allocate_new_index(struct DoubleChain *chain, int *index_out, time_ns_t time);
 
+//   Allocate up to n fresh indexes in a single pass over the free list. They
+//   are appended to the allocated ones in the order they are returned, all
+//   with the same timestamp.
+//   @param chain - pointer to the allocator.
+//   @param n - the number of indexes wanted.
+//   @param indexes_out - output array, large enough for n indexes.
+//   @param time - current time. Allocator will note this for the new indexes.
+//   @returns the number of allocated indexes, less than n if the allocator ran
+//            out of space.
+int dchain_allocate_n(struct DoubleChain *chain, int n, int *indexes_out, time_ns_t time);
+
+//   Allocate a fresh index, evicting the least recently used one if there is
+//   no free index left. The evicted index is recycled in place (it becomes
+//   the most recently used one), so the allocator never goes through a state
+//   where the index is free.
+//   @param chain - pointer to the allocator.
+//   @param index_out - output pointer to the newly allocated index.
+//   @param time - current time. Allocator will note this for the new index.
+//   @param evicted_out - output pointer, set to 1 if index_out was taken from
+//                        the oldest allocated index (whose owner must then be
+//                        cleaned up by the caller), and to 0 otherwise.
+//   @returns 0 if the index range is empty, and 1 otherwise.
+int dchain_allocate_new_index_evict(struct DoubleChain *chain, int *index_out, time_ns_t time, int *evicted_out);
+
 //   Update the index timestamp. Needed to keep the index from expiration.
 //   @param chain - pointer to the allocator.
 //   @param index - the index to rejuvenate.
@@ -41,6 +94,19 @@ int dchain_allocate_new_index(struct DoubleChain *chain, int *index_out, time_ns
 //            allocated.
 int dchain_rejuvenate_index(struct DoubleChain *chain, int index, time_ns_t time);
 
+//   Rejuvenate the indexes of a burst of packets. Indexes showing up more than
+//   once are only relinked (and their timestamp written) once, at the position
+//   of their last occurrence, so the resulting LRU order is the same as
+//   calling dchain_rejuvenate_index for each packet, in burst order.
+//   Meant for bursts: the cost is quadratic in n.
+//   @param chain - pointer to the allocator.
+//   @param indexes - the indexes to rejuvenate, in burst order.
+//   @param n - the number of indexes.
+//   @param time - the current time, it will replace the old timestamps.
+//   @returns the number of distinct indexes that were rejuvenated (indexes not
+//            tagged as allocated are skipped).
+int dchain_rejuvenate_batch(struct DoubleChain *chain, const int *indexes, int n, time_ns_t time);
+
 //   Make space in the allocator by expiring the least recently used index.
 //   @param chain - pointer to the allocator.
 //   @param index_out - output pointer to the expired index.
@@ -50,6 +116,42 @@ int dchain_rejuvenate_index(struct DoubleChain *chain, int index, time_ns_t time
 //   0 otherwise.
 int dchain_expire_one_index(struct DoubleChain *chain, int *index_out, time_ns_t time);
 
+//   Expire, in LRU order, all the indexes older than time, up to max of them.
+//   Same as calling dchain_expire_one_index until it fails, in a single call.
+//   @param chain - pointer to the allocator.
+//   @param time - the time border, separating expired indexes from non-expired
+//                ones.
+//   @param indexes_out - output array, large enough for max indexes, that will
+//                        hold the expired indexes, oldest first.
+//   @param max - the maximum number of indexes to expire.
+//   @returns the number of expired indexes.
+int dchain_expire_batch(struct DoubleChain *chain, time_ns_t time, int *indexes_out, int max);
+
 int dchain_is_index_allocated(struct DoubleChain *chain, int index);
 
 int dchain_free_index(struct DoubleChain *chain, int index);
+
+//   Free n indexes at once, e.g. the ones obtained from dchain_allocate_n.
+//   @param chain - pointer to the allocator.
+//   @param indexes - the indexes to free.
+//   @param n - the number of indexes.
+//   @returns the number of freed indexes (indexes not tagged as allocated are
+//            skipped).
+int dchain_free_n(struct DoubleChain *chain, const int *indexes, int n);
+
+//   Write the allocator state (cells and timestamps) to disk, as an image
+//   that dchain_load can map back in place.
+//   @param chain - pointer to the allocator.
+//   @param path - the file to write.
+//   @returns 1 if the image was written, and 0 otherwise.
+int dchain_save(struct DoubleChain *chain, const char *path);
+
+//   Map an allocator saved with dchain_save. Allocated indexes, their order
+//   and their timestamps are preserved.
+//   @param path - the file to map.
+//   @param chain_out - output pointer to the mapped allocator, to be released
+//                      with dchain_free.
+//   @returns 1 if the allocator was mapped, and 0 otherwise (including images
+//            whose layout is unknown, or whose sections do not match the
+//            index range).
+int dchain_load(const char *path, struct DoubleChain **chain_out);
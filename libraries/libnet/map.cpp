@@ -86,18 +86,18 @@ inline unsigned find_key_remove_chain(int *busybits, void **keyps, unsigned *k_h
 
 } // namespace
 
-Map::Map(unsigned _capacity, unsigned _key_size) : capacity(_capacity), key_size(_key_size), size(0) {
+Map::Map(unsigned _capacity, unsigned _key_size, const struct mem_opts *opts) : capacity(_capacity), key_size(_key_size), size(0) {
   // Check that capacity is a power of 2
   if (_capacity == 0 || is_power_of_two(_capacity) == 0) {
     fprintf(stderr, "Error: Capacity must be a power of 2\n");
     exit(1);
   }
 
-  busybits = (int *)malloc(sizeof(int) * (int)_capacity);
-  keyps    = (void **)malloc(sizeof(void *) * (int)_capacity);
-  khs      = (unsigned *)malloc(sizeof(unsigned) * (int)_capacity);
-  chns     = (int *)malloc(sizeof(int) * (int)_capacity);
-  vals     = (int *)malloc(sizeof(int) * (int)_capacity);
+  busybits = (int *)mem_alloc(sizeof(int) * _capacity, opts);
+  keyps    = (void **)mem_alloc(sizeof(void *) * _capacity, opts);
+  khs      = (unsigned *)mem_alloc(sizeof(unsigned) * _capacity, opts);
+  chns     = (int *)mem_alloc(sizeof(int) * _capacity, opts);
+  vals     = (int *)mem_alloc(sizeof(int) * _capacity, opts);
 
   for (unsigned i = 0; i < capacity; ++i) {
     busybits[i] = 0;
@@ -106,11 +106,11 @@ Map::Map(unsigned _capacity, unsigned _key_size) : capacity(_capacity), key_size
 }
 
 Map::~Map() {
-  free(busybits);
-  free(keyps);
-  free(khs);
-  free(chns);
-  free(vals);
+  mem_free(busybits);
+  mem_free(keyps);
+  mem_free(khs);
+  mem_free(chns);
+  mem_free(vals);
 }
 
 int Map::get(void *key, int *value_out) const {
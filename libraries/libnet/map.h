@@ -1,5 +1,7 @@
 #pragma once
 
+#include "mem.h"
+
 class Map {
 private:
   const unsigned capacity;
@@ -13,7 +15,8 @@ private:
   unsigned size;
 
 public:
-  Map(unsigned capacity, unsigned key_size);
+  // The backing memory of the table is configured by opts (NULL for the defaults).
+  Map(unsigned capacity, unsigned key_size, const struct mem_opts *opts = nullptr);
   ~Map();
 
   int get(void *key, int *value_out) const;
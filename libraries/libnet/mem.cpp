@@ -0,0 +1,191 @@
+#include "mem.h"
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#ifndef MAP_HUGE_SHIFT
+#define MAP_HUGE_SHIFT 26
+#endif
+
+#ifndef MAP_HUGE_2MB
+#define MAP_HUGE_2MB (21 << MAP_HUGE_SHIFT)
+#endif
+
+#ifndef MAP_HUGE_1GB
+#define MAP_HUGE_1GB (30 << MAP_HUGE_SHIFT)
+#endif
+
+// From linux/mempolicy.h, to avoid depending on libnuma.
+#define MEM_MPOL_BIND 2
+
+#define HUGE_PAGE_2M_SIZE (2ul << 20)
+#define HUGE_PAGE_1G_SIZE (1ul << 30)
+
+namespace {
+
+// Mapped allocations, kept out of line so that they start right at the first page: a header in front of them would take a whole extra page
+// (a huge page, with MEM_PAGES_2M or MEM_PAGES_1G). Heap allocations need no record, as free finds their size itself.
+struct mem_mapping {
+  void *base;
+  size_t mapped_size;
+  struct mem_mapping *next;
+};
+
+struct mem_mapping *mappings  = NULL;
+pthread_mutex_t mappings_lock = PTHREAD_MUTEX_INITIALIZER;
+
+inline size_t round_up(size_t n, size_t multiple) { return (n + multiple - 1) / multiple * multiple; }
+
+size_t page_size(enum mem_pages pages) {
+  switch (pages) {
+  case MEM_PAGES_2M:
+    return HUGE_PAGE_2M_SIZE;
+  case MEM_PAGES_1G:
+    return HUGE_PAGE_1G_SIZE;
+  case MEM_PAGES_DEFAULT:
+    break;
+  }
+  return sysconf(_SC_PAGESIZE);
+}
+
+int bind_to_node(void *addr, size_t size, int numa_node) {
+  constexpr const int word_bits = sizeof(unsigned long) * 8;
+
+  unsigned long nodemask[MEM_MAX_NUMA_NODES / word_bits] = {0};
+  nodemask[numa_node / word_bits]                        = 1ul << (numa_node % word_bits);
+
+  // Only the words up to the node are passed, the kernel rejects masks wider than its own number of nodes.
+  const unsigned long max_node = (unsigned long)(numa_node / word_bits + 1) * word_bits + 1;
+  return syscall(SYS_mbind, addr, size, MEM_MPOL_BIND, nodemask, max_node, 0) == 0;
+}
+
+void touch_pages(void *addr, size_t size) {
+#ifdef MADV_POPULATE_WRITE
+  if (madvise(addr, size, MADV_POPULATE_WRITE) == 0) {
+    return;
+  }
+#endif
+  const size_t step = sysconf(_SC_PAGESIZE);
+  for (size_t offset = 0; offset < size; offset += step) {
+    ((volatile char *)addr)[offset] = 0;
+  }
+}
+
+void *map_pages(size_t size, const struct mem_opts *opts, size_t *mapped_size) {
+  const size_t pg_size = page_size(opts->pages);
+  const bool bind      = opts->numa_node != MEM_NUMA_ANY;
+
+  // When binding to a node, pages must only be faulted in after the policy is set.
+  const int populate = (opts->prefault && !bind) ? MAP_POPULATE : 0;
+
+  void *addr = MAP_FAILED;
+  size_t len = round_up(size, pg_size);
+
+  if (opts->pages != MEM_PAGES_DEFAULT) {
+    const int huge_flags = opts->pages == MEM_PAGES_2M ? MAP_HUGE_2MB : MAP_HUGE_1GB;
+    addr                 = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | huge_flags | populate, -1, 0);
+
+    if (addr == MAP_FAILED) {
+      // No reserved huge pages: map regular pages aligned to the huge page size and ask for transparent huge pages instead.
+      const size_t padded = len + pg_size;
+      char *raw           = (char *)mmap(NULL, padded, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+      if (raw == MAP_FAILED) {
+        return NULL;
+      }
+
+      char *aligned = (char *)round_up((uintptr_t)raw, pg_size);
+      if (aligned != raw) {
+        munmap(raw, aligned - raw);
+      }
+      munmap(aligned + len, (raw + padded) - (aligned + len));
+
+      addr = aligned;
+      madvise(addr, len, MADV_HUGEPAGE);
+
+      if (opts->prefault && !bind) {
+        touch_pages(addr, len);
+      }
+    }
+  } else {
+    addr = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | populate, -1, 0);
+  }
+
+  if (addr == MAP_FAILED) {
+    return NULL;
+  }
+
+  if (bind) {
+    if (!bind_to_node(addr, len, opts->numa_node)) {
+      munmap(addr, len);
+      return NULL;
+    }
+
+    if (opts->prefault) {
+      touch_pages(addr, len);
+    }
+  }
+
+  *mapped_size = len;
+  return addr;
+}
+
+} // namespace
+
+void *mem_alloc(size_t size, const struct mem_opts *opts) {
+  if (opts == NULL || (opts->pages == MEM_PAGES_DEFAULT && opts->numa_node == MEM_NUMA_ANY && !opts->prefault)) {
+    return aligned_alloc(MEM_ALIGNMENT, round_up(size, MEM_ALIGNMENT));
+  }
+
+  if (opts->numa_node != MEM_NUMA_ANY && (opts->numa_node < 0 || opts->numa_node >= MEM_MAX_NUMA_NODES)) {
+    return NULL;
+  }
+
+  struct mem_mapping *mapping = (struct mem_mapping *)malloc(sizeof(struct mem_mapping));
+  if (mapping == NULL) {
+    return NULL;
+  }
+
+  // Pages are aligned well beyond MEM_ALIGNMENT.
+  mapping->base = map_pages(size, opts, &mapping->mapped_size);
+  if (mapping->base == NULL) {
+    free(mapping);
+    return NULL;
+  }
+
+  pthread_mutex_lock(&mappings_lock);
+  mapping->next = mappings;
+  mappings      = mapping;
+  pthread_mutex_unlock(&mappings_lock);
+
+  return mapping->base;
+}
+
+void mem_free(void *ptr) {
+  if (ptr == NULL) {
+    return;
+  }
+
+  struct mem_mapping *mapping = NULL;
+
+  pthread_mutex_lock(&mappings_lock);
+  for (struct mem_mapping **link = &mappings; *link != NULL; link = &(*link)->next) {
+    if ((*link)->base == ptr) {
+      mapping = *link;
+      *link   = mapping->next;
+      break;
+    }
+  }
+  pthread_mutex_unlock(&mappings_lock);
+
+  if (mapping == NULL) {
+    free(ptr);
+    return;
+  }
+
+  munmap(mapping->base, mapping->mapped_size);
+  free(mapping);
+}
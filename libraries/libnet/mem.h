@@ -0,0 +1,41 @@
+#pragma once
+
+#include <stddef.h>
+
+// All allocations are aligned to a cache line.
+#define MEM_ALIGNMENT 64
+
+// No NUMA binding: pages land wherever the kernel places them (usually the node of the first core touching them).
+#define MEM_NUMA_ANY (-1)
+
+// NUMA nodes supported for binding, as in the kernel's largest configuration.
+#define MEM_MAX_NUMA_NODES 1024
+
+enum mem_pages {
+  // Regular pages (usually 4KB).
+  MEM_PAGES_DEFAULT = 0,
+  // 2MB huge pages. Falls back to transparent huge pages if none are reserved.
+  MEM_PAGES_2M,
+  // 1GB huge pages. Falls back to transparent huge pages if none are reserved.
+  MEM_PAGES_1G,
+};
+
+// Options for the memory backing a table.
+struct mem_opts {
+  enum mem_pages pages;
+  // NUMA node to bind the memory to, or MEM_NUMA_ANY.
+  int numa_node;
+  // Fault all the pages in at allocation time, so that the first packets don't pay for the page faults.
+  int prefault;
+};
+
+//   Allocate memory for a table.
+//   @param size - the number of bytes to allocate.
+//   @param opts - backing memory options. NULL means regular pages, no NUMA
+//                 binding and no pre-faulting.
+//   @returns a MEM_ALIGNMENT aligned pointer, or NULL if the allocation failed or
+//            the NUMA node is neither MEM_NUMA_ANY nor below MEM_MAX_NUMA_NODES.
+void *mem_alloc(size_t size, const struct mem_opts *opts);
+
+//   Release memory obtained from mem_alloc. NULL is ignored.
+void mem_free(void *ptr);
@@ -0,0 +1,319 @@
+#include "partitioned-chain.h"
+
+#include <stdlib.h>
+#include <stddef.h>
+#include <limits.h>
+
+#include <atomic>
+#include <new>
+
+#include "double-chain-impl.h"
+
+// The list heads of each core take a whole cache line worth of cells, so that no two cores write to the same line.
+#define PCHAIN_HEAD_CELLS (8)
+
+enum pchain_steal_state {
+  // No request in flight, and no core had free indexes the last time we looked.
+  PCHAIN_STEAL_NONE,
+  // The victim was busy serving another core, try again.
+  PCHAIN_STEAL_RETRY,
+  // Waiting for the victim to fill the inbox.
+  PCHAIN_STEAL_POSTED,
+};
+
+struct alignas(64) pchain_core {
+  // Core id + 1 of the thief waiting on this core, 0 if none. Written by thieves.
+  std::atomic<int> steal_request;
+  // Number of cells handed over by the victim, -1 until it answers. Written by the victim.
+  std::atomic<int> inbox_count;
+  // Copy of free_count for the thieves, to pick their victim.
+  std::atomic<int> shared_free_count;
+
+  // Owner-only state.
+  int free_count;
+  enum pchain_steal_state steal_state;
+
+  int inbox[PCHAIN_STEAL_BATCH];
+};
+
+struct PartitionedChain {
+  // The list heads of all the cores, followed by one cell per index.
+  struct dchain_cell *cells;
+  time_ns_t *timestamps;
+  struct pchain_core *cores;
+  int index_range;
+  int num_cores;
+};
+
+namespace {
+
+inline int alloc_head(int core) { return core * PCHAIN_HEAD_CELLS; }
+inline int free_head(int core) { return core * PCHAIN_HEAD_CELLS + 1; }
+
+inline int reserved_cells(const struct PartitionedChain *chain) { return chain->num_cores * PCHAIN_HEAD_CELLS; }
+inline int cell_of(const struct PartitionedChain *chain, int index) { return reserved_cells(chain) + index; }
+inline int index_of(const struct PartitionedChain *chain, int cell) { return cell - reserved_cells(chain); }
+
+// Same convention as DoubleChain: free cells have equal prev and next, and so do allocated cells when they are alone in their list (both
+// pointing to the alloc head).
+inline int is_cell_allocated(const struct PartitionedChain *chain, int cell) {
+  const struct dchain_cell *cellp = chain->cells + cell;
+  if (cellp->prev != cellp->next) {
+    return 1;
+  }
+  return cellp->prev < reserved_cells(chain) && cellp->prev % PCHAIN_HEAD_CELLS == 0;
+}
+
+inline void publish_free_count(struct pchain_core *core) { core->shared_free_count.store(core->free_count, std::memory_order_relaxed); }
+
+inline void push_free(struct PartitionedChain *chain, int core, int cell) {
+  struct dchain_cell *fl_head = chain->cells + free_head(core);
+  struct dchain_cell *cellp   = chain->cells + cell;
+  cellp->next                 = fl_head->next;
+  cellp->prev                 = cellp->next;
+  fl_head->next               = cell;
+  fl_head->prev               = fl_head->next;
+  chain->cores[core].free_count++;
+}
+
+inline int pop_free(struct PartitionedChain *chain, int core) {
+  struct dchain_cell *fl_head = chain->cells + free_head(core);
+  int cell                    = fl_head->next;
+  if (cell == free_head(core)) {
+    return -1;
+  }
+  fl_head->next = chain->cells[cell].next;
+  fl_head->prev = fl_head->next;
+  chain->cores[core].free_count--;
+  return cell;
+}
+
+inline void link_newest(struct PartitionedChain *chain, int core, int cell) {
+  struct dchain_cell *al_head      = chain->cells + alloc_head(core);
+  struct dchain_cell *cellp        = chain->cells + cell;
+  cellp->next                      = alloc_head(core);
+  cellp->prev                      = al_head->prev;
+  chain->cells[al_head->prev].next = cell;
+  al_head->prev                    = cell;
+}
+
+inline void unlink(struct PartitionedChain *chain, int cell) {
+  struct dchain_cell *cellp      = chain->cells + cell;
+  chain->cells[cellp->prev].next = cellp->next;
+  chain->cells[cellp->next].prev = cellp->prev;
+}
+
+// Hand half of our free indexes over to the core waiting on us, if any.
+void serve_steal(struct PartitionedChain *chain, int core) {
+  struct pchain_core *self = chain->cores + core;
+  const int request        = self->steal_request.load(std::memory_order_acquire);
+  if (request == 0) {
+    return;
+  }
+
+  struct pchain_core *thief = chain->cores + request - 1;
+  int handed                = (self->free_count + 1) / 2;
+  if (handed > PCHAIN_STEAL_BATCH) {
+    handed = PCHAIN_STEAL_BATCH;
+  }
+  for (int i = 0; i < handed; i++) {
+    thief->inbox[i] = pop_free(chain, core);
+  }
+  publish_free_count(self);
+
+  thief->inbox_count.store(handed, std::memory_order_release);
+  self->steal_request.store(0, std::memory_order_release);
+}
+
+// Move the indexes handed over by the victim to our free list, as soon as it answered: they belong to no free list while in the inbox.
+// Returns the number of indexes collected, or -1 if the answer is still pending.
+int collect_inbox(struct PartitionedChain *chain, int core) {
+  struct pchain_core *self = chain->cores + core;
+  if (self->steal_state != PCHAIN_STEAL_POSTED) {
+    return 0;
+  }
+
+  const int handed = self->inbox_count.load(std::memory_order_acquire);
+  if (handed < 0) {
+    return -1;
+  }
+
+  for (int i = 0; i < handed; i++) {
+    push_free(chain, core, self->inbox[i]);
+  }
+  publish_free_count(self);
+  self->steal_state = PCHAIN_STEAL_NONE;
+  return handed;
+}
+
+// Collect the answer to our steal request, or post a new one. Returns whether there are free indexes to allocate from.
+int refill(struct PartitionedChain *chain, int core) {
+  struct pchain_core *self = chain->cores + core;
+
+  const int collected = collect_inbox(chain, core);
+  if (collected != 0) {
+    return collected > 0;
+  }
+
+  // Nothing (left) in the inbox: try the core with the most free indexes.
+  int victim = -1;
+  int most   = 0;
+  for (int other = 0; other < chain->num_cores; other++) {
+    const int free_count = chain->cores[other].shared_free_count.load(std::memory_order_relaxed);
+    if (other != core && free_count > most) {
+      victim = other;
+      most   = free_count;
+    }
+  }
+
+  if (victim < 0) {
+    self->steal_state = PCHAIN_STEAL_NONE;
+    return 0;
+  }
+
+  self->inbox_count.store(-1, std::memory_order_relaxed);
+  int expected = 0;
+  if (chain->cores[victim].steal_request.compare_exchange_strong(expected, core + 1, std::memory_order_acq_rel, std::memory_order_relaxed)) {
+    self->steal_state = PCHAIN_STEAL_POSTED;
+  } else {
+    self->steal_state = PCHAIN_STEAL_RETRY;
+  }
+  return 0;
+}
+
+} // namespace
+
+int pchain_allocate(int index_range, int num_cores, const struct mem_opts *opts, struct PartitionedChain **chain_out) {
+  if (num_cores <= 0 || index_range < num_cores || index_range > INT_MAX - num_cores * PCHAIN_HEAD_CELLS) {
+    return 0;
+  }
+
+  struct PartitionedChain *chain = (struct PartitionedChain *)malloc(sizeof(struct PartitionedChain));
+  if (chain == NULL) {
+    return 0;
+  }
+  chain->index_range = index_range;
+  chain->num_cores   = num_cores;
+
+  chain->cells      = (struct dchain_cell *)mem_alloc(sizeof(struct dchain_cell) * ((size_t)index_range + reserved_cells(chain)), opts);
+  chain->timestamps = (time_ns_t *)mem_alloc(sizeof(time_ns_t) * (size_t)index_range, opts);
+  chain->cores      = (struct pchain_core *)mem_alloc(sizeof(struct pchain_core) * num_cores, opts);
+  if (chain->cells == NULL || chain->timestamps == NULL || chain->cores == NULL) {
+    mem_free(chain->cells);
+    mem_free(chain->timestamps);
+    mem_free(chain->cores);
+    free(chain);
+    return 0;
+  }
+
+  for (int core = 0; core < num_cores; core++) {
+    struct pchain_core *corep = new (chain->cores + core) pchain_core();
+    corep->steal_request.store(0, std::memory_order_relaxed);
+    corep->inbox_count.store(0, std::memory_order_relaxed);
+    corep->free_count  = 0;
+    corep->steal_state = PCHAIN_STEAL_NONE;
+
+    struct dchain_cell *al_head = chain->cells + alloc_head(core);
+    al_head->prev               = alloc_head(core);
+    al_head->next               = alloc_head(core);
+
+    struct dchain_cell *fl_head = chain->cells + free_head(core);
+    fl_head->prev               = free_head(core);
+    fl_head->next               = free_head(core);
+
+    // Each core starts with an equal segment of the range, pushed backwards so that it allocates them in order.
+    const int first = (int)((int64_t)index_range * core / num_cores);
+    const int last  = (int)((int64_t)index_range * (core + 1) / num_cores);
+    for (int index = last - 1; index >= first; index--) {
+      push_free(chain, core, cell_of(chain, index));
+    }
+    publish_free_count(corep);
+  }
+
+  *chain_out = chain;
+  return 1;
+}
+
+void pchain_free(struct PartitionedChain *chain) {
+  for (int core = 0; core < chain->num_cores; core++) {
+    chain->cores[core].~pchain_core();
+  }
+  mem_free(chain->cells);
+  mem_free(chain->timestamps);
+  mem_free(chain->cores);
+  free(chain);
+}
+
+int pchain_allocate_new_index(struct PartitionedChain *chain, int core, int *index_out, time_ns_t time) {
+  serve_steal(chain, core);
+  collect_inbox(chain, core);
+
+  int cell = pop_free(chain, core);
+  if (cell < 0) {
+    if (!refill(chain, core)) {
+      return 0;
+    }
+    cell = pop_free(chain, core);
+  }
+  publish_free_count(chain->cores + core);
+
+  link_newest(chain, core, cell);
+  *index_out                    = index_of(chain, cell);
+  chain->timestamps[*index_out] = time;
+  return 1;
+}
+
+int pchain_rejuvenate_index(struct PartitionedChain *chain, int core, int index, time_ns_t time) {
+  serve_steal(chain, core);
+
+  const int cell = cell_of(chain, index);
+  if (!is_cell_allocated(chain, cell)) {
+    return 0;
+  }
+
+  // Already the most recent one.
+  if (chain->cells[cell].next != alloc_head(core)) {
+    unlink(chain, cell);
+    link_newest(chain, core, cell);
+  }
+  chain->timestamps[index] = time;
+  return 1;
+}
+
+int pchain_expire_one_index(struct PartitionedChain *chain, int core, int *index_out, time_ns_t time) {
+  serve_steal(chain, core);
+
+  const int oldest = chain->cells[alloc_head(core)].next;
+  if (oldest == alloc_head(core) || chain->timestamps[index_of(chain, oldest)] >= time) {
+    return 0;
+  }
+
+  unlink(chain, oldest);
+  push_free(chain, core, oldest);
+  publish_free_count(chain->cores + core);
+  *index_out = index_of(chain, oldest);
+  return 1;
+}
+
+int pchain_free_index(struct PartitionedChain *chain, int core, int index) {
+  serve_steal(chain, core);
+
+  const int cell = cell_of(chain, index);
+  if (!is_cell_allocated(chain, cell)) {
+    return 0;
+  }
+
+  unlink(chain, cell);
+  push_free(chain, core, cell);
+  publish_free_count(chain->cores + core);
+  return 1;
+}
+
+void pchain_poll(struct PartitionedChain *chain, int core) {
+  serve_steal(chain, core);
+  collect_inbox(chain, core);
+}
+
+int pchain_steal_pending(struct PartitionedChain *chain, int core) { return chain->cores[core].steal_state != PCHAIN_STEAL_NONE; }
+
+int pchain_get_free_count(struct PartitionedChain *chain, int core) { return chain->cores[core].shared_free_count.load(std::memory_order_relaxed); }
@@ -0,0 +1,90 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "time.h"
+#include "mem.h"
+
+struct PartitionedChain;
+
+// Index allocator with the DoubleChain semantics, shared by a set of cores.
+//
+// Each core owns the indexes it allocated, in its own LRU list, plus a list of
+// free indexes. Initially the index range is split in equal segments, one per
+// core. The lists of all the cores live in a single array of cells, so an
+// index can move from a core to another without changing its cell.
+//
+// A core whose free list runs dry steals a batch of free indexes from the
+// core that has the most of them. Stealing is cooperative and lock-free: the
+// thief posts a request on the victim, and the victim hands a batch over to
+// the thief's inbox the next time it calls into the allocator (any call made
+// with its core id, or pchain_poll). Until then, allocations on the thief
+// fail, and pchain_steal_pending tells whether retrying may succeed. The
+// thief moves the batch to its free list on its next allocation or
+// pchain_poll, even if it freed indexes of its own in the meantime.
+//
+// Except for the steal handshake, a core only touches its own lists: all the
+// calls below must be made by the owner of the given core id, and the indexes
+// passed to them must have been allocated by that core.
+
+// Upper bound on the number of free indexes handed over in a single steal.
+#define PCHAIN_STEAL_BATCH (256)
+
+//   Allocate memory and initialize a new partitioned allocator. The produced
+//   allocator will operate on indexes [0-index).
+//   @param index_range - the limit on the number of allocated indexes.
+//   @param num_cores - the number of cores sharing the allocator, each one
+//                      identified by a core id in [0-num_cores).
+//   @param opts - backing memory options (NULL for the defaults).
+//   @param chain_out - an output pointer that will hold the pointer to the
+//                      newly allocated allocator in the case of success.
+//   @returns 0 if the allocation failed, and 1 if the allocation is successful.
+int pchain_allocate(int index_range, int num_cores, const struct mem_opts *opts, struct PartitionedChain **chain_out);
+
+//   Release an allocator obtained from pchain_allocate.
+void pchain_free(struct PartitionedChain *chain);
+
+//   Allocate a fresh index, stealing free indexes from another core if needed.
+//   @param chain - pointer to the allocator.
+//   @param core - the core id of the caller.
+//   @param index_out - output pointer to the newly allocated index.
+//   @param time - current time. Allocator will note this for the new index.
+//   @returns 0 if there is no space (yet, see pchain_steal_pending), and 1 if
+//            the allocation is successful.
+int pchain_allocate_new_index(struct PartitionedChain *chain, int core, int *index_out, time_ns_t time);
+
+//   Update the index timestamp. Needed to keep the index from expiration.
+//   @param chain - pointer to the allocator.
+//   @param core - the core id of the caller, owner of the index.
+//   @param index - the index to rejuvenate.
+//   @param time - the current time, it will replace the old timestamp.
+//   @returns 1 if the timestamp was updated, and 0 if the index is not tagged
+//            as allocated.
+int pchain_rejuvenate_index(struct PartitionedChain *chain, int core, int index, time_ns_t time);
+
+//   Expire the least recently used index of the core, if it is older than time.
+//   @param chain - pointer to the allocator.
+//   @param core - the core id of the caller.
+//   @param index_out - output pointer to the expired index.
+//   @param time - the time border, separating expired indexes from non-expired
+//                 ones.
+//   @returns 1 if an index was expired, and 0 otherwise.
+int pchain_expire_one_index(struct PartitionedChain *chain, int core, int *index_out, time_ns_t time);
+
+//   Free an index of the core.
+//   @returns 1 if the index was freed, and 0 if it was not allocated.
+int pchain_free_index(struct PartitionedChain *chain, int core, int index);
+
+//   Serve the steal request posted on the core, if any, and collect the answer
+//   to its own. Cores that stop allocating must keep calling it for the others
+//   to be able to steal.
+void pchain_poll(struct PartitionedChain *chain, int core);
+
+//   Whether the core is waiting on another one to answer a steal request.
+//   @returns 1 if a failed allocation may succeed later on, and 0 if no core
+//            had free indexes left to steal.
+int pchain_steal_pending(struct PartitionedChain *chain, int core);
+
+//   Number of free indexes held by the core. Only approximate when read by
+//   another core.
+int pchain_get_free_count(struct PartitionedChain *chain, int core);
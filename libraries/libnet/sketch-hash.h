@@ -0,0 +1,69 @@
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+#include <immintrin.h>
+
+// Key hashing shared by the sketches. A key is hashed once, and every row or probe of a sketch derives its own position by mixing a salt
+// into that hash with fmix32. The vectorized versions compute the exact same hashes, for 16 keys at a time.
+
+#define SKETCH_HASH_MULTIPLIER 0x9e3779b1
+#define SKETCH_HASH_LANES 16
+
+static inline uint32_t key_hash(const void *key, uint32_t key_size) {
+  const uint8_t *bytes = (const uint8_t *)key;
+  uint32_t hash        = 0;
+  uint32_t i           = 0;
+  for (; i + sizeof(uint32_t) <= key_size; i += sizeof(uint32_t)) {
+    uint32_t word;
+    memcpy(&word, bytes + i, sizeof(uint32_t));
+    hash = (hash ^ word) * SKETCH_HASH_MULTIPLIER;
+  }
+  if (i < key_size) {
+    uint32_t word = 0;
+    memcpy(&word, bytes + i, key_size - i);
+    hash = (hash ^ word) * SKETCH_HASH_MULTIPLIER;
+  }
+  return hash;
+}
+
+// Murmur3 finalizer.
+static inline uint32_t fmix32(uint32_t h) {
+  h ^= h >> 16;
+  h *= 0x85ebca6b;
+  h ^= h >> 13;
+  h *= 0xc2b2ae35;
+  h ^= h >> 16;
+  return h;
+}
+
+static inline __m512i fmix32_vec(__m512i h) {
+  h = _mm512_xor_si512(h, _mm512_srli_epi32(h, 16));
+  h = _mm512_mullo_epi32(h, _mm512_set1_epi32(0x85ebca6b));
+  h = _mm512_xor_si512(h, _mm512_srli_epi32(h, 13));
+  h = _mm512_mullo_epi32(h, _mm512_set1_epi32(0xc2b2ae35));
+  h = _mm512_xor_si512(h, _mm512_srli_epi32(h, 16));
+  return h;
+}
+
+// Hashes of SKETCH_HASH_LANES keys laid out one after the other.
+static inline __m512i key_hash_vec(const void *keys, uint32_t key_size) {
+  // Gathering 4B at a time only works when no key ends with a partial word.
+  if (key_size % sizeof(uint32_t) != 0) {
+    alignas(64) uint32_t hashes[SKETCH_HASH_LANES];
+    for (int i = 0; i < SKETCH_HASH_LANES; i++) {
+      hashes[i] = key_hash((const uint8_t *)keys + i * key_size, key_size);
+    }
+    return _mm512_load_si512(hashes);
+  }
+
+  const __m512i multiplier = _mm512_set1_epi32(SKETCH_HASH_MULTIPLIER);
+  __m512i offsets          = _mm512_mullo_epi32(_mm512_set_epi32(15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0), _mm512_set1_epi32(key_size));
+  __m512i hash             = _mm512_setzero_si512();
+  for (uint32_t i = 0; i < key_size; i += sizeof(uint32_t)) {
+    const __m512i words = _mm512_i32gather_epi32(offsets, keys, 1);
+    hash                = _mm512_mullo_epi32(_mm512_xor_si512(hash, words), multiplier);
+    offsets             = _mm512_add_epi32(offsets, _mm512_set1_epi32(sizeof(uint32_t)));
+  }
+  return hash;
+}
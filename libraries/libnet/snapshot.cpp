@@ -0,0 +1,140 @@
+#include "snapshot.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define SNAPSHOT_PAGE_SIZE 4096
+
+static_assert(sizeof(struct snapshot_header) <= SNAPSHOT_PAGE_SIZE, "The header must fit in the first page");
+
+struct Snapshot {
+  void *base;
+  size_t size;
+};
+
+namespace {
+
+inline uint64_t round_up(uint64_t n, uint64_t multiple) { return (n + multiple - 1) / multiple * multiple; }
+
+int write_all(int fd, const void *data, size_t size) {
+  const char *ptr = (const char *)data;
+  while (size > 0) {
+    const ssize_t written = write(fd, ptr, size);
+    if (written < 0) {
+      return 0;
+    }
+    ptr += written;
+    size -= written;
+  }
+  return 1;
+}
+
+} // namespace
+
+int snapshot_save(const char *path, enum snapshot_kind kind, const uint64_t *params, const struct snapshot_section *sections, int num_sections) {
+  if (num_sections > SNAPSHOT_MAX_SECTIONS) {
+    return 0;
+  }
+
+  struct snapshot_header header;
+  memset(&header, 0, sizeof(header));
+  header.magic        = SNAPSHOT_MAGIC;
+  header.version      = SNAPSHOT_VERSION;
+  header.kind         = kind;
+  header.num_sections = num_sections;
+  memcpy(header.params, params, sizeof(header.params));
+
+  uint64_t offset = SNAPSHOT_PAGE_SIZE;
+  for (int i = 0; i < num_sections; i++) {
+    header.section_offsets[i] = offset;
+    header.section_sizes[i]   = sections[i].size;
+    offset                    = round_up(offset + sections[i].size, SNAPSHOT_PAGE_SIZE);
+  }
+
+  // Write to a temporary file first, so that a crash while saving never leaves a truncated image behind.
+  const size_t path_len = strlen(path);
+  char *tmp_path        = (char *)malloc(path_len + 5);
+  if (tmp_path == NULL) {
+    return 0;
+  }
+  memcpy(tmp_path, path, path_len);
+  memcpy(tmp_path + path_len, ".tmp", 5);
+
+  const int fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    free(tmp_path);
+    return 0;
+  }
+
+  static const char zeros[SNAPSHOT_PAGE_SIZE] = {0};
+
+  int ok = write_all(fd, &header, sizeof(header)) && write_all(fd, zeros, SNAPSHOT_PAGE_SIZE - sizeof(header));
+  for (int i = 0; ok && i < num_sections; i++) {
+    const size_t padding = round_up(sections[i].size, SNAPSHOT_PAGE_SIZE) - sections[i].size;
+    ok                   = write_all(fd, sections[i].data, sections[i].size) && write_all(fd, zeros, padding);
+  }
+
+  ok = (close(fd) == 0) && ok;
+  ok = ok && (rename(tmp_path, path) == 0);
+
+  if (!ok) {
+    unlink(tmp_path);
+  }
+
+  free(tmp_path);
+  return ok;
+}
+
+int snapshot_map(const char *path, enum snapshot_kind kind, struct Snapshot **snapshot_out) {
+  const int fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    return 0;
+  }
+
+  struct stat st;
+  if (fstat(fd, &st) != 0 || (size_t)st.st_size < SNAPSHOT_PAGE_SIZE) {
+    close(fd);
+    return 0;
+  }
+
+  void *base = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (base == MAP_FAILED) {
+    return 0;
+  }
+
+  const struct snapshot_header *header = (const struct snapshot_header *)base;
+
+  int valid = header->magic == SNAPSHOT_MAGIC && header->version == SNAPSHOT_VERSION && header->kind == (uint32_t)kind &&
+              header->num_sections <= SNAPSHOT_MAX_SECTIONS;
+  for (uint32_t i = 0; valid && i < header->num_sections; i++) {
+    valid = header->section_offsets[i] + header->section_sizes[i] <= (uint64_t)st.st_size;
+  }
+
+  struct Snapshot *snapshot = valid ? (struct Snapshot *)malloc(sizeof(struct Snapshot)) : NULL;
+  if (snapshot == NULL) {
+    munmap(base, st.st_size);
+    return 0;
+  }
+
+  snapshot->base = base;
+  snapshot->size = st.st_size;
+  *snapshot_out  = snapshot;
+  return 1;
+}
+
+const struct snapshot_header *snapshot_get_header(const struct Snapshot *snapshot) { return (const struct snapshot_header *)snapshot->base; }
+
+void *snapshot_get_section(const struct Snapshot *snapshot, int section) {
+  return (char *)snapshot->base + snapshot_get_header(snapshot)->section_offsets[section];
+}
+
+void snapshot_unmap(struct Snapshot *snapshot) {
+  munmap(snapshot->base, snapshot->size);
+  free(snapshot);
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// On-disk image of a table, laid out so that it can be mapped back into memory and used in place.
+//
+// The file starts with a header page, followed by the table's arrays (sections), each one starting at a page boundary.
+
+#define SNAPSHOT_MAGIC 0x54414e5354454e4cull
+#define SNAPSHOT_VERSION 1
+#define SNAPSHOT_MAX_PARAMS 4
+#define SNAPSHOT_MAX_SECTIONS 8
+
+enum snapshot_kind {
+  SNAPSHOT_VECTOR = 1,
+  SNAPSHOT_DCHAIN,
+  SNAPSHOT_MAPVEC16,
+  SNAPSHOT_MAPVEC8,
+};
+
+struct snapshot_header {
+  uint64_t magic;
+  uint32_t version;
+  uint32_t kind;
+  // Table specific parameters (capacity, element size, ...).
+  uint64_t params[SNAPSHOT_MAX_PARAMS];
+  uint32_t num_sections;
+  uint32_t reserved;
+  uint64_t section_offsets[SNAPSHOT_MAX_SECTIONS];
+  uint64_t section_sizes[SNAPSHOT_MAX_SECTIONS];
+};
+
+struct snapshot_section {
+  const void *data;
+  size_t size;
+};
+
+struct Snapshot;
+
+//   Write a table image to disk.
+//   @param path - the file to write. It is replaced if it already exists.
+//   @param kind - the kind of table.
+//   @param params - SNAPSHOT_MAX_PARAMS table specific parameters.
+//   @param sections - the arrays of the table, written in this order.
+//   @param num_sections - the number of sections, up to SNAPSHOT_MAX_SECTIONS.
+//   @returns 1 if the image was written, and 0 otherwise.
+int snapshot_save(const char *path, enum snapshot_kind kind, const uint64_t *params, const struct snapshot_section *sections, int num_sections);
+
+//   Map a table image into memory.
+//   The mapping is private: the table can be modified in place, but changes
+//   never reach the file. Pages are only read from disk when first touched.
+//   @param path - the file to map.
+//   @param kind - the kind of table expected in the file.
+//   @param snapshot_out - output pointer to the mapped image.
+//   @returns 1 if the image was mapped, and 0 if the file could not be mapped
+//            or does not hold a table of the given kind and version.
+int snapshot_map(const char *path, enum snapshot_kind kind, struct Snapshot **snapshot_out);
+
+const struct snapshot_header *snapshot_get_header(const struct Snapshot *snapshot);
+
+//   @returns a pointer to the given section of the mapped image.
+void *snapshot_get_section(const struct Snapshot *snapshot, int section);
+
+//   Unmap an image. Tables using its sections must not be used afterwards.
+void snapshot_unmap(struct Snapshot *snapshot);
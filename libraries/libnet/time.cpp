@@ -2,13 +2,81 @@
 
 #include <time.h>
 #include <assert.h>
+#include <cpuid.h>
+#include <pthread.h>
+#include <x86intrin.h>
 
-time_ns_t last_time = 0;
+namespace {
 
-time_ns_t current_time(void) {
+// Spent busy-waiting on the first clock read to calibrate the TSC.
+constexpr const time_ns_t CALIBRATION_NS = 5000000;
+
+// Initial-exec, so that reading it does not go through __tls_get_addr from the shared library.
+__attribute__((tls_model("initial-exec"))) thread_local time_ns_t last_time = 0;
+
+enum tsc_state { TSC_UNCALIBRATED = 0, TSC_ENABLED, TSC_DISABLED };
+
+struct tsc_clock {
+  // Written once calibration is over, after the other fields.
+  int state;
+  uint64_t base_cycles;
+  time_ns_t base_ns;
+  double ns_per_cycle;
+};
+
+struct tsc_clock tsc           = {TSC_UNCALIBRATED, 0, 0, 0};
+pthread_once_t tsc_calibration = PTHREAD_ONCE_INIT;
+
+// Without an invariant TSC the cycle counter may change pace (or stop) with the power states, so it cannot be used as a clock.
+int has_invariant_tsc() {
+  unsigned eax, ebx, ecx, edx;
+  if (!__get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx)) {
+    return 0;
+  }
+  return (edx >> 8) & 1;
+}
+
+// Done on the first clock read rather than when the library is loaded, so that programs that never read the clock do not wait for it.
+void calibrate_tsc() {
+  if (!has_invariant_tsc()) {
+    __atomic_store_n(&tsc.state, TSC_DISABLED, __ATOMIC_RELEASE);
+    return;
+  }
+
+  const time_ns_t start_ns    = monotonic_time();
+  const uint64_t start_cycles = __rdtsc();
+  time_ns_t end_ns            = start_ns;
+  while (end_ns - start_ns < CALIBRATION_NS) {
+    end_ns = monotonic_time();
+  }
+  const uint64_t end_cycles = __rdtsc();
+
+  tsc.base_cycles  = end_cycles;
+  tsc.base_ns      = end_ns;
+  tsc.ns_per_cycle = (double)(end_ns - start_ns) / (double)(end_cycles - start_cycles);
+  __atomic_store_n(&tsc.state, TSC_ENABLED, __ATOMIC_RELEASE);
+}
+
+} // namespace
+
+time_ns_t monotonic_time(void) {
   struct timespec tp;
   clock_gettime(CLOCK_MONOTONIC, &tp);
-  last_time = tp.tv_sec * 1000000000ul + tp.tv_nsec;
+  return tp.tv_sec * 1000000000ul + tp.tv_nsec;
+}
+
+time_ns_t current_time(void) {
+  int state = __atomic_load_n(&tsc.state, __ATOMIC_ACQUIRE);
+  if (__builtin_expect(state == TSC_UNCALIBRATED, 0)) {
+    pthread_once(&tsc_calibration, calibrate_tsc);
+    state = __atomic_load_n(&tsc.state, __ATOMIC_ACQUIRE);
+  }
+
+  if (state == TSC_ENABLED) {
+    last_time = tsc.base_ns + (time_ns_t)((double)(int64_t)(__rdtsc() - tsc.base_cycles) * tsc.ns_per_cycle);
+  } else {
+    last_time = monotonic_time();
+  }
   return last_time;
 }
 
@@ -8,8 +8,17 @@
 
 #define NS_TO_S_MULTIPLIER (1000000000ul)
 
+// Monotonic time, in ns. Read from the TSC, converted with a factor calibrated
+// against CLOCK_MONOTONIC on the first call, which takes a few ms (falls back to
+// clock_gettime on CPUs without an invariant TSC).
 time_ns_t current_time(void);
 
-// Returns the last result of current_time. must only be called after
-// current_time was invoked at least once.
+// Returns the last result of current_time on the calling thread. must only be
+// called after current_time was invoked at least once by that thread. Reading
+// the clock once per burst of packets, and passing that time to all the calls
+// made while processing the burst (DoubleChain allocations, CMS and BloomFilter
+// cleanups, ...), leaves recent_time for the code that has no time at hand.
 time_ns_t recent_time(void);
+
+// Monotonic time, in ns, straight from clock_gettime(CLOCK_MONOTONIC).
+time_ns_t monotonic_time(void);
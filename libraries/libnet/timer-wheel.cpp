@@ -0,0 +1,222 @@
+#include "timer-wheel.h"
+
+#include <stdlib.h>
+#include <stddef.h>
+
+#define TW_NIL (-1)
+
+// All the per-index state in a single cell, so that rejuvenating touches a single cache line.
+struct tw_cell {
+  time_ns_t timestamp;
+  // Next index in the bucket list the index is filed in.
+  int next;
+  uint8_t allocated;
+  // Whether the index is in a bucket list. Freed indexes stay filed until their bucket is processed.
+  uint8_t filed;
+};
+
+struct TimerWheel {
+  struct tw_cell *cells;
+  int *buckets;
+  // Stack of free indexes.
+  int *free_stack;
+  int free_top;
+
+  int index_range;
+  int num_buckets;
+  time_ns_t granularity;
+
+  // Next tick (time / granularity) to be processed by expiry.
+  int64_t cursor;
+  int cursor_started;
+
+  // List of indexes detached from the bucket being processed.
+  int pending;
+};
+
+namespace {
+
+inline int64_t tick_of(const struct TimerWheel *tw, time_ns_t time) { return time / tw->granularity; }
+
+inline void file_index(struct TimerWheel *tw, int index, int64_t tick) {
+  // Never file behind the cursor, or the index would only be seen after a full turn
+  if (tick < tw->cursor) {
+    tick = tw->cursor;
+  }
+
+  int *bucket            = tw->buckets + (tick & (tw->num_buckets - 1));
+  tw->cells[index].next  = *bucket;
+  tw->cells[index].filed = 1;
+  *bucket                = index;
+}
+
+// Moves the cursor forward to tick, when nothing is allocated. The buckets skipped over only hold freed indexes: they are unfiled, or once
+// allocated again they would stay in a bucket behind the cursor, and only be seen after a full turn.
+void skip_to(struct TimerWheel *tw, int64_t tick) {
+  const int64_t skipped = tick - tw->cursor < tw->num_buckets ? tick - tw->cursor : tw->num_buckets;
+  for (int64_t i = 0; i < skipped; i++) {
+    int *bucket = tw->buckets + ((tw->cursor + i) & (tw->num_buckets - 1));
+    for (int index = *bucket; index != TW_NIL; index = tw->cells[index].next) {
+      tw->cells[index].filed = 0;
+    }
+    *bucket = TW_NIL;
+  }
+  tw->cursor = tick;
+}
+
+} // namespace
+
+int tw_allocate(int index_range, time_ns_t granularity, int num_buckets, const struct mem_opts *opts, struct TimerWheel **tw_out) {
+  if (index_range <= 0 || granularity <= 0 || num_buckets <= 0 || (num_buckets & (num_buckets - 1)) != 0) {
+    return 0;
+  }
+
+  struct TimerWheel *tw = (struct TimerWheel *)malloc(sizeof(struct TimerWheel));
+  if (tw == NULL) {
+    return 0;
+  }
+
+  tw->cells      = (struct tw_cell *)mem_alloc(sizeof(struct tw_cell) * (size_t)index_range, opts);
+  tw->buckets    = (int *)mem_alloc(sizeof(int) * (size_t)num_buckets, opts);
+  tw->free_stack = (int *)mem_alloc(sizeof(int) * (size_t)index_range, opts);
+  if (tw->cells == NULL || tw->buckets == NULL || tw->free_stack == NULL) {
+    mem_free(tw->cells);
+    mem_free(tw->buckets);
+    mem_free(tw->free_stack);
+    free(tw);
+    return 0;
+  }
+
+  for (int i = 0; i < index_range; i++) {
+    tw->cells[i].timestamp = 0;
+    tw->cells[i].next      = TW_NIL;
+    tw->cells[i].allocated = 0;
+    tw->cells[i].filed     = 0;
+
+    // Lower indexes are handed out first
+    tw->free_stack[i] = index_range - 1 - i;
+  }
+
+  for (int i = 0; i < num_buckets; i++) {
+    tw->buckets[i] = TW_NIL;
+  }
+
+  tw->free_top       = index_range;
+  tw->index_range    = index_range;
+  tw->num_buckets    = num_buckets;
+  tw->granularity    = granularity;
+  tw->cursor         = 0;
+  tw->cursor_started = 0;
+  tw->pending        = TW_NIL;
+
+  *tw_out = tw;
+  return 1;
+}
+
+void tw_free(struct TimerWheel *tw) {
+  mem_free(tw->cells);
+  mem_free(tw->buckets);
+  mem_free(tw->free_stack);
+  free(tw);
+}
+
+int tw_allocate_new_index(struct TimerWheel *tw, int *index_out, time_ns_t time) {
+  if (tw->free_top == 0) {
+    return 0;
+  }
+
+  if (!tw->cursor_started) {
+    tw->cursor         = tick_of(tw, time);
+    tw->cursor_started = 1;
+  }
+
+  const int index      = tw->free_stack[--tw->free_top];
+  struct tw_cell *cell = tw->cells + index;
+  cell->timestamp      = time;
+  cell->allocated      = 1;
+
+  // Indexes freed but still filed are re-filed lazily, like rejuvenated ones
+  if (!cell->filed) {
+    file_index(tw, index, tick_of(tw, time));
+  }
+
+  *index_out = index;
+  return 1;
+}
+
+int tw_rejuvenate_index(struct TimerWheel *tw, int index, time_ns_t time) {
+  struct tw_cell *cell = tw->cells + index;
+  if (!cell->allocated) {
+    return 0;
+  }
+  cell->timestamp = time;
+  return 1;
+}
+
+int tw_expire_one_index(struct TimerWheel *tw, int *index_out, time_ns_t time) {
+  if (!tw->cursor_started) {
+    return 0;
+  }
+
+  while (1) {
+    while (tw->pending != TW_NIL) {
+      const int index      = tw->pending;
+      struct tw_cell *cell = tw->cells + index;
+      tw->pending          = cell->next;
+
+      if (!cell->allocated) {
+        // Freed while filed: it is already on the free stack
+        cell->filed = 0;
+        continue;
+      }
+
+      // The bucket must lie entirely before time for the tick of the timestamp too, not only for the tick it was processed as: after a
+      // catch-up turn, a bucket holds the indexes of the current tick as well.
+      if (cell->timestamp < time && tick_of(tw, cell->timestamp) < tw->cursor) {
+        cell->allocated                = 0;
+        cell->filed                    = 0;
+        tw->free_stack[tw->free_top++] = index;
+        *index_out                     = index;
+        return 1;
+      }
+
+      // Rejuvenated since it was filed, or filed a turn ahead
+      file_index(tw, index, tick_of(tw, cell->timestamp));
+    }
+
+    // Only buckets entirely before time are processed
+    if ((tw->cursor + 1) * tw->granularity > time) {
+      return 0;
+    }
+
+    // Nothing allocated: jump straight to the current tick
+    if (tw->free_top == tw->index_range) {
+      skip_to(tw, tick_of(tw, time));
+      continue;
+    }
+
+    // A turn or more behind after an idle gap: buckets are only told apart by tick modulo num_buckets, so a single turn ending at the current
+    // tick sees every filed index, instead of walking all the ticks of the gap.
+    const int64_t turn_start = tick_of(tw, time) - tw->num_buckets;
+    if (tw->cursor < turn_start) {
+      tw->cursor = turn_start;
+    }
+
+    int *bucket = tw->buckets + (tw->cursor & (tw->num_buckets - 1));
+    tw->pending = *bucket;
+    *bucket     = TW_NIL;
+    tw->cursor++;
+  }
+}
+
+int tw_is_index_allocated(struct TimerWheel *tw, int index) { return tw->cells[index].allocated; }
+
+int tw_free_index(struct TimerWheel *tw, int index) {
+  struct tw_cell *cell = tw->cells + index;
+  if (!cell->allocated) {
+    return 0;
+  }
+  cell->allocated                = 0;
+  tw->free_stack[tw->free_top++] = index;
+  return 1;
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "time.h"
+#include "mem.h"
+
+struct TimerWheel;
+
+// Index allocator with the same API as DoubleChain, but with approximate
+// expiry order.
+//
+// Instead of keeping the allocated indexes in exact LRU order, they are filed
+// into a wheel of time buckets, each one granularity wide. Rejuvenating an
+// index only updates its timestamp: the index is re-filed lazily, when its
+// (stale) bucket comes up for expiry. So rejuvenation is a single write to the
+// index's own cell, instead of relinking three scattered list cells.
+//
+// Expiry is coarse: an index is only considered once the whole bucket it was
+// filed in is older than the expiry time, so it may be expired up to
+// granularity later than with DoubleChain (but never earlier).
+
+//   Allocate memory and initialize a new timer wheel allocator. The produced
+//   allocator will operate on indexes [0-index).
+//   @param index_range - the limit on the number of allocated indexes.
+//   @param granularity - the time span of each bucket.
+//   @param num_buckets - the number of buckets in the wheel, a power of 2.
+//                        Indexes that last longer than a full turn of the wheel
+//                        are still handled correctly, but are looked at once
+//                        per turn.
+//   @param opts - backing memory options (NULL for the defaults).
+//   @param tw_out - an output pointer that will hold the pointer to the newly
+//                   allocated allocator in the case of success.
+//   @returns 0 if the allocation failed, and 1 if the allocation is successful.
+int tw_allocate(int index_range, time_ns_t granularity, int num_buckets, const struct mem_opts *opts, struct TimerWheel **tw_out);
+
+//   Release an allocator obtained from tw_allocate.
+void tw_free(struct TimerWheel *tw);
+
+//   Allocate a fresh index.
+//   @param tw - pointer to the allocator.
+//   @param index_out - output pointer to the newly allocated index.
+//   @param time - current time. Allocator will note this for the new index.
+//   @returns 0 if there is no space, and 1 if the allocation is successful.
+int tw_allocate_new_index(struct TimerWheel *tw, int *index_out, time_ns_t time);
+
+//   Update the index timestamp. Needed to keep the index from expiration.
+//   @param tw - pointer to the allocator.
+//   @param index - the index to rejuvenate.
+//   @param time - the current time, it will replace the old timestamp.
+//   @returns 1 if the timestamp was updated, and 0 if the index is not tagged
+//            as allocated.
+int tw_rejuvenate_index(struct TimerWheel *tw, int index, time_ns_t time);
+
+//   Expire one index whose timestamp is older than time, out of the buckets
+//   that lie entirely before time.
+//   @param tw - pointer to the allocator.
+//   @param index_out - output pointer to the expired index.
+//   @param time - the time border, separating expired indexes from non-expired
+//                 ones.
+//   @returns 1 if an index was expired, 0 otherwise.
+int tw_expire_one_index(struct TimerWheel *tw, int *index_out, time_ns_t time);
+
+int tw_is_index_allocated(struct TimerWheel *tw, int index);
+
+int tw_free_index(struct TimerWheel *tw, int index);
@@ -0,0 +1,166 @@
+#include "topk.h"
+#include "compute.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <immintrin.h>
+
+#include <algorithm>
+
+namespace {
+
+// The index is kept at most half full.
+inline uint64_t index_capacity(uint32_t k) {
+  const uint64_t capacity = 2 * (uint64_t)k;
+  return is_power_of_two(capacity) ? capacity : ensure_power_of_two(capacity);
+}
+
+} // namespace
+
+TopK::TopK(uint32_t _k, uint32_t _key_size, struct CMS *_cms, const struct mem_opts *opts)
+    : k(_k), key_size(_key_size), cms(_cms), index(index_capacity(_k), _key_size, opts), size(0) {
+  if (_k == 0) {
+    fprintf(stderr, "Error: k must be positive\n");
+    exit(1);
+  }
+
+  slot_keys      = (uint8_t *)mem_alloc((size_t)k * key_size, opts);
+  slot_positions = (int *)mem_alloc(sizeof(int) * k, opts);
+  heap_counts    = (int *)mem_alloc(sizeof(int) * k, opts);
+  heap_slots     = (int *)mem_alloc(sizeof(int) * k, opts);
+  order          = (int *)mem_alloc(sizeof(int) * k, opts);
+  if (slot_keys == NULL || slot_positions == NULL || heap_counts == NULL || heap_slots == NULL || order == NULL) {
+    fprintf(stderr, "Error: Failed to allocate the top-k candidates\n");
+    exit(1);
+  }
+}
+
+TopK::~TopK() {
+  mem_free(slot_keys);
+  mem_free(slot_positions);
+  mem_free(heap_counts);
+  mem_free(heap_slots);
+  mem_free(order);
+}
+
+void TopK::swap(uint32_t pos1, uint32_t pos2) {
+  std::swap(heap_counts[pos1], heap_counts[pos2]);
+  std::swap(heap_slots[pos1], heap_slots[pos2]);
+  slot_positions[heap_slots[pos1]] = pos1;
+  slot_positions[heap_slots[pos2]] = pos2;
+}
+
+void TopK::sift_up(uint32_t pos) {
+  while (pos > 0) {
+    const uint32_t parent = (pos - 1) / 2;
+    if (heap_counts[parent] <= heap_counts[pos]) {
+      break;
+    }
+    swap(pos, parent);
+    pos = parent;
+  }
+}
+
+void TopK::sift_down(uint32_t pos) {
+  while (true) {
+    const uint32_t left  = 2 * pos + 1;
+    const uint32_t right = left + 1;
+    uint32_t smallest    = pos;
+    if (left < size && heap_counts[left] < heap_counts[smallest]) {
+      smallest = left;
+    }
+    if (right < size && heap_counts[right] < heap_counts[smallest]) {
+      smallest = right;
+    }
+    if (smallest == pos) {
+      break;
+    }
+    swap(pos, smallest);
+    pos = smallest;
+  }
+}
+
+// Estimates only grow between cleanups: a candidate whose count is updated can only move down the heap.
+void TopK::offer(void *key, int count) {
+  if (size == k && count <= heap_counts[0]) {
+    return;
+  }
+
+  int slot;
+  if (index.get(key, &slot)) {
+    const uint32_t pos = slot_positions[slot];
+    heap_counts[pos]   = count;
+    sift_down(pos);
+    return;
+  }
+
+  if (size < k) {
+    slot = size;
+    memcpy(slot_keys + (size_t)slot * key_size, key, key_size);
+    index.put(slot_keys + (size_t)slot * key_size, slot);
+    slot_positions[slot] = size;
+    heap_counts[size]    = count;
+    heap_slots[size]     = slot;
+    size++;
+    sift_up(size - 1);
+    return;
+  }
+
+  // Replace the smallest candidate. Its key has to leave the index before its slot is overwritten.
+  slot = heap_slots[0];
+  index.erase(slot_keys + (size_t)slot * key_size);
+  memcpy(slot_keys + (size_t)slot * key_size, key, key_size);
+  index.put(slot_keys + (size_t)slot * key_size, slot);
+  heap_counts[0] = count;
+  sift_down(0);
+}
+
+void TopK::update(void *key) {
+  cms_increment(cms, key);
+  offer(key, cms_count_min(cms, key));
+}
+
+void TopK::update_vec(void *keys) {
+  int counts[CMS_VECTOR_SIZE];
+  cms_increment_vec(cms, keys);
+  cms_count_min_vec(cms, keys, counts);
+
+  const int threshold = size == k ? heap_counts[0] : -1;
+  __mmask16 above     = _mm512_cmpgt_epi32_mask(_mm512_loadu_si512(counts), _mm512_set1_epi32(threshold));
+
+  // The threshold only grows while the keys are offered, offer() checks it again.
+  while (above) {
+    const int lane = __builtin_ctz(above);
+    offer((uint8_t *)keys + (size_t)lane * key_size, counts[lane]);
+    above &= above - 1;
+  }
+}
+
+uint32_t TopK::topk(void *keys_out, int *counts_out) const {
+  for (uint32_t pos = 0; pos < size; pos++) {
+    order[pos] = pos;
+  }
+  std::sort(order, order + size, [this](int pos1, int pos2) { return heap_counts[pos1] > heap_counts[pos2]; });
+
+  for (uint32_t i = 0; i < size; i++) {
+    const int pos = order[i];
+    memcpy((uint8_t *)keys_out + (size_t)i * key_size, slot_keys + (size_t)heap_slots[pos] * key_size, key_size);
+    counts_out[i] = heap_counts[pos];
+  }
+  return size;
+}
+
+uint32_t TopK::get_size() const { return size; }
+
+int TopK::periodic_cleanup(time_ns_t now) {
+  if (!cms_periodic_cleanup(cms, now)) {
+    return 0;
+  }
+
+  for (uint32_t pos = 0; pos < size; pos++) {
+    index.erase(slot_keys + (size_t)heap_slots[pos] * key_size);
+  }
+  size = 0;
+  return 1;
+}
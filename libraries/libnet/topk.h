@@ -0,0 +1,51 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "cms.h"
+#include "map.h"
+#include "mem.h"
+#include "time.h"
+
+// Heavy hitters: the k keys with the largest counts in a CMS. The candidates are kept in a min-heap of their estimates, indexed by key. A key
+// becomes a candidate when its estimate gets past the smallest one in the heap, and takes its place.
+class TopK {
+private:
+  const uint32_t k;
+  const uint32_t key_size;
+
+  // Owned by the caller, like the keys of a Map.
+  struct CMS *cms;
+  // Key of a candidate -> its slot.
+  Map index;
+
+  // Candidate keys, one slot of key_size bytes each.
+  uint8_t *slot_keys;
+  int *slot_positions;
+  // The heap, by position: estimates and the slot of their key.
+  int *heap_counts;
+  int *heap_slots;
+  uint32_t size;
+
+  // Scratch space of topk().
+  int *order;
+
+  void offer(void *key, int count);
+  void swap(uint32_t pos1, uint32_t pos2);
+  void sift_up(uint32_t pos);
+  void sift_down(uint32_t pos);
+
+public:
+  // The backing memory of the candidates is configured by opts (NULL for the defaults).
+  TopK(uint32_t k, uint32_t key_size, struct CMS *cms, const struct mem_opts *opts = nullptr);
+  ~TopK();
+
+  void update(void *key);
+  // Same as update, for CMS_VECTOR_SIZE keys laid out one after the other. Only the keys estimated above the smallest candidate are looked up.
+  void update_vec(void *keys);
+  // Copies the candidates to keys_out (k * key_size bytes) and their estimates to counts_out (k ints), largest first. Returns their number.
+  uint32_t topk(void *keys_out, int *counts_out) const;
+  uint32_t get_size() const;
+  // Same as cms_periodic_cleanup, the candidates are dropped along with the counts.
+  int periodic_cleanup(time_ns_t now);
+};
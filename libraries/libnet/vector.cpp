@@ -1,23 +1,21 @@
 #include <stdlib.h>
 #include <stdint.h>
 #include <string.h>
+#include <limits.h>
 
 #include "vector.h"
+#include "snapshot.h"
 
-struct Vector {
-  char *data;
-  int elem_size;
-  unsigned capacity;
-};
+int vector_allocate(int elem_size, unsigned capacity, struct Vector **vector_out) { return vector_allocate_mem(elem_size, capacity, NULL, vector_out); }
 
-int vector_allocate(int elem_size, unsigned capacity, struct Vector **vector_out) {
+int vector_allocate_mem(int elem_size, unsigned capacity, const struct mem_opts *opts, struct Vector **vector_out) {
   struct Vector *old_vector_val = *vector_out;
   struct Vector *vector_alloc   = (struct Vector *)malloc(sizeof(struct Vector));
   if (vector_alloc == 0)
     return 0;
   *vector_out = (struct Vector *)vector_alloc;
 
-  char *data_alloc = (char *)malloc((uint32_t)elem_size * capacity);
+  char *data_alloc = (char *)mem_alloc((size_t)elem_size * capacity, opts);
   if (data_alloc == 0) {
     free(vector_alloc);
     *vector_out = old_vector_val;
@@ -26,17 +24,60 @@ int vector_allocate(int elem_size, unsigned capacity, struct Vector **vector_out
   (*vector_out)->data      = data_alloc;
   (*vector_out)->elem_size = elem_size;
   (*vector_out)->capacity  = capacity;
+  (*vector_out)->snapshot  = NULL;
 
   for (unsigned i = 0; i < capacity; ++i) {
-    memset((*vector_out)->data + elem_size * (int)i, 0, elem_size);
+    memset((*vector_out)->data + (size_t)elem_size * i, 0, elem_size);
   }
 
   return 1;
 }
 
-void vector_borrow(struct Vector *vector, int index, void **val_out) { *val_out = vector->data + index * vector->elem_size; }
+void vector_free(struct Vector *vector) {
+  if (vector->snapshot) {
+    snapshot_unmap(vector->snapshot);
+  } else {
+    mem_free(vector->data);
+  }
+  free(vector);
+}
+
+int vector_save(struct Vector *vector, const char *path) {
+  const uint64_t params[SNAPSHOT_MAX_PARAMS] = {(uint64_t)vector->elem_size, vector->capacity, 0, 0};
+  const struct snapshot_section sections[]   = {{vector->data, (size_t)vector->elem_size * vector->capacity}};
+  return snapshot_save(path, SNAPSHOT_VECTOR, params, sections, 1);
+}
+
+int vector_load(const char *path, struct Vector **vector_out) {
+  struct Snapshot *snapshot;
+  if (!snapshot_map(path, SNAPSHOT_VECTOR, &snapshot)) {
+    return 0;
+  }
+
+  // The elements must be exactly the ones the parameters describe.
+  const struct snapshot_header *header = snapshot_get_header(snapshot);
+  const uint64_t elem_size             = header->params[0];
+  const uint64_t capacity              = header->params[1];
+  if (elem_size == 0 || elem_size > INT_MAX || capacity > UINT_MAX || header->num_sections != 1 || header->section_sizes[0] != elem_size * capacity) {
+    snapshot_unmap(snapshot);
+    return 0;
+  }
+
+  struct Vector *vector_alloc = (struct Vector *)malloc(sizeof(struct Vector));
+  if (vector_alloc == 0) {
+    snapshot_unmap(snapshot);
+    return 0;
+  }
+
+  // The image is unmapped by vector_free.
+  vector_alloc->data      = (char *)snapshot_get_section(snapshot, 0);
+  vector_alloc->elem_size = (int)elem_size;
+  vector_alloc->capacity  = (unsigned)capacity;
+  vector_alloc->snapshot  = snapshot;
 
-void vector_return(struct Vector *vector, int index, void *value) {}
+  *vector_out = vector_alloc;
+  return 1;
+}
 
 void vector_clear(struct Vector *vector) { memset(vector->data, 0, vector->elem_size * vector->capacity); }
 
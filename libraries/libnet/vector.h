@@ -1,16 +1,71 @@
 #pragma once
 
+#include <assert.h>
+#include <stddef.h>
 #include <stdint.h>
+#include <immintrin.h>
+
+#include "mem.h"
 
 #define VECTOR_CAPACITY_UPPER_LIMIT 140000
 
-struct Vector;
+struct Snapshot;
+
+// Exposed so that the accessors below are inlined into their callers, instead of going through the PLT of the shared library.
+struct Vector {
+  char *data;
+  int elem_size;
+  unsigned capacity;
+  // Image the elements are mapped from, NULL when they were allocated.
+  struct Snapshot *snapshot;
+};
 
 int vector_allocate(int elem_size, unsigned capacity, struct Vector **vector_out);
-void vector_borrow(struct Vector *vector, int index, void **val_out);
-void vector_return(struct Vector *vector, int index, void *value);
+// Same as vector_allocate, with the backing memory of the elements configured by opts (NULL for the defaults).
+int vector_allocate_mem(int elem_size, unsigned capacity, const struct mem_opts *opts, struct Vector **vector_out);
+// Release a vector obtained from vector_allocate, vector_allocate_mem or vector_load. A loaded vector is unmapped.
+void vector_free(struct Vector *vector);
+
+static inline void vector_borrow(struct Vector *vector, int index, void **val_out) { *val_out = vector->data + (size_t)index * vector->elem_size; }
+static inline void vector_return(struct Vector *vector, int index, void *value) {}
+
+// Borrow the 16 elements at the given 32 bit indexes at once.
+// @param vals_out - output array of 16 pointers, in the order of the indexes.
+static inline void vector_borrow_vec(struct Vector *vector, __m512i indexes, void **vals_out) {
+  const __m512i base      = _mm512_set1_epi64((int64_t)vector->data);
+  const __m512i elem_size = _mm512_set1_epi64(vector->elem_size);
+
+  const __m512i lo = _mm512_cvtepi32_epi64(_mm512_castsi512_si256(indexes));
+  const __m512i hi = _mm512_cvtepi32_epi64(_mm512_extracti64x4_epi64(indexes, 1));
+
+  _mm512_storeu_si512(vals_out, _mm512_add_epi64(base, _mm512_mullo_epi64(lo, elem_size)));
+  _mm512_storeu_si512(vals_out + 8, _mm512_add_epi64(base, _mm512_mullo_epi64(hi, elem_size)));
+}
+
+// Gather the first 4B of the 16 elements at the given 32 bit indexes, for vectors of elements at least 4B large.
+static inline __m512i vector_gather32_vec(struct Vector *vector, __m512i indexes) {
+  // The gather scales the indexes itself for the element sizes it supports, which covers any capacity.
+  switch (vector->elem_size) {
+  case 4:
+    return _mm512_i32gather_epi32(indexes, vector->data, 4);
+  case 8:
+    return _mm512_i32gather_epi32(indexes, vector->data, 8);
+  }
+
+  // Otherwise the byte offsets are computed on 32 bits, and must not wrap.
+  assert((size_t)vector->capacity * (size_t)vector->elem_size <= INT32_MAX);
+  const __m512i offsets = _mm512_mullo_epi32(indexes, _mm512_set1_epi32(vector->elem_size));
+  return _mm512_i32gather_epi32(offsets, vector->data, 1);
+}
+
 void vector_clear(struct Vector *vector);
 
+// Write the vector to disk, as an image that vector_load can map back in place.
+int vector_save(struct Vector *vector, const char *path);
+// Map a vector saved with vector_save. The elements are read from disk lazily, as they are first accessed.
+// Fails if the image does not hold a vector, or its elements do not match its element size and capacity.
+int vector_load(const char *path, struct Vector **vector_out);
+
 // Randomly sample an element from the vector and compare it with the provided
 // threshold value.
 // Little endian byte by byte comparison (so it doesn't work for signed
@@ -0,0 +1,287 @@
+#pragma once
+
+#include <libutil/hash.h>
+#include <libutil/math.h>
+#include <libutil/zmm.h>
+#include <libnet/mem.h>
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <immintrin.h>
+#include <assert.h>
+
+#include <atomic>
+
+// MapVec8 variant that supports multiple threads inserting and reading at the same time, without locks.
+//
+// As in MapVec8, each slot holds its {hash, value} pair in a single 8B word. A thread claims an empty slot by atomically swapping that word from
+// SPECIAL_NULL_HASH to SPECIAL_BUSY_HASH (cmpxchg), then publishes the key pointer, and only then makes the real hash visible. So any reader that
+// sees a matching hash is guaranteed to also see the key pointer. Slots that are busy are skipped by readers, as if they were taken by another key.
+//
+// There is no erase: the table is meant for concurrent flow setup, and removing keys from a linear probing table that is being concurrently
+// probed is not supported.
+template <size_t key_size> class ConcurrentMapVec8 {
+public:
+  static constexpr const u32 VECTOR_SIZE       = 8;
+  static constexpr const u32 SPECIAL_NULL_HASH = 0;
+  static constexpr const u32 SPECIAL_BUSY_HASH = 0xffffffff;
+
+private:
+  const u32 capacity;
+
+  typedef struct {
+    u32 hash;
+    int value;
+  } hash_value_t;
+
+  static_assert(sizeof(hash_value_t) == sizeof(u64), "The hash and value must fit in a single 8B word");
+
+  hash_value_t *hashes_values;
+  void **keyps;
+
+  std::atomic<u32> size;
+
+public:
+  // The backing memory of the table is configured by opts (nullptr for the defaults).
+  ConcurrentMapVec8(u32 _capacity, const struct mem_opts *opts = nullptr) : capacity(_capacity), size(0) {
+    // Check that capacity is a power of 2
+    if (_capacity == 0 || is_power_of_two(_capacity) == 0) {
+      fprintf(stderr, "Error: Capacity must be a power of 2\n");
+      exit(1);
+    }
+
+    hashes_values = (hash_value_t *)mem_alloc(sizeof(hash_value_t) * _capacity, opts);
+    keyps         = (void **)mem_alloc(sizeof(void *) * _capacity, opts);
+
+    for (u32 i = 0; i < capacity; ++i) {
+      hashes_values[i].hash  = SPECIAL_NULL_HASH;
+      hashes_values[i].value = 0;
+      keyps[i]               = nullptr;
+    }
+  }
+
+  ~ConcurrentMapVec8() {
+    mem_free(hashes_values);
+    mem_free(keyps);
+  }
+
+  // Returns a bitmask of the lanes whose key was found. Values of the lanes that were not found are left untouched.
+  int get_vec(void *keys, int *values_out) const {
+    // Create a mask with all bits set to 1.
+    // This mask will be updated in each iteration of the loop, indicating the lanes that are still pending.
+    __mmask8 mask  = 0xff;
+    __mmask8 found = 0;
+
+    // Offset vector for linear probing, starting at 0.
+    __m512i offset = _mm512_setzero_si512();
+
+    // Load the hashes into a vector register
+    const __m512i hashes_vec = hash_keys_vec(keys);
+
+    // Key pointers of each lane
+    const __m512i base_offsets = _mm512_set_epi64(7, 6, 5, 4, 3, 2, 1, 0);
+    const __m512i keysp_base   = _mm512_add_epi64(_mm512_set1_epi64((u64)keys), _mm512_mullo_epi64(base_offsets, _mm512_set1_epi64(key_size)));
+
+    while (mask != 0) {
+      // Add offset to hashes and & capacity - 1 to get the indices within the capacity
+      const __m512i indices_vec = _mm512_and_epi64(_mm512_add_epi64(hashes_vec, offset), _mm512_set1_epi64(capacity - 1));
+
+      // Selectively gather hashes and values with the mask.
+      // Each 8B slot is read as a whole, so the hash and the value are always consistent.
+      const __m512i map_hashes_values_vec = _mm512_mask_i64gather_epi64(_mm512_setzero_si512(), mask, indices_vec, hashes_values, sizeof(hash_value_t));
+
+      // The key pointers must only be read after the hashes (acquire).
+      std::atomic_thread_fence(std::memory_order_acquire);
+
+      // Mask the values out, get the hashes
+      const __m512i map_hashes_vec = _mm512_and_epi64(map_hashes_values_vec, _mm512_set1_epi64(0x00000000ffffffff));
+
+      // Busy slots never match, as no key hashes to SPECIAL_BUSY_HASH.
+      const __mmask8 not_empty_slot = _mm512_mask_cmpneq_epi64_mask(mask, map_hashes_vec, _mm512_set1_epi64(SPECIAL_NULL_HASH));
+      __mmask8 match_mask           = _mm512_mask_cmpeq_epi64_mask(not_empty_slot, map_hashes_vec, hashes_vec);
+
+      // If the slot is empty, we can stop probing for that lane.
+      mask = _mm512_kand(not_empty_slot, mask);
+
+      // Load the keys from memory for the lanes where the match_mask is set
+      __m512i keysp_vec        = keysp_base;
+      __m512i target_keysp_vec = _mm512_mask_i64gather_epi64(_mm512_setzero_si512(), match_mask, indices_vec, keyps, sizeof(void *));
+
+      for (u32 bytes_compared = 0; bytes_compared < key_size; bytes_compared += 8) {
+        static_assert(key_size % 8 == 0, "Keys are compared 8B at a time");
+        const __m512i keys_vec        = _mm512_mask_i64gather_epi64(_mm512_setzero_si512(), match_mask, keysp_vec, NULL, 1);
+        const __m512i target_keys_vec = _mm512_mask_i64gather_epi64(_mm512_setzero_si512(), match_mask, target_keysp_vec, NULL, 1);
+        match_mask                    = _mm512_mask_cmpeq_epi64_mask(match_mask, keys_vec, target_keys_vec);
+
+        keysp_vec        = _mm512_add_epi64(keysp_vec, _mm512_set1_epi64(8));
+        target_keysp_vec = _mm512_add_epi64(target_keysp_vec, _mm512_set1_epi64(8));
+      }
+
+      const __m256i values_256vec = _mm512_cvtepi64_epi32(_mm512_srli_epi64(map_hashes_values_vec, 32));
+      _mm256_mask_storeu_epi32((__m256i *)values_out, match_mask, values_256vec);
+      found = _kor_mask8(found, match_mask);
+
+      // Update pending lanes and increment their offset
+      mask   = _mm512_kandn(match_mask, mask);
+      offset = _mm512_mask_add_epi64(offset, mask, offset, _mm512_set1_epi64(1));
+
+      // If offset == capacity, stop probing these lanes
+      mask = _mm512_mask_cmpneq_epi64_mask(mask, offset, _mm512_set1_epi64(capacity));
+    }
+
+    return found;
+  }
+
+  // Safe to be called by multiple threads at the same time.
+  // Keys are not checked for duplicates, as in MapVec8.
+  void put_vec(void *keys, int *values) {
+    assert(size.load(std::memory_order_relaxed) + VECTOR_SIZE <= capacity);
+
+    // Lanes still looking for a slot
+    __mmask8 mask = 0xff;
+
+    // Offset vector for linear probing, starting at 0.
+    __m512i offset = _mm512_setzero_si512();
+
+    // Load the hashes into a vector register
+    const __m512i hashes_vec = hash_keys_vec(keys);
+
+    // Combine the 8 values with the hashes, values in the 'odd' dwords, hashes in the 'even' ones.
+    __m512i values_vec     = _mm512_castsi256_si512(_mm256_loadu_si256((__m256i *)values));
+    values_vec             = _mm512_permutexvar_epi32(_mm512_set_epi32(7, 16, 6, 16, 5, 16, 4, 16, 3, 16, 2, 16, 1, 16, 0, 16), values_vec);
+    const __m512i combined = _mm512_mask_blend_epi32(0xAAAA, hashes_vec, values_vec);
+
+    // Key pointers of each lane
+    const __m512i base_offsets = _mm512_set_epi64(7, 6, 5, 4, 3, 2, 1, 0);
+    const __m512i keysp_vec    = _mm512_add_epi64(_mm512_set1_epi64((u64)keys), _mm512_mullo_epi64(base_offsets, _mm512_set1_epi64(key_size)));
+
+    u32 inserted = 0;
+
+    while (mask != 0) {
+      // Add offset to hashes and & capacity - 1 to get the indices within the capacity
+      const __m512i indices_vec = _mm512_and_epi64(_mm512_add_epi64(hashes_vec, offset), _mm512_set1_epi64(capacity - 1));
+
+      // A lane can only proceed if it has NO conflicts with previous lanes
+      const __m512i conflicts         = _mm512_mask_conflict_epi64(_mm512_setzero_si512(), mask, indices_vec);
+      const __mmask8 no_conflict_mask = _mm512_mask_testn_epi64_mask(mask, conflicts, _mm512_set1_epi64(0xffffffffffffffff));
+
+      // Selectively gather hashes and values with the mask
+      const __m512i map_hashes_values_vec = _mm512_mask_i64gather_epi64(_mm512_setzero_si512(), no_conflict_mask, indices_vec, hashes_values, sizeof(hash_value_t));
+      const __m512i map_hashes_vec        = _mm512_and_epi64(map_hashes_values_vec, _mm512_set1_epi64(0x00000000ffffffff));
+
+      // Lanes that found an empty slot and will try to claim it.
+      const __mmask8 candidates = _mm512_mask_cmpeq_epi64_mask(no_conflict_mask, map_hashes_vec, _mm512_set1_epi64(SPECIAL_NULL_HASH));
+
+      // There is no vector CAS, so each candidate lane claims its slot with its own cmpxchg.
+      alignas(64) u64 indices[VECTOR_SIZE];
+      alignas(64) u64 expected[VECTOR_SIZE];
+      _mm512_store_si512((void *)indices, indices_vec);
+      _mm512_store_si512((void *)expected, map_hashes_values_vec);
+
+      __mmask8 claimed = 0;
+      __mmask8 lost    = 0;
+      for (u32 pending = candidates; pending != 0; pending &= pending - 1) {
+        const u32 lane = __builtin_ctz(pending);
+        if (claim_slot(indices[lane], expected[lane])) {
+          claimed |= 1 << lane;
+        } else {
+          lost |= 1 << lane;
+        }
+      }
+
+      // Publish the key pointers first, and only then the hashes.
+      _mm512_mask_i64scatter_epi64(keyps, claimed, indices_vec, keysp_vec, sizeof(void *));
+      std::atomic_thread_fence(std::memory_order_release);
+      _mm512_mask_i64scatter_epi64(hashes_values, claimed, indices_vec, combined, sizeof(hash_value_t));
+
+      inserted += _mm_popcnt_u32(claimed);
+
+      // Lanes that lost the race retry the same slot: if it is now taken, they will move on to the next one.
+      mask = _mm512_kandn(claimed, mask);
+
+      const __mmask8 advance = _mm512_kandn(lost, mask);
+      offset                 = _mm512_mask_add_epi64(offset, advance, offset, _mm512_set1_epi64(1));
+
+      // If offset == capacity, the table is full for these lanes
+      mask = _mm512_mask_cmpneq_epi64_mask(mask, offset, _mm512_set1_epi64(capacity));
+    }
+
+    size.fetch_add(inserted, std::memory_order_relaxed);
+  }
+
+  int get(void *key, int *value_out) const {
+    const u32 hash = hash_key(key);
+
+    for (u32 i = 0; i < capacity; ++i) {
+      const u32 index       = loop(hash + i, capacity);
+      const hash_value_t vh = load_slot(index);
+      if (vh.hash == SPECIAL_NULL_HASH) {
+        return 0;
+      }
+      if (vh.hash == hash && keq(__atomic_load_n(&keyps[index], __ATOMIC_RELAXED), key)) {
+        *value_out = vh.value;
+        return 1;
+      }
+    }
+
+    return 0;
+  }
+
+  // Safe to be called by multiple threads at the same time.
+  void put(void *key, int value) {
+    const u32 hash = hash_key(key);
+
+    for (u32 i = 0; i < capacity; ++i) {
+      const u32 index       = loop(hash + i, capacity);
+      const hash_value_t vh = load_slot(index);
+      if (vh.hash != SPECIAL_NULL_HASH) {
+        continue;
+      }
+
+      if (!claim_slot(index, pack(vh))) {
+        // Lost the race for this slot, try it again.
+        --i;
+        continue;
+      }
+
+      __atomic_store_n(&keyps[index], key, __ATOMIC_RELAXED);
+      __atomic_store_n((u64 *)&hashes_values[index], pack({hash, value}), __ATOMIC_RELEASE);
+
+      size.fetch_add(1, std::memory_order_relaxed);
+      break;
+    }
+  }
+
+  u32 get_size() const { return size.load(std::memory_order_relaxed); }
+
+private:
+  int keq(void *key1, void *key2) const { return memcmp(key1, key2, key_size) == 0; }
+  u32 loop(u32 k, u32 capacity) const { return k & (capacity - 1); }
+
+  static u64 pack(hash_value_t vh) { return ((u64)(u32)vh.value << 32) | vh.hash; }
+
+  hash_value_t load_slot(u32 index) const {
+    const u64 word = __atomic_load_n((u64 *)&hashes_values[index], __ATOMIC_ACQUIRE);
+    return {(u32)word, (int)(word >> 32)};
+  }
+
+  // Swaps an empty slot to busy. Fails if someone else changed the slot in the meantime.
+  bool claim_slot(u32 index, u64 expected) {
+    return __atomic_compare_exchange_n((u64 *)&hashes_values[index], &expected, pack({SPECIAL_BUSY_HASH, 0}), false, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED);
+  }
+
+  // Keys hashing to one of the reserved hashes are moved to another one.
+  __m512i hash_keys_vec(void *keys) const {
+    __m256i hashes            = fxhash_vec8<key_size>(keys);
+    const __mmask8 null_lanes = _mm256_cmpeq_epi32_mask(hashes, _mm256_set1_epi32(SPECIAL_NULL_HASH));
+    const __mmask8 busy_lanes = _mm256_cmpeq_epi32_mask(hashes, _mm256_set1_epi32(SPECIAL_BUSY_HASH));
+    hashes                    = _mm256_mask_mov_epi32(hashes, null_lanes | busy_lanes, _mm256_set1_epi32(1));
+    return _mm512_cvtepu32_epi64(hashes);
+  }
+
+  u32 hash_key(void *key) const {
+    const u32 hash = fxhash<key_size>(key);
+    return (hash == SPECIAL_NULL_HASH || hash == SPECIAL_BUSY_HASH) ? 1 : hash;
+  }
+};
@@ -0,0 +1,179 @@
+#pragma once
+
+#include <libnetvec/mapvec16.h>
+#include <libnet/double-chain.h>
+#include <libnet/mem.h>
+#include <libutil/math.h>
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <immintrin.h>
+
+// What lookup_or_create_vec does with new flows when all the flow indexes are taken.
+enum flowtable_full_policy {
+  // New flows are rejected (index -1).
+  FLOWTABLE_REJECT,
+  // The least recently seen flow is evicted to make room for the new one.
+  FLOWTABLE_EVICT_OLDEST,
+};
+
+// Flow table combining the pieces every NF composes by hand: a map from flow keys to flow indexes, an allocator that keeps the indexes in LRU
+// order with their last-seen timestamps, and the per-flow state.
+//
+// Flows are identified by their index in [0, capacity). Each index owns an entry holding the flow key (which the map points to) next to the flow
+// state, so a hit reads the key and the state from the same cache line (as long as the state is small).
+template <size_t key_size, typename State> class FlowTable {
+public:
+  static constexpr const u32 VECTOR_SIZE = MapVec16<key_size>::VECTOR_SIZE;
+
+private:
+  struct entry_t {
+    u8 key[key_size];
+    State state;
+  };
+
+  const u32 capacity;
+  const time_ns_t expiration_time;
+  const enum flowtable_full_policy full_policy;
+
+  // Kept at most half full, so that probing stays short.
+  MapVec16<key_size> map;
+  struct DoubleChain *chain;
+  entry_t *entries;
+
+public:
+  // Flows not seen for expiration_time are removed by expire_vec.
+  FlowTable(u32 _capacity, time_ns_t _expiration_time, enum flowtable_full_policy _full_policy = FLOWTABLE_REJECT, const struct mem_opts *opts = nullptr)
+      : capacity(_capacity), expiration_time(_expiration_time), full_policy(_full_policy), map(2 * _capacity, opts), chain(nullptr) {
+    // Check that capacity is a power of 2
+    if (_capacity == 0 || is_power_of_two(_capacity) == 0) {
+      fprintf(stderr, "Error: Capacity must be a power of 2\n");
+      exit(1);
+    }
+
+    // Flows of the burst being processed must never be the oldest ones
+    if (_full_policy == FLOWTABLE_EVICT_OLDEST && _capacity < 2 * VECTOR_SIZE) {
+      fprintf(stderr, "Error: Evicting flow tables must hold at least two bursts of flows\n");
+      exit(1);
+    }
+
+    if (!dchain_allocate_mem(_capacity, opts, &chain)) {
+      fprintf(stderr, "Error: Failed to allocate the flow allocator\n");
+      exit(1);
+    }
+
+    entries = (entry_t *)mem_alloc(sizeof(entry_t) * _capacity, opts);
+    if (entries == nullptr) {
+      fprintf(stderr, "Error: Failed to allocate the flow entries\n");
+      exit(1);
+    }
+  }
+
+  ~FlowTable() {
+    dchain_free(chain);
+    mem_free(entries);
+  }
+
+  // Looks up the VECTOR_SIZE flows whose keys are stored contiguously in keys, writing their flow indexes to indices_out.
+  // Flows that are found are refreshed, and the others are created (with a default constructed state), all with the now timestamp. A flow
+  // showing up more than once in the burst is only created once. When the table is full, new flows either get index -1 (FLOWTABLE_REJECT) or
+  // take the index of the least recently seen flow, which is removed (FLOWTABLE_EVICT_OLDEST).
+  // Returns a bitmask of the lanes whose flow was created by this call.
+  int lookup_or_create_vec(void *keys, time_ns_t now, int *indices_out) {
+    const __mmask16 found = map.get_vec(keys, indices_out);
+
+    for (__mmask16 lanes = found; lanes != 0; lanes &= lanes - 1) {
+      dchain_rejuvenate_index(chain, indices_out[__builtin_ctz(lanes)], now);
+    }
+
+    __mmask16 created = 0;
+
+    for (__mmask16 lanes = ~found; lanes != 0; lanes &= lanes - 1) {
+      const u32 lane = __builtin_ctz(lanes);
+      u8 *key        = (u8 *)keys + lane * key_size;
+
+      // The flow may have been created by a previous lane of the same burst
+      int index = -1;
+      for (__mmask16 prev = created; prev != 0; prev &= prev - 1) {
+        const int prev_index = indices_out[__builtin_ctz(prev)];
+        if (memcmp(entries[prev_index].key, key, key_size) == 0) {
+          index = prev_index;
+          break;
+        }
+      }
+
+      if (index == -1) {
+        if (!allocate_index(&index, now)) {
+          indices_out[lane] = -1;
+          continue;
+        }
+
+        entry_t &entry = entries[index];
+        memcpy(entry.key, key, key_size);
+        entry.state = State{};
+        map.put(entry.key, index);
+
+        created |= 1 << lane;
+      }
+
+      indices_out[lane] = index;
+    }
+
+    return created;
+  }
+
+  // Removes all the flows that were not seen in the last expiration_time.
+  // Flows are expired VECTOR_SIZE at a time, and their keys removed from the map with a single vectorized erase.
+  // Returns the number of flows removed.
+  u32 expire_vec(time_ns_t now) {
+    const time_ns_t limit = now - expiration_time;
+
+    u32 expired = 0;
+    while (true) {
+      int indices[VECTOR_SIZE];
+      const int count = dchain_expire_batch(chain, limit, indices, VECTOR_SIZE);
+      if (count == 0) {
+        break;
+      }
+
+      erase_keys_vec(indices, count);
+      expired += count;
+    }
+
+    return expired;
+  }
+
+  // Removes from the map the keys of the given flow indexes (up to VECTOR_SIZE of them), which must have already been freed from the allocator.
+  void erase_keys_vec(const int *indices, u32 count) {
+    alignas(64) u8 keys[VECTOR_SIZE * key_size];
+    for (u32 i = 0; i < count; i++) {
+      memcpy(keys + i * key_size, entries[indices[i]].key, key_size);
+    }
+    map.erase_vec(keys, (__mmask16)((1u << count) - 1));
+  }
+
+  State &get_state(int index) { return entries[index].state; }
+  const void *get_key(int index) const { return entries[index].key; }
+
+  u32 get_size() const { return map.get_size(); }
+  u32 get_capacity() const { return capacity; }
+
+private:
+  int allocate_index(int *index, time_ns_t now) {
+    if (full_policy == FLOWTABLE_REJECT) {
+      return dchain_allocate_new_index(chain, index, now);
+    }
+
+    int evicted;
+    if (!dchain_allocate_new_index_evict(chain, index, now, &evicted)) {
+      return 0;
+    }
+
+    if (evicted) {
+      map.erase(entries[*index].key);
+    }
+
+    return 1;
+  }
+};
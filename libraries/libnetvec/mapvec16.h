@@ -3,6 +3,8 @@
 #include <libutil/hash.h>
 #include <libutil/math.h>
 #include <libutil/zmm.h>
+#include <libnet/mem.h>
+#include <libnet/snapshot.h>
 
 #include <stdlib.h>
 #include <stdio.h>
@@ -28,18 +30,22 @@ private:
 
   u32 size;
 
+  // Image the table arrays live in, after a load.
+  struct Snapshot *snapshot;
+
 public:
-  MapVec16(u32 _capacity) : capacity(_capacity), size(0) {
+  // The backing memory of the table is configured by opts (nullptr for the defaults).
+  MapVec16(u32 _capacity, const struct mem_opts *opts = nullptr) : capacity(_capacity), size(0), snapshot(nullptr) {
     // Check that capacity is a power of 2
     if (_capacity == 0 || is_power_of_two(_capacity) == 0) {
       fprintf(stderr, "Error: Capacity must be a power of 2\n");
       exit(1);
     }
 
-    busybits = (int *)malloc(sizeof(int) * (int)_capacity);
-    keyps    = (void **)malloc(sizeof(void *) * (int)_capacity);
-    khs      = (u32 *)malloc(sizeof(u32) * (int)_capacity);
-    vals     = (int *)malloc(sizeof(int) * (int)_capacity);
+    busybits = (int *)mem_alloc(sizeof(int) * _capacity, opts);
+    keyps    = (void **)mem_alloc(sizeof(void *) * _capacity, opts);
+    khs      = (u32 *)mem_alloc(sizeof(u32) * _capacity, opts);
+    vals     = (int *)mem_alloc(sizeof(int) * _capacity, opts);
 
     for (u32 i = 0; i < capacity; ++i) {
       busybits[i] = 0;
@@ -47,123 +53,127 @@ public:
   }
 
   ~MapVec16() {
-    free(busybits);
-    free(keyps);
-    free(khs);
-    free(vals);
+    release_arrays();
+    mem_free(keyps);
   }
 
-  // FIXME: this should return an array of ints indicating successful reads.
-  int get_vec(void *keys, int *values_out) const {
-    // Create a mask with all bits set to 1.
-    // This mask will be updated in each iteration of the loop, indicating the lanes that are still pending.
-    __mmask16 mask = 0xffff;
+  // Writes the table to disk, with the keys stored inline (the key pointers are meaningless to another process).
+  // Returns 1 if the image was written, and 0 otherwise.
+  int save(const char *path) const {
+    u8 *keys = (u8 *)calloc(capacity, key_size);
+    if (keys == nullptr) {
+      return 0;
+    }
 
-    // Offset vector for linear probing, starting at 0.
-    __m512i offset = _mm512_setzero_si512();
+    for (u32 i = 0; i < capacity; ++i) {
+      if (busybits[i] != 0) {
+        memcpy(keys + (size_t)i * key_size, keyps[i], key_size);
+      }
+    }
 
-    // Load the hashes into a vector register
-    __m512i hashes_vec = hash_keys_vec(keys);
-    // printf("hashes_vec: %s\n", zmm512_32b_to_str(hashes_vec).c_str());
+    const u64 params[SNAPSHOT_MAX_PARAMS]    = {capacity, key_size, size, 0};
+    const struct snapshot_section sections[] = {
+        {busybits, sizeof(int) * capacity},
+        {khs, sizeof(u32) * capacity},
+        {vals, sizeof(int) * capacity},
+        {keys, (size_t)key_size * capacity},
+    };
+
+    const int ok = snapshot_save(path, SNAPSHOT_MAPVEC16, params, sections, 4);
+    free(keys);
+    return ok;
+  }
 
-    u32 pending = VECTOR_SIZE;
-    while (pending != 0) {
-      // Add offset to hashes to get the current indices
-      __m512i indices_vec = _mm512_add_epi32(hashes_vec, offset);
+  // Replaces the contents of the table with an image written by save(), which must come from a table with the same capacity.
+  // The image is mapped in place, nothing is rehashed: only the key pointers are pointed at the inline keys. Lookups can start right away, with
+  // pages being read from disk as they are first touched.
+  // Returns 1 if the image was loaded, and 0 otherwise (the table is left untouched).
+  int load(const char *path) {
+    struct Snapshot *image;
+    if (!snapshot_map(path, SNAPSHOT_MAPVEC16, &image)) {
+      return 0;
+    }
 
-      // & capacity - 1 to get the indices within the capacity
-      indices_vec = _mm512_and_epi32(indices_vec, _mm512_set1_epi32(capacity - 1));
-      // printf("indices_vec: %s\n", zmm512_32b_to_str(indices_vec).c_str());
+    const struct snapshot_header *header = snapshot_get_header(image);
+    if (!is_valid_image(header)) {
+      snapshot_unmap(image);
+      return 0;
+    }
 
-      // Selectively gather busybits and hashes using the mask
-      __m512i busybits_vec = _mm512_mask_i32gather_epi32(_mm512_setzero_si512(), mask, indices_vec, busybits, sizeof(int));
-      __m512i khs_vec      = _mm512_mask_i32gather_epi32(_mm512_setzero_si512(), mask, indices_vec, khs, sizeof(u32));
+    release_arrays();
 
-      // Create a mask for lanes where busybits is 1 and hashes match
-      __mmask16 busybits_cmp = _mm512_cmpneq_epi32_mask(busybits_vec, _mm512_setzero_si512());
-      __mmask16 hash_cmp     = _mm512_cmpeq_epi32_mask(khs_vec, hashes_vec);
-      __mmask16 match_mask   = _mm512_kand(busybits_cmp, hash_cmp);
+    snapshot = image;
+    busybits = (int *)snapshot_get_section(image, 0);
+    khs      = (u32 *)snapshot_get_section(image, 1);
+    vals     = (int *)snapshot_get_section(image, 2);
+    size     = (u32)header->params[2];
 
-      // If busybit is 0, it means the slot is empty and the key is not found. We can stop probing for that lane.
-      mask = _mm512_kand(busybits_cmp, mask);
+    u8 *keys = (u8 *)snapshot_get_section(image, 3);
+    for (u32 i = 0; i < capacity; ++i) {
+      keyps[i] = keys + (size_t)i * key_size;
+    }
 
-      // Load the keys into vector registers, first 8 pointers (0-7) into the 'low' register and next 8 pointers (8-15) into the 'high' register
-      __m512i base_offsets        = _mm512_set_epi64(7, 6, 5, 4, 3, 2, 1, 0);
-      __m512i target_keysp_base   = _mm512_set1_epi64((u64)keys);
-      __m512i target_keysp_lo_vec = _mm512_add_epi64(target_keysp_base, _mm512_mullo_epi64(base_offsets, _mm512_set1_epi64(key_size)));
-      target_keysp_base           = _mm512_set1_epi64((u64)keys + 8 * key_size);
-      __m512i target_keysp_hi_vec = _mm512_add_epi64(target_keysp_base, _mm512_mullo_epi64(base_offsets, _mm512_set1_epi64(key_size)));
+    return 1;
+  }
 
-      // Print keys_lo_vec and keys_hi_vec for debugging
-      // printf("keys_lo_vec: %s\n", zmm512_64b_to_str(keys_lo_vec).c_str());
-      // printf("keys_hi_vec: %s\n", zmm512_64b_to_str(keys_hi_vec).c_str());
-      // printf("indices_vec: %s\n", zmm512_32b_to_str(indices_vec).c_str());
+  // Looks up the VECTOR_SIZE keys stored contiguously in keys.
+  // Returns a bitmask of the lanes whose key was found. Values of the lanes that were not found are left untouched.
+  int get_vec(void *keys, int *values_out) const { return get_vec(keys, values_out, 0xffff); }
 
-      __m256i indices_lo = _mm512_castsi512_si256(indices_vec);
-      __m256i indices_hi = _mm512_extracti32x8_epi32(indices_vec, 1);
+  // Same as above, but only the lanes set in the lanes mask are looked up.
+  int get_vec(void *keys, int *values_out, __mmask16 lanes) const {
+    __m512i slots_vec;
+    const __mmask16 found = find_vec(keys, lanes, slots_vec);
 
-      // Load the keys from memory for the lanes where the match_mask is set
-      // These 512b registers contain 64b pointers, so we need to gather them in two parts (lo and hi) and then combine them for comparison.
-      // So keysp_lo_vec has 8 pointers (0-7) and keyps_hi_vec has the next 8 pointers (8-15).
-      __m512i keysp_lo_vec = _mm512_mask_i32gather_epi64(_mm512_setzero_si512(), match_mask, indices_lo, keyps, sizeof(void *));
-      __m512i keyps_hi_vec = _mm512_mask_i32gather_epi64(_mm512_setzero_si512(), match_mask >> 8, indices_hi, keyps, sizeof(void *));
+    // Gather the values for the lanes that were found
+    const __m512i values_vec = _mm512_mask_i32gather_epi32(_mm512_setzero_si512(), found, slots_vec, vals, sizeof(int));
 
-      for (u32 bytes_compared = 0; bytes_compared < key_size; bytes_compared += 4) {
-        if (key_size - bytes_compared >= 4) {
-          // Compare the gathered keys with the input keys to confirm matches
-          // Keys can be arbitrarily large, so we need to compare them 32b at a time.
-          // Gather the next 32b of the keys for comparison
-          __mmask8 lo_mask           = _mm512_kand(match_mask, 0x00ff); // Mask for the lower 8 lanes
-          __m256i keys_lo_vec        = _mm512_mask_i64gather_epi32(_mm256_setzero_si256(), lo_mask, keysp_lo_vec, NULL, 1);
-          __m256i target_keys_lo_vec = _mm512_mask_i64gather_epi32(_mm256_setzero_si256(), lo_mask, target_keysp_lo_vec, NULL, 1);
-          __mmask8 lo_match          = _mm256_cmpeq_epi32_mask(keys_lo_vec, target_keys_lo_vec);
+    // Load the values from the vector register to the output array for the lanes where the mask is set
+    _mm512_mask_storeu_epi32((void *)values_out, found, values_vec);
 
-          // Compared 8 pointers in the 'lo' register, now we need to update the mask for those 8 bits
-          __mmask8 hi_mask           = _mm512_kand(match_mask >> 8, 0x00ff); // Mask for the upper 8 lanes
-          __m256i keys_hi_vec        = _mm512_mask_i64gather_epi32(_mm256_setzero_si256(), hi_mask, keyps_hi_vec, NULL, 1);
-          __m256i target_keys_hi_vec = _mm512_mask_i64gather_epi32(_mm256_setzero_si256(), hi_mask, target_keysp_hi_vec, NULL, 1);
-          __mmask8 hi_match          = _mm256_cmpeq_epi32_mask(keys_hi_vec, target_keys_hi_vec);
+    return found;
+  }
 
-          // Not ideal, we are bouncing from GPR to ZMM, but I don't see any other alternative.
-          match_mask = _mm512_kand(match_mask, ((__mmask16)hi_match << 8) | (__mmask16)lo_match);
-        } else {
-          // Handle the last few bytes that are less than 4
-          // This is more complex because we can't directly compare with SIMD instructions.
-          // We would need to create masks for the remaining bytes and compare them manually.
-          // For simplicity, we'll skip this part in this implementation.
-          assert(false && "TODO: Handle remaining bytes in get_vec");
+  // Removes the VECTOR_SIZE keys stored contiguously in keys.
+  // Returns a bitmask of the lanes whose key was found (and removed).
+  int erase_vec(void *keys) { return erase_vec(keys, 0xffff); }
+
+  // Same as above, but only the lanes set in the lanes mask are removed.
+  int erase_vec(void *keys, __mmask16 lanes) {
+    __m512i slots_vec;
+    const __mmask16 found = find_vec(keys, lanes, slots_vec);
+
+    alignas(64) u32 slots[VECTOR_SIZE];
+    _mm512_store_si512((void *)slots, slots_vec);
+
+    // Removing an entry shifts the following ones in its cluster back, which may move the entries found for later lanes. So remember which key
+    // pointer each slot held, to detect that.
+    alignas(64) void *found_keyps[VECTOR_SIZE];
+    _mm512_store_si512((void *)found_keyps, _mm512_mask_i32gather_epi64(_mm512_setzero_si512(), found, _mm512_castsi512_si256(slots_vec), keyps, sizeof(void *)));
+    _mm512_store_si512((void *)(found_keyps + 8),
+                       _mm512_mask_i32gather_epi64(_mm512_setzero_si512(), found >> 8, _mm512_extracti32x8_epi32(slots_vec, 1), keyps, sizeof(void *)));
+
+    __mmask16 erased = 0;
+
+    for (__mmask16 pending = found; pending != 0; pending &= pending - 1) {
+      const u32 lane = __builtin_ctz(pending);
+      int slot       = (int)slots[lane];
+
+      if (busybits[slot] == 0 || keyps[slot] != found_keyps[lane]) {
+        // Moved by a previous removal, or already removed (the same key showing up twice in the burst)
+        void *key = (u8 *)keys + lane * key_size;
+        slot      = find_key(busybits, keyps, khs, key, hash_key(key), capacity);
+        if (-1 == slot) {
+          continue;
         }
-
-        // Advance key pointers by 4 bytes for the next iteration
-        keysp_lo_vec        = _mm512_add_epi64(keysp_lo_vec, _mm512_set1_epi64(4));
-        keyps_hi_vec        = _mm512_add_epi64(keyps_hi_vec, _mm512_set1_epi64(4));
-        target_keysp_lo_vec = _mm512_add_epi64(target_keysp_lo_vec, _mm512_set1_epi64(4));
-        target_keysp_hi_vec = _mm512_add_epi64(target_keysp_hi_vec, _mm512_set1_epi64(4));
-      }
-
-      // Gather the values for the lanes where the mask is set
-      __m512i values_vec = _mm512_mask_i32gather_epi32(_mm512_setzero_si512(), match_mask, indices_vec, vals, sizeof(int));
-
-      // Load the values from the vector register to the output array for the lanes where the mask is set
-      _mm512_mask_storeu_epi32((void *)values_out, match_mask, values_vec);
-
-      // Update pending count and loop offset for the next iteration
-      mask = _mm512_kandn(match_mask, mask);
-
-      // Increment the offset only for the pending keys
-      offset = _mm512_mask_add_epi32(offset, mask, offset, _mm512_set1_epi32(1));
-
-      // If offset == capacity, set the mask to 0 to prevent further probing
-      if (_mm512_mask_cmpeq_epi32_mask(mask, offset, _mm512_set1_epi32(capacity))) {
-        mask = 0;
       }
 
-      // Count the number of bits set to 1 in the mask
-      pending = _cvtmask16_u32(_mm_popcnt_u32(mask));
+      remove_slot(busybits, keyps, khs, vals, (u32)slot, capacity);
+      --size;
+      erased |= 1 << lane;
     }
 
-    // TODO: Track the successful reads.
-    return 1;
+    return erased;
   }
 
   void put_vec(void *keys, int *values) {
@@ -253,8 +263,6 @@ public:
     size += VECTOR_SIZE;
   }
 
-  void erase_vec(void *keys);
-
   int get(void *key, int *value_out) const {
     u32 hash  = hash_key(key);
     int index = find_key(busybits, keyps, khs, key, hash, capacity);
@@ -283,14 +291,206 @@ public:
   }
 
   void erase(void *key) {
-    u32 hash = hash_key(key);
-    find_key_remove_chain(busybits, keyps, khs, key, hash, capacity);
+    u32 hash  = hash_key(key);
+    int index = find_key(busybits, keyps, khs, key, hash, capacity);
+
+    if (-1 == index) {
+      return;
+    }
+
+    remove_slot(busybits, keyps, khs, vals, (u32)index, capacity);
     --size;
   }
 
   u32 get_size() const { return size; }
 
+  // Calls fn(keyps, values, slots, count) for every occupied slot, in slot order, with batches of up to VECTOR_SIZE entries: keyps[i] points to the
+  // key stored in slot slots[i], and values[i] is its value. All batches but the last one are full.
+  // The table is scanned VECTOR_SIZE slots at a time, and the occupied ones are compressed into the batch. fn must not modify the table.
+  template <typename F> void for_each_batch(F &&fn) const {
+    // Each window adds up to VECTOR_SIZE entries on top of a partial batch.
+    alignas(64) void *batch_keyps[2 * VECTOR_SIZE];
+    alignas(64) int batch_values[2 * VECTOR_SIZE];
+    alignas(64) u32 batch_slots[2 * VECTOR_SIZE];
+    u32 count = 0;
+
+    const __m512i lanes_vec = _mm512_set_epi32(15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0);
+
+    for (u32 slot = 0; slot < capacity; slot += VECTOR_SIZE) {
+      // Tables smaller than VECTOR_SIZE only fill part of the window
+      const __mmask16 window = capacity - slot < VECTOR_SIZE ? (__mmask16)((1u << (capacity - slot)) - 1) : 0xffff;
+
+      const __m512i busybits_vec = _mm512_maskz_loadu_epi32(window, busybits + slot);
+      const __m512i values_vec   = _mm512_maskz_loadu_epi32(window, vals + slot);
+      const __mmask16 occupied   = _mm512_mask_cmpneq_epi32_mask(window, busybits_vec, _mm512_setzero_si512());
+      if (occupied == 0) {
+        continue;
+      }
+
+      const __mmask8 occupied_lo = (__mmask8)occupied;
+      const __mmask8 occupied_hi = (__mmask8)(occupied >> 8);
+
+      _mm512_mask_compressstoreu_epi32(batch_values + count, occupied, values_vec);
+      _mm512_mask_compressstoreu_epi32(batch_slots + count, occupied, _mm512_add_epi32(_mm512_set1_epi32(slot), lanes_vec));
+      _mm512_mask_compressstoreu_epi64(batch_keyps + count, occupied_lo, _mm512_maskz_loadu_epi64(occupied_lo, keyps + slot));
+      _mm512_mask_compressstoreu_epi64(batch_keyps + count + _mm_popcnt_u32(occupied_lo), occupied_hi, _mm512_maskz_loadu_epi64(occupied_hi, keyps + slot + 8));
+      count += _mm_popcnt_u32(occupied);
+
+      if (count >= VECTOR_SIZE) {
+        fn(batch_keyps, batch_values, batch_slots, VECTOR_SIZE);
+
+        // Move the leftovers to the front of the batch
+        count -= VECTOR_SIZE;
+        _mm512_store_si512((void *)batch_values, _mm512_load_si512((void *)(batch_values + VECTOR_SIZE)));
+        _mm512_store_si512((void *)batch_slots, _mm512_load_si512((void *)(batch_slots + VECTOR_SIZE)));
+        _mm512_store_si512((void *)batch_keyps, _mm512_load_si512((void *)(batch_keyps + VECTOR_SIZE)));
+        _mm512_store_si512((void *)(batch_keyps + 8), _mm512_load_si512((void *)(batch_keyps + VECTOR_SIZE + 8)));
+      }
+    }
+
+    if (count > 0) {
+      fn(batch_keyps, batch_values, batch_slots, count);
+    }
+  }
+
 private:
+  // Whether the image has the layout save() writes for a table like this one, so that every section can be used as an array of capacity
+  // entries.
+  bool is_valid_image(const struct snapshot_header *header) const {
+    if (header->params[0] != capacity || header->params[1] != key_size || header->params[2] > capacity || header->num_sections != 4) {
+      return false;
+    }
+    return header->section_sizes[0] == sizeof(int) * capacity && header->section_sizes[1] == sizeof(u32) * capacity &&
+           header->section_sizes[2] == sizeof(int) * capacity && header->section_sizes[3] == (size_t)key_size * capacity;
+  }
+
+  // Finds the slots holding the VECTOR_SIZE keys stored contiguously in keys, for the lanes set in the lanes mask.
+  // Returns a bitmask of the lanes whose key was found, with their slots in slots_out.
+  __mmask16 find_vec(void *keys, __mmask16 lanes, __m512i &slots_out) const {
+    // Start with the requested lanes.
+    // This mask will be updated in each iteration of the loop, indicating the lanes that are still pending.
+    __mmask16 mask = lanes;
+
+    // Lanes whose key was found.
+    __mmask16 found = 0;
+
+    // Offset vector for linear probing, starting at 0.
+    __m512i offset = _mm512_setzero_si512();
+
+    slots_out = _mm512_setzero_si512();
+
+    // Load the hashes into a vector register
+    __m512i hashes_vec = hash_keys_vec(keys);
+    // printf("hashes_vec: %s\n", zmm512_32b_to_str(hashes_vec).c_str());
+
+    u32 pending = VECTOR_SIZE;
+    while (pending != 0) {
+      // Add offset to hashes to get the current indices
+      __m512i indices_vec = _mm512_add_epi32(hashes_vec, offset);
+
+      // & capacity - 1 to get the indices within the capacity
+      indices_vec = _mm512_and_epi32(indices_vec, _mm512_set1_epi32(capacity - 1));
+      // printf("indices_vec: %s\n", zmm512_32b_to_str(indices_vec).c_str());
+
+      // Selectively gather busybits and hashes using the mask
+      __m512i busybits_vec = _mm512_mask_i32gather_epi32(_mm512_setzero_si512(), mask, indices_vec, busybits, sizeof(int));
+      __m512i khs_vec      = _mm512_mask_i32gather_epi32(_mm512_setzero_si512(), mask, indices_vec, khs, sizeof(u32));
+
+      // Create a mask for lanes where busybits is 1 and hashes match
+      __mmask16 busybits_cmp = _mm512_cmpneq_epi32_mask(busybits_vec, _mm512_setzero_si512());
+      __mmask16 hash_cmp     = _mm512_cmpeq_epi32_mask(khs_vec, hashes_vec);
+      __mmask16 match_mask   = _mm512_kand(busybits_cmp, hash_cmp);
+
+      // If busybit is 0, it means the slot is empty and the key is not found. We can stop probing for that lane.
+      mask = _mm512_kand(busybits_cmp, mask);
+
+      // Load the keys into vector registers, first 8 pointers (0-7) into the 'low' register and next 8 pointers (8-15) into the 'high' register
+      __m512i base_offsets        = _mm512_set_epi64(7, 6, 5, 4, 3, 2, 1, 0);
+      __m512i target_keysp_base   = _mm512_set1_epi64((u64)keys);
+      __m512i target_keysp_lo_vec = _mm512_add_epi64(target_keysp_base, _mm512_mullo_epi64(base_offsets, _mm512_set1_epi64(key_size)));
+      target_keysp_base           = _mm512_set1_epi64((u64)keys + 8 * key_size);
+      __m512i target_keysp_hi_vec = _mm512_add_epi64(target_keysp_base, _mm512_mullo_epi64(base_offsets, _mm512_set1_epi64(key_size)));
+
+      // Print keys_lo_vec and keys_hi_vec for debugging
+      // printf("keys_lo_vec: %s\n", zmm512_64b_to_str(keys_lo_vec).c_str());
+      // printf("keys_hi_vec: %s\n", zmm512_64b_to_str(keys_hi_vec).c_str());
+      // printf("indices_vec: %s\n", zmm512_32b_to_str(indices_vec).c_str());
+
+      __m256i indices_lo = _mm512_castsi512_si256(indices_vec);
+      __m256i indices_hi = _mm512_extracti32x8_epi32(indices_vec, 1);
+
+      // Load the keys from memory for the lanes where the match_mask is set
+      // These 512b registers contain 64b pointers, so we need to gather them in two parts (lo and hi) and then combine them for comparison.
+      // So keysp_lo_vec has 8 pointers (0-7) and keyps_hi_vec has the next 8 pointers (8-15).
+      __m512i keysp_lo_vec = _mm512_mask_i32gather_epi64(_mm512_setzero_si512(), match_mask, indices_lo, keyps, sizeof(void *));
+      __m512i keyps_hi_vec = _mm512_mask_i32gather_epi64(_mm512_setzero_si512(), match_mask >> 8, indices_hi, keyps, sizeof(void *));
+
+      for (u32 bytes_compared = 0; bytes_compared < key_size; bytes_compared += 4) {
+        if (key_size - bytes_compared >= 4) {
+          // Compare the gathered keys with the input keys to confirm matches
+          // Keys can be arbitrarily large, so we need to compare them 32b at a time.
+          // Gather the next 32b of the keys for comparison
+          __mmask8 lo_mask           = _mm512_kand(match_mask, 0x00ff); // Mask for the lower 8 lanes
+          __m256i keys_lo_vec        = _mm512_mask_i64gather_epi32(_mm256_setzero_si256(), lo_mask, keysp_lo_vec, NULL, 1);
+          __m256i target_keys_lo_vec = _mm512_mask_i64gather_epi32(_mm256_setzero_si256(), lo_mask, target_keysp_lo_vec, NULL, 1);
+          __mmask8 lo_match          = _mm256_cmpeq_epi32_mask(keys_lo_vec, target_keys_lo_vec);
+
+          // Compared 8 pointers in the 'lo' register, now we need to update the mask for those 8 bits
+          __mmask8 hi_mask           = _mm512_kand(match_mask >> 8, 0x00ff); // Mask for the upper 8 lanes
+          __m256i keys_hi_vec        = _mm512_mask_i64gather_epi32(_mm256_setzero_si256(), hi_mask, keyps_hi_vec, NULL, 1);
+          __m256i target_keys_hi_vec = _mm512_mask_i64gather_epi32(_mm256_setzero_si256(), hi_mask, target_keysp_hi_vec, NULL, 1);
+          __mmask8 hi_match          = _mm256_cmpeq_epi32_mask(keys_hi_vec, target_keys_hi_vec);
+
+          // Not ideal, we are bouncing from GPR to ZMM, but I don't see any other alternative.
+          match_mask = _mm512_kand(match_mask, ((__mmask16)hi_match << 8) | (__mmask16)lo_match);
+        } else {
+          // Handle the last few bytes that are less than 4
+          // This is more complex because we can't directly compare with SIMD instructions.
+          // We would need to create masks for the remaining bytes and compare them manually.
+          // For simplicity, we'll skip this part in this implementation.
+          assert(false && "TODO: Handle remaining bytes in get_vec");
+        }
+
+        // Advance key pointers by 4 bytes for the next iteration
+        keysp_lo_vec        = _mm512_add_epi64(keysp_lo_vec, _mm512_set1_epi64(4));
+        keyps_hi_vec        = _mm512_add_epi64(keyps_hi_vec, _mm512_set1_epi64(4));
+        target_keysp_lo_vec = _mm512_add_epi64(target_keysp_lo_vec, _mm512_set1_epi64(4));
+        target_keysp_hi_vec = _mm512_add_epi64(target_keysp_hi_vec, _mm512_set1_epi64(4));
+      }
+
+      // Keep the slots of the lanes where the key was found
+      slots_out = _mm512_mask_mov_epi32(slots_out, match_mask, indices_vec);
+      found     = _mm512_kor(found, match_mask);
+
+      // Update pending count and loop offset for the next iteration
+      mask = _mm512_kandn(match_mask, mask);
+
+      // Increment the offset only for the pending keys
+      offset = _mm512_mask_add_epi32(offset, mask, offset, _mm512_set1_epi32(1));
+
+      // If offset == capacity, set the mask to 0 to prevent further probing
+      if (_mm512_mask_cmpeq_epi32_mask(mask, offset, _mm512_set1_epi32(capacity))) {
+        mask = 0;
+      }
+
+      // Count the number of bits set to 1 in the mask
+      pending = _cvtmask16_u32(_mm_popcnt_u32(mask));
+    }
+
+    return found;
+  }
+
+  void release_arrays() {
+    if (snapshot) {
+      snapshot_unmap(snapshot);
+      snapshot = nullptr;
+    } else {
+      mem_free(busybits);
+      mem_free(khs);
+      mem_free(vals);
+    }
+  }
+
   int keq(void *key1, void *key2) const { return memcmp(key1, key2, key_size) == 0; }
 
   u32 loop(u32 k, u32 capacity) const { return k & (capacity - 1); }
@@ -302,7 +502,11 @@ private:
       int bb    = busybits[index];
       u32 kh    = k_hashes[index];
       void *kp  = keyps[index];
-      if (bb != 0 && kh == key_hash) {
+      if (bb == 0) {
+        // Erasing never leaves holes in a probe sequence, so an empty slot ends it (as in get_vec).
+        return -1;
+      }
+      if (kh == key_hash) {
         if (keq(kp, keyp)) {
           return (int)index;
         }
@@ -322,23 +526,28 @@ private:
     return -1;
   }
 
-  u32 find_key_remove_chain(int *busybits, void **keyps, u32 *k_hashes, void *keyp, u32 key_hash, u32 capacity) const {
-    u32 i     = 0;
-    u32 start = loop(key_hash, capacity);
+  // Backward shift deletion: the entries following the removed one in its cluster are moved back to fill the hole, as long as that does not move
+  // them before their home slot. Lookups stop probing at the first empty slot, so simply clearing the slot would hide these entries.
+  void remove_slot(int *busybits, void **keyps, u32 *k_hashes, int *vals, u32 index, u32 capacity) const {
+    u32 hole = index;
 
-    for (; i < capacity; ++i) {
-      u32 index = loop(start + i, capacity);
-      int bb    = busybits[index];
-      u32 kh    = k_hashes[index];
-      void *kp  = keyps[index];
-      if (bb != 0 && kh == key_hash) {
-        if (keq(kp, keyp)) {
-          busybits[index] = 0;
-          return index;
-        }
+    for (u32 i = 1; i < capacity; ++i) {
+      u32 next = loop(index + i, capacity);
+      if (busybits[next] == 0) {
+        break;
+      }
+
+      // Entries can only move back if the hole is between their home slot and their current slot.
+      u32 home = loop(k_hashes[next], capacity);
+      if (loop(next - home, capacity) >= loop(next - hole, capacity)) {
+        keyps[hole]    = keyps[next];
+        k_hashes[hole] = k_hashes[next];
+        vals[hole]     = vals[next];
+        hole           = next;
       }
     }
-    return -1;
+
+    busybits[hole] = 0;
   }
 
   __m512i hash_keys_vec(void *keys) const { return fxhash_vec16<key_size>(keys); }
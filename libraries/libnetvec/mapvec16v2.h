@@ -3,6 +3,7 @@
 #include <libutil/hash.h>
 #include <libutil/math.h>
 #include <libutil/zmm.h>
+#include <libnet/mem.h>
 
 #include <stdlib.h>
 #include <stdio.h>
@@ -29,16 +30,17 @@ private:
   u32 size;
 
 public:
-  MapVec16v2(u32 _capacity) : capacity(_capacity), size(0) {
+  // The backing memory of the table is configured by opts (nullptr for the defaults).
+  MapVec16v2(u32 _capacity, const struct mem_opts *opts = nullptr) : capacity(_capacity), size(0) {
     // Check that capacity is a power of 2
     if (_capacity == 0 || is_power_of_two(_capacity) == 0) {
       fprintf(stderr, "Error: Capacity must be a power of 2\n");
       exit(1);
     }
 
-    keyps = (void **)malloc(sizeof(void *) * _capacity);
-    khs   = (u32 *)malloc(sizeof(u32) * _capacity);
-    vals  = (int *)malloc(sizeof(int) * _capacity);
+    keyps = (void **)mem_alloc(sizeof(void *) * _capacity, opts);
+    khs   = (u32 *)mem_alloc(sizeof(u32) * _capacity, opts);
+    vals  = (int *)mem_alloc(sizeof(int) * _capacity, opts);
 
     for (u32 i = 0; i < capacity; ++i) {
       khs[i] = SPECIAL_NULL_HASH;
@@ -46,9 +48,9 @@ public:
   }
 
   ~MapVec16v2() {
-    free(keyps);
-    free(khs);
-    free(vals);
+    mem_free(keyps);
+    mem_free(khs);
+    mem_free(vals);
   }
 
   // FIXME: this should return an array of ints indicating successful reads.
@@ -302,6 +304,55 @@ public:
 
   u32 get_size() const { return size; }
 
+  // Calls fn(keyps, values, slots, count) for every occupied slot, in slot order, with batches of up to VECTOR_SIZE entries: keyps[i] points to the
+  // key stored in slot slots[i], and values[i] is its value. All batches but the last one are full.
+  // The table is scanned VECTOR_SIZE slots at a time, and the occupied ones are compressed into the batch. fn must not modify the table.
+  template <typename F> void for_each_batch(F &&fn) const {
+    // Each window adds up to VECTOR_SIZE entries on top of a partial batch.
+    alignas(64) void *batch_keyps[2 * VECTOR_SIZE];
+    alignas(64) int batch_values[2 * VECTOR_SIZE];
+    alignas(64) u32 batch_slots[2 * VECTOR_SIZE];
+    u32 count = 0;
+
+    const __m512i lanes_vec = _mm512_set_epi32(15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0);
+
+    for (u32 slot = 0; slot < capacity; slot += VECTOR_SIZE) {
+      // Tables smaller than VECTOR_SIZE only fill part of the window
+      const __mmask16 window = capacity - slot < VECTOR_SIZE ? (__mmask16)((1u << (capacity - slot)) - 1) : 0xffff;
+
+      const __m512i khs_vec    = _mm512_maskz_loadu_epi32(window, khs + slot);
+      const __m512i values_vec = _mm512_maskz_loadu_epi32(window, vals + slot);
+      const __mmask16 occupied = _mm512_mask_cmpneq_epi32_mask(window, khs_vec, _mm512_set1_epi32(SPECIAL_NULL_HASH));
+      if (occupied == 0) {
+        continue;
+      }
+
+      const __mmask8 occupied_lo = (__mmask8)occupied;
+      const __mmask8 occupied_hi = (__mmask8)(occupied >> 8);
+
+      _mm512_mask_compressstoreu_epi32(batch_values + count, occupied, values_vec);
+      _mm512_mask_compressstoreu_epi32(batch_slots + count, occupied, _mm512_add_epi32(_mm512_set1_epi32(slot), lanes_vec));
+      _mm512_mask_compressstoreu_epi64(batch_keyps + count, occupied_lo, _mm512_maskz_loadu_epi64(occupied_lo, keyps + slot));
+      _mm512_mask_compressstoreu_epi64(batch_keyps + count + _mm_popcnt_u32(occupied_lo), occupied_hi, _mm512_maskz_loadu_epi64(occupied_hi, keyps + slot + 8));
+      count += _mm_popcnt_u32(occupied);
+
+      if (count >= VECTOR_SIZE) {
+        fn(batch_keyps, batch_values, batch_slots, VECTOR_SIZE);
+
+        // Move the leftovers to the front of the batch
+        count -= VECTOR_SIZE;
+        _mm512_store_si512((void *)batch_values, _mm512_load_si512((void *)(batch_values + VECTOR_SIZE)));
+        _mm512_store_si512((void *)batch_slots, _mm512_load_si512((void *)(batch_slots + VECTOR_SIZE)));
+        _mm512_store_si512((void *)batch_keyps, _mm512_load_si512((void *)(batch_keyps + VECTOR_SIZE)));
+        _mm512_store_si512((void *)(batch_keyps + 8), _mm512_load_si512((void *)(batch_keyps + VECTOR_SIZE + 8)));
+      }
+    }
+
+    if (count > 0) {
+      fn(batch_keyps, batch_values, batch_slots, count);
+    }
+  }
+
 private:
   int keq(void *key1, void *key2) const { return memcmp(key1, key2, key_size) == 0; }
 
@@ -3,6 +3,8 @@
 #include <libutil/hash.h>
 #include <libutil/math.h>
 #include <libutil/zmm.h>
+#include <libnet/mem.h>
+#include <libnet/snapshot.h>
 
 #include <stdlib.h>
 #include <stdio.h>
@@ -32,16 +34,20 @@ private:
 
   u32 size;
 
+  // Image the table arrays live in, after a load.
+  struct Snapshot *snapshot;
+
 public:
-  MapVec8(u32 _capacity) : capacity(_capacity), size(0) {
+  // The backing memory of the table is configured by opts (nullptr for the defaults).
+  MapVec8(u32 _capacity, const struct mem_opts *opts = nullptr) : capacity(_capacity), size(0), snapshot(nullptr) {
     // Check that capacity is a power of 2
     if (_capacity == 0 || is_power_of_two(_capacity) == 0) {
       fprintf(stderr, "Error: Capacity must be a power of 2\n");
       exit(1);
     }
 
-    hashes_values = (hash_value_t *)malloc(sizeof(hash_value_t) * _capacity);
-    keyps         = (void **)malloc(sizeof(void *) * _capacity);
+    hashes_values = (hash_value_t *)mem_alloc(sizeof(hash_value_t) * _capacity, opts);
+    keyps         = (void **)mem_alloc(sizeof(void *) * _capacity, opts);
 
     for (u32 i = 0; i < capacity; ++i) {
       hashes_values[i].hash  = SPECIAL_NULL_HASH;
@@ -51,8 +57,70 @@ public:
   }
 
   ~MapVec8() {
-    free(hashes_values);
-    free(keyps);
+    if (snapshot) {
+      snapshot_unmap(snapshot);
+    } else {
+      mem_free(hashes_values);
+    }
+    mem_free(keyps);
+  }
+
+  // Writes the table to disk, with the keys stored inline (the key pointers are meaningless to another process).
+  // Returns 1 if the image was written, and 0 otherwise.
+  int save(const char *path) const {
+    u8 *keys = (u8 *)calloc(capacity, key_size);
+    if (keys == nullptr) {
+      return 0;
+    }
+
+    for (u32 i = 0; i < capacity; ++i) {
+      if (hashes_values[i].hash != SPECIAL_NULL_HASH) {
+        memcpy(keys + (size_t)i * key_size, keyps[i], key_size);
+      }
+    }
+
+    const u64 params[SNAPSHOT_MAX_PARAMS]    = {capacity, key_size, size, 0};
+    const struct snapshot_section sections[] = {
+        {hashes_values, sizeof(hash_value_t) * capacity},
+        {keys, (size_t)key_size * capacity},
+    };
+
+    const int ok = snapshot_save(path, SNAPSHOT_MAPVEC8, params, sections, 2);
+    free(keys);
+    return ok;
+  }
+
+  // Replaces the contents of the table with an image written by save(), which must come from a table with the same capacity.
+  // The image is mapped in place, see MapVec16::load.
+  // Returns 1 if the image was loaded, and 0 otherwise (the table is left untouched).
+  int load(const char *path) {
+    struct Snapshot *image;
+    if (!snapshot_map(path, SNAPSHOT_MAPVEC8, &image)) {
+      return 0;
+    }
+
+    const struct snapshot_header *header = snapshot_get_header(image);
+    if (!is_valid_image(header)) {
+      snapshot_unmap(image);
+      return 0;
+    }
+
+    if (snapshot) {
+      snapshot_unmap(snapshot);
+    } else {
+      mem_free(hashes_values);
+    }
+
+    snapshot      = image;
+    hashes_values = (hash_value_t *)snapshot_get_section(image, 0);
+    size          = (u32)header->params[2];
+
+    u8 *keys = (u8 *)snapshot_get_section(image, 1);
+    for (u32 i = 0; i < capacity; ++i) {
+      keyps[i] = keys + (size_t)i * key_size;
+    }
+
+    return 1;
   }
 
   // FIXME: this should return an array of ints indicating successful reads.
@@ -120,9 +188,9 @@ public:
           assert(false && "TODO: Handle remaining bytes in get_vec");
         }
 
-        // Advance key pointers by 4 bytes for the next iteration
-        keysp_vec        = _mm512_add_epi64(keysp_vec, _mm512_set1_epi64(4));
-        target_keysp_vec = _mm512_add_epi64(target_keysp_vec, _mm512_set1_epi64(4));
+        // Advance key pointers by 8 bytes for the next iteration
+        keysp_vec        = _mm512_add_epi64(keysp_vec, _mm512_set1_epi64(8));
+        target_keysp_vec = _mm512_add_epi64(target_keysp_vec, _mm512_set1_epi64(8));
       }
 
       // Load the values from the vector register to the output array for the lanes where the mask is set
@@ -299,7 +367,69 @@ public:
 
   u32 get_size() const { return size; }
 
+  // Calls fn(keyps, values, slots, count) for every occupied slot, in slot order, with batches of up to 2 * VECTOR_SIZE entries: keyps[i] points to the
+  // key stored in slot slots[i], and values[i] is its value. All batches but the last one are full.
+  // The table is scanned 16 slots (two vectors of {hash, value} pairs) at a time, and the occupied ones are compressed into the batch. fn must not modify the table.
+  template <typename F> void for_each_batch(F &&fn) const {
+    constexpr const u32 SCAN_SIZE = 2 * VECTOR_SIZE;
+
+    // Each window adds up to SCAN_SIZE entries on top of a partial batch.
+    alignas(64) void *batch_keyps[2 * SCAN_SIZE];
+    alignas(64) int batch_values[2 * SCAN_SIZE];
+    alignas(64) u32 batch_slots[2 * SCAN_SIZE];
+    u32 count = 0;
+
+    const __m512i lanes_vec = _mm512_set_epi32(15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0);
+
+    for (u32 slot = 0; slot < capacity; slot += SCAN_SIZE) {
+      // Tables smaller than SCAN_SIZE only fill part of the window
+      const __mmask16 window = capacity - slot < SCAN_SIZE ? (__mmask16)((1u << (capacity - slot)) - 1) : 0xffff;
+
+      // Split the {hash, value} pairs of the 16 slots into a vector of hashes and a vector of values
+      const __m512i pairs_lo   = _mm512_maskz_loadu_epi64((__mmask8)window, hashes_values + slot);
+      const __m512i pairs_hi   = _mm512_maskz_loadu_epi64((__mmask8)(window >> 8), hashes_values + slot + 8);
+      const __m512i hashes_vec = _mm512_permutex2var_epi32(pairs_lo, _mm512_set_epi32(30, 28, 26, 24, 22, 20, 18, 16, 14, 12, 10, 8, 6, 4, 2, 0), pairs_hi);
+      const __m512i values_vec = _mm512_permutex2var_epi32(pairs_lo, _mm512_set_epi32(31, 29, 27, 25, 23, 21, 19, 17, 15, 13, 11, 9, 7, 5, 3, 1), pairs_hi);
+      const __mmask16 occupied = _mm512_mask_cmpneq_epi32_mask(window, hashes_vec, _mm512_set1_epi32(SPECIAL_NULL_HASH));
+      if (occupied == 0) {
+        continue;
+      }
+
+      const __mmask8 occupied_lo = (__mmask8)occupied;
+      const __mmask8 occupied_hi = (__mmask8)(occupied >> 8);
+
+      _mm512_mask_compressstoreu_epi32(batch_values + count, occupied, values_vec);
+      _mm512_mask_compressstoreu_epi32(batch_slots + count, occupied, _mm512_add_epi32(_mm512_set1_epi32(slot), lanes_vec));
+      _mm512_mask_compressstoreu_epi64(batch_keyps + count, occupied_lo, _mm512_maskz_loadu_epi64(occupied_lo, keyps + slot));
+      _mm512_mask_compressstoreu_epi64(batch_keyps + count + _mm_popcnt_u32(occupied_lo), occupied_hi, _mm512_maskz_loadu_epi64(occupied_hi, keyps + slot + 8));
+      count += _mm_popcnt_u32(occupied);
+
+      if (count >= SCAN_SIZE) {
+        fn(batch_keyps, batch_values, batch_slots, SCAN_SIZE);
+
+        // Move the leftovers to the front of the batch
+        count -= SCAN_SIZE;
+        _mm512_store_si512((void *)batch_values, _mm512_load_si512((void *)(batch_values + SCAN_SIZE)));
+        _mm512_store_si512((void *)batch_slots, _mm512_load_si512((void *)(batch_slots + SCAN_SIZE)));
+        _mm512_store_si512((void *)batch_keyps, _mm512_load_si512((void *)(batch_keyps + SCAN_SIZE)));
+        _mm512_store_si512((void *)(batch_keyps + 8), _mm512_load_si512((void *)(batch_keyps + SCAN_SIZE + 8)));
+      }
+    }
+
+    if (count > 0) {
+      fn(batch_keyps, batch_values, batch_slots, count);
+    }
+  }
+
 private:
+  // Whether the image has the layout save() writes for a table like this one, see MapVec16::is_valid_image.
+  bool is_valid_image(const struct snapshot_header *header) const {
+    if (header->params[0] != capacity || header->params[1] != key_size || header->params[2] > capacity || header->num_sections != 2) {
+      return false;
+    }
+    return header->section_sizes[0] == sizeof(hash_value_t) * capacity && header->section_sizes[1] == (size_t)key_size * capacity;
+  }
+
   int keq(void *key1, void *key2) const { return memcmp(key1, key2, key_size) == 0; }
   u32 loop(u32 k, u32 capacity) const { return k & (capacity - 1); }
   __m512i hash_keys_vec(void *keys) const { return _mm512_cvtepu32_epi64(fxhash_vec8<key_size>(keys)); }
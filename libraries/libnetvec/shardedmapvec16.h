@@ -0,0 +1,165 @@
+#pragma once
+
+#include <libnetvec/mapvec16.h>
+#include <libutil/hash.h>
+#include <libutil/math.h>
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <immintrin.h>
+#include <assert.h>
+
+#include <memory>
+#include <vector>
+
+// A shared-nothing set of MapVec16 shards, meant to be owned one per core.
+//
+// Keys are steered to a shard using the high bits of their hash. MapVec16 indexes its slots with the low bits, so the two never overlap as long as
+// the shard capacity fits in the remaining bits.
+//
+// Shards are not allocated by the constructor. Each one must be initialized with init_shard() by the core that will own it: with the kernel's
+// first-touch policy, the shard's pages then end up on that core's NUMA node.
+template <size_t key_size> class ShardedMapVec16 {
+public:
+  static constexpr const u32 VECTOR_SIZE = MapVec16<key_size>::VECTOR_SIZE;
+
+private:
+  // Keys are compressed into per-shard sub-batches as 64b words, see split_vec.
+  static_assert(key_size % sizeof(u64) == 0, "ShardedMapVec16 requires the key size to be a multiple of 8B");
+  static_assert(key_size <= 32, "ShardedMapVec16 supports keys of up to 32B");
+
+  static constexpr const u32 WORDS_PER_KEY = key_size / sizeof(u64);
+
+  const u32 num_shards;
+  const u32 shard_capacity;
+  // Set once the number of shards is known to be a power of 2.
+  u32 shard_shift;
+
+  std::vector<std::unique_ptr<MapVec16<key_size>>> shards;
+
+public:
+  ShardedMapVec16(u32 _num_shards, u32 _shard_capacity)
+      : num_shards(_num_shards), shard_capacity(_shard_capacity), shard_shift(0), shards(_num_shards) {
+    // Check that the number of shards is a power of 2
+    if (_num_shards == 0 || is_power_of_two(_num_shards) == 0) {
+      fprintf(stderr, "Error: Number of shards must be a power of 2\n");
+      exit(1);
+    }
+
+    // The shard selection bits must not overlap with the bits used to index the shard slots
+    if ((u64)_shard_capacity * _num_shards > (1ull << 32)) {
+      fprintf(stderr, "Error: Total capacity must fit in the 32b hash\n");
+      exit(1);
+    }
+
+    shard_shift = 32 - __builtin_ctz(_num_shards);
+  }
+
+  // Allocates the shard. Must be called by the core that will own it, unless opts explicitly binds it to that core's NUMA node.
+  void init_shard(u32 shard, const struct mem_opts *opts = nullptr) {
+    assert(shard < num_shards && "Invalid shard");
+    assert(!shards[shard] && "Shard already initialized");
+    shards[shard] = std::make_unique<MapVec16<key_size>>(shard_capacity, opts);
+  }
+
+  MapVec16<key_size> &get_shard(u32 shard) {
+    assert(shards[shard] && "Shard not initialized");
+    return *shards[shard];
+  }
+
+  u32 get_num_shards() const { return num_shards; }
+
+  // Shard in charge of the given key.
+  u32 shard_of(void *key) const { return shard_of_hash(hash_key(key)); }
+
+  int get(void *key, int *value_out) const { return shards[shard_of(key)]->get(key, value_out); }
+  void put(void *key, int value) { shards[shard_of(key)]->put(key, value); }
+  void erase(void *key) { shards[shard_of(key)]->erase(key); }
+
+  u32 get_size() const {
+    u32 size = 0;
+    for (const std::unique_ptr<MapVec16<key_size>> &shard : shards) {
+      if (shard) {
+        size += shard->get_size();
+      }
+    }
+    return size;
+  }
+
+  // Looks up a burst of VECTOR_SIZE keys that may belong to any shard.
+  // The burst is split into per-shard sub-batches, each served by a single vectorized lookup on its shard.
+  // Returns a bitmask of the lanes whose key was found. Values of the lanes that were not found are left untouched.
+  int get_vec(void *keys, int *values_out) const {
+    __m512i values_vec = _mm512_loadu_si512((void *)values_out);
+    __mmask16 found    = 0;
+
+    split_vec(keys, [&](u32 shard, void *shard_keys, __mmask16 lanes, u32 count) {
+      // Compress the current values of the lanes, so that the ones that are not found keep their value once expanded back.
+      alignas(64) int shard_values[VECTOR_SIZE];
+      _mm512_store_si512((void *)shard_values, _mm512_maskz_compress_epi32(lanes, values_vec));
+
+      const __mmask16 shard_found = shards[shard]->get_vec(shard_keys, shard_values, (__mmask16)((1u << count) - 1));
+
+      // Move the results back to their original lanes
+      values_vec = _mm512_mask_expand_epi32(values_vec, lanes, _mm512_load_si512((void *)shard_values));
+      found     |= (__mmask16)_pdep_u32(shard_found, lanes);
+    });
+
+    _mm512_storeu_si512((void *)values_out, values_vec);
+    return found;
+  }
+
+  // Splits a burst of VECTOR_SIZE contiguous keys into per-shard sub-batches.
+  // For each shard with at least one key in the burst, fn(shard, shard_keys, lanes, count) is called, where shard_keys holds the count keys of
+  // that shard stored contiguously (in burst order), and lanes is the bitmask of their original positions in the burst.
+  // The sub-batch buffer is reused between calls, so it must be consumed (or copied, e.g. into a ring towards the owning core) by fn.
+  template <typename F> void split_vec(void *keys, F &&fn) const {
+    const __m512i hashes_vec = hash_keys_vec(keys);
+
+    // Shift by a variable amount, as shifting a 32b lane by 32 (single shard) yields 0.
+    const __m512i shards_vec = _mm512_srlv_epi32(hashes_vec, _mm512_set1_epi32(shard_shift));
+
+    alignas(64) u32 lanes_shards[VECTOR_SIZE];
+    _mm512_store_si512((void *)lanes_shards, shards_vec);
+
+    alignas(64) u8 shard_keys[VECTOR_SIZE * key_size];
+
+    __mmask16 pending = 0xffff;
+    while (pending != 0) {
+      // Pick the shard of the first pending lane, and find all the other lanes that go to that same shard
+      const u32 shard       = lanes_shards[__builtin_ctz(pending)];
+      const __mmask16 lanes = _mm512_mask_cmpeq_epi32_mask(pending, shards_vec, _mm512_set1_epi32(shard));
+      const u32 count       = _mm_popcnt_u32(lanes);
+
+      // Expand the lanes mask into a mask of 64b key words, each lane bit being repeated WORDS_PER_KEY times.
+      const u64 words_mask = _pdep_u64(lanes, lanes_words_spread()) * ((1ull << WORDS_PER_KEY) - 1);
+
+      // Compress the keys of the shard into the sub-batch buffer, 8 words at a time
+      u64 *dst = (u64 *)shard_keys;
+      for (u32 chunk = 0; chunk < 2 * WORDS_PER_KEY; chunk++) {
+        const __mmask8 chunk_mask = (__mmask8)(words_mask >> (chunk * 8));
+        _mm512_mask_compressstoreu_epi64((void *)dst, chunk_mask, _mm512_loadu_si512((u8 *)keys + chunk * 64));
+        dst += _mm_popcnt_u32(chunk_mask);
+      }
+
+      fn(shard, (void *)shard_keys, lanes, count);
+
+      pending = _mm512_kandn(lanes, pending);
+    }
+  }
+
+private:
+  u32 shard_of_hash(u32 hash) const { return (u32)((u64)hash >> shard_shift); }
+
+  // Bitmask with the first bit of the words of each lane set.
+  static constexpr u64 lanes_words_spread() {
+    u64 spread = 0;
+    for (u32 lane = 0; lane < VECTOR_SIZE; lane++) {
+      spread |= 1ull << (lane * WORDS_PER_KEY);
+    }
+    return spread;
+  }
+
+  __m512i hash_keys_vec(void *keys) const { return fxhash_vec16<key_size>(keys); }
+  u32 hash_key(void *key) const { return fxhash<key_size>(key); }
+};
@@ -0,0 +1,216 @@
+#include <libnet/bloom-filter.h>
+#include <libutil/random.h>
+
+#include <algorithm>
+#include <chrono>
+#include <format>
+#include <vector>
+#include <string.h>
+
+#include "common.h"
+#include "bench.h"
+
+// A flow filter in front of a SYN-flood check: each burst is first checked against the filter, and then set in it. Flows come and go: a
+// packet belongs to one of ACTIVE_FLOWS consecutive flows, and the window of active flows moves by one flow every CHURN_PACKETS packets.
+// Time is virtual, with one packet per nanosecond.
+//
+// A flow is known when it had a packet in the last KNOWN_PACKETS packets: the filter should never take it for a new one. The notes give the
+// share of known flows taken for new ones (on average, and in the worst window of WINDOW_PACKETS packets), the share of never seen flows taken
+// for known ones, the latency of the bursts, and the latency of the bursts that wiped or rotated the filter.
+class FlowFilterBench : public Benchmark {
+protected:
+  static constexpr const u32 BURST_SIZE     = 32;
+  static constexpr const u32 ACTIVE_FLOWS   = 1 << 14;
+  static constexpr const u32 CHURN_PACKETS  = 64;
+  static constexpr const u64 KNOWN_PACKETS  = 1 << 16;
+  static constexpr const u64 WINDOW_PACKETS = 1 << 15;
+  static constexpr const time_ns_t NEVER    = -1;
+
+  const u64 total_packets;
+
+  RandomUniformEngine uniform_engine;
+  RandomUniformEngine flow_engine;
+  keys_pool_t keys_pool;
+  std::vector<u32> flows;
+  std::vector<u8> packets;
+
+  std::vector<time_ns_t> last_seen;
+  std::vector<time_ns_t> latencies;
+  std::vector<time_ns_t> cleanup_latencies;
+  u64 known_packets;
+  u64 known_missed;
+  u64 new_packets;
+  u64 new_hits;
+  double worst_window;
+
+  u8 *get_burst(u64 i) { return packets.data() + i * keys_pool.key_size; }
+
+public:
+  FlowFilterBench(const std::string &_name, u32 random_seed, size_t key_size, u64 _total_packets)
+      : Benchmark(_name), total_packets(_total_packets), uniform_engine(random_seed, 0, 0xff), flow_engine(random_seed, 0, ACTIVE_FLOWS - 1),
+        keys_pool(key_size, _total_packets / CHURN_PACKETS + ACTIVE_FLOWS), known_packets(0), known_missed(0), new_packets(0), new_hits(0),
+        worst_window(0) {
+    assert(total_packets % BURST_SIZE == 0 && "total_packets must be a multiple of the burst size");
+  }
+
+  void setup() override {
+    keys_pool.random_populate(uniform_engine);
+    flows.resize(total_packets);
+    packets.resize(total_packets * keys_pool.key_size);
+    for (u64 i = 0; i < total_packets; i++) {
+      flows[i] = i / CHURN_PACKETS + flow_engine.generate();
+      memcpy(get_burst(i), keys_pool.get_key(flows[i]), keys_pool.key_size);
+    }
+    last_seen.assign(keys_pool.capacity, NEVER);
+    latencies.clear();
+    latencies.reserve(total_packets / BURST_SIZE);
+    cleanup_latencies.clear();
+  }
+
+  void run() override final {
+    u64 window_known  = 0;
+    u64 window_missed = 0;
+
+    for (u64 i = 0; i < total_packets; i += BURST_SIZE) {
+      const time_ns_t now = i + 1;
+
+      bool cleanup;
+      const auto start        = std::chrono::steady_clock::now();
+      const u64 present       = process_burst(get_burst(i), now, &cleanup);
+      const auto end          = std::chrono::steady_clock::now();
+      const time_ns_t latency = std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+      latencies.push_back(latency);
+      if (cleanup) {
+        cleanup_latencies.push_back(latency);
+      }
+
+      for (u32 packet = 0; packet < BURST_SIZE; packet++) {
+        const u32 flow     = flows[i + packet];
+        const bool found   = (present >> packet) & 1;
+        const time_ns_t at = now + packet;
+        if (last_seen[flow] == NEVER) {
+          new_packets++;
+          new_hits += found;
+        } else if (at - last_seen[flow] <= static_cast<time_ns_t>(KNOWN_PACKETS)) {
+          known_packets++;
+          known_missed += !found;
+          window_known++;
+          window_missed += !found;
+        }
+        last_seen[flow] = at;
+      }
+
+      if ((i + BURST_SIZE) % WINDOW_PACKETS == 0 && window_known > 0) {
+        worst_window  = std::max(worst_window, static_cast<double>(window_missed) / static_cast<double>(window_known));
+        window_known  = 0;
+        window_missed = 0;
+      }
+    }
+    Benchmark::increment_counter(total_packets);
+  }
+
+  // Many benchmarks are set up one after the other, release the packets.
+  void teardown() override final {
+    flows     = std::vector<u32>();
+    packets   = std::vector<u8>();
+    last_seen = std::vector<time_ns_t>();
+  }
+
+  std::string get_notes() const override final {
+    std::vector<time_ns_t> sorted = latencies;
+    std::sort(sorted.begin(), sorted.end());
+    const double missed   = 100.0 * static_cast<double>(known_missed) / static_cast<double>(known_packets);
+    const double fpr      = 100.0 * static_cast<double>(new_hits) / static_cast<double>(new_packets);
+    time_ns_t cleanup_sum = 0;
+    for (time_ns_t latency : cleanup_latencies) {
+      cleanup_sum += latency;
+    }
+    const time_ns_t cleanup_mean = cleanup_latencies.empty() ? 0 : cleanup_sum / static_cast<time_ns_t>(cleanup_latencies.size());
+    return std::format("known taken for new {:.3f}% (worst window {:.2f}%), fpr {:.3f}%, burst p50 {} ns p99 {} ns, cleanup burst {} ns", missed,
+                       100.0 * worst_window, fpr, sorted[sorted.size() / 2], sorted[sorted.size() * 99 / 100], cleanup_mean);
+  }
+
+protected:
+  // Checks the burst against the filter, sets it, and returns the bitmask of the packets that were found. Tells whether the filter was wiped
+  // or rotated first.
+  virtual u64 process_burst(void *keys, time_ns_t now, bool *cleanup_out) = 0;
+};
+
+// Blocked BloomFilter wiped by bf_periodic_cleanup.
+class PeriodicClear : public FlowFilterBench {
+private:
+  const u32 height;
+  const u32 width;
+  const time_ns_t cleanup_interval;
+
+  struct BloomFilter *bf;
+
+public:
+  PeriodicClear(u32 random_seed, size_t key_size, u32 _height, u32 _width, time_ns_t _cleanup_interval, u64 _total_packets)
+      : FlowFilterBench("periodic-clear", random_seed, key_size, _total_packets), height(_height), width(_width), cleanup_interval(_cleanup_interval),
+        bf(nullptr) {}
+
+  void setup() override final {
+    FlowFilterBench::setup();
+    assert_or_panic(bf_allocate_blocked(height, width, keys_pool.key_size, cleanup_interval, &bf), "Failed to allocate bloom filter");
+  }
+
+protected:
+  u64 process_burst(void *keys, time_ns_t now, bool *cleanup_out) override final {
+    *cleanup_out      = bf_periodic_cleanup(bf, now);
+    const u64 present = bf_query_vec(bf, keys, BURST_SIZE);
+    bf_set_vec(bf, keys, BURST_SIZE);
+    return present;
+  }
+};
+
+// AgingBloomFilter of the same total memory, that forgets keys after about the same time: the last generation fades out over the last
+// cleanup_interval / (num_generations - 1).
+class AgingFilter : public FlowFilterBench {
+private:
+  const u32 num_generations;
+  const u32 height;
+  const u32 width;
+  const time_ns_t generation_interval;
+
+  struct AgingBloomFilter *abf;
+
+public:
+  AgingFilter(u32 random_seed, size_t key_size, u32 _num_generations, u32 _height, u32 _width, time_ns_t cleanup_interval, u64 _total_packets)
+      : FlowFilterBench(std::format("aging-{}-generations", _num_generations), random_seed, key_size, _total_packets),
+        num_generations(_num_generations), height(_height), width(_width / _num_generations),
+        generation_interval(cleanup_interval / (_num_generations - 1)), abf(nullptr) {}
+
+  void setup() override final {
+    FlowFilterBench::setup();
+    assert_or_panic(abf_allocate(num_generations, height, width, keys_pool.key_size, generation_interval, &abf), "Failed to allocate aging filter");
+  }
+
+protected:
+  u64 process_burst(void *keys, time_ns_t now, bool *cleanup_out) override final {
+    *cleanup_out      = abf_advance(abf, now);
+    const u64 present = abf_query_vec(abf, keys, BURST_SIZE);
+    abf_set_vec(abf, keys, BURST_SIZE);
+    return present;
+  }
+};
+
+int main() {
+  constexpr const size_t key_size          = 16;
+  constexpr const u64 total_packets        = 8'388'608;
+  constexpr const u32 height               = 4;
+  constexpr const u32 width                = 1 << 20;
+  constexpr const time_ns_t clear_interval = 1 << 20;
+
+  BenchmarkSuite suite;
+
+  suite.add_benchmark_group(std::format("Flow filter, {} KB, cleared every {} packets", height * width / 8 / 1024, clear_interval));
+  suite.add_benchmark(std::make_unique<PeriodicClear>(0, key_size, height, width, clear_interval, total_packets));
+  for (u32 num_generations : {2, 4, 8}) {
+    suite.add_benchmark(std::make_unique<AgingFilter>(0, key_size, num_generations, height, width, clear_interval, total_packets));
+  }
+
+  suite.run_all();
+
+  return 0;
+}
@@ -0,0 +1,219 @@
+#include <libnet/bloom-filter.h>
+#include <libutil/random.h>
+
+#include <format>
+#include <vector>
+#include <string.h>
+
+#include "common.h"
+#include "bench.h"
+
+// Filters with one byte per bucket, or blocked ones with the same number of buckets packed as bits.
+class BloomFilterBench : public Benchmark {
+protected:
+  const bool blocked;
+  const u32 height;
+  const u32 width;
+  const u64 total_operations;
+
+  RandomUniformEngine uniform_engine;
+  RandomUniformEngine query_engine;
+  keys_pool_t keys_pool;
+  std::vector<u32> key_queries;
+
+  struct BloomFilter *bf;
+
+public:
+  BloomFilterBench(const std::string &_name, u32 random_seed, size_t key_size, bool _blocked, u32 _height, u32 _width, u32 total_keys,
+                   u64 _total_operations)
+      : Benchmark(std::format("{}{}-{}x{}", _blocked ? "blocked-" : "", _name, _height, _width)), blocked(_blocked), height(_height), width(_width),
+        total_operations(_total_operations), uniform_engine(random_seed, 0, 0xff), query_engine(random_seed, 0, total_keys - 1),
+        keys_pool(key_size, total_keys), bf(nullptr) {}
+
+  void setup() override {
+    keys_pool.random_populate(uniform_engine);
+    key_queries.clear();
+    for (u64 i = 0; i < total_operations; i++) {
+      key_queries.push_back(query_engine.generate());
+    }
+    if (blocked) {
+      assert_or_panic(bf_allocate_blocked(height, width, keys_pool.key_size, 1'000'000'000, &bf), "Failed to allocate bloom filter");
+    } else {
+      assert_or_panic(bf_allocate(height, width, keys_pool.key_size, 1'000'000'000, &bf), "Failed to allocate bloom filter");
+    }
+  }
+
+  void teardown() override {}
+};
+
+class BloomFilterSet : public BloomFilterBench {
+public:
+  BloomFilterSet(u32 random_seed, size_t key_size, bool _blocked, u32 _height, u32 _width, u32 total_keys, u64 _total_operations)
+      : BloomFilterBench("set", random_seed, key_size, _blocked, _height, _width, total_keys, _total_operations) {}
+
+  void run() override final {
+    for (u32 key_query : key_queries) {
+      bf_set(bf, keys_pool.get_key(key_query));
+    }
+    Benchmark::increment_counter(key_queries.size());
+  }
+};
+
+class BloomFilterQuery : public BloomFilterBench {
+private:
+  u64 sink;
+
+public:
+  BloomFilterQuery(u32 random_seed, size_t key_size, bool _blocked, u32 _height, u32 _width, u32 total_keys, u64 _total_operations)
+      : BloomFilterBench("query", random_seed, key_size, _blocked, _height, _width, total_keys, _total_operations), sink(0) {}
+
+  void setup() override final {
+    BloomFilterBench::setup();
+    for (u32 key_query : key_queries) {
+      bf_set(bf, keys_pool.get_key(key_query));
+    }
+  }
+
+  void run() override final {
+    for (u32 key_query : key_queries) {
+      sink += bf_query(bf, keys_pool.get_key(key_query));
+    }
+    Benchmark::increment_counter(key_queries.size());
+  }
+
+  void teardown() override final { assert_or_panic(sink == key_queries.size(), "False negatives"); }
+};
+
+// Bursts of BURST_SIZE packets, with their keys laid out one after the other.
+class BloomFilterBurstBench : public BloomFilterBench {
+protected:
+  static constexpr const u32 BURST_SIZE = 32;
+
+  std::vector<u8> packets;
+
+  u8 *get_burst(u64 i) { return packets.data() + i * keys_pool.key_size; }
+
+public:
+  BloomFilterBurstBench(const std::string &_name, u32 random_seed, size_t key_size, bool _blocked, u32 _height, u32 _width, u32 total_keys,
+                        u64 _total_operations)
+      : BloomFilterBench(_name, random_seed, key_size, _blocked, _height, _width, total_keys, _total_operations) {
+    assert(total_operations % BURST_SIZE == 0 && "total_operations must be a multiple of the burst size");
+  }
+
+  void setup() override {
+    BloomFilterBench::setup();
+    packets.resize(key_queries.size() * keys_pool.key_size);
+    for (u64 i = 0; i < key_queries.size(); i++) {
+      memcpy(get_burst(i), keys_pool.get_key(key_queries[i]), keys_pool.key_size);
+    }
+  }
+
+  // Many benchmarks are set up one after the other, release the packets.
+  void teardown() override { packets = std::vector<u8>(); }
+};
+
+class BloomFilterSetVec : public BloomFilterBurstBench {
+public:
+  BloomFilterSetVec(u32 random_seed, size_t key_size, bool _blocked, u32 _height, u32 _width, u32 total_keys, u64 _total_operations)
+      : BloomFilterBurstBench("set-vec", random_seed, key_size, _blocked, _height, _width, total_keys, _total_operations) {}
+
+  void run() override final {
+    for (u64 i = 0; i < key_queries.size(); i += BURST_SIZE) {
+      bf_set_vec(bf, get_burst(i), BURST_SIZE);
+    }
+    Benchmark::increment_counter(key_queries.size());
+  }
+};
+
+class BloomFilterQueryVec : public BloomFilterBurstBench {
+private:
+  u64 sink;
+
+public:
+  BloomFilterQueryVec(u32 random_seed, size_t key_size, bool _blocked, u32 _height, u32 _width, u32 total_keys, u64 _total_operations)
+      : BloomFilterBurstBench("query-vec", random_seed, key_size, _blocked, _height, _width, total_keys, _total_operations), sink(0) {}
+
+  void setup() override final {
+    BloomFilterBurstBench::setup();
+    bf_set_vec(bf, get_burst(0), key_queries.size());
+  }
+
+  void run() override final {
+    for (u64 i = 0; i < key_queries.size(); i += BURST_SIZE) {
+      sink += __builtin_popcountll(bf_query_vec(bf, get_burst(i), BURST_SIZE));
+    }
+    Benchmark::increment_counter(key_queries.size());
+  }
+
+  void teardown() override final {
+    BloomFilterBurstBench::teardown();
+    assert_or_panic(sink == key_queries.size(), "False negatives");
+  }
+};
+
+// Queries of keys that were never set: every positive is a false one. The first inserted_keys keys of the pool are set, and the queries are
+// drawn from the others.
+class BloomFilterFalsePositives : public BloomFilterBench {
+private:
+  const u32 inserted_keys;
+  u64 false_positives;
+
+public:
+  BloomFilterFalsePositives(u32 random_seed, size_t key_size, bool _blocked, u32 _height, u32 _width, u32 _inserted_keys, u32 total_keys,
+                            u64 _total_operations)
+      : BloomFilterBench("fpr", random_seed, key_size, _blocked, _height, _width, total_keys, _total_operations), inserted_keys(_inserted_keys),
+        false_positives(0) {}
+
+  void setup() override final {
+    BloomFilterBench::setup();
+    for (u32 key = 0; key < inserted_keys; key++) {
+      bf_set(bf, keys_pool.get_key(key));
+    }
+    for (u32 &key_query : key_queries) {
+      key_query = inserted_keys + key_query % (keys_pool.capacity - inserted_keys);
+    }
+  }
+
+  void run() override final {
+    for (u32 key_query : key_queries) {
+      false_positives += bf_query(bf, keys_pool.get_key(key_query));
+    }
+    Benchmark::increment_counter(key_queries.size());
+  }
+
+  std::string get_notes() const override final {
+    const u64 bytes = blocked ? static_cast<u64>(height) * width / 8 : static_cast<u64>(height) * width;
+    return std::format("{} KB, fpr {:.4f}%", bytes / 1024, 100.0 * static_cast<double>(false_positives) / static_cast<double>(key_queries.size()));
+  }
+};
+
+int main() {
+  constexpr const size_t key_size   = 16;
+  constexpr const u32 total_keys    = 1 << 16;
+  constexpr const u64 total_queries = 16'000'000;
+
+  BenchmarkSuite suite;
+
+  for (u32 width : {1 << 10, 1 << 16}) {
+    suite.add_benchmark_group(std::format("Bloom filter, 4 rows of {} buckets", width));
+    for (bool blocked : {false, true}) {
+      suite.add_benchmark(std::make_unique<BloomFilterSet>(0, key_size, blocked, 4, width, total_keys, total_queries));
+      suite.add_benchmark(std::make_unique<BloomFilterQuery>(0, key_size, blocked, 4, width, total_keys, total_queries));
+      suite.add_benchmark(std::make_unique<BloomFilterSetVec>(0, key_size, blocked, 4, width, total_keys, total_queries));
+      suite.add_benchmark(std::make_unique<BloomFilterQueryVec>(0, key_size, blocked, 4, width, total_keys, total_queries));
+    }
+  }
+
+  // 64K keys in 4 rows of 256K buckets (16 buckets per key), with a blocked filter of the same buckets, and one of the same memory.
+  constexpr const u32 inserted_keys = 1 << 16;
+  constexpr const u32 fpr_keys      = 1 << 20;
+  constexpr const u32 fpr_width     = 1 << 18;
+  suite.add_benchmark_group(std::format("False positives, {} keys", inserted_keys));
+  suite.add_benchmark(std::make_unique<BloomFilterFalsePositives>(0, key_size, false, 4, fpr_width, inserted_keys, fpr_keys, total_queries));
+  suite.add_benchmark(std::make_unique<BloomFilterFalsePositives>(0, key_size, true, 4, fpr_width, inserted_keys, fpr_keys, total_queries));
+  suite.add_benchmark(std::make_unique<BloomFilterFalsePositives>(0, key_size, true, 4, fpr_width * 8, inserted_keys, fpr_keys, total_queries));
+
+  suite.run_all();
+
+  return 0;
+}
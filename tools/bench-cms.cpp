@@ -0,0 +1,265 @@
+#include <libnet/cms.h>
+#include <libutil/random.h>
+
+#include <libnet/time.h>
+
+#include <algorithm>
+#include <format>
+#include <vector>
+#include <string.h>
+
+#include "common.h"
+#include "bench.h"
+
+const char *counter_name(enum cms_counter counter) {
+  switch (counter) {
+  case CMS_COUNTER_64:
+    return "u64";
+  case CMS_COUNTER_32:
+    return "u32";
+  case CMS_COUNTER_16:
+    return "u16";
+  case CMS_COUNTER_8:
+    return "u8";
+  }
+  return "";
+}
+
+struct cms_config_t {
+  u32 height;
+  u32 width;
+  enum cms_counter counter;
+  int flags;
+
+  std::string name() const {
+    return std::format("{}x{}-{}{}{}", height, width, counter_name(counter), (flags & CMS_CONSERVATIVE_UPDATE) ? "-conservative" : "",
+                       (flags & CMS_EAGER_RESET) ? "-eager" : "");
+  }
+};
+
+// Keys are drawn from a pool, and laid out one after the other in query order, so that the vectorized operations can take them in batches.
+class CMSBench : public Benchmark {
+protected:
+  const cms_config_t config;
+  const u64 total_operations;
+  time_ns_t cleanup_interval;
+
+  RandomUniformEngine uniform_engine;
+  RandomUniformEngine query_engine;
+  keys_pool_t keys_pool;
+  std::vector<u32> query_keys;
+  std::vector<u8> queries;
+
+  struct CMS *cms;
+
+  u8 *get_query(u64 i) { return queries.data() + i * keys_pool.key_size; }
+
+public:
+  CMSBench(const std::string &_name, u32 random_seed, size_t key_size, const cms_config_t &_config, u32 total_keys, u64 _total_operations)
+      : Benchmark(std::format("{}-{}", _name, _config.name())), config(_config), total_operations(_total_operations), cleanup_interval(1'000'000'000),
+        uniform_engine(random_seed, 0, 0xff), query_engine(random_seed, 0, total_keys - 1), keys_pool(key_size, total_keys), cms(nullptr) {
+    assert(total_operations % CMS_VECTOR_SIZE == 0 && "total_operations must be a multiple of the vector size");
+  }
+
+  void setup() override {
+    keys_pool.random_populate(uniform_engine);
+    query_keys.resize(total_operations);
+    queries.resize(total_operations * keys_pool.key_size);
+    for (u64 i = 0; i < total_operations; i++) {
+      query_keys[i] = query_engine.generate();
+      memcpy(get_query(i), keys_pool.get_key(query_keys[i]), keys_pool.key_size);
+    }
+    assert_or_panic(cms_allocate_counters(config.height, config.width, keys_pool.key_size, config.counter, config.flags, cleanup_interval, &cms),
+                    "Failed to allocate CMS");
+  }
+
+  // Many benchmarks are set up one after the other, release the queries.
+  void teardown() override {
+    query_keys = std::vector<u32>();
+    queries    = std::vector<u8>();
+  }
+};
+
+class CMSIncrement : public CMSBench {
+public:
+  CMSIncrement(u32 random_seed, size_t key_size, const cms_config_t &_config, u32 total_keys, u64 _total_operations)
+      : CMSBench("increment", random_seed, key_size, _config, total_keys, _total_operations) {}
+
+  void run() override final {
+    for (u64 i = 0; i < total_operations; i++) {
+      cms_increment(cms, get_query(i));
+    }
+    Benchmark::increment_counter(total_operations);
+  }
+};
+
+class CMSIncrementVec : public CMSBench {
+public:
+  CMSIncrementVec(u32 random_seed, size_t key_size, const cms_config_t &_config, u32 total_keys, u64 _total_operations)
+      : CMSBench("increment-vec", random_seed, key_size, _config, total_keys, _total_operations) {}
+
+  void run() override final {
+    for (u64 i = 0; i < total_operations; i += CMS_VECTOR_SIZE) {
+      cms_increment_vec(cms, get_query(i));
+    }
+    Benchmark::increment_counter(total_operations);
+  }
+};
+
+// The sketch is filled with the first window_operations keys, and then queried with all of them. The error is how much the estimates exceed
+// the exact counts in the window, on average.
+class CMSCountMinBench : public CMSBench {
+protected:
+  const u64 window_operations;
+
+  std::vector<u32> exact_counts;
+  u64 exact_sum;
+  u64 sink;
+
+public:
+  CMSCountMinBench(const std::string &_name, u32 random_seed, size_t key_size, const cms_config_t &_config, u32 total_keys, u64 _window_operations,
+                   u64 _total_operations)
+      : CMSBench(_name, random_seed, key_size, _config, total_keys, _total_operations), window_operations(_window_operations), exact_counts(total_keys),
+        exact_sum(0), sink(0) {}
+
+  void setup() override final {
+    CMSBench::setup();
+    for (u64 i = 0; i < window_operations; i++) {
+      cms_increment(cms, get_query(i));
+      exact_counts[query_keys[i]]++;
+    }
+    for (u64 i = 0; i < total_operations; i++) {
+      exact_sum += exact_counts[query_keys[i]];
+    }
+  }
+
+  void teardown() override final {
+    CMSBench::teardown();
+    assert_or_panic(sink >= exact_sum, "Underestimated counts");
+  }
+
+  std::string get_notes() const override final {
+    return std::format("mean error {:.2f}", static_cast<double>(sink - exact_sum) / static_cast<double>(total_operations));
+  }
+};
+
+class CMSCountMin : public CMSCountMinBench {
+public:
+  CMSCountMin(u32 random_seed, size_t key_size, const cms_config_t &_config, u32 total_keys, u64 _window_operations, u64 _total_operations)
+      : CMSCountMinBench("count-min", random_seed, key_size, _config, total_keys, _window_operations, _total_operations) {}
+
+  void run() override final {
+    for (u64 i = 0; i < total_operations; i++) {
+      sink += cms_count_min(cms, get_query(i));
+    }
+    Benchmark::increment_counter(total_operations);
+  }
+};
+
+class CMSCountMinVec : public CMSCountMinBench {
+public:
+  CMSCountMinVec(u32 random_seed, size_t key_size, const cms_config_t &_config, u32 total_keys, u64 _window_operations, u64 _total_operations)
+      : CMSCountMinBench("count-min-vec", random_seed, key_size, _config, total_keys, _window_operations, _total_operations) {}
+
+  void run() override final {
+    for (u64 i = 0; i < total_operations; i += CMS_VECTOR_SIZE) {
+      int counts[CMS_VECTOR_SIZE];
+      cms_count_min_vec(cms, get_query(i), counts);
+      for (int count : counts) {
+        sink += count;
+      }
+    }
+    Benchmark::increment_counter(total_operations);
+  }
+};
+
+// Latency of each packet, made of a cleanup check and an increment, in the bursts that start with a cleanup. Time is virtual, with one packet
+// per nanosecond, so that the sketch is cleaned up every cleanup_packets packets.
+class CMSCleanupLatency : public CMSBench {
+private:
+  static constexpr const u64 BURST_SIZE = 32;
+
+  const u64 cleanup_packets;
+  std::vector<time_ns_t> latencies;
+  time_ns_t p50;
+  time_ns_t p99;
+  time_ns_t max;
+
+public:
+  CMSCleanupLatency(u32 random_seed, size_t key_size, const cms_config_t &_config, u32 total_keys, u64 _cleanup_packets, u64 _total_operations)
+      : CMSBench("cleanup", random_seed, key_size, _config, total_keys, _total_operations), cleanup_packets(_cleanup_packets), p50(0), p99(0), max(0) {
+    cleanup_interval = static_cast<time_ns_t>(cleanup_packets);
+  }
+
+  void setup() override final {
+    CMSBench::setup();
+    latencies.clear();
+    latencies.reserve(total_operations / cleanup_packets * BURST_SIZE);
+  }
+
+  void run() override final {
+    for (u64 i = 0; i < total_operations; i++) {
+      const time_ns_t start = current_time();
+      cms_periodic_cleanup(cms, i + 1);
+      cms_increment(cms, get_query(i));
+      const time_ns_t latency = current_time() - start;
+
+      // The cleanups happen on the packets i = k * cleanup_packets.
+      if (i % cleanup_packets < BURST_SIZE) {
+        latencies.push_back(latency);
+      }
+    }
+    Benchmark::increment_counter(total_operations);
+  }
+
+  void teardown() override final {
+    CMSBench::teardown();
+    std::sort(latencies.begin(), latencies.end());
+    p50 = latencies[latencies.size() / 2];
+    p99 = latencies[latencies.size() * 99 / 100];
+    max = latencies.back();
+  }
+
+  std::string get_notes() const override final { return std::format("cleanup bursts: p50 {} ns, p99 {} ns, max {} ns", p50, p99, max); }
+};
+
+int main() {
+  constexpr const size_t key_size       = 16;
+  constexpr const u32 total_keys        = 1 << 16;
+  constexpr const u64 window_operations = 1 << 20;
+  constexpr const u64 total_queries     = 16'000'000;
+  constexpr const u64 cleanup_packets   = 100'000;
+
+  BenchmarkSuite suite;
+
+  for (u32 width : {1 << 10, 1 << 16}) {
+    const cms_config_t conservative = {4, width, CMS_COUNTER_32, CMS_CONSERVATIVE_UPDATE};
+
+    suite.add_benchmark_group(std::format("CMS increment, 4 rows of {} counters", width));
+    for (enum cms_counter counter : {CMS_COUNTER_64, CMS_COUNTER_32, CMS_COUNTER_16, CMS_COUNTER_8}) {
+      suite.add_benchmark(std::make_unique<CMSIncrement>(0, key_size, cms_config_t{4, width, counter, 0}, total_keys, total_queries));
+      suite.add_benchmark(std::make_unique<CMSIncrementVec>(0, key_size, cms_config_t{4, width, counter, 0}, total_keys, total_queries));
+    }
+    suite.add_benchmark(std::make_unique<CMSIncrement>(0, key_size, conservative, total_keys, total_queries));
+    suite.add_benchmark(std::make_unique<CMSIncrementVec>(0, key_size, conservative, total_keys, total_queries));
+
+    suite.add_benchmark_group(std::format("CMS count-min, 4 rows of {} counters, {} keys in the window", width, window_operations));
+    for (enum cms_counter counter : {CMS_COUNTER_64, CMS_COUNTER_32, CMS_COUNTER_16, CMS_COUNTER_8}) {
+      suite.add_benchmark(std::make_unique<CMSCountMin>(0, key_size, cms_config_t{4, width, counter, 0}, total_keys, window_operations, total_queries));
+      suite.add_benchmark(std::make_unique<CMSCountMinVec>(0, key_size, cms_config_t{4, width, counter, 0}, total_keys, window_operations, total_queries));
+    }
+    suite.add_benchmark(std::make_unique<CMSCountMin>(0, key_size, conservative, total_keys, window_operations, total_queries));
+    suite.add_benchmark(std::make_unique<CMSCountMinVec>(0, key_size, conservative, total_keys, window_operations, total_queries));
+  }
+
+  suite.add_benchmark_group(std::format("CMS cleanup every {} packets, 4 rows of {} counters", cleanup_packets, 1 << 16));
+  for (enum cms_counter counter : {CMS_COUNTER_64, CMS_COUNTER_16}) {
+    suite.add_benchmark(std::make_unique<CMSCleanupLatency>(0, key_size, cms_config_t{4, 1 << 16, counter, CMS_EAGER_RESET}, total_keys, cleanup_packets,
+                                                            total_queries));
+    suite.add_benchmark(std::make_unique<CMSCleanupLatency>(0, key_size, cms_config_t{4, 1 << 16, counter, 0}, total_keys, cleanup_packets, total_queries));
+  }
+
+  suite.run_all();
+
+  return 0;
+}
@@ -0,0 +1,139 @@
+#include <libnet/map.h>
+#include <libnetvec/concurrentmapvec8.h>
+#include <libutil/random.h>
+
+#include <format>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "common.h"
+#include "bench.h"
+
+// Concurrent flow setup: every thread inserts its own share of new flows into a single shared table.
+template <size_t key_size> class ConcurrentSetupBench : public Benchmark {
+protected:
+  const u64 map_capacity;
+  const u64 total_flows;
+  const u32 num_threads;
+
+  RandomUniformEngine uniform_engine;
+  keys_pool_t keys_pool;
+
+public:
+  ConcurrentSetupBench(const std::string &_name, u32 random_seed, u64 _map_capacity, u64 _total_flows, u32 _num_threads)
+      : Benchmark(_name), map_capacity(_map_capacity), total_flows(_total_flows), num_threads(_num_threads), uniform_engine(random_seed, 0, 0xff),
+        keys_pool(key_size, _total_flows) {
+    assert(total_flows <= map_capacity && "total_flows must fit in the map");
+    assert(total_flows % (num_threads * ConcurrentMapVec8<key_size>::VECTOR_SIZE) == 0 && "total_flows must be evenly split in vectors between threads");
+  }
+
+  void setup() override { keys_pool.random_populate(uniform_engine); }
+  void teardown() override {}
+
+  void run() override final {
+    const u64 flows_per_thread = total_flows / num_threads;
+
+    std::vector<std::thread> threads;
+    for (u32 thread = 0; thread < num_threads; thread++) {
+      threads.emplace_back([this, thread, flows_per_thread]() { insert(thread * flows_per_thread, flows_per_thread); });
+    }
+    for (std::thread &thread : threads) {
+      thread.join();
+    }
+
+    Benchmark::increment_counter(total_flows);
+  }
+
+protected:
+  virtual void insert(u64 first, u64 count) = 0;
+};
+
+template <size_t key_size> class MutexMapSetup : public ConcurrentSetupBench<key_size> {
+private:
+  std::unique_ptr<Map> map;
+  std::mutex lock;
+
+public:
+  MutexMapSetup(u32 random_seed, u64 _map_capacity, u64 _total_flows, u32 _num_threads)
+      : ConcurrentSetupBench<key_size>(std::format("mutex-map-{}-threads", _num_threads), random_seed, _map_capacity, _total_flows, _num_threads) {}
+
+  void setup() override final {
+    ConcurrentSetupBench<key_size>::setup();
+    map = std::make_unique<Map>(this->map_capacity, key_size);
+  }
+
+protected:
+  void insert(u64 first, u64 count) override final {
+    for (u64 i = first; i < first + count; i++) {
+      std::lock_guard<std::mutex> guard(lock);
+      map->put(this->keys_pool.get_key(i), static_cast<int>(i));
+    }
+  }
+};
+
+template <size_t key_size> class ConcurrentMapVec8Setup : public ConcurrentSetupBench<key_size> {
+private:
+  std::unique_ptr<ConcurrentMapVec8<key_size>> map;
+
+public:
+  ConcurrentMapVec8Setup(u32 random_seed, u64 _map_capacity, u64 _total_flows, u32 _num_threads)
+      : ConcurrentSetupBench<key_size>(std::format("cmapvec8-{}-threads", _num_threads), random_seed, _map_capacity, _total_flows, _num_threads) {}
+
+  void setup() override final {
+    ConcurrentSetupBench<key_size>::setup();
+    map = std::make_unique<ConcurrentMapVec8<key_size>>(this->map_capacity);
+  }
+
+protected:
+  void insert(u64 first, u64 count) override final {
+    for (u64 i = first; i < first + count; i++) {
+      map->put(this->keys_pool.get_key(i), static_cast<int>(i));
+    }
+  }
+};
+
+template <size_t key_size> class ConcurrentMapVec8VecSetup : public ConcurrentSetupBench<key_size> {
+private:
+  std::unique_ptr<ConcurrentMapVec8<key_size>> map;
+
+public:
+  ConcurrentMapVec8VecSetup(u32 random_seed, u64 _map_capacity, u64 _total_flows, u32 _num_threads)
+      : ConcurrentSetupBench<key_size>(std::format("cmapvec8-vec-{}-threads", _num_threads), random_seed, _map_capacity, _total_flows, _num_threads) {}
+
+  void setup() override final {
+    ConcurrentSetupBench<key_size>::setup();
+    map = std::make_unique<ConcurrentMapVec8<key_size>>(this->map_capacity);
+  }
+
+protected:
+  void insert(u64 first, u64 count) override final {
+    for (u64 i = first; i < first + count; i += ConcurrentMapVec8<key_size>::VECTOR_SIZE) {
+      int values[ConcurrentMapVec8<key_size>::VECTOR_SIZE];
+      for (u32 j = 0; j < ConcurrentMapVec8<key_size>::VECTOR_SIZE; j++) {
+        values[j] = static_cast<int>(i + j);
+      }
+      map->put_vec(this->keys_pool.get_key(i), values);
+    }
+  }
+};
+
+int main() {
+  constexpr const size_t key_size = 16;
+  const u64 map_capacity          = 1 << 21;
+  const u64 total_flows           = 1 << 20;
+
+  BenchmarkSuite suite;
+
+  for (u32 num_threads = 2; num_threads <= 32; num_threads *= 2) {
+    suite.add_benchmark_group(std::format("Concurrent flow setup, {} threads", num_threads));
+    suite.add_benchmark(std::make_unique<MutexMapSetup<key_size>>(0, map_capacity, total_flows, num_threads));
+    suite.add_benchmark(std::make_unique<ConcurrentMapVec8Setup<key_size>>(0, map_capacity, total_flows, num_threads));
+    suite.add_benchmark(std::make_unique<ConcurrentMapVec8VecSetup<key_size>>(0, map_capacity, total_flows, num_threads));
+  }
+
+  suite.run_all();
+
+  return 0;
+}
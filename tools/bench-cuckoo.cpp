@@ -0,0 +1,256 @@
+#include <libnet/bloom-filter.h>
+#include <libnet/cuckoo-filter.h>
+#include <libutil/random.h>
+
+#include <format>
+#include <memory>
+#include <vector>
+#include <string.h>
+
+#include "common.h"
+#include "bench.h"
+
+// The filters compared, all given the same memory.
+class Filter {
+public:
+  virtual ~Filter() {}
+
+  virtual void insert(void *key) = 0;
+  virtual bool query(void *key)  = 0;
+  // Bitmask of the CF_VECTOR_SIZE keys that may be in the filter.
+  virtual u16 query_vec(void *keys) = 0;
+  // Empties the filter, that holds the given keys.
+  virtual void clear(void *keys, u32 num_keys) = 0;
+};
+
+// Bloom filters can only be emptied all at once, by a periodic cleanup.
+class BloomFilterAdapter : public Filter {
+private:
+  const bool blocked;
+  const u32 height;
+  struct BloomFilter *bf;
+  time_ns_t now;
+
+public:
+  BloomFilterAdapter(bool _blocked, u32 _height, u64 memory, size_t key_size) : blocked(_blocked), height(_height), bf(nullptr), now(1) {
+    if (blocked) {
+      assert_or_panic(bf_allocate_blocked(height, memory * 8 / height, key_size, 1, &bf), "Failed to allocate bloom filter");
+    } else {
+      assert_or_panic(bf_allocate(height, memory / height, key_size, 1, &bf), "Failed to allocate bloom filter");
+    }
+    bf_periodic_cleanup(bf, now);
+  }
+
+  void insert(void *key) override final { bf_set(bf, key); }
+  bool query(void *key) override final { return bf_query(bf, key); }
+  u16 query_vec(void *keys) override final { return bf_query_vec(bf, keys, CF_VECTOR_SIZE); }
+  void clear(void *keys, u32 num_keys) override final { bf_periodic_cleanup(bf, ++now); }
+};
+
+// Cuckoo filters are emptied by deleting their keys one by one.
+class CuckooFilterAdapter : public Filter {
+private:
+  struct CuckooFilter *cf;
+  const size_t key_size;
+
+public:
+  CuckooFilterAdapter(u64 memory, size_t _key_size) : cf(nullptr), key_size(_key_size) {
+    assert_or_panic(cf_allocate(memory / sizeof(u64) * CF_BUCKET_SLOTS, key_size, &cf), "Failed to allocate cuckoo filter");
+  }
+
+  void insert(void *key) override final { assert_or_panic(cf_insert(cf, key), "Cuckoo filter full"); }
+  bool query(void *key) override final { return cf_query(cf, key); }
+  u16 query_vec(void *keys) override final { return cf_query_vec(cf, keys); }
+
+  void clear(void *keys, u32 num_keys) override final {
+    for (u32 i = 0; i < num_keys; i++) {
+      cf_delete(cf, static_cast<u8 *>(keys) + i * key_size);
+    }
+  }
+};
+
+enum class FilterKind { BLOOM, BLOCKED_BLOOM_4, BLOCKED_BLOOM_8, CUCKOO };
+
+std::string get_filter_name(FilterKind kind) {
+  switch (kind) {
+  case FilterKind::BLOOM:
+    return "bloom-4";
+  case FilterKind::BLOCKED_BLOOM_4:
+    return "blocked-bloom-4";
+  case FilterKind::BLOCKED_BLOOM_8:
+    return "blocked-bloom-8";
+  case FilterKind::CUCKOO:
+    return "cuckoo";
+  }
+  return "";
+}
+
+std::unique_ptr<Filter> make_filter(FilterKind kind, u64 memory, size_t key_size) {
+  switch (kind) {
+  case FilterKind::BLOOM:
+    return std::make_unique<BloomFilterAdapter>(false, 4, memory, key_size);
+  case FilterKind::BLOCKED_BLOOM_4:
+    return std::make_unique<BloomFilterAdapter>(true, 4, memory, key_size);
+  case FilterKind::BLOCKED_BLOOM_8:
+    return std::make_unique<BloomFilterAdapter>(true, 8, memory, key_size);
+  case FilterKind::CUCKOO:
+    return std::make_unique<CuckooFilterAdapter>(memory, key_size);
+  }
+  return nullptr;
+}
+
+// The first inserted_keys keys of the pool are inserted, and the queries are drawn from the whole pool, so that some of them are for keys
+// that were never inserted: every positive of those is a false one.
+class FilterBench : public Benchmark {
+protected:
+  const FilterKind kind;
+  const u64 memory;
+  const u32 inserted_keys;
+  const u64 total_operations;
+
+  RandomUniformEngine uniform_engine;
+  RandomUniformEngine query_engine;
+  keys_pool_t keys_pool;
+  std::vector<u32> key_queries;
+  std::vector<u8> packets;
+
+  std::unique_ptr<Filter> filter;
+  u64 inserted_hits;
+  u64 inserted_queries;
+  u64 false_positives;
+  u64 absent_queries;
+
+  u8 *get_packet(u64 i) { return packets.data() + i * keys_pool.key_size; }
+
+public:
+  FilterBench(const std::string &_name, u32 random_seed, size_t key_size, FilterKind _kind, u64 _memory, u32 _inserted_keys, u32 total_keys,
+              u64 _total_operations)
+      : Benchmark(std::format("{}-{}", get_filter_name(_kind), _name)), kind(_kind), memory(_memory),
+        inserted_keys(_inserted_keys), total_operations(_total_operations), uniform_engine(random_seed, 0, 0xff),
+        query_engine(random_seed, 0, total_keys - 1), keys_pool(key_size, total_keys), inserted_hits(0), inserted_queries(0), false_positives(0),
+        absent_queries(0) {
+    assert(total_operations % CF_VECTOR_SIZE == 0 && "total_operations must be a multiple of the vector size");
+  }
+
+  void setup() override {
+    keys_pool.random_populate(uniform_engine);
+    key_queries.resize(total_operations);
+    packets.resize(total_operations * keys_pool.key_size);
+    for (u64 i = 0; i < total_operations; i++) {
+      key_queries[i] = query_engine.generate();
+      memcpy(get_packet(i), keys_pool.get_key(key_queries[i]), keys_pool.key_size);
+    }
+    filter = make_filter(kind, memory, keys_pool.key_size);
+  }
+
+  // Many benchmarks are set up one after the other, release the packets.
+  void teardown() override final {
+    key_queries = std::vector<u32>();
+    packets     = std::vector<u8>();
+    assert_or_panic(inserted_hits == inserted_queries, "False negatives");
+  }
+
+  std::string get_notes() const override {
+    const double bits_per_key = 8.0 * static_cast<double>(memory) / static_cast<double>(inserted_keys);
+    return std::format("{:.1f} bits/key, fpr {:.4f}%", bits_per_key, 100.0 * static_cast<double>(false_positives) / static_cast<double>(absent_queries));
+  }
+
+protected:
+  void fill() {
+    for (u32 key = 0; key < inserted_keys; key++) {
+      filter->insert(keys_pool.get_key(key));
+    }
+  }
+
+  void record(u32 key, bool found) {
+    if (key < inserted_keys) {
+      inserted_queries++;
+      inserted_hits += found;
+    } else {
+      absent_queries++;
+      false_positives += found;
+    }
+  }
+};
+
+// Fills the filter and empties it again, total_operations / inserted_keys times.
+class FilterInsert : public FilterBench {
+public:
+  FilterInsert(u32 random_seed, size_t key_size, FilterKind _kind, u64 _memory, u32 _inserted_keys, u32 total_keys, u64 _total_operations)
+      : FilterBench("insert", random_seed, key_size, _kind, _memory, _inserted_keys, total_keys, _total_operations) {}
+
+  void run() override final {
+    const u64 rounds = total_operations / inserted_keys;
+    for (u64 round = 0; round < rounds; round++) {
+      fill();
+      filter->clear(keys_pool.get_key(0), inserted_keys);
+    }
+    Benchmark::increment_counter(rounds * inserted_keys);
+  }
+
+  std::string get_notes() const override final { return kind == FilterKind::CUCKOO ? "emptied by deletes" : "emptied by a cleanup"; }
+};
+
+class FilterQuery : public FilterBench {
+public:
+  FilterQuery(u32 random_seed, size_t key_size, FilterKind _kind, u64 _memory, u32 _inserted_keys, u32 total_keys, u64 _total_operations)
+      : FilterBench("query", random_seed, key_size, _kind, _memory, _inserted_keys, total_keys, _total_operations) {}
+
+  void setup() override final {
+    FilterBench::setup();
+    fill();
+  }
+
+  void run() override final {
+    for (u64 i = 0; i < total_operations; i++) {
+      record(key_queries[i], filter->query(get_packet(i)));
+    }
+    Benchmark::increment_counter(total_operations);
+  }
+};
+
+class FilterQueryVec : public FilterBench {
+public:
+  FilterQueryVec(u32 random_seed, size_t key_size, FilterKind _kind, u64 _memory, u32 _inserted_keys, u32 total_keys, u64 _total_operations)
+      : FilterBench("query-vec", random_seed, key_size, _kind, _memory, _inserted_keys, total_keys, _total_operations) {}
+
+  void setup() override final {
+    FilterBench::setup();
+    fill();
+  }
+
+  void run() override final {
+    for (u64 i = 0; i < total_operations; i += CF_VECTOR_SIZE) {
+      const u16 present = filter->query_vec(get_packet(i));
+      for (u32 lane = 0; lane < CF_VECTOR_SIZE; lane++) {
+        record(key_queries[i + lane], (present >> lane) & 1);
+      }
+    }
+    Benchmark::increment_counter(total_operations);
+  }
+};
+
+int main() {
+  constexpr const size_t key_size   = 16;
+  constexpr const u64 total_queries = 16'000'000;
+
+  BenchmarkSuite suite;
+
+  // The cuckoo filter is filled to 90% of its slots, and the bloom filters get the same keys in the same memory. Half the queries are for keys
+  // that were never inserted.
+  for (u64 memory : {128 * 1024, 4 * 1024 * 1024}) {
+    const u32 inserted_keys = memory / sizeof(u64) * CF_BUCKET_SLOTS * 9 / 10;
+    const u32 total_keys    = 2 * inserted_keys;
+
+    suite.add_benchmark_group(std::format("Filters of {} KB, {} keys", memory / 1024, inserted_keys));
+    for (FilterKind kind : {FilterKind::BLOOM, FilterKind::BLOCKED_BLOOM_4, FilterKind::BLOCKED_BLOOM_8, FilterKind::CUCKOO}) {
+      suite.add_benchmark(std::make_unique<FilterInsert>(0, key_size, kind, memory, inserted_keys, total_keys, total_queries));
+      suite.add_benchmark(std::make_unique<FilterQuery>(0, key_size, kind, memory, inserted_keys, total_keys, total_queries));
+      suite.add_benchmark(std::make_unique<FilterQueryVec>(0, key_size, kind, memory, inserted_keys, total_keys, total_queries));
+    }
+  }
+
+  suite.run_all();
+
+  return 0;
+}
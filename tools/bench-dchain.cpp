@@ -0,0 +1,519 @@
+#include <libnet/double-chain.h>
+#include <libnet/timer-wheel.h>
+#include <libnetvec/mapvec16.h>
+#include <libutil/random.h>
+
+#include <algorithm>
+#include <format>
+#include <memory>
+#include <vector>
+
+#include "common.h"
+#include "bench.h"
+
+// Expiry after a traffic lull: all the flows of the table are expired at once.
+// Flow index i is always keyed by the i-th key of the pool.
+template <size_t key_size> class ExpireBench : public Benchmark {
+protected:
+  const u32 capacity;
+  const u32 total_flows;
+
+  RandomUniformEngine uniform_engine;
+  keys_pool_t keys_pool;
+
+  struct DoubleChain *chain;
+  std::unique_ptr<MapVec16<key_size>> map;
+
+public:
+  ExpireBench(const std::string &_name, u32 random_seed, u32 _capacity, u32 _total_flows)
+      : Benchmark(_name), capacity(_capacity), total_flows(_total_flows), uniform_engine(random_seed, 0, 0xff), keys_pool(key_size, _capacity),
+        chain(nullptr) {
+    assert(total_flows <= capacity && "total_flows must fit in the dchain");
+  }
+
+  void setup() override {
+    keys_pool.random_populate(uniform_engine);
+
+    assert_or_panic(dchain_allocate(capacity, &chain), "Failed to allocate dchain");
+    map = std::make_unique<MapVec16<key_size>>(2 * capacity);
+
+    for (u32 i = 0; i < total_flows; i++) {
+      int index;
+      assert_or_panic(dchain_allocate_new_index(chain, &index, i), "Failed to allocate index");
+      map->put(keys_pool.get_key(index), index);
+    }
+  }
+
+  void teardown() override {
+    assert_or_panic(map->get_size() == 0, "Flows left behind (%u)", map->get_size());
+    dchain_free(chain);
+    map.reset();
+  }
+};
+
+template <size_t key_size> class ExpireOneByOne : public ExpireBench<key_size> {
+public:
+  ExpireOneByOne(u32 random_seed, u32 _capacity, u32 _total_flows)
+      : ExpireBench<key_size>(std::format("expire-one-{}", _total_flows), random_seed, _capacity, _total_flows) {}
+
+  void run() override final {
+    int index;
+    while (dchain_expire_one_index(this->chain, &index, this->total_flows)) {
+      this->map->erase(this->keys_pool.get_key(index));
+      Benchmark::increment_counter();
+    }
+  }
+};
+
+template <size_t key_size> class ExpireBatch : public ExpireBench<key_size> {
+public:
+  ExpireBatch(u32 random_seed, u32 _capacity, u32 _total_flows)
+      : ExpireBench<key_size>(std::format("expire-batch-{}", _total_flows), random_seed, _capacity, _total_flows) {}
+
+  void run() override final {
+    int indices[MapVec16<key_size>::VECTOR_SIZE];
+    int count;
+    while ((count = dchain_expire_batch(this->chain, this->total_flows, indices, MapVec16<key_size>::VECTOR_SIZE)) > 0) {
+      for (int i = 0; i < count; i++) {
+        this->map->erase(this->keys_pool.get_key(indices[i]));
+      }
+      Benchmark::increment_counter(count);
+    }
+  }
+};
+
+template <size_t key_size> class ExpireBatchEraseVec : public ExpireBench<key_size> {
+public:
+  ExpireBatchEraseVec(u32 random_seed, u32 _capacity, u32 _total_flows)
+      : ExpireBench<key_size>(std::format("expire-batch-vec-{}", _total_flows), random_seed, _capacity, _total_flows) {}
+
+  void run() override final {
+    int indices[MapVec16<key_size>::VECTOR_SIZE];
+    alignas(64) u8 keys[MapVec16<key_size>::VECTOR_SIZE * key_size];
+    int count;
+    while ((count = dchain_expire_batch(this->chain, this->total_flows, indices, MapVec16<key_size>::VECTOR_SIZE)) > 0) {
+      for (int i = 0; i < count; i++) {
+        memcpy(keys + i * key_size, this->keys_pool.get_key(indices[i]), key_size);
+      }
+      this->map->erase_vec(keys, (__mmask16)((1u << count) - 1));
+      Benchmark::increment_counter(count);
+    }
+  }
+};
+
+// Per-packet cost of keeping flows alive: every index is allocated, and random ones are rejuvenated.
+// The engine is either a DoubleChain or a TimerWheel, both behind the same operations.
+class RejuvenateBench : public Benchmark {
+protected:
+  static constexpr const time_ns_t GRANULARITY = 1'000;
+
+  const int index_range;
+  const u64 total_operations;
+
+  RandomUniformEngine uniform_engine;
+  std::vector<int> indices;
+
+public:
+  RejuvenateBench(const std::string &_name, u32 random_seed, int _index_range, u64 _total_operations)
+      : Benchmark(_name), index_range(_index_range), total_operations(_total_operations), uniform_engine(random_seed, 0, _index_range - 1) {}
+
+  void setup() override {
+    indices.clear();
+    for (u64 i = 0; i < total_operations; i++) {
+      indices.push_back(uniform_engine.generate());
+    }
+  }
+};
+
+class DChainRejuvenate : public RejuvenateBench {
+private:
+  struct DoubleChain *chain;
+
+public:
+  DChainRejuvenate(u32 random_seed, int _index_range, u64 _total_operations)
+      : RejuvenateBench(std::format("dchain-{}", _index_range), random_seed, _index_range, _total_operations), chain(nullptr) {}
+
+  void setup() override final {
+    RejuvenateBench::setup();
+    assert_or_panic(dchain_allocate(index_range, &chain), "Failed to allocate dchain");
+    for (int i = 0; i < index_range; i++) {
+      int index;
+      dchain_allocate_new_index(chain, &index, 0);
+    }
+  }
+
+  void run() override final {
+    time_ns_t now = 0;
+    for (int index : indices) {
+      dchain_rejuvenate_index(chain, index, now++);
+    }
+    Benchmark::increment_counter(indices.size());
+  }
+
+  void teardown() override final { dchain_free(chain); }
+};
+
+class TimerWheelRejuvenate : public RejuvenateBench {
+private:
+  struct TimerWheel *tw;
+
+public:
+  TimerWheelRejuvenate(u32 random_seed, int _index_range, u64 _total_operations)
+      : RejuvenateBench(std::format("timer-wheel-{}", _index_range), random_seed, _index_range, _total_operations), tw(nullptr) {}
+
+  void setup() override final {
+    RejuvenateBench::setup();
+    assert_or_panic(tw_allocate(index_range, GRANULARITY, 1024, nullptr, &tw), "Failed to allocate timer wheel");
+    for (int i = 0; i < index_range; i++) {
+      int index;
+      tw_allocate_new_index(tw, &index, 0);
+    }
+  }
+
+  void run() override final {
+    time_ns_t now = 0;
+    for (int index : indices) {
+      tw_rejuvenate_index(tw, index, now++);
+    }
+    Benchmark::increment_counter(indices.size());
+  }
+
+  void teardown() override final { tw_free(tw); }
+};
+
+// Rejuvenate half of the indexes, then expire the other half.
+class DChainExpire : public RejuvenateBench {
+private:
+  struct DoubleChain *chain;
+
+public:
+  DChainExpire(u32 random_seed, int _index_range)
+      : RejuvenateBench(std::format("dchain-expire-{}", _index_range), random_seed, _index_range, _index_range / 2), chain(nullptr) {}
+
+  void setup() override final {
+    RejuvenateBench::setup();
+    assert_or_panic(dchain_allocate(index_range, &chain), "Failed to allocate dchain");
+    for (int i = 0; i < index_range; i++) {
+      int index;
+      dchain_allocate_new_index(chain, &index, 0);
+    }
+    for (int index : indices) {
+      dchain_rejuvenate_index(chain, index, 2 * GRANULARITY);
+    }
+  }
+
+  void run() override final {
+    int index;
+    while (dchain_expire_one_index(chain, &index, GRANULARITY)) {
+      Benchmark::increment_counter();
+    }
+  }
+
+  void teardown() override final { dchain_free(chain); }
+};
+
+class TimerWheelExpire : public RejuvenateBench {
+private:
+  struct TimerWheel *tw;
+
+public:
+  TimerWheelExpire(u32 random_seed, int _index_range)
+      : RejuvenateBench(std::format("timer-wheel-expire-{}", _index_range), random_seed, _index_range, _index_range / 2), tw(nullptr) {}
+
+  void setup() override final {
+    RejuvenateBench::setup();
+    assert_or_panic(tw_allocate(index_range, GRANULARITY, 1024, nullptr, &tw), "Failed to allocate timer wheel");
+    for (int i = 0; i < index_range; i++) {
+      int index;
+      tw_allocate_new_index(tw, &index, 0);
+    }
+    for (int index : indices) {
+      tw_rejuvenate_index(tw, index, 2 * GRANULARITY);
+    }
+  }
+
+  void run() override final {
+    int index;
+    while (tw_expire_one_index(tw, &index, GRANULARITY)) {
+      Benchmark::increment_counter();
+    }
+  }
+
+  void teardown() override final { tw_free(tw); }
+};
+
+// Rejuvenations driven by Zipf traffic, in bursts of packets: popular flows show up several times in the same burst.
+class ZipfBurstRejuvenate : public Benchmark {
+private:
+  static constexpr const int BURST_SIZE = 32;
+
+  const int index_range;
+  const u64 total_packets;
+  const bool batched;
+
+  RandomZipfEngine zipf_engine;
+  std::vector<int> packets;
+  struct DoubleChain *chain;
+
+public:
+  ZipfBurstRejuvenate(u32 random_seed, double zipf_param, int _index_range, u64 _total_packets, bool _batched)
+      : Benchmark(std::format("{}-zipf-{}", _batched ? "batch" : "per-packet", zipf_param)), index_range(_index_range), total_packets(_total_packets),
+        batched(_batched), zipf_engine(random_seed, zipf_param, 0, _index_range - 1), chain(nullptr) {
+    assert(total_packets % BURST_SIZE == 0 && "total_packets must be a multiple of the burst size");
+  }
+
+  void setup() override final {
+    packets.clear();
+    for (u64 i = 0; i < total_packets; i++) {
+      packets.push_back(static_cast<int>(zipf_engine.generate()));
+    }
+
+    assert_or_panic(dchain_allocate(index_range, &chain), "Failed to allocate dchain");
+    for (int i = 0; i < index_range; i++) {
+      int index;
+      dchain_allocate_new_index(chain, &index, 0);
+    }
+  }
+
+  void run() override final {
+    time_ns_t now = 0;
+    for (u64 burst = 0; burst < total_packets; burst += BURST_SIZE) {
+      if (batched) {
+        dchain_rejuvenate_batch(chain, packets.data() + burst, BURST_SIZE, now);
+      } else {
+        for (int i = 0; i < BURST_SIZE; i++) {
+          dchain_rejuvenate_index(chain, packets[burst + i], now);
+        }
+      }
+      now++;
+      Benchmark::increment_counter(BURST_SIZE);
+    }
+  }
+
+  void teardown() override final { dchain_free(chain); }
+};
+
+// Cost of the DoubleChain operations depending on the layout of its cells.
+class LayoutBench : public Benchmark {
+protected:
+  const enum dchain_layout layout;
+  const int index_range;
+
+  struct DoubleChain *chain;
+
+  static const char *layout_name(enum dchain_layout layout) {
+    switch (layout) {
+    case DCHAIN_LAYOUT_COMPACT:
+      return "compact";
+    case DCHAIN_LAYOUT_AOS:
+      return "aos";
+    default:
+      return "default";
+    }
+  }
+
+public:
+  LayoutBench(const std::string &op_name, enum dchain_layout _layout, int _index_range)
+      : Benchmark(std::format("{}-{}", layout_name(_layout), op_name)), layout(_layout), index_range(_index_range), chain(nullptr) {}
+
+  void setup() override { assert_or_panic(dchain_allocate_layout(index_range, layout, nullptr, &chain), "Failed to allocate dchain"); }
+
+  void teardown() override { dchain_free(chain); }
+};
+
+// Fill the whole range and free it back, index by index, for a number of rounds.
+class LayoutAllocateFree : public LayoutBench {
+private:
+  const int rounds;
+  std::vector<int> allocated;
+
+public:
+  LayoutAllocateFree(enum dchain_layout _layout, int _index_range, int _rounds)
+      : LayoutBench("alloc-free", _layout, _index_range), rounds(_rounds), allocated(_index_range) {}
+
+  void run() override final {
+    for (int round = 0; round < rounds; round++) {
+      for (int i = 0; i < index_range; i++) {
+        dchain_allocate_new_index(chain, &allocated[i], round);
+      }
+      for (int i = 0; i < index_range; i++) {
+        dchain_free_index(chain, allocated[i]);
+      }
+      Benchmark::increment_counter(2 * static_cast<u64>(index_range));
+    }
+  }
+};
+
+class LayoutRejuvenate : public LayoutBench {
+private:
+  RandomUniformEngine uniform_engine;
+  std::vector<int> indices;
+  const u64 total_operations;
+
+public:
+  LayoutRejuvenate(u32 random_seed, enum dchain_layout _layout, int _index_range, u64 _total_operations)
+      : LayoutBench("rejuvenate", _layout, _index_range), uniform_engine(random_seed, 0, _index_range - 1), total_operations(_total_operations) {}
+
+  void setup() override final {
+    LayoutBench::setup();
+    for (int i = 0; i < index_range; i++) {
+      int index;
+      dchain_allocate_new_index(chain, &index, 0);
+    }
+
+    indices.clear();
+    for (u64 i = 0; i < total_operations; i++) {
+      indices.push_back(uniform_engine.generate());
+    }
+  }
+
+  void run() override final {
+    time_ns_t now = 1;
+    for (int index : indices) {
+      dchain_rejuvenate_index(chain, index, now++);
+    }
+    Benchmark::increment_counter(indices.size());
+  }
+};
+
+// Rejuvenate half of the indexes at random, then expire the other half.
+class LayoutExpire : public LayoutBench {
+private:
+  RandomUniformEngine uniform_engine;
+
+public:
+  LayoutExpire(u32 random_seed, enum dchain_layout _layout, int _index_range)
+      : LayoutBench("expire", _layout, _index_range), uniform_engine(random_seed, 0, _index_range - 1) {}
+
+  void setup() override final {
+    LayoutBench::setup();
+    for (int i = 0; i < index_range; i++) {
+      int index;
+      dchain_allocate_new_index(chain, &index, 0);
+    }
+    for (int i = 0; i < index_range / 2; i++) {
+      dchain_rejuvenate_index(chain, uniform_engine.generate(), 2);
+    }
+  }
+
+  void run() override final {
+    int index;
+    while (dchain_expire_one_index(chain, &index, 1)) {
+      Benchmark::increment_counter();
+    }
+  }
+};
+
+// NAT port pool: connection storms allocate a run of ports at once, and release them together later on.
+class PortPoolStorm : public Benchmark {
+private:
+  const int index_range;
+  const int storm_size;
+  const int rounds;
+  const bool bulk;
+
+  struct DoubleChain *chain;
+  std::vector<int> ports;
+
+public:
+  PortPoolStorm(int _index_range, int _storm_size, int _rounds, bool _bulk)
+      : Benchmark(std::format("{}-{}", _bulk ? "allocate-n" : "one-by-one", _storm_size)), index_range(_index_range), storm_size(_storm_size), rounds(_rounds),
+        bulk(_bulk), chain(nullptr), ports(_index_range) {
+    assert(index_range % storm_size == 0 && "index_range must be a multiple of the storm size");
+  }
+
+  void setup() override final { assert_or_panic(dchain_allocate(index_range, &chain), "Failed to allocate dchain"); }
+
+  void run() override final {
+    for (int round = 0; round < rounds; round++) {
+      for (int storm = 0; storm < index_range; storm += storm_size) {
+        int *storm_ports = ports.data() + storm;
+        if (bulk) {
+          dchain_allocate_n(chain, storm_size, storm_ports, round);
+        } else {
+          for (int i = 0; i < storm_size; i++) {
+            dchain_allocate_new_index(chain, &storm_ports[i], round);
+          }
+        }
+      }
+
+      for (int storm = 0; storm < index_range; storm += storm_size) {
+        int *storm_ports = ports.data() + storm;
+        if (bulk) {
+          dchain_free_n(chain, storm_ports, storm_size);
+        } else {
+          for (int i = 0; i < storm_size; i++) {
+            dchain_free_index(chain, storm_ports[i]);
+          }
+        }
+      }
+
+      Benchmark::increment_counter(2 * static_cast<u64>(index_range));
+    }
+  }
+
+  void teardown() override final { dchain_free(chain); }
+};
+
+int main() {
+  constexpr const size_t key_size = 16;
+  const u32 capacity              = 1 << 20;
+
+  BenchmarkSuite suite;
+
+  for (u32 total_flows : {100'000, 1'000'000}) {
+    suite.add_benchmark_group(std::format("Expire {} flows", total_flows));
+    suite.add_benchmark(std::make_unique<ExpireOneByOne<key_size>>(0, capacity, total_flows));
+    suite.add_benchmark(std::make_unique<ExpireBatch<key_size>>(0, capacity, total_flows));
+    suite.add_benchmark(std::make_unique<ExpireBatchEraseVec<key_size>>(0, capacity, total_flows));
+  }
+
+  for (int index_range : {1 << 20, 1 << 22, 1 << 24}) {
+    suite.add_benchmark_group(std::format("Rejuvenate, {} indexes", index_range));
+    suite.add_benchmark(std::make_unique<DChainRejuvenate>(0, index_range, 16'000'000));
+    suite.add_benchmark(std::make_unique<TimerWheelRejuvenate>(0, index_range, 16'000'000));
+
+    suite.add_benchmark_group(std::format("Expire, {} indexes", index_range));
+    suite.add_benchmark(std::make_unique<DChainExpire>(0, index_range));
+    suite.add_benchmark(std::make_unique<TimerWheelExpire>(0, index_range));
+  }
+
+  for (double zipf_param : {0.9, 1.1, 1.3}) {
+    suite.add_benchmark_group(std::format("Rejuvenate Zipf bursts, s={}", zipf_param));
+    suite.add_benchmark(std::make_unique<ZipfBurstRejuvenate>(0, zipf_param, 1 << 20, 16'000'000, false));
+    suite.add_benchmark(std::make_unique<ZipfBurstRejuvenate>(0, zipf_param, 1 << 20, 16'000'000, true));
+  }
+
+  // Both ends of the range: the largest compact one, and one far beyond the old 1M limit.
+  for (int index_range : {DCHAIN_COMPACT_LIMIT, 1 << 26}) {
+    std::vector<enum dchain_layout> layouts = {DCHAIN_LAYOUT_DEFAULT, DCHAIN_LAYOUT_AOS};
+    if (index_range <= DCHAIN_COMPACT_LIMIT) {
+      layouts.push_back(DCHAIN_LAYOUT_COMPACT);
+    }
+
+    suite.add_benchmark_group(std::format("Layouts, allocate and free, {} indexes", index_range));
+    for (enum dchain_layout layout : layouts) {
+      suite.add_benchmark(std::make_unique<LayoutAllocateFree>(layout, index_range, std::max(1, (1 << 24) / index_range)));
+    }
+
+    suite.add_benchmark_group(std::format("Layouts, rejuvenate, {} indexes", index_range));
+    for (enum dchain_layout layout : layouts) {
+      suite.add_benchmark(std::make_unique<LayoutRejuvenate>(0, layout, index_range, 16'000'000));
+    }
+
+    suite.add_benchmark_group(std::format("Layouts, expire, {} indexes", index_range));
+    for (enum dchain_layout layout : layouts) {
+      suite.add_benchmark(std::make_unique<LayoutExpire>(0, layout, index_range));
+    }
+  }
+
+  for (int storm_size : {16, 256}) {
+    suite.add_benchmark_group(std::format("Port pool, storms of {} connections", storm_size));
+    suite.add_benchmark(std::make_unique<PortPoolStorm>(1 << 16, storm_size, 256, false));
+    suite.add_benchmark(std::make_unique<PortPoolStorm>(1 << 16, storm_size, 256, true));
+  }
+
+  suite.run_all();
+
+  return 0;
+}
@@ -0,0 +1,253 @@
+#include <libnet/map.h>
+#include <libnet/double-chain.h>
+#include <libnet/vector.h>
+#include <libnetvec/flowtable.h>
+#include <libutil/random.h>
+
+#include <format>
+#include <memory>
+#include <vector>
+
+#include "common.h"
+#include "bench.h"
+
+struct flow_state_t {
+  u64 packets;
+};
+
+// NF-style trace replay with churn.
+// Packets come in bursts of VECTOR_SIZE, picked uniformly from a window of active flows. The window slides by churn flows every burst, so new
+// flows keep arriving and old ones stop being seen and eventually expire.
+template <size_t key_size> class FlowTraceBench : public Benchmark {
+protected:
+  static constexpr const u32 BURST_SIZE = FlowTable<key_size, flow_state_t>::VECTOR_SIZE;
+
+  // Time between bursts, and how often expired flows are collected.
+  static constexpr const time_ns_t BURST_INTERVAL = 100;
+  static constexpr const u32 EXPIRE_PERIOD        = 64;
+
+  const u32 capacity;
+  const u32 active_flows;
+  const u32 churn;
+  const u64 total_bursts;
+  const time_ns_t expiration_time;
+
+  RandomUniformEngine uniform_engine;
+  keys_pool_t keys_pool;
+  std::vector<u8> trace;
+
+public:
+  FlowTraceBench(const std::string &_name, u32 random_seed, u32 _capacity, u32 _active_flows, u32 _churn, u64 _total_packets)
+      : Benchmark(_name), capacity(_capacity), active_flows(_active_flows), churn(_churn), total_bursts(_total_packets / BURST_SIZE),
+        // Flows stop being seen once they leave the window, which takes active_flows / churn bursts.
+        expiration_time(BURST_INTERVAL * (_active_flows / std::max(_churn, 1u))), uniform_engine(random_seed, 0, 0xff),
+        keys_pool(key_size, _active_flows + _churn * (_total_packets / BURST_SIZE)) {
+    assert(2 * active_flows <= capacity && "The table must fit the flows being expired on top of the active ones");
+  }
+
+  void setup() override {
+    keys_pool.random_populate(uniform_engine);
+
+    trace.resize(total_bursts * BURST_SIZE * key_size);
+    for (u64 burst = 0; burst < total_bursts; burst++) {
+      const u64 window_start = burst * churn;
+      for (u32 i = 0; i < BURST_SIZE; i++) {
+        const u64 flow = window_start + uniform_engine.generate() % active_flows;
+        memcpy(trace.data() + (burst * BURST_SIZE + i) * key_size, keys_pool.get_key(flow), key_size);
+      }
+    }
+  }
+
+  void teardown() override {}
+
+  void run() override final {
+    time_ns_t now = expiration_time;
+    for (u64 burst = 0; burst < total_bursts; burst++) {
+      process_burst(trace.data() + burst * BURST_SIZE * key_size, now);
+      if (burst % EXPIRE_PERIOD == 0) {
+        expire(now);
+      }
+      now += BURST_INTERVAL;
+      Benchmark::increment_counter(BURST_SIZE);
+    }
+  }
+
+protected:
+  virtual void process_burst(u8 *keys, time_ns_t now) = 0;
+  virtual void expire(time_ns_t now)                  = 0;
+};
+
+// What NFs do today: a libnet Map, a DoubleChain and Vectors for the keys and the states, glued together packet by packet.
+template <size_t key_size> class ComposedFlowTrace : public FlowTraceBench<key_size> {
+private:
+  std::unique_ptr<Map> map;
+  struct DoubleChain *chain;
+  struct Vector *keys;
+  struct Vector *states;
+
+public:
+  ComposedFlowTrace(u32 random_seed, u32 _capacity, u32 _active_flows, u32 _churn, u64 _total_packets)
+      : FlowTraceBench<key_size>(std::format("map+dchain+vector-churn-{}", _churn), random_seed, _capacity, _active_flows, _churn, _total_packets),
+        chain(nullptr), keys(nullptr), states(nullptr) {}
+
+  void setup() override final {
+    FlowTraceBench<key_size>::setup();
+    map = std::make_unique<Map>(2 * this->capacity, key_size);
+    assert_or_panic(dchain_allocate(this->capacity, &chain), "Failed to allocate dchain");
+    assert_or_panic(vector_allocate(key_size, this->capacity, &keys), "Failed to allocate keys vector");
+    assert_or_panic(vector_allocate(sizeof(flow_state_t), this->capacity, &states), "Failed to allocate states vector");
+  }
+
+  void teardown() override final {
+    map.reset();
+    dchain_free(chain);
+  }
+
+protected:
+  void process_burst(u8 *burst, time_ns_t now) override final {
+    for (u32 i = 0; i < FlowTraceBench<key_size>::BURST_SIZE; i++) {
+      void *key = burst + i * key_size;
+
+      int index;
+      if (map->get(key, &index)) {
+        dchain_rejuvenate_index(chain, index, now);
+      } else {
+        if (!dchain_allocate_new_index(chain, &index, now)) {
+          continue;
+        }
+
+        void *stored_key;
+        vector_borrow(keys, index, &stored_key);
+        memcpy(stored_key, key, key_size);
+        map->put(stored_key, index);
+        vector_return(keys, index, stored_key);
+
+        void *state;
+        vector_borrow(states, index, &state);
+        ((flow_state_t *)state)->packets = 0;
+        vector_return(states, index, state);
+      }
+
+      void *state;
+      vector_borrow(states, index, &state);
+      ((flow_state_t *)state)->packets++;
+      vector_return(states, index, state);
+    }
+  }
+
+  void expire(time_ns_t now) override final {
+    int index;
+    while (dchain_expire_one_index(chain, &index, now - this->expiration_time)) {
+      void *stored_key;
+      vector_borrow(keys, index, &stored_key);
+      map->erase(stored_key);
+      vector_return(keys, index, stored_key);
+    }
+  }
+};
+
+template <size_t key_size> class FlowTableTrace : public FlowTraceBench<key_size> {
+private:
+  std::unique_ptr<FlowTable<key_size, flow_state_t>> table;
+
+public:
+  FlowTableTrace(u32 random_seed, u32 _capacity, u32 _active_flows, u32 _churn, u64 _total_packets)
+      : FlowTraceBench<key_size>(std::format("flowtable-churn-{}", _churn), random_seed, _capacity, _active_flows, _churn, _total_packets) {}
+
+  void setup() override final {
+    FlowTraceBench<key_size>::setup();
+    table = std::make_unique<FlowTable<key_size, flow_state_t>>(this->capacity, this->expiration_time);
+  }
+
+  void teardown() override final { table.reset(); }
+
+protected:
+  void process_burst(u8 *burst, time_ns_t now) override final {
+    int indices[FlowTraceBench<key_size>::BURST_SIZE];
+    table->lookup_or_create_vec(burst, now, indices);
+    for (u32 i = 0; i < FlowTraceBench<key_size>::BURST_SIZE; i++) {
+      if (indices[i] != -1) {
+        table->get_state(indices[i]).packets++;
+      }
+    }
+  }
+
+  void expire(time_ns_t now) override final { table->expire_vec(now); }
+};
+
+// New flows keep arriving at a table with no expiry: once the offered flows exceed the capacity, the table stays at 100% occupancy and every
+// new flow has to evict the oldest one.
+template <size_t key_size> class FullTableTrace : public Benchmark {
+private:
+  static constexpr const u32 BURST_SIZE = FlowTable<key_size, flow_state_t>::VECTOR_SIZE;
+
+  const u32 capacity;
+  const u32 offered_flows;
+  const u64 total_bursts;
+  const enum flowtable_full_policy full_policy;
+
+  RandomUniformEngine uniform_engine;
+  keys_pool_t keys_pool;
+  std::vector<u8> trace;
+  std::unique_ptr<FlowTable<key_size, flow_state_t>> table;
+
+public:
+  FullTableTrace(u32 random_seed, u32 _capacity, u32 _offered_flows, u64 _total_packets, enum flowtable_full_policy _full_policy)
+      : Benchmark(std::format("{}-{}-flows", _full_policy == FLOWTABLE_REJECT ? "reject" : "evict", _offered_flows)), capacity(_capacity),
+        offered_flows(_offered_flows), total_bursts(_total_packets / BURST_SIZE), full_policy(_full_policy), uniform_engine(random_seed, 0, 0xff),
+        keys_pool(key_size, _offered_flows) {}
+
+  void setup() override final {
+    keys_pool.random_populate(uniform_engine);
+
+    trace.resize(total_bursts * BURST_SIZE * key_size);
+    for (u64 packet = 0; packet < total_bursts * BURST_SIZE; packet++) {
+      memcpy(trace.data() + packet * key_size, keys_pool.get_key(uniform_engine.generate() % offered_flows), key_size);
+    }
+
+    // Expiry is never triggered
+    table = std::make_unique<FlowTable<key_size, flow_state_t>>(capacity, 0, full_policy);
+  }
+
+  void teardown() override final { table.reset(); }
+
+  void run() override final {
+    for (u64 burst = 0; burst < total_bursts; burst++) {
+      int indices[BURST_SIZE];
+      table->lookup_or_create_vec(trace.data() + burst * BURST_SIZE * key_size, burst, indices);
+      for (u32 i = 0; i < BURST_SIZE; i++) {
+        if (indices[i] != -1) {
+          table->get_state(indices[i]).packets++;
+        }
+      }
+      Benchmark::increment_counter(BURST_SIZE);
+    }
+  }
+};
+
+int main() {
+  constexpr const size_t key_size = 16;
+  const u32 capacity              = 1 << 17;
+  const u32 active_flows          = 1 << 15;
+  const u64 total_packets         = 16'000'000;
+
+  BenchmarkSuite suite;
+
+  for (u32 churn : {0, 1, 4}) {
+    suite.add_benchmark_group(std::format("Trace replay, {} new flows per burst", churn));
+    suite.add_benchmark(std::make_unique<ComposedFlowTrace<key_size>>(0, capacity, active_flows, churn, total_packets));
+    suite.add_benchmark(std::make_unique<FlowTableTrace<key_size>>(0, capacity, active_flows, churn, total_packets));
+  }
+
+  // From half full to twice as many flows as the table can hold
+  for (enum flowtable_full_policy full_policy : {FLOWTABLE_EVICT_OLDEST, FLOWTABLE_REJECT}) {
+    suite.add_benchmark_group(std::format("Occupancy, {} on full table", full_policy == FLOWTABLE_REJECT ? "reject" : "evict"));
+    for (u32 offered_flows : {capacity / 2, capacity, 2 * capacity, 4 * capacity}) {
+      suite.add_benchmark(std::make_unique<FullTableTrace<key_size>>(0, capacity, offered_flows, total_packets, full_policy));
+    }
+  }
+
+  suite.run_all();
+
+  return 0;
+}
@@ -13,74 +13,7 @@
 #include <chrono>
 
 #include "common.h"
-
-class Benchmark {
-private:
-  using clock = std::conditional<std::chrono::high_resolution_clock::is_steady, std::chrono::high_resolution_clock, std::chrono::steady_clock>::type;
-
-  const std::string name;
-  clock::time_point start_time;
-  u64 counter;
-
-public:
-  Benchmark(const std::string &_name) : name(_name), counter(0) {}
-
-  const std::string &get_name() const { return name; }
-  u64 get_counter() const { return counter; }
-  void increment_counter(u64 increment = 1) { counter += increment; }
-
-  virtual void setup()    = 0;
-  virtual void run()      = 0;
-  virtual void teardown() = 0;
-
-  void start() {
-    start_time = clock::now();
-    counter    = 0;
-  }
-
-  time_ns_t stop() {
-    const clock::time_point end_time = clock::now();
-    return std::chrono::duration_cast<std::chrono::nanoseconds>(end_time - start_time).count();
-  }
-};
-
-class BenchmarkSuite {
-private:
-  using benchmarks_t = std::vector<std::unique_ptr<Benchmark>>;
-
-  std::vector<std::pair<std::string, benchmarks_t>> benchmarks_groups;
-
-public:
-  void add_benchmark(std::unique_ptr<Benchmark> benchmark) { benchmarks_groups.back().second.push_back(std::move(benchmark)); }
-  void add_benchmark_group(const std::string &name) { benchmarks_groups.emplace_back(name, benchmarks_t{}); }
-
-  void run_all() {
-    for (const std::pair<std::string, BenchmarkSuite::benchmarks_t> &group : benchmarks_groups) {
-      std::optional<time_ns_t> base_duration;
-      printf("%s\n", group.first.c_str());
-      for (const std::unique_ptr<Benchmark> &benchmark : group.second) {
-        benchmark->setup();
-        benchmark->start();
-        benchmark->run();
-        const time_ns_t duration = benchmark->stop();
-        benchmark->teardown();
-
-        if (!base_duration) {
-          base_duration = duration;
-        }
-
-        const double ops_per_sec = static_cast<double>(benchmark->get_counter()) / (duration / 1'000'000'000.0);
-        const double speedup     = static_cast<double>(*base_duration) / duration;
-
-        printf("  %-25s", benchmark->get_name().c_str());
-        printf("\t%15ld ns", duration);
-        printf("\t%15.0f ops/sec", ops_per_sec);
-        printf("\t\t%7.4fx speedup", speedup);
-        printf("\n");
-      }
-    }
-  }
-};
+#include "bench.h"
 
 template <size_t key_size> class MapBench : public Benchmark {
 protected:
@@ -681,6 +614,165 @@ public:
   }
 };
 
+// =====================================================================================
+//
+//                                 Full table scans
+//
+// =====================================================================================
+
+// Control-plane scans over a half-full table. The counter is the number of slots scanned.
+template <typename MapT, size_t key_size> class TableScan : public Benchmark {
+private:
+  const u64 map_capacity;
+  const u32 total_scans;
+
+  RandomUniformEngine uniform_engine;
+  keys_pool_t keys_pool;
+  MapT map;
+
+public:
+  TableScan(const std::string &map_name, u32 random_seed, u64 _map_capacity, u32 _total_scans)
+      : Benchmark(std::format("scan-{}-{}", map_name, _map_capacity)), map_capacity(_map_capacity), total_scans(_total_scans), uniform_engine(random_seed, 0, 0xff),
+        keys_pool(key_size, _map_capacity / 2), map(_map_capacity) {}
+
+  void setup() override final {
+    keys_pool.random_populate(uniform_engine);
+    for (u64 i = 0; i < keys_pool.capacity; i++) {
+      map.put(keys_pool.get_key(i), static_cast<int>(i));
+    }
+  }
+
+  void run() override final {
+    for (u32 scan = 0; scan < total_scans; scan++) {
+      u64 sum = 0;
+      map.for_each_batch([&sum](void **keyps, int *values, u32 *slots, u32 count) {
+        for (u32 i = 0; i < count; i++) {
+          sum += values[i];
+        }
+      });
+      assert(sum == keys_pool.capacity * (keys_pool.capacity - 1) / 2 && "Scan missed entries");
+      Benchmark::increment_counter(map_capacity);
+    }
+  }
+
+  void teardown() override {}
+};
+
+// =====================================================================================
+//
+//                        Large table benchmarks (huge pages vs regular pages)
+//
+// =====================================================================================
+
+// Tables big enough for TLB misses to dominate the lookups. Tables are only half full, and all the queried keys are in the table.
+template <size_t key_size> class LargeTableBench : public Benchmark {
+protected:
+  const u64 map_capacity;
+  const u64 total_operations;
+  const struct mem_opts opts;
+
+  RandomUniformEngine uniform_engine;
+  keys_pool_t keys_pool;
+  std::vector<u64> key_queries;
+
+public:
+  LargeTableBench(const std::string &_name, u32 random_seed, u64 _map_capacity, u64 _total_operations, enum mem_pages pages)
+      : Benchmark(_name + (pages == MEM_PAGES_DEFAULT ? "-4k" : pages == MEM_PAGES_2M ? "-2m" : "-1g")), map_capacity(_map_capacity),
+        total_operations(_total_operations), opts{pages, MEM_NUMA_ANY, 1}, uniform_engine(random_seed, 0, 0xff), keys_pool(key_size, _map_capacity / 2) {
+    assert((map_capacity & (map_capacity - 1)) == 0 && "map_capacity must be a power of 2");
+    assert(total_operations % MapVec16<key_size>::VECTOR_SIZE == 0 && "total_operations must be a multiple of the vector size");
+  }
+
+  void setup() override {
+    keys_pool.random_populate(uniform_engine);
+    key_queries.clear();
+    for (u64 i = 0; i < total_operations; i += MapVec16<key_size>::VECTOR_SIZE) {
+      key_queries.push_back(uniform_engine.generate() % (keys_pool.capacity - MapVec16<key_size>::VECTOR_SIZE));
+    }
+  }
+
+  void teardown() override {}
+};
+
+template <size_t key_size> class MapLargeReads : public LargeTableBench<key_size> {
+private:
+  Map map;
+
+public:
+  MapLargeReads(u32 random_seed, u64 _map_capacity, u64 _total_operations, enum mem_pages pages)
+      : LargeTableBench<key_size>(std::format("large-r-map-{}", _total_operations), random_seed, _map_capacity, _total_operations, pages),
+        map(_map_capacity, key_size, &this->opts) {}
+
+  void setup() override final {
+    LargeTableBench<key_size>::setup();
+    for (u64 i = 0; i < this->keys_pool.capacity; i++) {
+      map.put(this->keys_pool.get_key(i), static_cast<int>(i));
+    }
+  }
+
+  void run() override final {
+    for (u64 key_query : this->key_queries) {
+      for (u64 i = key_query; i < key_query + MapVec16<key_size>::VECTOR_SIZE; i++) {
+        int value;
+        map.get(this->keys_pool.get_key(i), &value);
+      }
+      Benchmark::increment_counter(MapVec16<key_size>::VECTOR_SIZE);
+    }
+  }
+};
+
+template <size_t key_size> class MapVec16LargeReads : public LargeTableBench<key_size> {
+private:
+  MapVec16<key_size> map;
+
+public:
+  MapVec16LargeReads(u32 random_seed, u64 _map_capacity, u64 _total_operations, enum mem_pages pages)
+      : LargeTableBench<key_size>(std::format("large-r-mapvec16-{}", _total_operations), random_seed, _map_capacity, _total_operations, pages),
+        map(_map_capacity, &this->opts) {}
+
+  void setup() override final {
+    LargeTableBench<key_size>::setup();
+    for (u64 i = 0; i < this->keys_pool.capacity; i++) {
+      map.put(this->keys_pool.get_key(i), static_cast<int>(i));
+    }
+  }
+
+  void run() override final {
+    for (u64 key_query : this->key_queries) {
+      int values[MapVec16<key_size>::VECTOR_SIZE];
+      map.get_vec(this->keys_pool.get_key(key_query), values);
+      Benchmark::increment_counter(MapVec16<key_size>::VECTOR_SIZE);
+    }
+  }
+};
+
+template <size_t key_size> class MapVec8LargeReads : public LargeTableBench<key_size> {
+private:
+  MapVec8<key_size> map;
+
+public:
+  MapVec8LargeReads(u32 random_seed, u64 _map_capacity, u64 _total_operations, enum mem_pages pages)
+      : LargeTableBench<key_size>(std::format("large-r-mapvec8-{}", _total_operations), random_seed, _map_capacity, _total_operations, pages),
+        map(_map_capacity, &this->opts) {}
+
+  void setup() override final {
+    LargeTableBench<key_size>::setup();
+    for (u64 i = 0; i < this->keys_pool.capacity; i++) {
+      map.put(this->keys_pool.get_key(i), static_cast<int>(i));
+    }
+  }
+
+  void run() override final {
+    for (u64 key_query : this->key_queries) {
+      for (u64 i = key_query; i < key_query + MapVec16<key_size>::VECTOR_SIZE; i += MapVec8<key_size>::VECTOR_SIZE) {
+        int values[MapVec8<key_size>::VECTOR_SIZE];
+        map.get_vec(this->keys_pool.get_key(i), values);
+      }
+      Benchmark::increment_counter(MapVec16<key_size>::VECTOR_SIZE);
+    }
+  }
+};
+
 int main() {
   BenchmarkSuite suite;
 
@@ -712,6 +804,19 @@ int main() {
    */
   suite.add_benchmark(std::make_unique<CwissUniformWrites<16>>(0, 262'144, 65536));
 
+  suite.add_benchmark_group("Full table scan");
+  suite.add_benchmark(std::make_unique<TableScan<MapVec16<16>, 16>>("mapvec16", 0, 1 << 20, 100));
+  suite.add_benchmark(std::make_unique<TableScan<MapVec16v2<16>, 16>>("mapvec16v2", 0, 1 << 20, 100));
+  suite.add_benchmark(std::make_unique<TableScan<MapVec8<16>, 16>>("mapvec8", 0, 1 << 20, 100));
+
+  // 16M slots, way past what the TLB covers with regular pages.
+  suite.add_benchmark_group("Large table reads");
+  for (enum mem_pages pages : {MEM_PAGES_DEFAULT, MEM_PAGES_2M}) {
+    suite.add_benchmark(std::make_unique<MapLargeReads<16>>(0, 1 << 24, 1'600'000, pages));
+    suite.add_benchmark(std::make_unique<MapVec16LargeReads<16>>(0, 1 << 24, 1'600'000, pages));
+    suite.add_benchmark(std::make_unique<MapVec8LargeReads<16>>(0, 1 << 24, 1'600'000, pages));
+  }
+
   suite.run_all();
 
   return 0;
@@ -0,0 +1,187 @@
+#include <libnet/double-chain.h>
+#include <libnet/partitioned-chain.h>
+
+#include <atomic>
+#include <format>
+#include <thread>
+#include <vector>
+
+#include "common.h"
+#include "bench.h"
+
+// Flow setup on cores with unbalanced RSS: core t gets a share of the new flows proportional to 1/(t+1). The whole demand fits in the index range,
+// but not in the equal share of the busiest cores. Each round, every core allocates its flows, and then frees them.
+class SkewedAllocBench : public Benchmark {
+protected:
+  const int index_range;
+  const int num_threads;
+  const int rounds;
+
+  std::vector<int> demand;
+  std::vector<u64> allocated;
+
+public:
+  SkewedAllocBench(const std::string &_name, int _index_range, int _num_threads, double load, int _rounds)
+      : Benchmark(_name), index_range(_index_range), num_threads(_num_threads), rounds(_rounds), demand(_num_threads), allocated(_num_threads) {
+    double total_weight = 0;
+    for (int thread = 0; thread < num_threads; thread++) {
+      total_weight += 1.0 / (thread + 1);
+    }
+    for (int thread = 0; thread < num_threads; thread++) {
+      demand[thread] = static_cast<int>(load * index_range / (thread + 1) / total_weight);
+    }
+  }
+
+  void run() override final {
+    std::vector<std::thread> threads;
+    for (int thread = 0; thread < num_threads; thread++) {
+      threads.emplace_back([this, thread]() { allocated[thread] = run_core(thread); });
+    }
+    for (std::thread &thread : threads) {
+      thread.join();
+    }
+
+    for (u64 thread_allocated : allocated) {
+      Benchmark::increment_counter(thread_allocated);
+    }
+  }
+
+  // Jain's fairness index of the share of the demand each core got, and the overall share of failed allocations.
+  std::string get_notes() const override final {
+    double sum         = 0;
+    double sum_squares = 0;
+    u64 total_demand   = 0;
+    u64 total_success  = 0;
+    for (int thread = 0; thread < num_threads; thread++) {
+      const double satisfied = static_cast<double>(allocated[thread]) / (static_cast<double>(demand[thread]) * rounds);
+      sum += satisfied;
+      sum_squares += satisfied * satisfied;
+      total_demand += static_cast<u64>(demand[thread]) * rounds;
+      total_success += allocated[thread];
+    }
+    const double fairness = sum * sum / (num_threads * sum_squares);
+    const double failed   = 100.0 * static_cast<double>(total_demand - total_success) / static_cast<double>(total_demand);
+    return std::format("fairness {:.4f}, {:.2f}% failed", fairness, failed);
+  }
+
+protected:
+  // Runs the rounds of a core, returns the number of successful allocations.
+  virtual u64 run_core(int core) = 0;
+};
+
+// Baseline: the index range is statically split, each core allocates from its own DoubleChain.
+class StaticPartitionAlloc : public SkewedAllocBench {
+private:
+  std::vector<struct DoubleChain *> chains;
+
+public:
+  StaticPartitionAlloc(int _index_range, int _num_threads, double load, int _rounds)
+      : SkewedAllocBench(std::format("static-{}-threads", _num_threads), _index_range, _num_threads, load, _rounds), chains(_num_threads) {}
+
+  void setup() override final {
+    for (int thread = 0; thread < num_threads; thread++) {
+      assert_or_panic(dchain_allocate(index_range / num_threads, &chains[thread]), "Failed to allocate dchain");
+    }
+  }
+
+  void teardown() override final {
+    for (struct DoubleChain *chain : chains) {
+      dchain_free(chain);
+    }
+  }
+
+protected:
+  u64 run_core(int core) override final {
+    struct DoubleChain *chain = chains[core];
+    std::vector<int> indexes;
+    u64 successes = 0;
+
+    for (int round = 0; round < rounds; round++) {
+      for (int flow = 0; flow < demand[core]; flow++) {
+        int index;
+        if (dchain_allocate_new_index(chain, &index, round)) {
+          indexes.push_back(index);
+        }
+      }
+      successes += indexes.size();
+      for (int index : indexes) {
+        dchain_free_index(chain, index);
+      }
+      indexes.clear();
+    }
+
+    return successes;
+  }
+};
+
+// A single PartitionedChain: busy cores steal free indexes from the idle ones.
+class PartitionedChainAlloc : public SkewedAllocBench {
+private:
+  struct PartitionedChain *chain;
+  std::atomic<int> cores_done;
+
+public:
+  PartitionedChainAlloc(int _index_range, int _num_threads, double load, int _rounds)
+      : SkewedAllocBench(std::format("stealing-{}-threads", _num_threads), _index_range, _num_threads, load, _rounds), chain(nullptr), cores_done(0) {}
+
+  void setup() override final {
+    assert_or_panic(pchain_allocate(index_range, num_threads, nullptr, &chain), "Failed to allocate partitioned chain");
+    cores_done = 0;
+  }
+
+  void teardown() override final { pchain_free(chain); }
+
+protected:
+  u64 run_core(int core) override final {
+    std::vector<int> indexes;
+    u64 successes = 0;
+
+    for (int round = 0; round < rounds; round++) {
+      for (int flow = 0; flow < demand[core]; flow++) {
+        int index;
+        while (!pchain_allocate_new_index(chain, core, &index, round)) {
+          if (!pchain_steal_pending(chain, core)) {
+            index = -1;
+            break;
+          }
+          std::this_thread::yield();
+        }
+        if (index >= 0) {
+          indexes.push_back(index);
+        }
+      }
+      successes += indexes.size();
+      for (int index : indexes) {
+        pchain_free_index(chain, core, index);
+      }
+      indexes.clear();
+    }
+
+    // Keep answering the steal requests of the busier cores.
+    cores_done++;
+    while (cores_done < num_threads) {
+      pchain_poll(chain, core);
+      std::this_thread::yield();
+    }
+
+    return successes;
+  }
+};
+
+int main() {
+  constexpr const int index_range = 1 << 20;
+  constexpr const double load     = 0.9;
+  constexpr const int rounds      = 4;
+
+  BenchmarkSuite suite;
+
+  for (int num_threads : {1, 2, 4, 8, 16, 32}) {
+    suite.add_benchmark_group(std::format("Skewed allocation, {} threads", num_threads));
+    suite.add_benchmark(std::make_unique<StaticPartitionAlloc>(index_range, num_threads, load, rounds));
+    suite.add_benchmark(std::make_unique<PartitionedChainAlloc>(index_range, num_threads, load, rounds));
+  }
+
+  suite.run_all();
+
+  return 0;
+}
@@ -0,0 +1,195 @@
+#include <libnetvec/mapvec16.h>
+#include <libnetvec/shardedmapvec16.h>
+#include <libutil/random.h>
+#include <libutil/hash.h>
+
+#include <array>
+#include <format>
+#include <vector>
+#include <thread>
+
+#include "common.h"
+#include "bench.h"
+
+template <size_t key_size> class ShardedMapBench : public Benchmark {
+protected:
+  const u32 num_shards;
+  const u64 shard_capacity;
+  const u64 total_operations;
+
+  RandomUniformEngine uniform_engine;
+  keys_pool_t keys_pool;
+  std::vector<u64> key_queries;
+
+public:
+  ShardedMapBench(const std::string &_name, u32 random_seed, u32 _num_shards, u64 _shard_capacity, u64 _total_operations)
+      : Benchmark(_name), num_shards(_num_shards), shard_capacity(_shard_capacity), total_operations(_total_operations), uniform_engine(random_seed, 0, 0xff),
+        keys_pool(key_size, _num_shards * _shard_capacity) {
+    assert(num_shards > 0 && "num_shards must be greater than 0");
+    assert(total_operations > 0 && "total_operations must be greater than 0");
+    assert(total_operations % MapVec16<key_size>::VECTOR_SIZE == 0 && "total_operations must be a multiple of the vector size");
+  }
+
+  void setup() override {
+    keys_pool.random_populate(uniform_engine);
+    key_queries.clear();
+    for (u64 i = 0; i < total_operations; i += MapVec16<key_size>::VECTOR_SIZE) {
+      const u64 random_index = uniform_engine.generate() % (keys_pool.capacity - MapVec16<key_size>::VECTOR_SIZE);
+      key_queries.push_back(random_index);
+    }
+  }
+
+  void teardown() override {}
+};
+
+// Single core baseline: the whole table is one MapVec16.
+template <size_t key_size> class MapVec16Reads : public ShardedMapBench<key_size> {
+private:
+  MapVec16<key_size> map;
+
+public:
+  MapVec16Reads(u32 random_seed, u64 _capacity, u64 _total_operations)
+      : ShardedMapBench<key_size>(std::format("mapvec16-{}", _total_operations), random_seed, 1, _capacity, _total_operations), map(_capacity) {}
+
+  void setup() override final {
+    ShardedMapBench<key_size>::setup();
+    for (u64 i = 0; i < this->keys_pool.capacity / 2; i++) {
+      map.put(this->keys_pool.get_key(i), static_cast<int>(i));
+    }
+  }
+
+  void run() override final {
+    for (u64 key_query : this->key_queries) {
+      int values[MapVec16<key_size>::VECTOR_SIZE];
+      map.get_vec(this->keys_pool.get_key(key_query), values);
+      Benchmark::increment_counter(MapVec16<key_size>::VECTOR_SIZE);
+    }
+  }
+};
+
+// Single core, mixed bursts: every burst is split into per-shard sub-batches.
+template <size_t key_size> class ShardedMapVec16SplitReads : public ShardedMapBench<key_size> {
+private:
+  ShardedMapVec16<key_size> map;
+
+public:
+  ShardedMapVec16SplitReads(u32 random_seed, u32 _num_shards, u64 _shard_capacity, u64 _total_operations)
+      : ShardedMapBench<key_size>(std::format("split-{}-shards-{}", _num_shards, _total_operations), random_seed, _num_shards, _shard_capacity, _total_operations),
+        map(_num_shards, _shard_capacity) {
+    for (u32 shard = 0; shard < _num_shards; shard++) {
+      map.init_shard(shard);
+    }
+  }
+
+  void setup() override final {
+    ShardedMapBench<key_size>::setup();
+    for (u64 i = 0; i < this->keys_pool.capacity / 2; i++) {
+      map.put(this->keys_pool.get_key(i), static_cast<int>(i));
+    }
+  }
+
+  void run() override final {
+    for (u64 key_query : this->key_queries) {
+      int values[MapVec16<key_size>::VECTOR_SIZE];
+      map.get_vec(this->keys_pool.get_key(key_query), values);
+      Benchmark::increment_counter(MapVec16<key_size>::VECTOR_SIZE);
+    }
+  }
+};
+
+// One thread per shard. Each thread initializes its own shard (so that its memory is local) and serves the bursts steered to it, as if the NIC
+// was steering packets with the same hash bits.
+template <size_t key_size> class ShardedMapVec16PerCoreReads : public ShardedMapBench<key_size> {
+private:
+  ShardedMapVec16<key_size> map;
+
+  // Per shard, the contiguous bursts of keys that belong to that shard.
+  std::vector<std::vector<u8>> shard_bursts;
+
+public:
+  ShardedMapVec16PerCoreReads(u32 random_seed, u32 _num_shards, u64 _shard_capacity, u64 _total_operations)
+      : ShardedMapBench<key_size>(std::format("per-core-{}-threads-{}", _num_shards, _total_operations), random_seed, _num_shards, _shard_capacity, _total_operations),
+        map(_num_shards, _shard_capacity), shard_bursts(_num_shards) {}
+
+  void setup() override final {
+    ShardedMapBench<key_size>::setup();
+
+    std::vector<std::vector<u64>> shard_keys(this->num_shards);
+    for (u64 i = 0; i < this->keys_pool.capacity / 2; i++) {
+      shard_keys[map.shard_of(this->keys_pool.get_key(i))].push_back(i);
+    }
+
+    std::vector<std::thread> threads;
+    for (u32 shard = 0; shard < this->num_shards; shard++) {
+      threads.emplace_back([this, shard, &shard_keys]() {
+        map.init_shard(shard);
+        MapVec16<key_size> &local = map.get_shard(shard);
+        for (u64 i : shard_keys[shard]) {
+          local.put(this->keys_pool.get_key(i), static_cast<int>(i));
+        }
+      });
+    }
+    for (std::thread &thread : threads) {
+      thread.join();
+    }
+
+    // Every thread gets the same number of bursts, made only of keys of its shard.
+    const u64 bursts_per_shard = this->total_operations / MapVec16<key_size>::VECTOR_SIZE / this->num_shards;
+    for (u32 shard = 0; shard < this->num_shards; shard++) {
+      const std::vector<u64> &keys = shard_keys[shard];
+      assert(!keys.empty() && "Shard without keys");
+      std::vector<u8> &bursts = shard_bursts[shard];
+      bursts.resize(bursts_per_shard * MapVec16<key_size>::VECTOR_SIZE * key_size);
+      for (u64 j = 0; j < bursts_per_shard * MapVec16<key_size>::VECTOR_SIZE; j++) {
+        const u64 i = keys[this->uniform_engine.generate() % keys.size()];
+        memcpy(bursts.data() + j * key_size, this->keys_pool.get_key(i), key_size);
+      }
+    }
+  }
+
+  void run() override final {
+    std::vector<std::thread> threads;
+    for (u32 shard = 0; shard < this->num_shards; shard++) {
+      threads.emplace_back([this, shard]() {
+        MapVec16<key_size> &local = map.get_shard(shard);
+        std::vector<u8> &bursts   = shard_bursts[shard];
+        for (u64 offset = 0; offset < bursts.size(); offset += MapVec16<key_size>::VECTOR_SIZE * key_size) {
+          int values[MapVec16<key_size>::VECTOR_SIZE];
+          local.get_vec(bursts.data() + offset, values);
+        }
+      });
+    }
+    for (std::thread &thread : threads) {
+      thread.join();
+    }
+
+    for (const std::vector<u8> &bursts : shard_bursts) {
+      Benchmark::increment_counter(bursts.size() / key_size);
+    }
+  }
+};
+
+int main() {
+  constexpr const size_t key_size = 16;
+  const u64 total_capacity        = 1 << 20;
+  const u64 total_operations      = 16'000'000;
+
+  BenchmarkSuite suite;
+
+  suite.add_benchmark_group("Mixed bursts, single core");
+  suite.add_benchmark(std::make_unique<MapVec16Reads<key_size>>(0, total_capacity, total_operations));
+  for (u32 num_shards = 1; num_shards <= 16; num_shards *= 2) {
+    suite.add_benchmark(std::make_unique<ShardedMapVec16SplitReads<key_size>>(0, num_shards, total_capacity / num_shards, total_operations));
+  }
+
+  // Scale from 1 to all the cores (rounded down to a power of 2, as the number of shards must be one).
+  const u32 cores = std::max(1u, std::thread::hardware_concurrency());
+  suite.add_benchmark_group("Steered bursts, one shard per core");
+  for (u32 num_shards = 1; num_shards <= cores; num_shards *= 2) {
+    suite.add_benchmark(std::make_unique<ShardedMapVec16PerCoreReads<key_size>>(0, num_shards, total_capacity / num_shards, total_operations));
+  }
+
+  suite.run_all();
+
+  return 0;
+}
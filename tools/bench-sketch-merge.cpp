@@ -0,0 +1,217 @@
+#include <libnet/bloom-filter.h>
+#include <libnet/cms.h>
+#include <libutil/random.h>
+
+#include <atomic>
+#include <chrono>
+#include <format>
+#include <thread>
+#include <vector>
+#include <string.h>
+
+#include "common.h"
+#include "bench.h"
+
+// Merges of a sketch filled with random keys into another one. The notes give the bandwidth, over the bytes of both sketches.
+class MergeBench : public Benchmark {
+protected:
+  static constexpr const u64 MERGES      = 10'000;
+  static constexpr const u64 FILL_KEYS   = 100'000;
+  static constexpr const size_t KEY_SIZE = 16;
+
+  const u64 sketch_bytes;
+  RandomUniformEngine uniform_engine;
+  keys_pool_t keys_pool;
+  time_ns_t duration;
+
+public:
+  MergeBench(const std::string &_name, u32 random_seed, u64 _sketch_bytes)
+      : Benchmark(_name), sketch_bytes(_sketch_bytes), uniform_engine(random_seed, 0, 0xff), keys_pool(KEY_SIZE, FILL_KEYS), duration(0) {}
+
+  void setup() override { keys_pool.random_populate(uniform_engine); }
+  void teardown() override {}
+
+  void run() override final {
+    const auto start = std::chrono::steady_clock::now();
+    for (u64 i = 0; i < MERGES; i++) {
+      merge();
+    }
+    duration = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+    Benchmark::increment_counter(MERGES);
+  }
+
+  std::string get_notes() const override final {
+    return std::format("{} KB, {:.2f} GB/s", sketch_bytes / 1024, 2.0 * sketch_bytes * MERGES / static_cast<double>(duration));
+  }
+
+protected:
+  virtual void merge() = 0;
+};
+
+class CMSMerge : public MergeBench {
+private:
+  const u32 height;
+  const u32 width;
+  const int flags;
+
+  struct CMS *dst;
+  struct CMS *src;
+
+public:
+  CMSMerge(u32 random_seed, u32 _height, u32 _width, int _flags)
+      : MergeBench(std::format("cms-{}x{}-u32{}", _height, _width, (_flags & CMS_EAGER_RESET) ? "-eager" : ""), random_seed,
+                   static_cast<u64>(_height) * _width * sizeof(u32)),
+        height(_height), width(_width), flags(_flags), dst(nullptr), src(nullptr) {}
+
+  void setup() override final {
+    MergeBench::setup();
+    assert_or_panic(cms_allocate_counters(height, width, KEY_SIZE, CMS_COUNTER_32, flags, 0, &dst), "Failed to allocate CMS");
+    assert_or_panic(cms_allocate_counters(height, width, KEY_SIZE, CMS_COUNTER_32, flags, 0, &src), "Failed to allocate CMS");
+    for (u64 i = 0; i < FILL_KEYS; i++) {
+      cms_increment(src, keys_pool.get_key(i));
+    }
+  }
+
+protected:
+  void merge() override final { assert_or_panic(cms_merge(dst, src), "Failed to merge CMS"); }
+};
+
+class BloomMerge : public MergeBench {
+private:
+  const u32 height;
+  const u32 width;
+
+  struct BloomFilter *dst;
+  struct BloomFilter *src;
+
+public:
+  BloomMerge(u32 random_seed, u32 _height, u32 _width)
+      : MergeBench(std::format("bloom-{}x{}", _height, _width), random_seed, static_cast<u64>(_height) * _width), height(_height), width(_width),
+        dst(nullptr), src(nullptr) {}
+
+  void setup() override final {
+    MergeBench::setup();
+    assert_or_panic(bf_allocate(height, width, KEY_SIZE, 0, &dst), "Failed to allocate bloom filter");
+    assert_or_panic(bf_allocate(height, width, KEY_SIZE, 0, &src), "Failed to allocate bloom filter");
+    for (u64 i = 0; i < FILL_KEYS; i++) {
+      bf_set(src, keys_pool.get_key(i));
+    }
+  }
+
+protected:
+  void merge() override final { assert_or_panic(bf_merge(dst, src), "Failed to merge bloom filters"); }
+};
+
+// Each core counts its share of the packets in its own sketch, while a control thread merges them into a global sketch every
+// merge_interval. The cores that are done keep polling until the last merge.
+class PerCoreCounting : public Benchmark {
+private:
+  static constexpr const u32 HEIGHT = 4;
+  static constexpr const u32 WIDTH  = 1 << 14;
+
+  const int num_cores;
+  const u64 total_packets;
+  const std::chrono::microseconds merge_interval;
+
+  RandomUniformEngine uniform_engine;
+  RandomUniformEngine query_engine;
+  keys_pool_t keys_pool;
+  std::vector<u8> packets;
+
+  struct PerCoreCMS *pcms;
+  struct CMS *global;
+  std::atomic<int> cores_done;
+  std::atomic<bool> stop;
+  u64 merges;
+
+  u8 *get_packet(u64 i) { return packets.data() + i * keys_pool.key_size; }
+
+public:
+  PerCoreCounting(u32 random_seed, size_t key_size, int _num_cores, u32 total_keys, u64 _total_packets, std::chrono::microseconds _merge_interval)
+      : Benchmark(std::format("per-core-{}-cores", _num_cores)), num_cores(_num_cores), total_packets(_total_packets), merge_interval(_merge_interval),
+        uniform_engine(random_seed, 0, 0xff), query_engine(random_seed, 0, total_keys - 1), keys_pool(key_size, total_keys), pcms(nullptr),
+        global(nullptr), cores_done(0), stop(false), merges(0) {
+    assert(total_packets % (CMS_VECTOR_SIZE * num_cores) == 0 && "each core must get a multiple of the vector size");
+  }
+
+  void setup() override final {
+    keys_pool.random_populate(uniform_engine);
+    packets.resize(total_packets * keys_pool.key_size);
+    for (u64 i = 0; i < total_packets; i++) {
+      memcpy(get_packet(i), keys_pool.get_key(query_engine.generate()), keys_pool.key_size);
+    }
+    assert_or_panic(pcms_allocate(num_cores, HEIGHT, WIDTH, keys_pool.key_size, CMS_COUNTER_32, 0, &pcms), "Failed to allocate per-core CMS");
+    assert_or_panic(cms_allocate_counters(HEIGHT, WIDTH, keys_pool.key_size, CMS_COUNTER_32, 0, 0, &global), "Failed to allocate CMS");
+    cores_done = 0;
+    stop       = false;
+  }
+
+  void run() override final {
+    std::vector<std::thread> cores;
+    for (int core = 0; core < num_cores; core++) {
+      cores.emplace_back([this, core]() { run_core(core); });
+    }
+
+    while (cores_done < num_cores) {
+      std::this_thread::sleep_for(merge_interval);
+      assert_or_panic(pcms_merge(pcms, global), "Failed to merge");
+      merges++;
+    }
+    // Everything counted in the last generation.
+    assert_or_panic(pcms_merge(pcms, global), "Failed to merge");
+    merges++;
+
+    stop = true;
+    for (std::thread &core : cores) {
+      core.join();
+    }
+    Benchmark::increment_counter(total_packets);
+  }
+
+  void teardown() override final { packets = std::vector<u8>(); }
+
+  std::string get_notes() const override final { return std::format("{} merges", merges); }
+
+private:
+  void run_core(int core) {
+    const u64 share = total_packets / num_cores;
+    for (u64 i = core * share; i < (core + 1) * share; i += CMS_VECTOR_SIZE) {
+      pcms_increment_vec(pcms, core, get_packet(i));
+    }
+
+    cores_done++;
+    while (!stop) {
+      pcms_poll(pcms, core);
+      std::this_thread::yield();
+    }
+  }
+};
+
+int main() {
+  constexpr const size_t key_size   = 16;
+  constexpr const u32 total_keys    = 1 << 16;
+  constexpr const u64 total_packets = 16'777'216;
+  constexpr const u32 seed          = 0;
+
+  BenchmarkSuite suite;
+
+  suite.add_benchmark_group("CMS merge");
+  for (u32 width : {1 << 10, 1 << 12, 1 << 14, 1 << 16}) {
+    suite.add_benchmark(std::make_unique<CMSMerge>(seed, 4, width, 0));
+    suite.add_benchmark(std::make_unique<CMSMerge>(seed, 4, width, CMS_EAGER_RESET));
+  }
+
+  suite.add_benchmark_group("Bloom filter merge");
+  for (u32 width : {1 << 12, 1 << 14, 1 << 16, 1 << 18}) {
+    suite.add_benchmark(std::make_unique<BloomMerge>(seed, 4, width));
+  }
+
+  suite.add_benchmark_group("Per-core counting, merged every 1ms");
+  for (int num_cores : {1, 2, 4, 8, 16}) {
+    suite.add_benchmark(std::make_unique<PerCoreCounting>(seed, key_size, num_cores, total_keys, total_packets, std::chrono::microseconds(1000)));
+  }
+
+  suite.run_all();
+
+  return 0;
+}
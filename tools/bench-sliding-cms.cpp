@@ -0,0 +1,154 @@
+#include <libnet/cms.h>
+#include <libutil/random.h>
+
+#include <format>
+#include <vector>
+#include <string.h>
+
+#include "common.h"
+#include "bench.h"
+
+// A SlidingCMS over a window of WINDOW_PACKETS packets, with one packet per nanosecond of virtual time: the panes are recycled every
+// WINDOW_PACKETS / num_panes packets. The sketch is 4 rows of 16384 cells.
+class SlidingCMSBench : public Benchmark {
+protected:
+  static constexpr const u32 HEIGHT               = 4;
+  static constexpr const u32 WIDTH                = 1 << 14;
+  static constexpr const time_ns_t WINDOW_PACKETS = 1 << 20;
+
+  const u32 num_panes;
+  const u64 total_operations;
+
+  RandomUniformEngine uniform_engine;
+  RandomUniformEngine query_engine;
+  keys_pool_t keys_pool;
+  std::vector<u8> queries;
+
+  struct SlidingCMS *scms;
+
+  u8 *get_query(u64 i) { return queries.data() + i * keys_pool.key_size; }
+
+public:
+  SlidingCMSBench(const std::string &_name, u32 random_seed, size_t key_size, u32 _num_panes, u32 total_keys, u64 _total_operations)
+      : Benchmark(std::format("{}-{}-panes", _name, _num_panes)), num_panes(_num_panes), total_operations(_total_operations),
+        uniform_engine(random_seed, 0, 0xff), query_engine(random_seed, 0, total_keys - 1), keys_pool(key_size, total_keys), scms(nullptr) {
+    assert(total_operations % CMS_VECTOR_SIZE == 0 && "total_operations must be a multiple of the vector size");
+  }
+
+  void setup() override {
+    keys_pool.random_populate(uniform_engine);
+    queries.resize(total_operations * keys_pool.key_size);
+    for (u64 i = 0; i < total_operations; i++) {
+      memcpy(get_query(i), keys_pool.get_key(query_engine.generate()), keys_pool.key_size);
+    }
+    assert_or_panic(scms_allocate(HEIGHT, WIDTH, keys_pool.key_size, num_panes, WINDOW_PACKETS, &scms), "Failed to allocate sliding CMS");
+  }
+
+  // Many benchmarks are set up one after the other, release the queries.
+  void teardown() override { queries = std::vector<u8>(); }
+};
+
+class SlidingIncrement : public SlidingCMSBench {
+public:
+  SlidingIncrement(u32 random_seed, size_t key_size, u32 _num_panes, u32 total_keys, u64 _total_operations)
+      : SlidingCMSBench("increment", random_seed, key_size, _num_panes, total_keys, _total_operations) {}
+
+  void run() override final {
+    for (u64 i = 0; i < total_operations; i++) {
+      scms_advance(scms, i + 1);
+      scms_increment(scms, get_query(i));
+    }
+    Benchmark::increment_counter(total_operations);
+  }
+};
+
+class SlidingIncrementVec : public SlidingCMSBench {
+public:
+  SlidingIncrementVec(u32 random_seed, size_t key_size, u32 _num_panes, u32 total_keys, u64 _total_operations)
+      : SlidingCMSBench("increment-vec", random_seed, key_size, _num_panes, total_keys, _total_operations) {}
+
+  void run() override final {
+    for (u64 i = 0; i < total_operations; i += CMS_VECTOR_SIZE) {
+      scms_advance(scms, i + 1);
+      scms_increment_vec(scms, get_query(i));
+    }
+    Benchmark::increment_counter(total_operations);
+  }
+};
+
+// The window is filled before the queries, so that all the panes hold counts.
+class SlidingCountMinBench : public SlidingCMSBench {
+protected:
+  u64 sink;
+
+public:
+  SlidingCountMinBench(const std::string &_name, u32 random_seed, size_t key_size, u32 _num_panes, u32 total_keys, u64 _total_operations)
+      : SlidingCMSBench(_name, random_seed, key_size, _num_panes, total_keys, _total_operations), sink(0) {}
+
+  void setup() override final {
+    SlidingCMSBench::setup();
+    for (u64 i = 0; i < WINDOW_PACKETS; i++) {
+      scms_advance(scms, i + 1);
+      scms_increment(scms, get_query(i % total_operations));
+    }
+  }
+
+  void teardown() override final {
+    SlidingCMSBench::teardown();
+    assert_or_panic(sink > 0, "Empty window");
+  }
+};
+
+class SlidingCountMin : public SlidingCountMinBench {
+public:
+  SlidingCountMin(u32 random_seed, size_t key_size, u32 _num_panes, u32 total_keys, u64 _total_operations)
+      : SlidingCountMinBench("count-min", random_seed, key_size, _num_panes, total_keys, _total_operations) {}
+
+  void run() override final {
+    for (u64 i = 0; i < total_operations; i++) {
+      sink += scms_count_min(scms, get_query(i));
+    }
+    Benchmark::increment_counter(total_operations);
+  }
+};
+
+class SlidingCountMinVec : public SlidingCountMinBench {
+public:
+  SlidingCountMinVec(u32 random_seed, size_t key_size, u32 _num_panes, u32 total_keys, u64 _total_operations)
+      : SlidingCountMinBench("count-min-vec", random_seed, key_size, _num_panes, total_keys, _total_operations) {}
+
+  void run() override final {
+    for (u64 i = 0; i < total_operations; i += CMS_VECTOR_SIZE) {
+      int counts[CMS_VECTOR_SIZE];
+      scms_count_min_vec(scms, get_query(i), counts);
+      for (int count : counts) {
+        sink += count;
+      }
+    }
+    Benchmark::increment_counter(total_operations);
+  }
+};
+
+int main() {
+  constexpr const size_t key_size   = 16;
+  constexpr const u32 total_keys    = 1 << 16;
+  constexpr const u64 total_queries = 16'000'000;
+
+  BenchmarkSuite suite;
+
+  suite.add_benchmark_group("Sliding CMS increment");
+  for (u32 num_panes : {1, 3, 7, 15}) {
+    suite.add_benchmark(std::make_unique<SlidingIncrement>(0, key_size, num_panes, total_keys, total_queries));
+    suite.add_benchmark(std::make_unique<SlidingIncrementVec>(0, key_size, num_panes, total_keys, total_queries));
+  }
+
+  suite.add_benchmark_group("Sliding CMS count-min");
+  for (u32 num_panes : {1, 3, 7, 15}) {
+    suite.add_benchmark(std::make_unique<SlidingCountMin>(0, key_size, num_panes, total_keys, total_queries));
+    suite.add_benchmark(std::make_unique<SlidingCountMinVec>(0, key_size, num_panes, total_keys, total_queries));
+  }
+
+  suite.run_all();
+
+  return 0;
+}
@@ -0,0 +1,103 @@
+#include <libnetvec/mapvec16.h>
+#include <libnetvec/mapvec8.h>
+#include <libutil/random.h>
+
+#include <format>
+#include <memory>
+#include <filesystem>
+
+#include "common.h"
+#include "bench.h"
+
+// Warm restart: how long it takes for a fresh table to serve its first lookup, either by re-inserting every flow or by mapping a snapshot.
+// Snapshots are read back from the page cache, as they would be right after the process restarts.
+template <typename MapT, size_t key_size> class RestartBench : public Benchmark {
+protected:
+  const u64 map_capacity;
+  const u64 total_entries;
+  const std::string path;
+
+  RandomUniformEngine uniform_engine;
+  keys_pool_t keys_pool;
+  std::unique_ptr<MapT> map;
+
+public:
+  RestartBench(const std::string &_name, u32 random_seed, u64 _map_capacity, u64 _total_entries)
+      : Benchmark(_name), map_capacity(_map_capacity), total_entries(_total_entries),
+        path((std::filesystem::temp_directory_path() / (_name + ".snapshot")).string()), uniform_engine(random_seed, 0, 0xff),
+        keys_pool(key_size, _total_entries) {
+    assert(total_entries <= map_capacity / 2 && "Tables are kept at most half full");
+  }
+
+  void setup() override { keys_pool.random_populate(uniform_engine); }
+
+  void teardown() override {
+    map.reset();
+    std::filesystem::remove(path);
+  }
+
+protected:
+  void first_lookup() {
+    int values[MapT::VECTOR_SIZE];
+    map->get_vec(keys_pool.get_key(0), values);
+    assert_or_panic(values[0] == 0, "First lookup failed");
+  }
+};
+
+template <typename MapT, size_t key_size> class ReinsertRestart : public RestartBench<MapT, key_size> {
+public:
+  ReinsertRestart(const std::string &map_name, u32 random_seed, u64 _map_capacity, u64 _total_entries)
+      : RestartBench<MapT, key_size>(std::format("reinsert-{}-{}", map_name, _total_entries), random_seed, _map_capacity, _total_entries) {}
+
+  void run() override final {
+    this->map = std::make_unique<MapT>(this->map_capacity);
+    for (u64 i = 0; i < this->total_entries; i++) {
+      this->map->put(this->keys_pool.get_key(i), static_cast<int>(i));
+    }
+    this->first_lookup();
+    Benchmark::increment_counter(this->total_entries);
+  }
+};
+
+template <typename MapT, size_t key_size> class SnapshotRestart : public RestartBench<MapT, key_size> {
+public:
+  SnapshotRestart(const std::string &map_name, u32 random_seed, u64 _map_capacity, u64 _total_entries)
+      : RestartBench<MapT, key_size>(std::format("snapshot-{}-{}", map_name, _total_entries), random_seed, _map_capacity, _total_entries) {}
+
+  void setup() override final {
+    RestartBench<MapT, key_size>::setup();
+
+    MapT original(this->map_capacity);
+    for (u64 i = 0; i < this->total_entries; i++) {
+      original.put(this->keys_pool.get_key(i), static_cast<int>(i));
+    }
+    assert_or_panic(original.save(this->path.c_str()) == 1, "Failed to save snapshot");
+  }
+
+  void run() override final {
+    this->map = std::make_unique<MapT>(this->map_capacity);
+    assert_or_panic(this->map->load(this->path.c_str()) == 1, "Failed to load snapshot");
+    this->first_lookup();
+    Benchmark::increment_counter(this->total_entries);
+  }
+};
+
+int main() {
+  constexpr const size_t key_size = 16;
+  const u64 map_capacity          = 1 << 25;
+  const u64 total_entries         = 1 << 24;
+
+  BenchmarkSuite suite;
+
+  suite.add_benchmark_group("MapVec16 time to first lookup");
+  suite.add_benchmark(std::make_unique<ReinsertRestart<MapVec16<key_size>, key_size>>("mapvec16", 0, map_capacity, total_entries));
+  suite.add_benchmark(std::make_unique<SnapshotRestart<MapVec16<key_size>, key_size>>("mapvec16", 0, map_capacity, total_entries));
+
+  suite.add_benchmark_group("MapVec8 time to first lookup");
+  suite.add_benchmark(std::make_unique<ReinsertRestart<MapVec8<key_size>, key_size>>("mapvec8", 0, map_capacity, total_entries));
+  suite.add_benchmark(std::make_unique<SnapshotRestart<MapVec8<key_size>, key_size>>("mapvec8", 0, map_capacity, total_entries));
+
+  suite.run_all();
+
+  return 0;
+}
@@ -0,0 +1,135 @@
+#include <libnet/time.h>
+#include <libnet/double-chain.h>
+#include <libnet/cms.h>
+#include <libnet/bloom-filter.h>
+#include <libutil/random.h>
+
+#include <format>
+#include <vector>
+
+#include "common.h"
+#include "bench.h"
+
+enum class time_source_t { MONOTONIC, CURRENT_TIME, RECENT_TIME };
+
+// Cost of a single clock read.
+class ClockRead : public Benchmark {
+private:
+  const time_source_t source;
+  const u64 total_reads;
+  time_ns_t sink;
+
+  static std::string source_name(time_source_t source) {
+    switch (source) {
+    case time_source_t::MONOTONIC:
+      return "clock_gettime";
+    case time_source_t::CURRENT_TIME:
+      return "current_time";
+    default:
+      return "recent_time";
+    }
+  }
+
+public:
+  ClockRead(time_source_t _source, u64 _total_reads) : Benchmark(source_name(_source)), source(_source), total_reads(_total_reads), sink(0) {}
+
+  void setup() override final { current_time(); }
+
+  void run() override final {
+    for (u64 i = 0; i < total_reads; i++) {
+      switch (source) {
+      case time_source_t::MONOTONIC:
+        sink += monotonic_time();
+        break;
+      case time_source_t::CURRENT_TIME:
+        sink += current_time();
+        break;
+      case time_source_t::RECENT_TIME:
+        sink += recent_time();
+        break;
+      }
+    }
+    Benchmark::increment_counter(total_reads);
+  }
+
+  void teardown() override final { assert_or_panic(sink != 0, "Clock never read"); }
+};
+
+// Per-packet processing touching DoubleChain, CMS and BloomFilter, timestamped either once per packet or once per burst.
+class PacketTimestamps : public Benchmark {
+private:
+  static constexpr const int BURST_SIZE  = 32;
+  static constexpr const int INDEX_RANGE = 1 << 16;
+
+  const time_source_t per_packet_source;
+  const bool per_burst;
+  const u64 total_packets;
+
+  RandomUniformEngine uniform_engine;
+  std::vector<int> packets;
+
+  struct DoubleChain *chain;
+  struct CMS *cms;
+  struct BloomFilter *bf;
+
+public:
+  PacketTimestamps(const std::string &_name, u32 random_seed, time_source_t _per_packet_source, bool _per_burst, u64 _total_packets)
+      : Benchmark(_name), per_packet_source(_per_packet_source), per_burst(_per_burst), total_packets(_total_packets),
+        uniform_engine(random_seed, 0, INDEX_RANGE - 1), chain(nullptr), cms(nullptr), bf(nullptr) {
+    assert(total_packets % BURST_SIZE == 0 && "total_packets must be a multiple of the burst size");
+  }
+
+  void setup() override final {
+    packets.clear();
+    for (u64 i = 0; i < total_packets; i++) {
+      packets.push_back(uniform_engine.generate());
+    }
+
+    assert_or_panic(dchain_allocate(INDEX_RANGE, &chain), "Failed to allocate dchain");
+    assert_or_panic(cms_allocate(4, 1024, sizeof(int), 1'000'000'000, &cms), "Failed to allocate CMS");
+    assert_or_panic(bf_allocate(4, 1024, sizeof(int), 1'000'000'000, &bf), "Failed to allocate bloom filter");
+
+    const time_ns_t now = current_time();
+    for (int i = 0; i < INDEX_RANGE; i++) {
+      int index;
+      dchain_allocate_new_index(chain, &index, now);
+    }
+  }
+
+  void run() override final {
+    for (u64 burst = 0; burst < total_packets; burst += BURST_SIZE) {
+      time_ns_t now = per_burst ? current_time() : 0;
+
+      for (int i = 0; i < BURST_SIZE; i++) {
+        if (!per_burst) {
+          now = per_packet_source == time_source_t::MONOTONIC ? monotonic_time() : current_time();
+        }
+        dchain_rejuvenate_index(chain, packets[burst + i], now);
+        cms_periodic_cleanup(cms, now);
+        bf_periodic_cleanup(bf, now);
+      }
+
+      Benchmark::increment_counter(BURST_SIZE);
+    }
+  }
+
+  void teardown() override final { dchain_free(chain); }
+};
+
+int main() {
+  BenchmarkSuite suite;
+
+  suite.add_benchmark_group("Clock read");
+  suite.add_benchmark(std::make_unique<ClockRead>(time_source_t::MONOTONIC, 100'000'000));
+  suite.add_benchmark(std::make_unique<ClockRead>(time_source_t::CURRENT_TIME, 100'000'000));
+  suite.add_benchmark(std::make_unique<ClockRead>(time_source_t::RECENT_TIME, 100'000'000));
+
+  suite.add_benchmark_group("Packet timestamps, bursts of 32");
+  suite.add_benchmark(std::make_unique<PacketTimestamps>("per-packet-clock_gettime", 0, time_source_t::MONOTONIC, false, 32'000'000));
+  suite.add_benchmark(std::make_unique<PacketTimestamps>("per-packet-current_time", 0, time_source_t::CURRENT_TIME, false, 32'000'000));
+  suite.add_benchmark(std::make_unique<PacketTimestamps>("per-burst", 0, time_source_t::CURRENT_TIME, true, 32'000'000));
+
+  suite.run_all();
+
+  return 0;
+}
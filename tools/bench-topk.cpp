@@ -0,0 +1,185 @@
+#include <libnet/cms.h>
+#include <libnet/topk.h>
+#include <libutil/random.h>
+
+#include <algorithm>
+#include <format>
+#include <memory>
+#include <vector>
+#include <string.h>
+
+#include "common.h"
+#include "bench.h"
+
+// Flows drawn from a Zipf distribution, and their exact counts. Shared by the benchmarks of a group, the keys are only laid out in setup.
+struct zipf_trace_t {
+  const double zipf_param;
+  keys_pool_t keys_pool;
+  std::vector<u32> flows;
+  std::vector<u32> exact_counts;
+
+  zipf_trace_t(u32 random_seed, size_t key_size, double _zipf_param, u32 total_flows, u64 total_packets)
+      : zipf_param(_zipf_param), keys_pool(key_size, total_flows), flows(total_packets), exact_counts(total_flows) {
+    RandomUniformEngine uniform_engine(random_seed, 0, 0xff);
+    RandomZipfEngine zipf_engine(random_seed, zipf_param, 0, total_flows - 1);
+    keys_pool.random_populate(uniform_engine);
+    for (u32 &flow : flows) {
+      flow = zipf_engine.generate();
+      exact_counts[flow]++;
+    }
+  }
+
+  // Flows of the exact top-k. Ties on the smallest count are broken by flow id.
+  std::vector<u32> exact_topk(u32 k) const {
+    std::vector<u32> ranked(exact_counts.size());
+    for (u32 flow = 0; flow < ranked.size(); flow++) {
+      ranked[flow] = flow;
+    }
+    std::partial_sort(ranked.begin(), ranked.begin() + k, ranked.end(), [this](u32 flow1, u32 flow2) {
+      return exact_counts[flow1] != exact_counts[flow2] ? exact_counts[flow1] > exact_counts[flow2] : flow1 < flow2;
+    });
+    ranked.resize(k);
+    return ranked;
+  }
+};
+
+// A TopK over a 4x16384 CMS of 32 bit counters with conservative update, fed with the whole trace. Recall is the share of the exact top-k
+// flows among the reported ones.
+class TopKBench : public Benchmark {
+protected:
+  static constexpr const u32 CMS_HEIGHT = 4;
+  static constexpr const u32 CMS_WIDTH  = 1 << 14;
+
+  zipf_trace_t &trace;
+  const u32 k;
+  std::vector<u8> packets;
+
+  struct CMS *cms;
+  std::unique_ptr<TopK> topk;
+  double recall;
+
+  u8 *get_packet(u64 i) { return packets.data() + i * trace.keys_pool.key_size; }
+
+public:
+  TopKBench(const std::string &_name, zipf_trace_t &_trace, u32 _k)
+      : Benchmark(std::format("{}-k{}", _name, _k)), trace(_trace), k(_k), cms(nullptr), recall(0) {
+    assert(trace.flows.size() % CMS_VECTOR_SIZE == 0 && "the number of packets must be a multiple of the vector size");
+  }
+
+  void setup() override {
+    const size_t key_size = trace.keys_pool.key_size;
+    packets.resize(trace.flows.size() * key_size);
+    for (u64 i = 0; i < trace.flows.size(); i++) {
+      memcpy(get_packet(i), trace.keys_pool.get_key(trace.flows[i]), key_size);
+    }
+    assert_or_panic(cms_allocate_counters(CMS_HEIGHT, CMS_WIDTH, key_size, CMS_COUNTER_32, CMS_CONSERVATIVE_UPDATE, 1'000'000'000, &cms),
+                    "Failed to allocate CMS");
+    topk = std::make_unique<TopK>(k, key_size, cms);
+  }
+
+  void teardown() override {
+    const size_t key_size = trace.keys_pool.key_size;
+    std::vector<u8> reported(k * key_size);
+    std::vector<int> counts(k);
+    const u32 size = topk->topk(reported.data(), counts.data());
+
+    u32 hits = 0;
+    for (u32 flow : trace.exact_topk(k)) {
+      for (u32 i = 0; i < size; i++) {
+        if (memcmp(reported.data() + i * key_size, trace.keys_pool.get_key(flow), key_size) == 0) {
+          hits++;
+          break;
+        }
+      }
+    }
+    recall = static_cast<double>(hits) / k;
+
+    // Many benchmarks are set up one after the other, release the packets.
+    packets = std::vector<u8>();
+    topk.reset();
+  }
+
+  std::string get_notes() const override final { return std::format("recall {:.3f}", recall); }
+};
+
+class TopKUpdate : public TopKBench {
+public:
+  TopKUpdate(zipf_trace_t &_trace, u32 _k) : TopKBench("update", _trace, _k) {}
+
+  void run() override final {
+    for (u64 i = 0; i < trace.flows.size(); i++) {
+      topk->update(get_packet(i));
+    }
+    Benchmark::increment_counter(trace.flows.size());
+  }
+};
+
+class TopKUpdateVec : public TopKBench {
+public:
+  TopKUpdateVec(zipf_trace_t &_trace, u32 _k) : TopKBench("update-vec", _trace, _k) {}
+
+  void run() override final {
+    for (u64 i = 0; i < trace.flows.size(); i += CMS_VECTOR_SIZE) {
+      topk->update_vec(get_packet(i));
+    }
+    Benchmark::increment_counter(trace.flows.size());
+  }
+};
+
+// Snapshots of the candidates, once they were fed with the whole trace.
+class TopKSnapshot : public TopKBench {
+private:
+  static constexpr const u64 SNAPSHOTS = 100'000;
+
+  std::vector<u8> keys_out;
+  std::vector<int> counts_out;
+  u64 sink;
+
+public:
+  TopKSnapshot(zipf_trace_t &_trace, u32 _k) : TopKBench("snapshot", _trace, _k), keys_out(_k * _trace.keys_pool.key_size), counts_out(_k), sink(0) {}
+
+  void setup() override final {
+    TopKBench::setup();
+    for (u64 i = 0; i < trace.flows.size(); i += CMS_VECTOR_SIZE) {
+      topk->update_vec(get_packet(i));
+    }
+  }
+
+  void run() override final {
+    for (u64 i = 0; i < SNAPSHOTS; i++) {
+      topk->topk(keys_out.data(), counts_out.data());
+      sink += counts_out[0];
+    }
+    Benchmark::increment_counter(SNAPSHOTS);
+  }
+};
+
+int main() {
+  constexpr const size_t key_size   = 16;
+  constexpr const u32 total_flows   = 1 << 20;
+  constexpr const u64 total_packets = 16'000'000;
+  constexpr const u32 seed          = 0;
+
+  BenchmarkSuite suite;
+
+  std::vector<std::unique_ptr<zipf_trace_t>> traces;
+  for (double zipf_param : {0.9, 1.2}) {
+    traces.push_back(std::make_unique<zipf_trace_t>(seed, key_size, zipf_param, total_flows, total_packets));
+    zipf_trace_t &trace = *traces.back();
+
+    suite.add_benchmark_group(std::format("Top-k update, zipf {}", zipf_param));
+    for (u32 k : {16, 256}) {
+      suite.add_benchmark(std::make_unique<TopKUpdate>(trace, k));
+      suite.add_benchmark(std::make_unique<TopKUpdateVec>(trace, k));
+    }
+  }
+
+  suite.add_benchmark_group("Top-k snapshot");
+  for (u32 k : {16, 256, 1024}) {
+    suite.add_benchmark(std::make_unique<TopKSnapshot>(*traces.back(), k));
+  }
+
+  suite.run_all();
+
+  return 0;
+}
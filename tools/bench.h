@@ -0,0 +1,85 @@
+#pragma once
+
+#include <libutil/types.h>
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <optional>
+#include <chrono>
+#include <stdio.h>
+
+class Benchmark {
+private:
+  using clock = std::conditional<std::chrono::high_resolution_clock::is_steady, std::chrono::high_resolution_clock, std::chrono::steady_clock>::type;
+
+  const std::string name;
+  clock::time_point start_time;
+  u64 counter;
+
+public:
+  Benchmark(const std::string &_name) : name(_name), counter(0) {}
+
+  const std::string &get_name() const { return name; }
+  u64 get_counter() const { return counter; }
+  void increment_counter(u64 increment = 1) { counter += increment; }
+
+  // Extra results, printed at the end of the benchmark line.
+  virtual std::string get_notes() const { return ""; }
+
+  virtual void setup()    = 0;
+  virtual void run()      = 0;
+  virtual void teardown() = 0;
+
+  void start() {
+    start_time = clock::now();
+    counter    = 0;
+  }
+
+  time_ns_t stop() {
+    const clock::time_point end_time = clock::now();
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(end_time - start_time).count();
+  }
+};
+
+class BenchmarkSuite {
+private:
+  using benchmarks_t = std::vector<std::unique_ptr<Benchmark>>;
+
+  std::vector<std::pair<std::string, benchmarks_t>> benchmarks_groups;
+
+public:
+  void add_benchmark(std::unique_ptr<Benchmark> benchmark) { benchmarks_groups.back().second.push_back(std::move(benchmark)); }
+  void add_benchmark_group(const std::string &name) { benchmarks_groups.emplace_back(name, benchmarks_t{}); }
+
+  void run_all() {
+    for (const std::pair<std::string, BenchmarkSuite::benchmarks_t> &group : benchmarks_groups) {
+      std::optional<time_ns_t> base_duration;
+      printf("%s\n", group.first.c_str());
+      for (const std::unique_ptr<Benchmark> &benchmark : group.second) {
+        benchmark->setup();
+        benchmark->start();
+        benchmark->run();
+        const time_ns_t duration = benchmark->stop();
+        benchmark->teardown();
+
+        if (!base_duration) {
+          base_duration = duration;
+        }
+
+        const double ops_per_sec = static_cast<double>(benchmark->get_counter()) / (duration / 1'000'000'000.0);
+        const double speedup     = static_cast<double>(*base_duration) / duration;
+
+        printf("  %-25s", benchmark->get_name().c_str());
+        printf("\t%15ld ns", duration);
+        printf("\t%15.0f ops/sec", ops_per_sec);
+        printf("\t\t%7.4fx speedup", speedup);
+        const std::string notes = benchmark->get_notes();
+        if (!notes.empty()) {
+          printf("\t%s", notes.c_str());
+        }
+        printf("\n");
+      }
+    }
+  }
+};
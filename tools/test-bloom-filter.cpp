@@ -0,0 +1,225 @@
+#include <libnet/bloom-filter.h>
+#include <libutil/types.h>
+#include <libutil/random.h>
+
+#include <vector>
+#include <algorithm>
+#include <assert.h>
+
+#include "common.h"
+
+int allocate(bool blocked, u32 height, u32 width, u32 key_size, struct BloomFilter **bf_out) {
+  return blocked ? bf_allocate_blocked(height, width, key_size, 0, bf_out) : bf_allocate(height, width, key_size, 0, bf_out);
+}
+
+// Two filters get the same keys, one at a time and n at a time: the vectorized queries of both must give the same answers as the scalar ones,
+// for the keys that were set and for the ones that were not. n need not be a multiple of the 16 keys hashed at once.
+void test_scalar_vs_vec(bool blocked, const size_t key_size, const u32 n) {
+  constexpr const u32 height   = 4;
+  constexpr const u32 width    = 1 << 14;
+  constexpr const u32 set_keys = 64 * 37 * 2;
+  constexpr const u32 all_keys = 2 * set_keys;
+
+  RandomUniformEngine keys_uniform_engine(0, 0, 0xff);
+  keys_pool_t keys(key_size, all_keys);
+  keys.random_populate(keys_uniform_engine);
+
+  struct BloomFilter *scalar;
+  struct BloomFilter *vec;
+  assert_or_panic(allocate(blocked, height, width, key_size, &scalar) == 1, "Failed to allocate bloom filter");
+  assert_or_panic(allocate(blocked, height, width, key_size, &vec) == 1, "Failed to allocate bloom filter");
+
+  for (u32 i = 0; i < set_keys; i++) {
+    bf_set(scalar, keys.get_key(i));
+  }
+  for (u32 i = 0; i < set_keys; i += n) {
+    bf_set_vec(vec, keys.get_key(i), std::min(n, set_keys - i));
+  }
+
+  u32 false_positives = 0;
+  for (u32 i = 0; i + n <= all_keys; i += n) {
+    const u64 present_scalar = bf_query_vec(scalar, keys.get_key(i), n);
+    const u64 present_vec    = bf_query_vec(vec, keys.get_key(i), n);
+
+    for (u32 lane = 0; lane < n; lane++) {
+      const int expected = bf_query(scalar, keys.get_key(i + lane));
+      assert_or_panic(bf_query(vec, keys.get_key(i + lane)) == expected, "Key %u set differently one at a time and %u at a time", i + lane, n);
+      assert_or_panic(static_cast<int>((present_scalar >> lane) & 1) == expected, "Vector query mismatch for key %u (expected %d)", i + lane,
+                      expected);
+      assert_or_panic(static_cast<int>((present_vec >> lane) & 1) == expected, "Vector query mismatch for key %u (expected %d)", i + lane,
+                      expected);
+      assert_or_panic(i + lane >= set_keys || expected == 1, "Key %u not found", i + lane);
+      false_positives += i + lane >= set_keys ? expected : 0;
+    }
+    if (n < BF_QUERY_VEC_MAX_KEYS) {
+      assert_or_panic((present_scalar >> n) == 0, "Bits set beyond the %u keys queried", n);
+    }
+  }
+
+  assert_or_panic(false_positives < set_keys / 10, "Too many false positives (%u out of %u)", false_positives, set_keys);
+}
+
+// A filter with a set of keys merged into one with another set answers like a filter given both sets, and finds all of their keys. Filters of
+// different shapes or layouts are not merged.
+void test_merge(bool blocked, const size_t key_size) {
+  constexpr const u32 height   = 4;
+  constexpr const u32 width    = 1 << 14;
+  constexpr const u32 set_keys = 2048;
+  constexpr const u32 all_keys = 4 * set_keys;
+
+  RandomUniformEngine keys_uniform_engine(0, 0, 0xff);
+  keys_pool_t keys(key_size, all_keys);
+  keys.random_populate(keys_uniform_engine);
+
+  struct BloomFilter *dst;
+  struct BloomFilter *src;
+  struct BloomFilter *both;
+  assert_or_panic(allocate(blocked, height, width, key_size, &dst) == 1, "Failed to allocate bloom filter");
+  assert_or_panic(allocate(blocked, height, width, key_size, &src) == 1, "Failed to allocate bloom filter");
+  assert_or_panic(allocate(blocked, height, width, key_size, &both) == 1, "Failed to allocate bloom filter");
+
+  for (u32 i = 0; i < set_keys; i++) {
+    bf_set(dst, keys.get_key(i));
+    bf_set(both, keys.get_key(i));
+  }
+  for (u32 i = set_keys; i < 2 * set_keys; i++) {
+    bf_set(src, keys.get_key(i));
+    bf_set(both, keys.get_key(i));
+  }
+
+  assert_or_panic(bf_merge(dst, src) == 1, "Failed to merge bloom filters");
+  for (u32 i = 0; i < all_keys; i++) {
+    const int expected = bf_query(both, keys.get_key(i));
+    assert_or_panic(bf_query(dst, keys.get_key(i)) == expected, "Merged filter answers %d for key %u", 1 - expected, i);
+    assert_or_panic(i >= 2 * set_keys || expected == 1, "Key %u not found", i);
+  }
+
+  struct BloomFilter *other;
+  assert_or_panic(allocate(!blocked, height, width, key_size, &other) == 1, "Failed to allocate bloom filter");
+  assert_or_panic(bf_merge(dst, other) == 0, "Merged bloom filters of different layouts");
+  assert_or_panic(allocate(blocked, height, 2 * width, key_size, &other) == 1, "Failed to allocate bloom filter");
+  assert_or_panic(bf_merge(dst, other) == 0, "Merged bloom filters of different widths");
+  assert_or_panic(allocate(blocked, height - 1, width, key_size, &other) == 1, "Failed to allocate bloom filter");
+  assert_or_panic(bf_merge(dst, other) == 0, "Merged bloom filters of different heights");
+  assert_or_panic(allocate(blocked, height, width, key_size + 1, &other) == 1, "Failed to allocate bloom filter");
+  assert_or_panic(bf_merge(dst, other) == 0, "Merged bloom filters of different key sizes");
+}
+
+// Keys set in a generation are found until num_generations generation intervals have gone by, whether time moves forward one interval at a
+// time or in a single idle gap.
+void test_aging_gap(const u32 num_generations, const size_t key_size) {
+  constexpr const u32 height         = 4;
+  constexpr const u32 width          = 1 << 12;
+  constexpr const u32 total_keys     = 512;
+  constexpr const time_ns_t interval = 1000;
+  const std::vector<time_ns_t> gaps  = {interval, (num_generations - 1) * interval, num_generations * interval, 10 * num_generations * interval};
+
+  RandomUniformEngine keys_uniform_engine(0, 0, 0xff);
+  keys_pool_t keys(key_size, total_keys);
+  keys.random_populate(keys_uniform_engine);
+
+  for (time_ns_t gap : gaps) {
+    struct AgingBloomFilter *abf;
+    assert_or_panic(abf_allocate(num_generations, height, width, key_size, interval, &abf) == 1, "Failed to allocate aging bloom filter");
+
+    time_ns_t now = 1;
+    assert_or_panic(abf_advance(abf, now) == 0, "First advance rotated");
+    abf_set_vec(abf, keys.get_key(0), BF_QUERY_VEC_MAX_KEYS);
+    for (u32 i = BF_QUERY_VEC_MAX_KEYS; i < total_keys; i++) {
+      abf_set(abf, keys.get_key(i));
+    }
+
+    now               += gap;
+    const int rotated  = abf_advance(abf, now);
+    const int expected = static_cast<int>(std::min<time_ns_t>(gap / interval, num_generations));
+    assert_or_panic(rotated == expected, "Rotated %d generations instead of %d, after %ld", rotated, expected, gap);
+
+    const bool kept = static_cast<u32>(rotated) < num_generations;
+    u32 found       = 0;
+    for (u32 i = 0; i < total_keys; i++) {
+      found += abf_query(abf, keys.get_key(i));
+    }
+    assert_or_panic(!kept || found == total_keys, "Lost %u keys after %d generations", total_keys - found, rotated);
+    assert_or_panic(kept || found == 0, "Kept %u keys after %d generations", found, rotated);
+
+    // The next generation starts one interval after the last one, or from now after a gap longer than all of them.
+    assert_or_panic(abf_advance(abf, now + interval / 2) == 0, "Rotated within a generation");
+    assert_or_panic(abf_advance(abf, now + interval) == 1, "Did not rotate after a generation");
+  }
+}
+
+// A group of keys is set in each generation, then time jumps over some of them: the groups of the generations that expired are gone right away,
+// even though only the one taking over was cleared, and stay gone as the next calls clear the others. The other groups are kept throughout.
+void test_aging_stale(const u32 num_generations, const u32 expired) {
+  constexpr const u32 height         = 4;
+  constexpr const u32 width          = 1 << 14;
+  constexpr const u32 group_keys     = 64;
+  constexpr const time_ns_t interval = 1000;
+  const u32 total_keys               = num_generations * group_keys;
+
+  RandomUniformEngine keys_uniform_engine(0, 0, 0xff);
+  keys_pool_t keys(16, total_keys);
+  keys.random_populate(keys_uniform_engine);
+
+  struct AgingBloomFilter *abf;
+  assert_or_panic(abf_allocate(num_generations, height, width, 16, interval, &abf) == 1, "Failed to allocate aging bloom filter");
+
+  // Advancing at the turn of each generation only, so that nothing is cleared along the way.
+  time_ns_t now = 1;
+  abf_advance(abf, now);
+  for (u32 group = 0; group < num_generations; group++) {
+    if (group > 0) {
+      now += interval;
+      assert_or_panic(abf_advance(abf, now) == 1, "Did not rotate after a generation");
+    }
+    abf_set_vec(abf, keys.get_key(group * group_keys), group_keys);
+  }
+
+  now += expired * interval;
+  assert_or_panic(abf_advance(abf, now) == static_cast<int>(expired), "Did not rotate %u generations", expired);
+
+  // Enough calls to clear every generation that expired, all at the start of the current one, so that the oldest one does not fade yet.
+  const u32 calls = num_generations * (width * height / 8 / ABF_CLEAR_CHUNK + 1);
+  for (u32 call = 0; call <= calls; call += calls) {
+    u32 false_positives = 0;
+    for (u32 i = 0; i < total_keys; i += group_keys) {
+      const u64 present = abf_query_vec(abf, keys.get_key(i), group_keys);
+      for (u32 lane = 0; lane < group_keys; lane++) {
+        const int found = abf_query(abf, keys.get_key(i + lane));
+        assert_or_panic(static_cast<int>((present >> lane) & 1) == found, "Vector query mismatch for key %u", i + lane);
+        assert_or_panic(i / group_keys < expired || found == 1, "Lost key %u of generation %u after %u calls", i + lane, i / group_keys, call);
+        false_positives += i / group_keys < expired ? found : 0;
+      }
+    }
+    assert_or_panic(false_positives <= expired * group_keys / 10, "Found %u expired keys after %u calls", false_positives, call);
+
+    for (u32 i = 0; i < calls && call == 0; i++) {
+      assert_or_panic(abf_advance(abf, now) == 0, "Rotated within a generation");
+    }
+  }
+
+  // The generation taking over was cleared: new keys are set and found there.
+  abf_set_vec(abf, keys.get_key(0), group_keys);
+  assert_or_panic(abf_query_vec(abf, keys.get_key(0), group_keys) == (1ull << group_keys) - 1, "Keys set after the gap not found");
+}
+
+int main() {
+  for (bool blocked : {false, true}) {
+    for (u32 n : {37u, 64u, 16u, 5u}) {
+      test_scalar_vs_vec(blocked, 16, n);
+      test_scalar_vs_vec(blocked, 13, n);
+    }
+    test_merge(blocked, 16);
+    test_merge(blocked, 13);
+  }
+
+  for (u32 num_generations : {2, 3, ABF_MAX_GENERATIONS}) {
+    test_aging_gap(num_generations, 16);
+    test_aging_gap(num_generations, 13);
+    for (u32 expired = 1; expired <= num_generations; expired++) {
+      test_aging_stale(num_generations, expired);
+    }
+  }
+
+  return 0;
+}
@@ -0,0 +1,402 @@
+#include <libnet/cms.h>
+#include <libutil/types.h>
+#include <libutil/random.h>
+
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <algorithm>
+#include <assert.h>
+#include <string.h>
+
+#include "common.h"
+
+u64 counter_max(enum cms_counter counter) {
+  switch (counter) {
+  case CMS_COUNTER_8:
+    return UINT8_MAX;
+  case CMS_COUNTER_16:
+    return UINT16_MAX;
+  default:
+    // Counts are read back as int
+    return INT32_MAX;
+  }
+}
+
+// Packets of a few heavy keys and many light ones, so that bursts are full of duplicates and narrow counters saturate.
+std::vector<u32> make_trace(u32 total_keys, u32 heavy_keys, u64 total_packets) {
+  RandomUniformEngine pick_engine(0, 0, 3);
+  RandomUniformEngine heavy_engine(0, 0, heavy_keys - 1);
+  RandomUniformEngine light_engine(0, 0, total_keys - 1);
+
+  std::vector<u32> trace(total_packets);
+  for (u64 i = 0; i < total_packets; i++) {
+    trace[i] = pick_engine.generate() == 0 ? light_engine.generate() : heavy_engine.generate();
+  }
+  return trace;
+}
+
+// Two sketches get the same packets, one key at a time and CMS_VECTOR_SIZE keys at a time: every count must be the same, whether read one key
+// at a time or with the vectorized queries, and never below the exact count (up to saturation). The sketches are cleaned up twice along the
+// way, so that the lazy resets are exercised too.
+void test_scalar_vs_vec(const size_t key_size, enum cms_counter counter, int flags, u32 height, u32 width) {
+  constexpr const u32 total_keys      = 1024;
+  constexpr const u32 heavy_keys      = 8;
+  constexpr const u64 total_packets   = 3 * 65536;
+  constexpr const time_ns_t interval  = 1000;
+  constexpr const u64 cleanup_packets = total_packets / 3;
+
+  RandomUniformEngine keys_uniform_engine(0, 0, 0xff);
+  keys_pool_t keys(key_size, total_keys);
+  keys.random_populate(keys_uniform_engine);
+
+  const std::vector<u32> trace = make_trace(total_keys, heavy_keys, total_packets);
+  std::vector<u8> packets(total_packets * key_size);
+  for (u64 i = 0; i < total_packets; i++) {
+    memcpy(packets.data() + i * key_size, keys.get_key(trace[i]), key_size);
+  }
+
+  struct CMS *scalar;
+  struct CMS *vec;
+  assert_or_panic(cms_allocate_counters(height, width, key_size, counter, flags, interval, &scalar), "Failed to allocate CMS");
+  assert_or_panic(cms_allocate_counters(height, width, key_size, counter, flags, interval, &vec), "Failed to allocate CMS");
+
+  time_ns_t now = 1;
+  cms_periodic_cleanup(scalar, now);
+  cms_periodic_cleanup(vec, now);
+
+  std::vector<u64> exact(total_keys, 0);
+
+  for (u64 start = 0; start < total_packets; start += cleanup_packets) {
+    for (u64 i = start; i < start + cleanup_packets; i++) {
+      cms_increment(scalar, packets.data() + i * key_size);
+      exact[trace[i]]++;
+    }
+    for (u64 i = start; i < start + cleanup_packets; i += CMS_VECTOR_SIZE) {
+      cms_increment_vec(vec, packets.data() + i * key_size);
+    }
+
+    for (u32 key = 0; key + CMS_VECTOR_SIZE <= total_keys; key += CMS_VECTOR_SIZE) {
+      int counts[CMS_VECTOR_SIZE];
+      cms_count_min_vec(vec, keys.get_key(key), counts);
+
+      for (u32 lane = 0; lane < CMS_VECTOR_SIZE; lane++) {
+        const int expected = cms_count_min(scalar, keys.get_key(key + lane));
+        const int actual   = cms_count_min(vec, keys.get_key(key + lane));
+        assert_or_panic(actual == expected, "Count mismatch for key %u (scalar %d, vector increments %d)", key + lane, expected, actual);
+        assert_or_panic(counts[lane] == expected, "Count mismatch for key %u (scalar %d, vector query %d)", key + lane, expected, counts[lane]);
+
+        const u64 floor = std::min(exact[key + lane], counter_max(counter));
+        assert_or_panic(static_cast<u64>(expected) >= floor, "Count of key %u below the exact count (%d < %lu)", key + lane, expected, floor);
+      }
+    }
+
+    now += interval;
+    assert_or_panic(cms_periodic_cleanup(scalar, now) == 1, "Scalar sketch not cleaned up");
+    assert_or_panic(cms_periodic_cleanup(vec, now) == 1, "Vector sketch not cleaned up");
+    std::fill(exact.begin(), exact.end(), 0);
+
+    for (u32 key = 0; key < total_keys; key++) {
+      assert_or_panic(cms_count_min(vec, keys.get_key(key)) == 0, "Count of key %u not reset", key);
+    }
+  }
+}
+
+// Two sliding sketches get the same packets, one key at a time and CMS_VECTOR_SIZE keys at a time, while time moves forward by less than a
+// pane, by several panes, and by more than the whole window. The counts are checked against exact counts kept per pane: with a sketch wide
+// enough for keys not to share counters, they must be equal.
+void test_sliding(const size_t key_size, u32 num_panes, u32 height, u32 width, bool exact_counts) {
+  constexpr const u32 total_keys    = 256;
+  constexpr const u32 heavy_keys    = 8;
+  constexpr const u64 burst_packets = 4096;
+  const time_ns_t window            = 1000 * num_panes;
+  const time_ns_t pane_interval     = window / num_panes;
+  // Time steps, in thousandths of a pane: within the pane, over a few panes, over more than the window.
+  const std::vector<u64> steps = {300, 300, 500, 1000, 2500, 100, 1000 * (num_panes + 1), 700, 700, 1000 * num_panes, 1500, 1000 * 2 * num_panes};
+
+  RandomUniformEngine keys_uniform_engine(0, 0, 0xff);
+  keys_pool_t keys(key_size, total_keys);
+  keys.random_populate(keys_uniform_engine);
+
+  const std::vector<u32> trace = make_trace(total_keys, heavy_keys, burst_packets * steps.size());
+  std::vector<u8> packets(trace.size() * key_size);
+  for (u64 i = 0; i < trace.size(); i++) {
+    memcpy(packets.data() + i * key_size, keys.get_key(trace[i]), key_size);
+  }
+
+  struct SlidingCMS *scalar;
+  struct SlidingCMS *vec;
+  assert_or_panic(scms_allocate(height, width, key_size, num_panes, window, &scalar), "Failed to allocate SlidingCMS");
+  assert_or_panic(scms_allocate(height, width, key_size, num_panes, window, &vec), "Failed to allocate SlidingCMS");
+
+  time_ns_t now = 1;
+  scms_advance(scalar, now);
+  scms_advance(vec, now);
+
+  // Exact counts of the live panes, newest last.
+  std::vector<std::vector<u64>> panes(1, std::vector<u64>(total_keys, 0));
+
+  for (size_t step = 0; step < steps.size(); step++) {
+    for (u64 i = step * burst_packets; i < (step + 1) * burst_packets; i++) {
+      scms_increment(scalar, packets.data() + i * key_size);
+      panes.back()[trace[i]]++;
+    }
+    for (u64 i = step * burst_packets; i < (step + 1) * burst_packets; i += CMS_VECTOR_SIZE) {
+      scms_increment_vec(vec, packets.data() + i * key_size);
+    }
+
+    for (u32 key = 0; key + CMS_VECTOR_SIZE <= total_keys; key += CMS_VECTOR_SIZE) {
+      int counts[CMS_VECTOR_SIZE];
+      scms_count_min_vec(vec, keys.get_key(key), counts);
+
+      for (u32 lane = 0; lane < CMS_VECTOR_SIZE; lane++) {
+        const int expected = scms_count_min(scalar, keys.get_key(key + lane));
+        const int actual   = scms_count_min(vec, keys.get_key(key + lane));
+        assert_or_panic(actual == expected, "Count mismatch for key %u (scalar %d, vector increments %d)", key + lane, expected, actual);
+        assert_or_panic(counts[lane] == expected, "Count mismatch for key %u (scalar %d, vector query %d)", key + lane, expected, counts[lane]);
+
+        u64 exact = 0;
+        for (const std::vector<u64> &pane : panes) {
+          exact += pane[key + lane];
+        }
+        assert_or_panic(static_cast<u64>(expected) >= exact, "Count of key %u below the exact count (%d < %lu)", key + lane, expected, exact);
+        assert_or_panic(!exact_counts || static_cast<u64>(expected) == exact, "Count of key %u is %d instead of %lu", key + lane, expected, exact);
+      }
+    }
+
+    now              += steps[step] * pane_interval / 1000;
+    const int dropped = scms_advance(scalar, now);
+    assert_or_panic(scms_advance(vec, now) == dropped, "Sketches dropped different numbers of panes");
+    assert_or_panic(dropped <= static_cast<int>(num_panes), "Dropped %d panes out of %u", dropped, num_panes);
+
+    for (int i = 0; i < dropped; i++) {
+      panes.emplace_back(total_keys, 0);
+    }
+    if (panes.size() > num_panes) {
+      panes.erase(panes.begin(), panes.end() - num_panes);
+    }
+
+    // After a gap longer than the window, nothing is left.
+    if (dropped == static_cast<int>(num_panes)) {
+      for (u32 key = 0; key < total_keys; key++) {
+        assert_or_panic(scms_count_min(vec, keys.get_key(key)) == 0, "Count of key %u left after the whole window", key);
+      }
+    }
+  }
+}
+
+// Feeds the packets [from, to) of the trace to the sketch, one key at a time.
+void feed(struct CMS *cms, const std::vector<u8> &packets, size_t key_size, u64 from, u64 to) {
+  for (u64 i = from; i < to; i++) {
+    cms_increment(cms, const_cast<u8 *>(packets.data()) + i * key_size);
+  }
+}
+
+// Two sketches get one half of the trace each, and a third one the whole trace: once merged, the first one must give the same counts as the
+// third one, saturation included. Before that, the sketches go through a cleanup with other packets, so that the lazy ones hold stale blocks
+// that must count as zeros, on either side of the merge.
+void test_merge(const size_t key_size, enum cms_counter counter, int dst_flags, int src_flags, u32 height, u32 width) {
+  constexpr const u32 total_keys     = 1024;
+  constexpr const u32 heavy_keys     = 8;
+  constexpr const u64 total_packets  = 2 * 65536;
+  constexpr const time_ns_t interval = 1000;
+
+  RandomUniformEngine keys_uniform_engine(0, 0, 0xff);
+  keys_pool_t keys(key_size, total_keys);
+  keys.random_populate(keys_uniform_engine);
+
+  const std::vector<u32> trace = make_trace(total_keys, heavy_keys, total_packets);
+  std::vector<u8> packets(total_packets * key_size);
+  for (u64 i = 0; i < total_packets; i++) {
+    memcpy(packets.data() + i * key_size, keys.get_key(trace[i]), key_size);
+  }
+
+  struct CMS *dst;
+  struct CMS *src;
+  struct CMS *whole;
+  assert_or_panic(cms_allocate_counters(height, width, key_size, counter, dst_flags, interval, &dst), "Failed to allocate CMS");
+  assert_or_panic(cms_allocate_counters(height, width, key_size, counter, src_flags, interval, &src), "Failed to allocate CMS");
+  assert_or_panic(cms_allocate_counters(height, width, key_size, counter, dst_flags, interval, &whole), "Failed to allocate CMS");
+
+  // Only the first half of the keys, so that some blocks are stale and others are not.
+  time_ns_t now = 1;
+  for (struct CMS *cms : {dst, src}) {
+    cms_periodic_cleanup(cms, now);
+    for (u32 key = 0; key < total_keys / 2; key++) {
+      cms_increment(cms, keys.get_key(key));
+    }
+  }
+  now += interval;
+  assert_or_panic(cms_periodic_cleanup(dst, now) == 1 && cms_periodic_cleanup(src, now) == 1, "Sketches not cleaned up");
+
+  feed(dst, packets, key_size, 0, total_packets / 2);
+  feed(src, packets, key_size, total_packets / 2, total_packets);
+  feed(whole, packets, key_size, 0, total_packets);
+
+  assert_or_panic(cms_merge(dst, src) == 1, "Failed to merge sketches");
+  for (u32 key = 0; key < total_keys; key++) {
+    const int expected = cms_count_min(whole, keys.get_key(key));
+    const int actual   = cms_count_min(dst, keys.get_key(key));
+    assert_or_panic(actual == expected, "Merged count of key %u is %d instead of %d", key, actual, expected);
+  }
+
+  // The source is left as it was, and merging an empty sketch changes nothing.
+  struct CMS *empty;
+  assert_or_panic(cms_allocate_counters(height, width, key_size, counter, src_flags, interval, &empty), "Failed to allocate CMS");
+  assert_or_panic(cms_merge(dst, empty) == 1, "Failed to merge an empty sketch");
+  for (u32 key = 0; key < total_keys; key++) {
+    assert_or_panic(cms_count_min(dst, keys.get_key(key)) == cms_count_min(whole, keys.get_key(key)), "Merging an empty sketch changed key %u", key);
+  }
+}
+
+// Counts that only overflow once added up stop at the largest value of the counters.
+void test_merge_saturates(enum cms_counter counter, int flags) {
+  constexpr const size_t key_size = 16;
+  const u64 half                  = counter_max(counter) * 3 / 4;
+
+  RandomUniformEngine keys_uniform_engine(0, 0, 0xff);
+  keys_pool_t keys(key_size, 2);
+  keys.random_populate(keys_uniform_engine);
+
+  struct CMS *dst;
+  struct CMS *src;
+  assert_or_panic(cms_allocate_counters(4, 1024, key_size, counter, flags, 0, &dst), "Failed to allocate CMS");
+  assert_or_panic(cms_allocate_counters(4, 1024, key_size, counter, flags, 0, &src), "Failed to allocate CMS");
+  for (u64 i = 0; i < half; i++) {
+    cms_increment(dst, keys.get_key(0));
+    cms_increment(src, keys.get_key(0));
+  }
+  cms_increment(src, keys.get_key(1));
+
+  assert_or_panic(cms_merge(dst, src) == 1, "Failed to merge sketches");
+  const int saturated = cms_count_min(dst, keys.get_key(0));
+  assert_or_panic(static_cast<u64>(saturated) == counter_max(counter), "Merged count is %d instead of %lu", saturated, counter_max(counter));
+  assert_or_panic(cms_count_min(dst, keys.get_key(1)) >= 1, "Lost the count of the other key");
+}
+
+// Sketches of different shapes are not merged, and the destination is left untouched.
+void test_merge_mismatch() {
+  struct CMS *dst;
+  assert_or_panic(cms_allocate_counters(4, 1024, 16, CMS_COUNTER_32, 0, 0, &dst), "Failed to allocate CMS");
+  u8 key[16] = {1};
+  cms_increment(dst, key);
+
+  struct CMS *other;
+  assert_or_panic(cms_allocate_counters(3, 1024, 16, CMS_COUNTER_32, 0, 0, &other), "Failed to allocate CMS");
+  assert_or_panic(cms_merge(dst, other) == 0, "Merged sketches of different heights");
+  assert_or_panic(cms_allocate_counters(4, 2048, 16, CMS_COUNTER_32, 0, 0, &other), "Failed to allocate CMS");
+  assert_or_panic(cms_merge(dst, other) == 0, "Merged sketches of different widths");
+  assert_or_panic(cms_allocate_counters(4, 1024, 8, CMS_COUNTER_32, 0, 0, &other), "Failed to allocate CMS");
+  assert_or_panic(cms_merge(dst, other) == 0, "Merged sketches of different key sizes");
+  assert_or_panic(cms_allocate_counters(4, 1024, 16, CMS_COUNTER_16, 0, 0, &other), "Failed to allocate CMS");
+  assert_or_panic(cms_merge(dst, other) == 0, "Merged sketches of different counters");
+  assert_or_panic(cms_count_min(dst, key) == 1, "A failed merge changed the destination");
+
+  struct PerCoreCMS *pcms;
+  assert_or_panic(pcms_allocate(2, 4, 1024, 16, CMS_COUNTER_16, 0, &pcms), "Failed to allocate per-core CMS");
+  assert_or_panic(pcms_merge(pcms, dst) == 0, "Merged per-core sketches of different counters");
+}
+
+// Cores count their own share of the packets while the control thread keeps merging: once they are done, a last merge must bring the global
+// sketch to the exact count of every key.
+void test_per_core(const u32 num_cores, enum cms_counter counter, int flags) {
+  constexpr const size_t key_size      = 16;
+  constexpr const u32 total_keys       = 1024;
+  constexpr const u64 packets_per_core = 16 * 8192;
+
+  RandomUniformEngine keys_uniform_engine(0, 0, 0xff);
+  keys_pool_t keys(key_size, total_keys);
+  keys.random_populate(keys_uniform_engine);
+
+  const std::vector<u32> trace = make_trace(total_keys, 8, packets_per_core);
+  std::vector<u8> packets(packets_per_core * key_size);
+  for (u64 i = 0; i < packets_per_core; i++) {
+    memcpy(packets.data() + i * key_size, keys.get_key(trace[i]), key_size);
+  }
+
+  // Wide enough for keys not to share counters, and a counter wide enough for the totals.
+  struct PerCoreCMS *pcms;
+  struct CMS *dst;
+  assert_or_panic(pcms_allocate(num_cores, 4, 65536, key_size, counter, flags, &pcms), "Failed to allocate per-core CMS");
+  assert_or_panic(cms_allocate_counters(4, 65536, key_size, counter, 0, 0, &dst), "Failed to allocate CMS");
+
+  std::atomic<u32> cores_done(0);
+  std::atomic<bool> merged(false);
+  std::vector<std::thread> threads;
+  for (u32 core = 0; core < num_cores; core++) {
+    threads.emplace_back([&, core]() {
+      // Half of the cores count one key at a time, the other half CMS_VECTOR_SIZE keys at a time.
+      if (core % 2 == 0) {
+        for (u64 i = 0; i < packets_per_core; i++) {
+          pcms_increment(pcms, core, packets.data() + i * key_size);
+        }
+      } else {
+        for (u64 i = 0; i < packets_per_core; i += CMS_VECTOR_SIZE) {
+          pcms_increment_vec(pcms, core, packets.data() + i * key_size);
+        }
+      }
+      cores_done++;
+      while (!merged.load()) {
+        pcms_poll(pcms, core);
+      }
+    });
+  }
+
+  while (cores_done.load() < num_cores) {
+    assert_or_panic(pcms_merge(pcms, dst) == 1, "Failed to merge per-core sketches");
+  }
+  assert_or_panic(pcms_merge(pcms, dst) == 1, "Failed to merge per-core sketches");
+  merged = true;
+  for (std::thread &thread : threads) {
+    thread.join();
+  }
+
+  std::vector<u64> exact(total_keys, 0);
+  for (u32 key : trace) {
+    exact[key] += num_cores;
+  }
+  u64 total = 0;
+  for (u32 key = 0; key < total_keys; key++) {
+    const int count = cms_count_min(dst, keys.get_key(key));
+    assert_or_panic(static_cast<u64>(count) == exact[key], "Merged count of key %u is %d instead of %lu", key, count, exact[key]);
+    total += count;
+  }
+  assert_or_panic(total == num_cores * packets_per_core, "Merged counts add up to %lu instead of %lu", total, num_cores * packets_per_core);
+}
+
+int main() {
+  for (enum cms_counter counter : {CMS_COUNTER_64, CMS_COUNTER_32, CMS_COUNTER_16, CMS_COUNTER_8}) {
+    for (int flags : {0, CMS_CONSERVATIVE_UPDATE, CMS_EAGER_RESET, CMS_CONSERVATIVE_UPDATE | CMS_EAGER_RESET}) {
+      // A narrow sketch, so that keys share counters, and a wide one, so that most of them do not.
+      test_scalar_vs_vec(16, counter, flags, 4, 64);
+      test_scalar_vs_vec(16, counter, flags, 3, 4096);
+      // Keys whose size is not a multiple of 4B are hashed one at a time.
+      test_scalar_vs_vec(13, counter, flags, 4, 256);
+    }
+  }
+
+  for (u32 num_panes : {1, 3, 7, 15}) {
+    test_sliding(16, num_panes, 4, 64, false);
+    test_sliding(16, num_panes, 4, 65536, true);
+    test_sliding(13, num_panes, 3, 65536, true);
+  }
+
+  for (enum cms_counter counter : {CMS_COUNTER_64, CMS_COUNTER_32, CMS_COUNTER_16, CMS_COUNTER_8}) {
+    for (int dst_flags : {0, CMS_EAGER_RESET}) {
+      for (int src_flags : {0, CMS_EAGER_RESET}) {
+        test_merge(16, counter, dst_flags, src_flags, 4, 64);
+        test_merge(13, counter, dst_flags, src_flags, 3, 4096);
+      }
+    }
+  }
+  for (enum cms_counter counter : {CMS_COUNTER_16, CMS_COUNTER_8}) {
+    test_merge_saturates(counter, 0);
+    test_merge_saturates(counter, CMS_EAGER_RESET);
+  }
+  test_merge_mismatch();
+  test_per_core(1, CMS_COUNTER_64, 0);
+  test_per_core(4, CMS_COUNTER_32, 0);
+  test_per_core(4, CMS_COUNTER_64, CMS_EAGER_RESET);
+
+  return 0;
+}
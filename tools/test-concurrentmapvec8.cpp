@@ -0,0 +1,88 @@
+#include <libnetvec/concurrentmapvec8.h>
+#include <libutil/types.h>
+#include <libutil/random.h>
+
+#include <array>
+#include <thread>
+#include <vector>
+#include <assert.h>
+
+#include "common.h"
+
+// Every thread inserts its own slice of the keys, half of them with put_vec and the other half with put.
+template <size_t key_size> void test_concurrent_puts(const unsigned capacity, const unsigned total_puts, const unsigned num_threads) {
+  using map_t = ConcurrentMapVec8<key_size>;
+
+  map_t map(capacity);
+  RandomUniformEngine keys_uniform_engine(0, 0, 0xff);
+
+  keys_pool_t keys(key_size, total_puts);
+  keys.random_populate(keys_uniform_engine);
+
+  const unsigned puts_per_thread = total_puts / num_threads;
+  assert(puts_per_thread % (2 * map_t::VECTOR_SIZE) == 0);
+
+  std::vector<std::thread> threads;
+  for (unsigned thread = 0; thread < num_threads; thread++) {
+    threads.emplace_back([&, thread]() {
+      const unsigned first = thread * puts_per_thread;
+      for (unsigned ops_done = 0; ops_done < puts_per_thread; ops_done += 2 * map_t::VECTOR_SIZE) {
+        int values[map_t::VECTOR_SIZE];
+        for (unsigned i = 0; i < map_t::VECTOR_SIZE; i++) {
+          values[i] = first + ops_done + i;
+        }
+        map.put_vec(keys.get_key(first + ops_done), values);
+
+        for (unsigned i = map_t::VECTOR_SIZE; i < 2 * map_t::VECTOR_SIZE; i++) {
+          map.put(keys.get_key(first + ops_done + i), first + ops_done + i);
+        }
+      }
+    });
+  }
+
+  for (std::thread &thread : threads) {
+    thread.join();
+  }
+
+  assert_or_panic(map.get_size() == puts_per_thread * num_threads, "Size mismatch (expected %u, got %u)", puts_per_thread * num_threads, map.get_size());
+
+  for (unsigned ops_done = 0; ops_done < puts_per_thread * num_threads; ops_done += map_t::VECTOR_SIZE) {
+    int values[map_t::VECTOR_SIZE];
+    int found = map.get_vec(keys.get_key(ops_done), values);
+    assert_or_panic(found == 0xff, "Not all keys were found (found mask 0x%02x)", found);
+
+    for (unsigned i = 0; i < map_t::VECTOR_SIZE; i++) {
+      assert_or_panic(values[i] == (int)(ops_done + i), "Value mismatch in map (expected %u, got %d)", ops_done + i, values[i]);
+
+      int value = 0;
+      found     = map.get(keys.get_key(ops_done + i), &value);
+      assert_or_panic(found == 1, "Failed to find key %u", ops_done + i);
+      assert_or_panic(value == (int)(ops_done + i), "Value mismatch in map (expected %u, got %d)", ops_done + i, value);
+    }
+  }
+}
+
+template <size_t key_size> void test_unsuccessful_gets(const unsigned capacity, const unsigned total_gets) {
+  using map_t = ConcurrentMapVec8<key_size>;
+
+  map_t map(capacity);
+  RandomUniformEngine keys_uniform_engine(0, 0, 0xff);
+
+  keys_pool_t keys(key_size, total_gets);
+  keys.random_populate(keys_uniform_engine);
+
+  for (unsigned ops_done = 0; ops_done < total_gets; ops_done += map_t::VECTOR_SIZE) {
+    int values[map_t::VECTOR_SIZE];
+    int found = map.get_vec(keys.get_key(ops_done), values);
+    assert_or_panic(found == 0, "Found keys in an empty map (found mask 0x%02x)", found);
+  }
+}
+
+int main() {
+  test_concurrent_puts<16>(65536, 32, 1);
+  test_concurrent_puts<16>(64, 32, 2);
+  test_concurrent_puts<16>(65536, 32768, 4);
+  test_concurrent_puts<16>(65536, 65536, 8);
+  test_unsuccessful_gets<16>(65536, 64);
+  return 0;
+}
@@ -0,0 +1,173 @@
+#include <libnet/cuckoo-filter.h>
+#include <libutil/types.h>
+#include <libutil/random.h>
+
+#include <vector>
+#include <assert.h>
+
+#include "common.h"
+
+// Inserts keys of the pool, in order, until an insertion fails. Returns the number of keys inserted.
+u32 fill(struct CuckooFilter *cf, keys_pool_t &keys) {
+  u32 inserted = 0;
+  while (inserted < keys.capacity && cf_insert(cf, keys.get_key(inserted))) {
+    inserted++;
+  }
+  return inserted;
+}
+
+void check_present(struct CuckooFilter *cf, keys_pool_t &keys, u32 from, u32 to) {
+  for (u32 i = from; i < to; i++) {
+    assert_or_panic(cf_query(cf, keys.get_key(i)) == 1, "Key %u not found", i);
+  }
+}
+
+// The vectorized queries give the same answers as the scalar ones, for every key of the pool.
+void check_query_vec(struct CuckooFilter *cf, keys_pool_t &keys) {
+  for (u32 i = 0; i + CF_VECTOR_SIZE <= keys.capacity; i += CF_VECTOR_SIZE) {
+    const u16 present = cf_query_vec(cf, keys.get_key(i));
+    for (u32 lane = 0; lane < CF_VECTOR_SIZE; lane++) {
+      const int expected = cf_query(cf, keys.get_key(i + lane));
+      assert_or_panic(((present >> lane) & 1) == expected, "Vector query mismatch for key %u (expected %d)", i + lane, expected);
+    }
+  }
+}
+
+// Fills the filter to its first failed insertion: with 4 slots per bucket, that happens above 95% load.
+void test_fill(const size_t key_size, const u32 capacity) {
+  RandomUniformEngine keys_uniform_engine(0, 0, 0xff);
+  keys_pool_t keys(key_size, 4 * capacity);
+  keys.random_populate(keys_uniform_engine);
+
+  struct CuckooFilter *cf;
+  assert_or_panic(cf_allocate(capacity, key_size, &cf) == 1, "Failed to allocate cuckoo filter");
+
+  const u32 inserted = fill(cf, keys);
+  assert_or_panic(inserted >= capacity * 95 / 100, "Only %u keys inserted out of %u slots", inserted, capacity);
+  assert_or_panic(cf_get_size(cf) == inserted, "Size mismatch (expected %u, got %u)", inserted, cf_get_size(cf));
+
+  check_present(cf, keys, 0, inserted);
+  check_query_vec(cf, keys);
+
+  // 8 / 2^16 false positives expected, with some margin.
+  u32 false_positives = 0;
+  for (u32 i = inserted; i < keys.capacity; i++) {
+    false_positives += cf_query(cf, keys.get_key(i));
+  }
+  const u32 absent = keys.capacity - inserted;
+  assert_or_panic(false_positives <= absent / 2000, "Too many false positives (%u out of %u)", false_positives, absent);
+}
+
+// Once full, the filter keeps a fingerprint aside. The insertions that fail afterwards leave the filter as it was, and the ones that succeed
+// are kept.
+void test_full(const size_t key_size, const u32 capacity) {
+  RandomUniformEngine keys_uniform_engine(0, 0, 0xff);
+  keys_pool_t keys(key_size, 2 * capacity);
+  keys.random_populate(keys_uniform_engine);
+
+  struct CuckooFilter *cf;
+  assert_or_panic(cf_allocate(capacity, key_size, &cf) == 1, "Failed to allocate cuckoo filter");
+
+  const u32 inserted = fill(cf, keys);
+
+  std::vector<u32> later;
+  for (u32 i = inserted + 1; i < inserted + 1 + capacity / 16; i++) {
+    if (cf_insert(cf, keys.get_key(i))) {
+      later.push_back(i);
+    }
+  }
+  assert_or_panic(cf_get_size(cf) == inserted + later.size(), "Size mismatch (expected %zu, got %u)", inserted + later.size(), cf_get_size(cf));
+
+  // One of the inserted keys has its fingerprint kept aside, it must still be found, by both kinds of queries.
+  check_present(cf, keys, 0, inserted);
+  for (u32 i : later) {
+    check_present(cf, keys, i, i + 1);
+  }
+  check_query_vec(cf, keys);
+}
+
+// Deleting keys of a full filter makes room for the fingerprint kept aside, and for new keys.
+void test_delete(const size_t key_size, const u32 capacity) {
+  RandomUniformEngine keys_uniform_engine(0, 0, 0xff);
+  keys_pool_t keys(key_size, 4 * capacity);
+  keys.random_populate(keys_uniform_engine);
+
+  struct CuckooFilter *cf;
+  assert_or_panic(cf_allocate(capacity, key_size, &cf) == 1, "Failed to allocate cuckoo filter");
+
+  const u32 inserted = fill(cf, keys);
+  const u32 deleted  = inserted / 2;
+  for (u32 i = 0; i < deleted; i++) {
+    assert_or_panic(cf_delete(cf, keys.get_key(i)) == 1, "Failed to delete key %u", i);
+    // The key kept aside may be any of the remaining ones, and may have moved back into its bucket.
+    if (i % 1024 == 0) {
+      check_present(cf, keys, i + 1, inserted);
+    }
+  }
+  assert_or_panic(cf_get_size(cf) == inserted - deleted, "Size mismatch (expected %u, got %u)", inserted - deleted, cf_get_size(cf));
+  check_present(cf, keys, deleted, inserted);
+  check_query_vec(cf, keys);
+
+  u32 still_present = 0;
+  for (u32 i = 0; i < deleted; i++) {
+    still_present += cf_query(cf, keys.get_key(i));
+  }
+  assert_or_panic(still_present <= deleted / 1000, "Too many deleted keys still found (%u out of %u)", still_present, deleted);
+
+  // Back to three quarters full, every new key fits.
+  const u32 reinserted = inserted / 4;
+  for (u32 i = inserted; i < inserted + reinserted; i++) {
+    assert_or_panic(cf_insert(cf, keys.get_key(i)) == 1, "Failed to insert key %u after deletions", i);
+  }
+  check_present(cf, keys, deleted, inserted + reinserted);
+  check_query_vec(cf, keys);
+
+  // A key that was never inserted is not deleted, unless it shares its fingerprint and buckets with another one.
+  void *absent          = keys.get_key(keys.capacity - 1);
+  const int false_match = cf_query(cf, absent);
+  assert_or_panic(cf_delete(cf, absent) == false_match, "Deleted an absent key");
+}
+
+// The filter is a multiset: a key inserted several times is held as many times, up to CF_MAX_COPIES, and repeating it never blocks the other
+// keys.
+void test_repeated_key(const size_t key_size, const u32 capacity) {
+  RandomUniformEngine keys_uniform_engine(0, 0, 0xff);
+  keys_pool_t keys(key_size, capacity / 2);
+  keys.random_populate(keys_uniform_engine);
+
+  struct CuckooFilter *cf;
+  assert_or_panic(cf_allocate(capacity, key_size, &cf) == 1, "Failed to allocate cuckoo filter");
+
+  void *repeated = keys.get_key(0);
+  for (u32 i = 0; i < CF_MAX_COPIES; i++) {
+    assert_or_panic(cf_insert(cf, repeated) == 1, "Failed to insert copy %u", i);
+  }
+  for (u32 i = 0; i < 2 * CF_MAX_KICKS; i++) {
+    assert_or_panic(cf_insert(cf, repeated) == 0, "Inserted more than %d copies", CF_MAX_COPIES);
+  }
+  assert_or_panic(cf_get_size(cf) == CF_MAX_COPIES, "Size mismatch (expected %d, got %u)", CF_MAX_COPIES, cf_get_size(cf));
+
+  for (u32 i = 1; i < keys.capacity; i++) {
+    assert_or_panic(cf_insert(cf, keys.get_key(i)) == 1, "Failed to insert key %u after a repeated key", i);
+  }
+  check_present(cf, keys, 0, keys.capacity);
+
+  for (u32 i = 0; i < CF_MAX_COPIES; i++) {
+    assert_or_panic(cf_delete(cf, repeated) == 1, "Failed to delete copy %u", i);
+  }
+  assert_or_panic(cf_delete(cf, repeated) == 0, "Copies left behind");
+}
+
+int main() {
+  test_fill(16, 1 << 16);
+  test_fill(13, 1 << 16);
+  test_fill(4, 64);
+  test_full(16, 1 << 12);
+  test_full(13, 1 << 12);
+  test_delete(16, 1 << 16);
+  test_delete(13, 1 << 16);
+  test_repeated_key(16, 1 << 20);
+  test_repeated_key(13, 1 << 12);
+
+  return 0;
+}
@@ -0,0 +1,89 @@
+#include <libnet/double-chain.h>
+#include <libnet/snapshot.h>
+#include <libutil/types.h>
+
+#include <vector>
+#include <assert.h>
+
+#include "common.h"
+
+// Allocates every index, rejuvenates some of them, and checks that the loaded allocator expires them in the same order as the original one.
+void test_save_load(enum dchain_layout layout, const int index_range) {
+  const std::string path = (std::filesystem::temp_directory_path() / "test-dchain.snapshot").string();
+
+  struct DoubleChain *chain;
+  assert_or_panic(dchain_allocate_layout(index_range, layout, nullptr, &chain) == 1, "Failed to allocate chain");
+
+  for (int i = 0; i < index_range; i++) {
+    int index;
+    assert_or_panic(dchain_allocate_new_index(chain, &index, i + 1) == 1, "Failed to allocate index %d", i);
+  }
+  for (int index = 0; index < index_range; index += 3) {
+    assert_or_panic(dchain_rejuvenate_index(chain, index, index_range + index + 1) == 1, "Failed to rejuvenate index %d", index);
+  }
+  // A hole, so that the free list is saved too.
+  assert_or_panic(dchain_free_index(chain, 1) == 1, "Failed to free index 1");
+
+  assert_or_panic(dchain_save(chain, path.c_str()) == 1, "Failed to save chain");
+
+  std::vector<int> expected(index_range);
+  const int total_expected = dchain_expire_batch(chain, 3 * index_range, expected.data(), index_range);
+  assert_or_panic(total_expected == index_range - 1, "Expired %d indexes instead of %d", total_expected, index_range - 1);
+  dchain_free(chain);
+
+  assert_or_panic(dchain_load(path.c_str(), &chain) == 1, "Failed to load chain");
+  assert_or_panic(dchain_is_index_allocated(chain, 0) == 1, "Index 0 not allocated after load");
+  assert_or_panic(dchain_is_index_allocated(chain, 1) == 0, "Index 1 allocated after load");
+
+  std::vector<int> expired(index_range);
+  const int total_expired = dchain_expire_batch(chain, 3 * index_range, expired.data(), index_range);
+  assert_or_panic(total_expired == total_expected, "Expired %d indexes instead of %d", total_expired, total_expected);
+  for (int i = 0; i < total_expired; i++) {
+    assert_or_panic(expired[i] == expected[i], "Expiry order mismatch at %d (expected %d, got %d)", i, expected[i], expired[i]);
+  }
+
+  // The loaded allocator keeps working as a regular one.
+  int index;
+  assert_or_panic(dchain_allocate_new_index(chain, &index, 1) == 1, "Failed to allocate after load");
+  dchain_free(chain);
+
+  std::filesystem::remove(path);
+}
+
+// Images whose sections do not match their parameters are rejected.
+void test_load_rejects(const int index_range) {
+  const std::string path = (std::filesystem::temp_directory_path() / "test-dchain-bad.snapshot").string();
+  std::vector<u8> cells(16 * (index_range + 2));
+  std::vector<u8> timestamps(sizeof(time_ns_t) * index_range);
+
+  const struct snapshot_section sections[] = {{cells.data(), cells.size()}, {timestamps.data(), timestamps.size()}};
+
+  // Unknown layout.
+  const uint64_t unknown_layout[SNAPSHOT_MAX_PARAMS] = {(uint64_t)index_range, 7, 0, 0};
+  assert_or_panic(snapshot_save(path.c_str(), SNAPSHOT_DCHAIN, unknown_layout, sections, 2) == 1, "Failed to save image");
+  struct DoubleChain *chain;
+  assert_or_panic(dchain_load(path.c_str(), &chain) == 0, "Loaded an image with an unknown layout");
+
+  // Cells of 16B for the default layout, whose cells are smaller.
+  const uint64_t default_layout[SNAPSHOT_MAX_PARAMS] = {(uint64_t)index_range, DCHAIN_LAYOUT_DEFAULT, 0, 0};
+  assert_or_panic(snapshot_save(path.c_str(), SNAPSHOT_DCHAIN, default_layout, sections, 2) == 1, "Failed to save image");
+  assert_or_panic(dchain_load(path.c_str(), &chain) == 0, "Loaded an image with oversized cells");
+
+  // An index range larger than the sections.
+  const uint64_t too_large[SNAPSHOT_MAX_PARAMS] = {(uint64_t)index_range * 4, DCHAIN_LAYOUT_AOS, 0, 0};
+  assert_or_panic(snapshot_save(path.c_str(), SNAPSHOT_DCHAIN, too_large, sections, 1) == 1, "Failed to save image");
+  assert_or_panic(dchain_load(path.c_str(), &chain) == 0, "Loaded an image with undersized cells");
+
+  std::filesystem::remove(path);
+}
+
+int main() {
+  for (enum dchain_layout layout : {DCHAIN_LAYOUT_DEFAULT, DCHAIN_LAYOUT_COMPACT, DCHAIN_LAYOUT_AOS}) {
+    test_save_load(layout, 4);
+    test_save_load(layout, 1022);
+    test_save_load(layout, 65534);
+  }
+  test_load_rejects(1022);
+
+  return 0;
+}
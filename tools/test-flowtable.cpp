@@ -0,0 +1,169 @@
+#include <libnetvec/flowtable.h>
+#include <libutil/types.h>
+#include <libutil/random.h>
+
+#include <array>
+#include <vector>
+#include <assert.h>
+
+#include "common.h"
+
+struct flow_state_t {
+  u64 packets;
+};
+
+template <size_t key_size> void test_lookup_or_create(const unsigned capacity, const unsigned total_flows) {
+  using table_t = FlowTable<key_size, flow_state_t>;
+
+  table_t table(capacity, 1000);
+  RandomUniformEngine keys_uniform_engine(0, 0, 0xff);
+
+  keys_pool_t keys(key_size, total_flows);
+  keys.random_populate(keys_uniform_engine);
+
+  std::vector<int> flow_indices(total_flows);
+
+  // First pass: every flow is new
+  for (unsigned i = 0; i < total_flows; i += table_t::VECTOR_SIZE) {
+    int indices[table_t::VECTOR_SIZE];
+    int created = table.lookup_or_create_vec(keys.get_key(i), 0, indices);
+    assert_or_panic(created == 0xffff, "Not all flows were created (created mask 0x%04x)", created);
+
+    for (unsigned j = 0; j < table_t::VECTOR_SIZE; j++) {
+      assert_or_panic(indices[j] >= 0 && indices[j] < (int)capacity, "Invalid index %d", indices[j]);
+      assert_or_panic(memcmp(table.get_key(indices[j]), keys.get_key(i + j), key_size) == 0, "Key mismatch for index %d", indices[j]);
+      table.get_state(indices[j]).packets++;
+      flow_indices[i + j] = indices[j];
+    }
+  }
+
+  assert_or_panic(table.get_size() == total_flows, "Size mismatch (expected %u, got %u)", total_flows, table.get_size());
+
+  // Second pass: every flow is found, with the same index and state
+  for (unsigned i = 0; i < total_flows; i += table_t::VECTOR_SIZE) {
+    int indices[table_t::VECTOR_SIZE];
+    int created = table.lookup_or_create_vec(keys.get_key(i), 10, indices);
+    assert_or_panic(created == 0, "Flows were created twice (created mask 0x%04x)", created);
+
+    for (unsigned j = 0; j < table_t::VECTOR_SIZE; j++) {
+      assert_or_panic(indices[j] == flow_indices[i + j], "Index mismatch (expected %d, got %d)", flow_indices[i + j], indices[j]);
+      assert_or_panic(table.get_state(indices[j]).packets == 1, "State mismatch for index %d", indices[j]);
+    }
+  }
+}
+
+template <size_t key_size> void test_duplicates_in_burst(const unsigned capacity) {
+  using table_t = FlowTable<key_size, flow_state_t>;
+
+  table_t table(capacity, 1000);
+  RandomUniformEngine keys_uniform_engine(0, 0, 0xff);
+
+  keys_pool_t keys(key_size, table_t::VECTOR_SIZE);
+  keys.random_populate(keys_uniform_engine);
+
+  // Only 4 different flows in the burst
+  for (unsigned i = 4; i < table_t::VECTOR_SIZE; i++) {
+    memcpy(keys.get_key(i), keys.get_key(i % 4), key_size);
+  }
+
+  int indices[table_t::VECTOR_SIZE];
+  int created = table.lookup_or_create_vec(keys.get_key(0), 0, indices);
+  assert_or_panic(created == 0x000f, "Unexpected created mask 0x%04x", created);
+  assert_or_panic(table.get_size() == 4, "Size mismatch (expected 4, got %u)", table.get_size());
+
+  for (unsigned i = 4; i < table_t::VECTOR_SIZE; i++) {
+    assert_or_panic(indices[i] == indices[i % 4], "Duplicate flow got a different index (%d vs %d)", indices[i], indices[i % 4]);
+  }
+}
+
+template <size_t key_size> void test_expire(const unsigned capacity) {
+  using table_t = FlowTable<key_size, flow_state_t>;
+
+  table_t table(capacity, 100);
+  RandomUniformEngine keys_uniform_engine(0, 0, 0xff);
+
+  keys_pool_t keys(key_size, capacity);
+  keys.random_populate(keys_uniform_engine);
+
+  int indices[table_t::VECTOR_SIZE];
+
+  // Old flows, then recent flows
+  for (unsigned i = 0; i < capacity / 2; i += table_t::VECTOR_SIZE) {
+    table.lookup_or_create_vec(keys.get_key(i), 0, indices);
+  }
+  for (unsigned i = capacity / 2; i < capacity; i += table_t::VECTOR_SIZE) {
+    table.lookup_or_create_vec(keys.get_key(i), 50, indices);
+  }
+
+  // The table is full, new flows are rejected
+  keys_pool_t new_keys(key_size, table_t::VECTOR_SIZE);
+  new_keys.random_populate(keys_uniform_engine);
+  int created = table.lookup_or_create_vec(new_keys.get_key(0), 60, indices);
+  assert_or_panic(created == 0, "Flows were created on a full table (created mask 0x%04x)", created);
+  assert_or_panic(indices[0] == -1, "Rejected flow got index %d", indices[0]);
+
+  // Refresh one of the old flows, so that it survives
+  table.lookup_or_create_vec(keys.get_key(0), 60, indices);
+  const int refreshed = indices[0];
+
+  const u32 expired = table.expire_vec(120);
+  assert_or_panic(expired == capacity / 2 - table_t::VECTOR_SIZE, "Unexpected number of expired flows (%u)", expired);
+  assert_or_panic(table.get_size() == capacity / 2 + table_t::VECTOR_SIZE, "Size mismatch (got %u)", table.get_size());
+
+  // Surviving flows keep their index, expired ones are created again
+  table.lookup_or_create_vec(keys.get_key(0), 130, indices);
+  assert_or_panic(indices[0] == refreshed, "Refreshed flow changed index (%d vs %d)", refreshed, indices[0]);
+
+  created = table.lookup_or_create_vec(keys.get_key(table_t::VECTOR_SIZE), 130, indices);
+  assert_or_panic(created == 0xffff, "Expired flows were not created again (created mask 0x%04x)", created);
+
+  for (unsigned i = capacity / 2; i < capacity; i += table_t::VECTOR_SIZE) {
+    created = table.lookup_or_create_vec(keys.get_key(i), 130, indices);
+    assert_or_panic(created == 0, "Recent flows were expired (created mask 0x%04x)", created);
+  }
+}
+
+template <size_t key_size> void test_evict_oldest(const unsigned capacity) {
+  using table_t = FlowTable<key_size, flow_state_t>;
+
+  table_t table(capacity, 1000, FLOWTABLE_EVICT_OLDEST);
+  RandomUniformEngine keys_uniform_engine(0, 0, 0xff);
+
+  keys_pool_t keys(key_size, capacity + table_t::VECTOR_SIZE);
+  keys.random_populate(keys_uniform_engine);
+
+  int indices[table_t::VECTOR_SIZE];
+
+  // Fill the table, one burst at a time, each one more recent than the previous
+  for (unsigned i = 0; i < capacity; i += table_t::VECTOR_SIZE) {
+    table.lookup_or_create_vec(keys.get_key(i), i, indices);
+  }
+  assert_or_panic(table.get_size() == capacity, "Size mismatch (expected %u, got %u)", capacity, table.get_size());
+
+  // A burst of new flows replaces the oldest burst
+  int created = table.lookup_or_create_vec(keys.get_key(capacity), capacity, indices);
+  assert_or_panic(created == 0xffff, "New flows were not created on a full table (created mask 0x%04x)", created);
+  assert_or_panic(table.get_size() == capacity, "Size mismatch after eviction (expected %u, got %u)", capacity, table.get_size());
+
+  // The flows after the oldest burst are still there
+  for (unsigned i = table_t::VECTOR_SIZE; i < capacity + table_t::VECTOR_SIZE; i += table_t::VECTOR_SIZE) {
+    created = table.lookup_or_create_vec(keys.get_key(i), capacity + i, indices);
+    assert_or_panic(created == 0, "Recent flows were evicted (created mask 0x%04x)", created);
+  }
+
+  // While the oldest burst is gone
+  created = table.lookup_or_create_vec(keys.get_key(0), 2 * capacity, indices);
+  assert_or_panic(created == 0xffff, "Oldest flows were not evicted (created mask 0x%04x)", created);
+}
+
+int main() {
+  test_lookup_or_create<16>(65536, 32768);
+  test_lookup_or_create<16>(65536, 65536);
+  test_duplicates_in_burst<16>(1024);
+  test_expire<16>(1024);
+  test_expire<16>(65536);
+  test_evict_oldest<16>(32);
+  test_evict_oldest<16>(65536);
+
+  return 0;
+}
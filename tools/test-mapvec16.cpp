@@ -3,6 +3,7 @@
 #include <libutil/random.h>
 
 #include <array>
+#include <vector>
 #include <assert.h>
 
 #include "common.h"
@@ -124,6 +125,186 @@ template <size_t key_size> void test_unsuccessful_gets(const unsigned capacity,
   }
 }
 
+template <size_t key_size> void test_save_load(const unsigned capacity, const unsigned total_puts) {
+  const std::string path = (std::filesystem::temp_directory_path() / "test-mapvec16.snapshot").string();
+  RandomUniformEngine keys_uniform_engine(0, 0, 0xff);
+
+  // Queries use a copy of the keys, so that the loaded table can only find them through its own inline keys.
+  keys_pool_t queries(key_size, total_puts);
+
+  {
+    MapVec16<key_size> map(capacity);
+    keys_pool_t keys(key_size, total_puts);
+    keys.random_populate(keys_uniform_engine);
+    memcpy(queries.data, keys.data, key_size * total_puts);
+
+    for (unsigned i = 0; i < total_puts; i++) {
+      map.put(keys.get_key(i), static_cast<int>(i));
+    }
+
+    assert_or_panic(map.save(path.c_str()) == 1, "Failed to save map");
+  }
+
+  MapVec16<key_size> other(capacity / 2);
+  assert_or_panic(other.load(path.c_str()) == 0, "Loaded a snapshot with a different capacity");
+
+  MapVec16<key_size> map(capacity);
+  assert_or_panic(map.load(path.c_str()) == 1, "Failed to load map");
+  assert_or_panic(map.get_size() == total_puts, "Size mismatch (expected %u, got %u)", total_puts, map.get_size());
+
+  for (unsigned i = 0; i + MapVec16<key_size>::VECTOR_SIZE <= total_puts; i += MapVec16<key_size>::VECTOR_SIZE) {
+    int values[MapVec16<key_size>::VECTOR_SIZE];
+    map.get_vec(queries.get_key(i), values);
+    for (unsigned j = 0; j < MapVec16<key_size>::VECTOR_SIZE; j++) {
+      assert_or_panic(values[j] == static_cast<int>(i + j), "Value mismatch (expected %u, got %d)", i + j, values[j]);
+    }
+  }
+
+  // The loaded table keeps working as a regular one.
+  map.erase(queries.get_key(0));
+  int value = 0xDEADBEEF;
+  assert_or_panic(map.get(queries.get_key(0), &value) != 1, "Found erased key");
+
+  std::filesystem::remove(path);
+}
+
+template <size_t key_size> void test_for_each_batch(const unsigned capacity, const unsigned total_puts) {
+  MapVec16<key_size> map(capacity);
+  RandomUniformEngine keys_uniform_engine(0, 0, 0xff);
+
+  keys_pool_t keys(key_size, total_puts);
+  keys.random_populate(keys_uniform_engine);
+
+  for (unsigned i = 0; i < total_puts; i++) {
+    map.put(keys.get_key(i), static_cast<int>(i));
+  }
+
+  // Erase a few keys, so that the scan finds holes
+  for (unsigned i = 0; i < total_puts; i += 3) {
+    map.erase(keys.get_key(i));
+  }
+
+  std::vector<bool> seen(total_puts, false);
+  unsigned total_seen = 0;
+  int last_slot       = -1;
+
+  map.for_each_batch([&](void **keyps, int *values, u32 *slots, u32 count) {
+    for (u32 i = 0; i < count; i++) {
+      const int value = values[i];
+      assert_or_panic(value >= 0 && value < (int)total_puts, "Invalid value %d", value);
+      assert_or_panic(value % 3 != 0, "Found erased key (value %d)", value);
+      assert_or_panic(!seen[value], "Value %d seen twice", value);
+      assert_or_panic(keyps[i] == keys.get_key(value), "Key pointer mismatch for value %d", value);
+      assert_or_panic((int)slots[i] > last_slot, "Slots out of order (%u after %d)", slots[i], last_slot);
+
+      int found_value = 0xDEADBEEF;
+      assert_or_panic(map.get(keyps[i], &found_value) == 1 && found_value == value, "Key of slot %u not in the map", slots[i]);
+
+      seen[value] = true;
+      last_slot   = slots[i];
+      total_seen++;
+    }
+  });
+
+  assert_or_panic(total_seen == map.get_size(), "Scan size mismatch (expected %u, got %u)", map.get_size(), total_seen);
+}
+
+template <size_t key_size> void test_erase_vec(const unsigned capacity, const unsigned total_puts) {
+  MapVec16<key_size> map(capacity);
+  RandomUniformEngine keys_uniform_engine(0, 0, 0xff);
+
+  keys_pool_t keys(key_size, total_puts);
+  keys.random_populate(keys_uniform_engine);
+
+  for (unsigned i = 0; i < total_puts; i++) {
+    map.put(keys.get_key(i), static_cast<int>(i));
+  }
+
+  // Erase every other burst, leaving the odd lanes of the erased bursts in the map
+  for (unsigned i = 0; i < total_puts; i += 2 * MapVec16<key_size>::VECTOR_SIZE) {
+    int erased = map.erase_vec(keys.get_key(i), 0x5555);
+    assert_or_panic(erased == 0x5555, "Not all keys were erased (erased mask 0x%04x)", erased);
+
+    // Erasing them again finds nothing
+    erased = map.erase_vec(keys.get_key(i), 0x5555);
+    assert_or_panic(erased == 0, "Erased keys were found (erased mask 0x%04x)", erased);
+  }
+
+  assert_or_panic(map.get_size() == total_puts - total_puts / 4, "Size mismatch (got %u)", map.get_size());
+
+  for (unsigned i = 0; i < total_puts; i += MapVec16<key_size>::VECTOR_SIZE) {
+    int values[MapVec16<key_size>::VECTOR_SIZE];
+    const int found    = map.get_vec(keys.get_key(i), values);
+    const int expected = (i / MapVec16<key_size>::VECTOR_SIZE) % 2 == 0 ? 0xaaaa : 0xffff;
+    assert_or_panic(found == expected, "Unexpected found mask 0x%04x (expected 0x%04x)", found, expected);
+
+    for (unsigned j = 0; j < MapVec16<key_size>::VECTOR_SIZE; j++) {
+      if (found & (1 << j)) {
+        assert_or_panic(values[j] == static_cast<int>(i + j), "Value mismatch (expected %u, got %d)", i + j, values[j]);
+      }
+    }
+  }
+
+  // The same key twice in a burst is only erased once
+  keys_pool_t burst(key_size, MapVec16<key_size>::VECTOR_SIZE);
+  for (unsigned j = 0; j < MapVec16<key_size>::VECTOR_SIZE; j++) {
+    memcpy(burst.get_key(j), keys.get_key(MapVec16<key_size>::VECTOR_SIZE + j % 2), key_size);
+  }
+  const int erased = map.erase_vec(burst.get_key(0));
+  assert_or_panic(erased == 0x0003, "Unexpected erased mask 0x%04x", erased);
+}
+
+// Images with the parameters of the table, but whose sections do not match them, are rejected and leave the table as it was.
+template <size_t key_size> void test_load_rejects(const unsigned capacity) {
+  const std::string path = (std::filesystem::temp_directory_path() / "test-mapvec16-bad.snapshot").string();
+  std::vector<u8> data(64 * (size_t)capacity);
+  const u64 entry_sizes[]          = {sizeof(int), sizeof(u32), sizeof(int), key_size};
+  constexpr const int num_sections = sizeof(entry_sizes) / sizeof(entry_sizes[0]);
+
+  MapVec16<key_size> map(capacity);
+  RandomUniformEngine keys_uniform_engine(0, 0, 0xff);
+  keys_pool_t keys(key_size, 1);
+  keys.random_populate(keys_uniform_engine);
+  map.put(keys.get_key(0), 42);
+
+  // Saves an image with the given size parameter and sections, each one entry_size * capacity + extra[i] bytes.
+  auto save = [&](u64 size, int sections_saved, const std::array<long, num_sections> &extra) {
+    std::vector<struct snapshot_section> sections;
+    for (int i = 0; i < sections_saved; i++) {
+      sections.push_back({data.data(), static_cast<size_t>(static_cast<long>(entry_sizes[i] * capacity) + extra[i])});
+    }
+    const u64 params[SNAPSHOT_MAX_PARAMS] = {capacity, key_size, size, 0};
+    assert_or_panic(snapshot_save(path.c_str(), SNAPSHOT_MAPVEC16, params, sections.data(), sections_saved) == 1, "Failed to save image");
+  };
+
+  save(capacity + 1, num_sections, {});
+  assert_or_panic(map.load(path.c_str()) == 0, "Loaded an image holding more keys than its capacity");
+
+  save(0, num_sections - 1, {});
+  assert_or_panic(map.load(path.c_str()) == 0, "Loaded an image missing a section");
+
+  for (int i = 0; i < num_sections; i++) {
+    std::array<long, num_sections> extra = {};
+    extra[i]                             = -static_cast<long>(entry_sizes[i]);
+    save(0, num_sections, extra);
+    assert_or_panic(map.load(path.c_str()) == 0, "Loaded an image with a truncated section %d", i);
+    extra[i] = 64;
+    save(0, num_sections, extra);
+    assert_or_panic(map.load(path.c_str()) == 0, "Loaded an image with an oversized section %d", i);
+  }
+
+  int value = 0;
+  assert_or_panic(map.get(keys.get_key(0), &value) == 1 && value == 42, "Rejected images changed the table");
+  assert_or_panic(map.get_size() == 1, "Rejected images changed the size");
+
+  // The same image with matching sections is accepted.
+  save(0, num_sections, {});
+  assert_or_panic(map.load(path.c_str()) == 1, "Failed to load a matching image");
+  assert_or_panic(map.get_size() == 0, "Size mismatch (expected 0, got %u)", map.get_size());
+
+  std::filesystem::remove(path);
+}
+
 int main() {
   test_puts<16>(65536, 16);
   test_puts<16>(32, 16);
@@ -132,5 +313,11 @@ int main() {
   test_gets<16>(65536, 32);
   test_gets<16>(65536, 65536);
   test_unsuccessful_gets<16>(65536, 16);
+  test_save_load<16>(65536, 32768);
+  test_load_rejects<16>(1024);
+  test_for_each_batch<16>(8, 4);
+  test_for_each_batch<16>(65536, 32768);
+  test_erase_vec<16>(65536, 32768);
+  test_erase_vec<16>(65536, 65536);
   return 0;
 }
\ No newline at end of file
@@ -0,0 +1,225 @@
+#include <libnet/partitioned-chain.h>
+#include <libnet/double-chain.h>
+#include <libutil/types.h>
+#include <libutil/random.h>
+
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <assert.h>
+
+#include "common.h"
+
+// Polls every core, twice: the first pass serves the pending steal requests, the second one collects their answers.
+void poll_all(struct PartitionedChain *chain, int num_cores) {
+  for (int pass = 0; pass < 2; pass++) {
+    for (int core = 0; core < num_cores; core++) {
+      pchain_poll(chain, core);
+    }
+  }
+}
+
+// Allocates from the core until no core has free indexes left, and checks that every index of the range came out exactly once.
+void check_all_allocatable(struct PartitionedChain *chain, int index_range, int num_cores, int core) {
+  std::vector<bool> seen(index_range, false);
+  int allocated = 0;
+  while (true) {
+    int index;
+    if (pchain_allocate_new_index(chain, core, &index, 1)) {
+      assert_or_panic(index >= 0 && index < index_range, "Allocated index %d out of range", index);
+      assert_or_panic(!seen[index], "Index %d allocated twice", index);
+      seen[index] = true;
+      allocated++;
+      continue;
+    }
+    if (!pchain_steal_pending(chain, core)) {
+      break;
+    }
+    poll_all(chain, num_cores);
+  }
+  assert_or_panic(allocated == index_range, "Allocated %d indexes out of %d", allocated, index_range);
+
+  for (int index = 0; index < index_range; index++) {
+    assert_or_panic(pchain_free_index(chain, core, index) == 1, "Failed to free index %d", index);
+  }
+}
+
+// Cores allocate a skewed share of the range (core 0 the most), so that they keep stealing from each other. Every index must be held by a
+// single core at a time, and once everything is freed and polled, the free indexes of all the cores add up to the range.
+void test_ownership(const int index_range, const int num_cores, const int rounds) {
+  struct PartitionedChain *chain;
+  assert_or_panic(pchain_allocate(index_range, num_cores, nullptr, &chain) == 1, "Failed to allocate partitioned chain");
+
+  std::vector<std::atomic<int>> owners(index_range);
+  for (std::atomic<int> &owner : owners) {
+    owner.store(-1, std::memory_order_relaxed);
+  }
+  std::atomic<int> cores_done(0);
+
+  double total_weight = 0;
+  for (int core = 0; core < num_cores; core++) {
+    total_weight += 1.0 / (core + 1);
+  }
+
+  auto run_core = [&](int core) {
+    const int demand = static_cast<int>(0.9 * index_range / (core + 1) / total_weight);
+    std::vector<int> held;
+
+    for (int round = 0; round < rounds; round++) {
+      while (static_cast<int>(held.size()) < demand) {
+        int index;
+        if (!pchain_allocate_new_index(chain, core, &index, round)) {
+          if (!pchain_steal_pending(chain, core)) {
+            break;
+          }
+          std::this_thread::yield();
+          continue;
+        }
+
+        int expected = -1;
+        assert_or_panic(owners[index].compare_exchange_strong(expected, core), "Index %d allocated by core %d, still held by core %d", index,
+                        core, expected);
+        held.push_back(index);
+      }
+
+      for (int index : held) {
+        assert_or_panic(pchain_rejuvenate_index(chain, core, index, round + 1) == 1, "Failed to rejuvenate index %d", index);
+      }
+
+      // Release before freeing, the index may be handed to another core right after.
+      for (int index : held) {
+        int expected = core;
+        assert_or_panic(owners[index].compare_exchange_strong(expected, -1), "Index %d freed by core %d, held by core %d", index, core, expected);
+        assert_or_panic(pchain_free_index(chain, core, index) == 1, "Failed to free index %d", index);
+      }
+      held.clear();
+    }
+
+    // Keep serving the cores still allocating.
+    cores_done++;
+    while (cores_done.load() < num_cores) {
+      pchain_poll(chain, core);
+      std::this_thread::yield();
+    }
+  };
+
+  std::vector<std::thread> threads;
+  for (int core = 0; core < num_cores; core++) {
+    threads.emplace_back(run_core, core);
+  }
+  for (std::thread &thread : threads) {
+    thread.join();
+  }
+
+  poll_all(chain, num_cores);
+  int free_count = 0;
+  for (int core = 0; core < num_cores; core++) {
+    free_count += pchain_get_free_count(chain, core);
+  }
+  assert_or_panic(free_count == index_range, "Free indexes add up to %d instead of %d", free_count, index_range);
+
+  check_all_allocatable(chain, index_range, num_cores, num_cores - 1);
+  pchain_free(chain);
+}
+
+// A core that ran dry gets half of the free indexes of another one, once that one answers through pchain_poll. The batch reaches the free
+// list even if the thief freed an index of its own in the meantime.
+void test_steal_through_poll() {
+  constexpr const int index_range = 8;
+  struct PartitionedChain *chain;
+  assert_or_panic(pchain_allocate(index_range, 2, nullptr, &chain) == 1, "Failed to allocate partitioned chain");
+
+  std::vector<int> indexes(index_range / 2);
+  for (int &index : indexes) {
+    assert_or_panic(pchain_allocate_new_index(chain, 0, &index, 1) == 1, "Failed to allocate from the own segment");
+    assert_or_panic(index < index_range / 2, "Index %d allocated out of the own segment", index);
+  }
+
+  int index;
+  assert_or_panic(pchain_allocate_new_index(chain, 0, &index, 1) == 0, "Allocated past the own segment without stealing");
+  assert_or_panic(pchain_steal_pending(chain, 0) == 1, "No steal request posted");
+  assert_or_panic(pchain_allocate_new_index(chain, 0, &index, 1) == 0, "Allocated before the victim answered");
+
+  assert_or_panic(pchain_free_index(chain, 0, indexes[0]) == 1, "Failed to free index %d", indexes[0]);
+  pchain_poll(chain, 1);
+  assert_or_panic(pchain_get_free_count(chain, 1) == index_range / 4, "Victim kept %d free indexes", pchain_get_free_count(chain, 1));
+
+  // The index freed in the meantime, and the two handed over.
+  std::vector<int> allocated;
+  assert_or_panic(pchain_allocate_new_index(chain, 0, &index, 1) == 1, "Failed to allocate after the steal");
+  assert_or_panic(pchain_steal_pending(chain, 0) == 0, "Steal still pending after the answer");
+  allocated.push_back(index);
+  const int free_count = pchain_get_free_count(chain, 0);
+  assert_or_panic(free_count == index_range / 4, "Thief holds %d free indexes instead of %d", free_count, index_range / 4);
+
+  while (pchain_allocate_new_index(chain, 0, &index, 1)) {
+    allocated.push_back(index);
+  }
+  assert_or_panic(allocated.size() == 1 + index_range / 4, "Allocated %zu indexes instead of %d", allocated.size(), 1 + index_range / 4);
+
+  int stolen = 0;
+  for (int allocated_index : allocated) {
+    assert_or_panic(allocated_index == indexes[0] || allocated_index >= index_range / 2, "Index %d allocated twice", allocated_index);
+    stolen += allocated_index >= index_range / 2;
+  }
+  assert_or_panic(stolen == index_range / 4, "Allocated %d stolen indexes instead of %d", stolen, index_range / 4);
+
+  pchain_free(chain);
+}
+
+// With a single core, the allocator behaves like a DoubleChain: same indexes allocated, same expiry order.
+void test_single_core_like_dchain(const int index_range, const int total_ops) {
+  struct PartitionedChain *chain;
+  struct DoubleChain *dchain;
+  assert_or_panic(pchain_allocate(index_range, 1, nullptr, &chain) == 1, "Failed to allocate partitioned chain");
+  assert_or_panic(dchain_allocate(index_range, &dchain) == 1, "Failed to allocate dchain");
+
+  RandomUniformEngine ops_engine(0, 0, 9);
+  RandomUniformEngine index_engine(0, 0, index_range - 1);
+  time_ns_t now = 1;
+
+  for (int op = 0; op < total_ops; op++) {
+    now++;
+    const u64 kind = ops_engine.generate();
+    int expected;
+    int actual;
+
+    if (kind < 4) {
+      const int ok = dchain_allocate_new_index(dchain, &expected, now);
+      assert_or_panic(pchain_allocate_new_index(chain, 0, &actual, now) == ok, "Allocation outcome mismatch at op %d", op);
+      assert_or_panic(!ok || actual == expected, "Allocated index %d instead of %d at op %d", actual, expected, op);
+    } else if (kind < 8) {
+      const int index = static_cast<int>(index_engine.generate());
+      const int ok    = dchain_rejuvenate_index(dchain, index, now);
+      assert_or_panic(pchain_rejuvenate_index(chain, 0, index, now) == ok, "Rejuvenation outcome mismatch for index %d at op %d", index, op);
+    } else if (kind < 9) {
+      const time_ns_t threshold = now - index_range / 2;
+      while (true) {
+        const int ok = dchain_expire_one_index(dchain, &expected, threshold);
+        assert_or_panic(pchain_expire_one_index(chain, 0, &actual, threshold) == ok, "Expiry outcome mismatch at op %d", op);
+        if (!ok) {
+          break;
+        }
+        assert_or_panic(actual == expected, "Expired index %d instead of %d at op %d", actual, expected, op);
+      }
+    } else {
+      const int index = static_cast<int>(index_engine.generate());
+      const int ok    = dchain_free_index(dchain, index);
+      assert_or_panic(pchain_free_index(chain, 0, index) == ok, "Free outcome mismatch for index %d at op %d", index, op);
+    }
+  }
+
+  dchain_free(dchain);
+  pchain_free(chain);
+}
+
+int main() {
+  test_steal_through_poll();
+  test_single_core_like_dchain(1024, 100000);
+  test_single_core_like_dchain(16, 10000);
+  test_ownership(1 << 12, 2, 200);
+  test_ownership(1 << 12, 8, 2000);
+  test_ownership(1 << 16, 8, 20);
+
+  return 0;
+}
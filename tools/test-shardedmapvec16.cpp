@@ -0,0 +1,89 @@
+#include <libnetvec/shardedmapvec16.h>
+#include <libutil/types.h>
+#include <libutil/random.h>
+
+#include <array>
+#include <assert.h>
+
+#include "common.h"
+
+template <size_t key_size> void test_gets(const unsigned num_shards, const unsigned shard_capacity, const unsigned total_gets) {
+  using map_t = ShardedMapVec16<key_size>;
+
+  map_t map(num_shards, shard_capacity);
+  for (unsigned shard = 0; shard < num_shards; shard++) {
+    map.init_shard(shard);
+  }
+
+  RandomUniformEngine keys_uniform_engine(0, 0, 0xff);
+  RandomUniformEngine values_uniform_engine(0);
+
+  keys_pool_t keys(key_size, total_gets);
+  keys.random_populate(keys_uniform_engine);
+
+  for (unsigned ops_done = 0; ops_done < total_gets; ops_done += map_t::VECTOR_SIZE) {
+    int values[map_t::VECTOR_SIZE];
+
+    for (unsigned i = 0; i < map_t::VECTOR_SIZE; i++) {
+      void *key = (void *)keys.get_key(ops_done + i);
+      values[i] = values_uniform_engine.generate();
+      map.put(key, values[i]);
+      printf("Key %02d: shard %u\n", i, map.shard_of(key));
+    }
+
+    int new_values[map_t::VECTOR_SIZE];
+    for (unsigned i = 0; i < map_t::VECTOR_SIZE; i++) {
+      new_values[i] = 0;
+    }
+
+    void *target_keys = (void *)keys.get_key(ops_done);
+    int found         = map.get_vec(target_keys, new_values);
+    assert_or_panic(found == 0xffff, "Not all keys were found (found mask 0x%04x)", found);
+
+    for (unsigned i = 0; i < map_t::VECTOR_SIZE; i++) {
+      int value     = values[i];
+      int new_value = new_values[i];
+      assert_or_panic(new_value == value, "Value mismatch in map (expected %d, got %d)", value, new_value);
+    }
+  }
+
+  assert_or_panic(map.get_size() == total_gets, "Size mismatch (expected %u, got %u)", total_gets, map.get_size());
+}
+
+template <size_t key_size> void test_unsuccessful_gets(const unsigned num_shards, const unsigned shard_capacity, const unsigned total_gets) {
+  using map_t = ShardedMapVec16<key_size>;
+
+  map_t map(num_shards, shard_capacity);
+  for (unsigned shard = 0; shard < num_shards; shard++) {
+    map.init_shard(shard);
+  }
+
+  RandomUniformEngine keys_uniform_engine(0, 0, 0xff);
+
+  keys_pool_t keys(key_size, total_gets);
+  keys.random_populate(keys_uniform_engine);
+
+  for (unsigned ops_done = 0; ops_done < total_gets; ops_done += map_t::VECTOR_SIZE) {
+    int new_values[map_t::VECTOR_SIZE];
+    for (unsigned i = 0; i < map_t::VECTOR_SIZE; i++) {
+      new_values[i] = i;
+    }
+
+    void *target_keys = (void *)keys.get_key(ops_done);
+    int found         = map.get_vec(target_keys, new_values);
+    assert_or_panic(found == 0, "Found keys in an empty map (found mask 0x%04x)", found);
+
+    for (unsigned i = 0; i < map_t::VECTOR_SIZE; i++) {
+      assert_or_panic(new_values[i] == (int)i, "Value of a missing key was overwritten (lane %u, got %d)", i, new_values[i]);
+    }
+  }
+}
+
+int main() {
+  test_gets<16>(1, 65536, 16);
+  test_gets<16>(4, 16384, 16);
+  test_gets<16>(4, 16384, 4096);
+  test_gets<16>(16, 4096, 4096);
+  test_unsuccessful_gets<16>(4, 16384, 16);
+  return 0;
+}
@@ -0,0 +1,122 @@
+#include <libnet/timer-wheel.h>
+#include <libutil/types.h>
+
+#include <vector>
+#include <assert.h>
+
+#include "common.h"
+
+// Expires everything older than time, and returns the number of expired indexes.
+int expire_all(struct TimerWheel *tw, time_ns_t time) {
+  int expired = 0;
+  int index;
+  while (tw_expire_one_index(tw, &index, time)) {
+    assert_or_panic(tw_is_index_allocated(tw, index) == 0, "Expired index %d still allocated", index);
+    expired++;
+  }
+  return expired;
+}
+
+// Indexes are expired within a bucket of their timestamp, never before it.
+void test_expire(const int index_range, const time_ns_t granularity, const int num_buckets) {
+  struct TimerWheel *tw;
+  assert_or_panic(tw_allocate(index_range, granularity, num_buckets, nullptr, &tw) == 1, "Failed to allocate timer wheel");
+
+  for (int i = 0; i < index_range; i++) {
+    int index;
+    assert_or_panic(tw_allocate_new_index(tw, &index, i * granularity / 4) == 1, "Failed to allocate index %d", i);
+  }
+
+  const time_ns_t last = (index_range - 1) * granularity / 4;
+  int expired          = 0;
+  for (time_ns_t time = 0; time <= last + 2 * granularity; time += granularity / 2) {
+    int index;
+    while (tw_expire_one_index(tw, &index, time)) {
+      const time_ns_t timestamp = index * granularity / 4;
+      assert_or_panic(timestamp < time, "Index %d expired early (timestamp %ld, time %ld)", index, timestamp, time);
+      assert_or_panic(time <= timestamp + 2 * granularity, "Index %d expired late (timestamp %ld, time %ld)", index, timestamp, time);
+      expired++;
+    }
+  }
+  assert_or_panic(expired == index_range, "Expired %d indexes instead of %d", expired, index_range);
+
+  tw_free(tw);
+}
+
+// Allocate, expire everything, stay idle for longer than a turn of the wheel, and allocate again: the new indexes must still expire within
+// a bucket, even though the cursor jumped over buckets holding indexes that were freed before being expired.
+void test_allocate_after_idle(const int index_range, const time_ns_t granularity, const int num_buckets) {
+  struct TimerWheel *tw;
+  assert_or_panic(tw_allocate(index_range, granularity, num_buckets, nullptr, &tw) == 1, "Failed to allocate timer wheel");
+
+  std::vector<int> indexes(index_range);
+  for (int i = 0; i < index_range; i++) {
+    assert_or_panic(tw_allocate_new_index(tw, &indexes[i], i * granularity) == 1, "Failed to allocate index %d", i);
+  }
+
+  // The older half is expired, and the other half is freed before its buckets come up, so that it stays filed in them.
+  time_ns_t now           = index_range / 2 * granularity;
+  const int expired_older = expire_all(tw, now);
+  assert_or_panic(expired_older == index_range / 2, "Expired %d indexes instead of %d", expired_older, index_range / 2);
+  for (int i = index_range / 2; i < index_range; i++) {
+    assert_or_panic(tw_free_index(tw, indexes[i]) == 1, "Failed to free index %d", indexes[i]);
+    assert_or_panic(tw_rejuvenate_index(tw, indexes[i], now) == 0, "Rejuvenated a free index");
+  }
+
+  // Idle, then a single expiry check moves the cursor.
+  now += 10 * num_buckets * granularity;
+  assert_or_panic(expire_all(tw, now) == 0, "Expired an index while idle");
+
+  for (int i = 0; i < index_range; i++) {
+    assert_or_panic(tw_allocate_new_index(tw, &indexes[i], now) == 1, "Failed to allocate index %d after idle", i);
+  }
+
+  assert_or_panic(expire_all(tw, now + granularity / 2) == 0, "Expired indexes early");
+  const int expired = expire_all(tw, now + 2 * granularity);
+  assert_or_panic(expired == index_range, "Expired %d indexes instead of %d, within two buckets", expired, index_range);
+
+  tw_free(tw);
+}
+
+// Stay idle for far longer than a turn of the wheel while indexes are still allocated: a single expiry check catches up in one turn, expires
+// the indexes older than time, and keeps the rejuvenated and the new ones until their own bucket.
+void test_idle_with_live(const int index_range, const time_ns_t granularity, const int num_buckets) {
+  struct TimerWheel *tw;
+  assert_or_panic(tw_allocate(index_range, granularity, num_buckets, nullptr, &tw) == 1, "Failed to allocate timer wheel");
+
+  // One index left for after the gap.
+  const int allocated = index_range - 1;
+  std::vector<int> indexes(allocated);
+  for (int i = 0; i < allocated; i++) {
+    assert_or_panic(tw_allocate_new_index(tw, &indexes[i], 1 + i * granularity) == 1, "Failed to allocate index %d", i);
+  }
+
+  // Far enough for walking the ticks of the gap one by one to never end.
+  time_ns_t now = (1l << 40) * granularity;
+  assert_or_panic(tw_rejuvenate_index(tw, indexes[0], now) == 1, "Failed to rejuvenate index %d", indexes[0]);
+  int fresh;
+  assert_or_panic(tw_allocate_new_index(tw, &fresh, now) == 1, "Failed to allocate an index after idle");
+
+  const int expired_idle = expire_all(tw, now - 10 * num_buckets * granularity);
+  assert_or_panic(expired_idle == allocated - 1, "Expired %d indexes instead of %d after idle", expired_idle, allocated - 1);
+  assert_or_panic(tw_is_index_allocated(tw, indexes[0]) == 1, "Expired a rejuvenated index");
+  assert_or_panic(tw_is_index_allocated(tw, fresh) == 1, "Expired a new index");
+
+  assert_or_panic(expire_all(tw, now + granularity / 2) == 0, "Expired indexes early");
+  const int expired = expire_all(tw, now + 2 * granularity);
+  assert_or_panic(expired == 2, "Expired %d indexes instead of 2, within two buckets", expired);
+
+  tw_free(tw);
+}
+
+int main() {
+  test_expire(1024, 1000, 1024);
+  test_expire(4096, 1000, 64);
+  test_allocate_after_idle(64, 1000, 1024);
+  test_allocate_after_idle(64, 1000, 16);
+  test_allocate_after_idle(1024, 1000, 1024);
+  test_idle_with_live(64, 1000, 1024);
+  test_idle_with_live(1024, 1, 16);
+
+  return 0;
+}
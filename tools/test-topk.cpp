@@ -0,0 +1,172 @@
+#include <libnet/topk.h>
+#include <libnet/cms.h>
+#include <libutil/types.h>
+#include <libutil/random.h>
+
+#include <vector>
+#include <assert.h>
+#include <string.h>
+
+#include "common.h"
+
+constexpr const u32 key_size = 16;
+// Wide enough for the keys of these tests not to share counters: estimates are exact.
+constexpr const u32 cms_height = 4;
+constexpr const u32 cms_width  = 1 << 16;
+
+struct candidates_t {
+  std::vector<u8> keys;
+  std::vector<int> counts;
+  u32 size;
+};
+
+candidates_t candidates(const TopK &topk, u32 k) {
+  candidates_t out{std::vector<u8>((size_t)k * key_size), std::vector<int>(k), 0};
+  out.size = topk.topk(out.keys.data(), out.counts.data());
+  assert_or_panic(out.size == topk.get_size(), "topk() returned %u candidates out of %u", out.size, topk.get_size());
+
+  for (u32 i = 1; i < out.size; i++) {
+    assert_or_panic(out.counts[i - 1] >= out.counts[i], "Candidates out of order at %u (%d < %d)", i, out.counts[i - 1], out.counts[i]);
+  }
+  for (u32 i = 0; i < out.size; i++) {
+    for (u32 j = i + 1; j < out.size; j++) {
+      assert_or_panic(memcmp(&out.keys[(size_t)i * key_size], &out.keys[(size_t)j * key_size], key_size) != 0, "Candidates %u and %u share a key",
+                      i, j);
+    }
+  }
+  return out;
+}
+
+// Position of the key among the candidates, or -1.
+int find(const candidates_t &out, const void *key) {
+  for (u32 i = 0; i < out.size; i++) {
+    if (memcmp(&out.keys[(size_t)i * key_size], key, key_size) == 0) {
+      return static_cast<int>(i);
+    }
+  }
+  return -1;
+}
+
+// Once full, a key estimated above the smallest candidate takes its slot. The key it replaced must leave the index with it: offered again, it
+// comes back as a candidate of its own, instead of updating the slot it used to have.
+void test_replacement(const u32 k) {
+  RandomUniformEngine keys_uniform_engine(0, 0, 0xff);
+  keys_pool_t keys(key_size, 2 * k);
+  keys.random_populate(keys_uniform_engine);
+
+  struct CMS *cms;
+  assert_or_panic(cms_allocate(cms_height, cms_width, key_size, 0, &cms) == 1, "Failed to allocate CMS");
+  TopK topk(k, key_size, cms);
+
+  // Key i is seen i + 1 times, the first one is the smallest candidate.
+  for (u32 i = 0; i < k; i++) {
+    for (u32 j = 0; j <= i; j++) {
+      topk.update(keys.get_key(i));
+    }
+  }
+  assert_or_panic(topk.get_size() == k, "Size mismatch (expected %u, got %u)", k, topk.get_size());
+
+  // Seen twice, the new key beats the first one only.
+  topk.update(keys.get_key(k));
+  assert_or_panic(find(candidates(topk, k), keys.get_key(k)) < 0, "A key below the smallest candidate was taken");
+  topk.update(keys.get_key(k));
+  candidates_t out = candidates(topk, k);
+  assert_or_panic(find(out, keys.get_key(k)) >= 0, "The new key did not replace the smallest candidate");
+  assert_or_panic(find(out, keys.get_key(0)) < 0, "The smallest candidate was not replaced");
+
+  // The replaced key comes back, in place of the smallest candidate left.
+  topk.update(keys.get_key(0));
+  topk.update(keys.get_key(0));
+  out = candidates(topk, k);
+  assert_or_panic(topk.get_size() == k, "Size mismatch (expected %u, got %u)", k, topk.get_size());
+  const int pos = find(out, keys.get_key(0));
+  assert_or_panic(pos >= 0 && out.counts[pos] == 3, "The replaced key did not come back with its count");
+
+  for (u32 i = 0; i <= k; i++) {
+    const int found = find(out, keys.get_key(i));
+    assert_or_panic(found < 0 || out.counts[found] == cms_count_min(cms, keys.get_key(i)), "Stale count for key %u", i);
+  }
+}
+
+// k heavy keys, each seen a distinct number of times, hidden among light keys, and shuffled into bursts full of duplicates. One key at a time
+// and CMS_VECTOR_SIZE keys at a time, the candidates must be the heavy keys with their exact counts, heaviest first. A cleanup drops them all,
+// and the next ones are found again.
+void test_scalar_vs_vec(const u32 k) {
+  const u32 light_keys = 16 * k;
+  RandomUniformEngine keys_uniform_engine(0, 0, 0xff);
+  keys_pool_t keys(key_size, k + light_keys);
+  keys.random_populate(keys_uniform_engine);
+
+  // Heavy key i is seen 64 + 8 * (k - i) times, light keys at most 8 times.
+  std::vector<u32> trace;
+  for (u32 i = 0; i < k; i++) {
+    trace.insert(trace.end(), 64 + 8 * (k - i), i);
+  }
+  RandomUniformEngine light_engine(0, 1, 8);
+  for (u32 i = k; i < k + light_keys; i++) {
+    trace.insert(trace.end(), light_engine.generate(), i);
+  }
+  while (trace.size() % CMS_VECTOR_SIZE != 0) {
+    trace.push_back(k);
+  }
+  RandomUniformEngine shuffle_engine(0);
+  for (size_t i = trace.size() - 1; i > 0; i--) {
+    std::swap(trace[i], trace[shuffle_engine.generate() % (i + 1)]);
+  }
+
+  std::vector<u8> packets(trace.size() * key_size);
+  for (size_t i = 0; i < trace.size(); i++) {
+    memcpy(&packets[i * key_size], keys.get_key(trace[i]), key_size);
+  }
+
+  constexpr const time_ns_t interval = 1000;
+  struct CMS *scalar_cms;
+  struct CMS *vec_cms;
+  assert_or_panic(cms_allocate(cms_height, cms_width, key_size, interval, &scalar_cms) == 1, "Failed to allocate CMS");
+  assert_or_panic(cms_allocate(cms_height, cms_width, key_size, interval, &vec_cms) == 1, "Failed to allocate CMS");
+  TopK scalar(k, key_size, scalar_cms);
+  TopK vec(k, key_size, vec_cms);
+
+  time_ns_t now = 1;
+  scalar.periodic_cleanup(now);
+  vec.periodic_cleanup(now);
+
+  for (int epoch = 0; epoch < 2; epoch++) {
+    for (size_t i = 0; i < trace.size(); i++) {
+      scalar.update(&packets[i * key_size]);
+    }
+    for (size_t i = 0; i < trace.size(); i += CMS_VECTOR_SIZE) {
+      vec.update_vec(&packets[i * key_size]);
+    }
+
+    const candidates_t scalar_out = candidates(scalar, k);
+    const candidates_t vec_out    = candidates(vec, k);
+    assert_or_panic(scalar_out.size == k, "Found %u candidates out of %u", scalar_out.size, k);
+    assert_or_panic(vec_out.size == k, "Found %u candidates out of %u, %u at a time", vec_out.size, k, CMS_VECTOR_SIZE);
+
+    for (u32 i = 0; i < k; i++) {
+      const int expected = static_cast<int>(64 + 8 * (k - i));
+      assert_or_panic(memcmp(&scalar_out.keys[(size_t)i * key_size], keys.get_key(i), key_size) == 0, "Heavy key %u not at position %u", i, i);
+      assert_or_panic(memcmp(&vec_out.keys[(size_t)i * key_size], keys.get_key(i), key_size) == 0, "Heavy key %u not at position %u, %u at a time",
+                      i, i, CMS_VECTOR_SIZE);
+      assert_or_panic(scalar_out.counts[i] == expected, "Heavy key %u counted %d instead of %d", i, scalar_out.counts[i], expected);
+      assert_or_panic(vec_out.counts[i] == expected, "Heavy key %u counted %d instead of %d, %u at a time", i, vec_out.counts[i], expected,
+                      CMS_VECTOR_SIZE);
+    }
+
+    now += interval;
+    assert_or_panic(scalar.periodic_cleanup(now) == 1, "No cleanup after the interval");
+    assert_or_panic(vec.periodic_cleanup(now) == 1, "No cleanup after the interval");
+    assert_or_panic(scalar.get_size() == 0 && vec.get_size() == 0, "Candidates left after a cleanup");
+    assert_or_panic(candidates(vec, k).size == 0, "topk() returned candidates after a cleanup");
+  }
+}
+
+int main() {
+  for (u32 k : {1, 8, 13, 64, 100}) {
+    test_replacement(k);
+    test_scalar_vs_vec(k);
+  }
+
+  return 0;
+}
@@ -0,0 +1,100 @@
+#include <libnet/vector.h>
+#include <libnet/snapshot.h>
+#include <libutil/types.h>
+
+#include <vector>
+#include <assert.h>
+#include <string.h>
+
+#include "common.h"
+
+void test_save_load(const int elem_size, const unsigned capacity) {
+  const std::string path = (std::filesystem::temp_directory_path() / "test-vector.snapshot").string();
+
+  struct Vector *vector = nullptr;
+  assert_or_panic(vector_allocate(elem_size, capacity, &vector) == 1, "Failed to allocate vector");
+  for (unsigned i = 0; i < capacity; i++) {
+    void *elem;
+    vector_borrow(vector, i, &elem);
+    memset(elem, static_cast<int>(i & 0xff), elem_size);
+  }
+
+  assert_or_panic(vector_save(vector, path.c_str()) == 1, "Failed to save vector");
+  vector_free(vector);
+
+  vector = nullptr;
+  assert_or_panic(vector_load(path.c_str(), &vector) == 1, "Failed to load vector");
+  assert_or_panic(vector->elem_size == elem_size, "Element size mismatch (expected %d, got %d)", elem_size, vector->elem_size);
+  assert_or_panic(vector->capacity == capacity, "Capacity mismatch (expected %u, got %u)", capacity, vector->capacity);
+
+  for (unsigned i = 0; i < capacity; i++) {
+    u8 *elem;
+    vector_borrow(vector, i, (void **)&elem);
+    for (int j = 0; j < elem_size; j++) {
+      assert_or_panic(elem[j] == (i & 0xff), "Element %u mismatch at byte %d", i, j);
+    }
+  }
+
+  // The loaded vector keeps working as a regular one.
+  vector_clear(vector);
+  vector_free(vector);
+
+  std::filesystem::remove(path);
+}
+
+// Images whose section does not match their parameters are rejected.
+void test_load_rejects() {
+  const std::string path = (std::filesystem::temp_directory_path() / "test-vector-bad.snapshot").string();
+  std::vector<u8> data(4096);
+  const struct snapshot_section sections[] = {{data.data(), data.size()}};
+
+  const uint64_t too_large[SNAPSHOT_MAX_PARAMS] = {8, 1024, 0, 0};
+  assert_or_panic(snapshot_save(path.c_str(), SNAPSHOT_VECTOR, too_large, sections, 1) == 1, "Failed to save image");
+  struct Vector *vector;
+  assert_or_panic(vector_load(path.c_str(), &vector) == 0, "Loaded an image with a capacity larger than its section");
+
+  const uint64_t empty_elems[SNAPSHOT_MAX_PARAMS] = {0, 1024, 0, 0};
+  assert_or_panic(snapshot_save(path.c_str(), SNAPSHOT_VECTOR, empty_elems, sections, 1) == 1, "Failed to save image");
+  assert_or_panic(vector_load(path.c_str(), &vector) == 0, "Loaded an image with empty elements");
+
+  std::filesystem::remove(path);
+}
+
+// The gathered words are the first 4B of the elements at the indexes, whatever the element size.
+void test_gather(const int elem_size, const unsigned capacity) {
+  struct Vector *vector = nullptr;
+  assert_or_panic(vector_allocate(elem_size, capacity, &vector) == 1, "Failed to allocate vector");
+  for (unsigned i = 0; i < capacity; i++) {
+    void *elem;
+    vector_borrow(vector, i, &elem);
+    const u32 word = i * 2654435761u;
+    memcpy(elem, &word, sizeof(word));
+  }
+
+  for (unsigned i = 0; i + 16 <= capacity; i += 16) {
+    alignas(64) int indexes[16];
+    alignas(64) u32 words[16];
+    for (int lane = 0; lane < 16; lane++) {
+      indexes[lane] = static_cast<int>(capacity - 1 - (i + lane * 7) % capacity);
+    }
+    _mm512_store_si512(words, vector_gather32_vec(vector, _mm512_load_si512(indexes)));
+    for (int lane = 0; lane < 16; lane++) {
+      const u32 expected = static_cast<u32>(indexes[lane]) * 2654435761u;
+      assert_or_panic(words[lane] == expected, "Gathered %x instead of %x for element %d", words[lane], expected, indexes[lane]);
+    }
+  }
+
+  vector_free(vector);
+}
+
+int main() {
+  test_save_load(4, 1);
+  test_save_load(16, 65536);
+  test_save_load(13, 1000);
+  test_load_rejects();
+  test_gather(4, 65536);
+  test_gather(8, 65536);
+  test_gather(13, 1000);
+
+  return 0;
+}